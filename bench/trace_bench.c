@@ -0,0 +1,640 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Benchmark suite for trace(), trace_dump() and trace_dump_all().  Each test
+ * prints one CSV row, so the results of releases can be compared by a script:
+ *   config,test,threads,depth,wrap,value,unit
+ * config names the build (lock type and time stamp), see the makefile for the
+ * builds run by "make bench".  The contended tests need thread safe tracing,
+ * so they only run with TRACE_USE_ATOMIC or bench/trace_mutex.h.
+ *
+ * Usage: trace_bench [-n] [-t traces] [-j max threads]
+ *   -n  No CSV header
+ *   -t  Number of traces per thread and test (default 1000000)
+ *   -j  Maximum number of threads of the contended tests (default 8)
+ */
+/********************* System Headers ************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/********************* Local Headers *************************/
+#include "trace.h"
+
+/*********************** Constants ***************************/
+#define BENCH_DEPTH             4096
+#define BENCH_MAX_THREADS       8
+#define BENCH_TRACES            1000000
+#define BENCH_DUMP_LINES        2000000 // Number of trace lines dumped per dump test
+#define BENCH_BIN_SIZE          (1 << 20)
+#define BENCH_DRAIN_PATH        "/tmp/trace_bench_drain"   // Path of the files of the drain benchmark
+#define BENCH_DRAIN_MS          200     // Duration of the drain benchmark [in ms]
+#define BENCH_ALLOCS            10000   // Number of trace_alloc() and trace_free() pairs
+#define BENCH_SAMPLE_RATE       10      // TRACE_SAMPLED() stores 1 in BENCH_SAMPLE_RATE calls
+
+#if defined(TRACE_USE_ATOMIC)
+#define BENCH_LOCK              "atomic"
+#elif defined(__TRACE_MUTEX_H__)
+#define BENCH_LOCK              "mutex"
+#else
+#define BENCH_LOCK              "none"
+#endif // defined(TRACE_USE_ATOMIC)
+#if defined(TRACE_USE_LARGE)
+#define BENCH_RING              BENCH_LOCK "+large"
+#elif defined(TRACE_USE_SPANS)
+#define BENCH_RING              BENCH_LOCK "+spans"
+#elif defined(TRACE_USE_FAST_DUMP)
+#define BENCH_RING              BENCH_LOCK "+fast"
+#elif defined(TRACE_USE_INSTRUMENT)
+#define BENCH_RING              BENCH_LOCK "+instrument"
+#elif defined(TRACE_USE_DRAIN)
+#define BENCH_RING              BENCH_LOCK "+drain"
+#elif defined(TRACE_USE_ARENA)
+#define BENCH_RING              BENCH_LOCK "+arena"
+#elif defined(TRACE_USE_QUERY)
+#define BENCH_RING              BENCH_LOCK "+query"
+#elif defined(TRACE_USE_SAMPLING)
+#define BENCH_RING              BENCH_LOCK "+sampled"
+#else
+#define BENCH_RING              BENCH_LOCK
+#endif // defined(TRACE_USE_LARGE)
+#if defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+#define BENCH_CONFIG            BENCH_RING "+tick64c"
+#elif defined(TRACE_USE_TICK64)
+#define BENCH_CONFIG            BENCH_RING "+tick64"
+#elif defined(TRACE_GET_TICK)
+#define BENCH_CONFIG            BENCH_RING "+tick"
+#else
+#define BENCH_CONFIG            BENCH_RING "+notick"
+#endif // defined(TRACE_GET_TICK)
+
+/********************* Global Variables **********************/
+#ifdef __TRACE_MUTEX_H__
+pthread_mutex_t gxTraceMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif // __TRACE_MUTEX_H__
+
+static trace_line_t gaxBenchLine[BENCH_DEPTH];
+static trace_t gxBench;
+static uint32_t gulTraces = BENCH_TRACES;
+static char gacOutput[256];                 // Receives the formatted trace_dump() output
+static uint8_t gaucBin[BENCH_BIN_SIZE];     // Receives the trace_dump_binary() output
+
+/********************* Local Functions ***********************/
+// A per-thread tick keeps the time stamp out of the contention being measured
+uint32_t fake_tick(void)
+{
+    static __thread uint32_t ulTick = 0;
+    return ulTick++;
+}
+
+// TRACE_OUTPUT of the benchmark: formats the output, but does not write it
+int bench_output(const char *pcFormat, ...)
+{
+    va_list xArgs;
+    int iLen;
+    va_start(xArgs, pcFormat);
+    iLen = vsnprintf(gacOutput, sizeof(gacOutput), pcFormat, xArgs);
+    va_end(xArgs);
+    return iLen;
+}
+
+static uint64_t bench_ns(void)
+{
+    struct timespec xTs;
+    clock_gettime(CLOCK_MONOTONIC, &xTs);
+    return (uint64_t)xTs.tv_sec * 1000000000ull + xTs.tv_nsec;
+}
+
+/**
+ * @brief      Output a result as a CSV row
+ */
+static void bench_result(const char *pcTest, int iThreads, int iDepth, bool bIsWrap, double dValue, const char *pcUnit)
+{
+    printf("%s,%s,%d,%d,%s,%.2f,%s\n", BENCH_CONFIG, pcTest, iThreads, iDepth, bIsWrap ? "wrap" : "nowrap", dValue, pcUnit);
+}
+
+static void *bench_thread(void *pvArg)
+{
+    uint32_t ulIdx;
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        trace(&gxBench, "bench", ulIdx);
+    }
+    return pvArg;
+}
+
+/**
+ * @brief      Measure trace() from a number of threads
+ *
+ * @return     Average latency seen by each thread [in ns/op]
+ */
+static double bench_trace(int iThreads, bool bIsWrap)
+{
+    pthread_t axThread[BENCH_MAX_THREADS];
+    uint64_t ullStart;
+    int idx;
+
+    trace_init(&gxBench, "Bench", gaxBenchLine, BENCH_DEPTH, bIsWrap);
+    if (iThreads == 1)
+    {
+        ullStart = bench_ns();
+        bench_thread(NULL);
+        return (double)(bench_ns() - ullStart) / gulTraces;
+    }
+    ullStart = bench_ns();
+    for (idx = 0; idx < iThreads; idx++)
+    {
+        pthread_create(&axThread[idx], NULL, bench_thread, NULL);
+    }
+    for (idx = 0; idx < iThreads; idx++)
+    {
+        pthread_join(axThread[idx], NULL);
+    }
+    return (double)(bench_ns() - ullStart) / gulTraces;
+}
+
+/**
+ * @brief      Measure a TRACE() call site disabled at run time
+ *
+ * @return     Cost of the call site [in ns/op]
+ */
+static double bench_trace_disabled(void)
+{
+    uint64_t ullStart;
+    uint32_t ulIdx;
+
+    TRACE_SET_LEVEL(Bench64, TRACE_LEVEL_OFF);
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        TRACE(Bench64, "bench", ulIdx);
+        // Keep the compiler from hoisting the enable check out of the loop
+        __asm__ __volatile__("" ::: "memory");
+    }
+    TRACE_SET_LEVEL(Bench64, TRACE_LEVEL_VERBOSE);
+    return (double)(bench_ns() - ullStart) / gulTraces;
+}
+
+/**
+ * @brief      Fill a trace buffer
+ */
+static void bench_fill(trace_t *This)
+{
+    uint32_t ulIdx;
+    for (ulIdx = 0; ulIdx < TRACE_DEPTH(This); ulIdx++)
+    {
+        trace(This, "bench dump", ulIdx);
+    }
+}
+
+/**
+ * @brief      Measure trace_dump() or trace_dump_binary() of a full trace buffer
+ *
+ * @return     Throughput [in entries/s]
+ */
+static double bench_dump(trace_t *This, bool bBinary)
+{
+    uint32_t ulDumps = BENCH_DUMP_LINES / TRACE_DEPTH(This), ulIdx;
+    uint64_t ullStart;
+
+    bench_fill(This);
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < ulDumps; ulIdx++)
+    {
+        if (bBinary)
+        {
+            trace_dump_binary_buf(This, gaucBin, sizeof(gaucBin));
+        }
+        else
+        {
+            trace_dump(This, false);
+        }
+    }
+    return (double)ulDumps * TRACE_DEPTH(This) * 1e9 / (bench_ns() - ullStart);
+}
+
+#if defined(TRACE_USE_FAST_DUMP) || defined(TRACE_USE_QUERY)
+// Sink of trace_dump_text() and trace_query(): receives the text, but does not write it
+static void bench_sink(void *pvCtx, const void *pvData, size_t xSize)
+{
+    *(size_t *)pvCtx += xSize;
+    __asm__ __volatile__("" :: "r"(pvData) : "memory");
+}
+#endif // defined(TRACE_USE_FAST_DUMP) || defined(TRACE_USE_QUERY)
+
+#if defined(TRACE_USE_FAST_DUMP)
+/**
+ * @brief      Measure trace_dump_text() of a full trace buffer
+ *
+ * @return     Throughput [in entries/s]
+ */
+static double bench_dump_text(trace_t *This)
+{
+    uint32_t ulDumps = BENCH_DUMP_LINES / TRACE_DEPTH(This), ulIdx;
+    uint64_t ullStart;
+    size_t xText = 0;
+
+    bench_fill(This);
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < ulDumps; ulIdx++)
+    {
+        trace_dump_text(This, bench_sink, &xText);
+    }
+    return (double)ulDumps * TRACE_DEPTH(This) * 1e9 / (bench_ns() - ullStart);
+}
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+#if defined(TRACE_USE_INSTRUMENT)
+// NOTE: The benchmark is not built with -finstrument-functions, so it calls the hooks itself
+extern void __cyg_profile_func_enter(void *pvFunc, void *pvCall);
+extern void __cyg_profile_func_exit(void *pvFunc, void *pvCall);
+
+/**
+ * @brief      Measure the hooks of a function built with -finstrument-functions
+ *
+ * @param[in]  bEnable  true - traced, false - disabled for the thread by trace_func_thread()
+ *
+ * @return     Cost of the entry and exit of a call [in ns/op]
+ */
+static double bench_func(bool bEnable)
+{
+    uint64_t ullStart;
+    uint32_t ulIdx;
+
+    trace_func_thread(bEnable);
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        __cyg_profile_func_enter((void *)bench_func, NULL);
+        __cyg_profile_func_exit((void *)bench_func, NULL);
+    }
+    trace_func_thread(true);
+    return (double)(bench_ns() - ullStart) / gulTraces;
+}
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_DRAIN)
+/**
+ * @brief      Remove the files of the drain benchmark
+ *
+ * @param      pxStats  Statistics of the drain
+ */
+static void bench_drain_clean(const trace_drain_stats_t *pxStats)
+{
+    char acName[256];
+    uint32_t ulIdx;
+
+    for (ulIdx = 0; ulIdx < pxStats->ulFiles; ulIdx++)
+    {
+        snprintf(acName, sizeof(acName), TRACE_DRAIN_NAME, BENCH_DRAIN_PATH, ulIdx);
+        unlink(acName);
+    }
+}
+
+/**
+ * @brief      Measure trace() flat out for BENCH_DRAIN_MS while the drain streams
+ *             the trace buffer to disk.  The drain can't keep up with that
+ *
+ * @param      pdLost  Returns the share of the trace lines the drain lost [in %]
+ *
+ * @return     Cost of trace() [in ns/op]
+ */
+static double bench_drained(double *pdLost)
+{
+    trace_t *pxTrace = gpxTraceBench16384;
+    uint64_t ullStart, ullEnd, ullTraces = 0;
+    trace_drain_stats_t xStats;
+    uint32_t ulIdx;
+
+    *pdLost = 0;
+    if (!trace_drain_start(BENCH_DRAIN_PATH, &pxTrace, 1))
+    {
+        return 0;
+    }
+    ullStart = ullEnd = bench_ns();
+    while (ullEnd - ullStart < BENCH_DRAIN_MS * 1000000ull)
+    {
+        for (ulIdx = 0; ulIdx < 1000; ulIdx++)
+        {
+            trace(pxTrace, "bench drain", ulIdx);
+        }
+        ullTraces += ulIdx;
+        ullEnd = bench_ns();
+    }
+    trace_drain_stop();
+    trace_drain_stats(&xStats);
+    bench_drain_clean(&xStats);
+    *pdLost = 100.0 * xStats.ullLost / ullTraces;
+    return (double)(ullEnd - ullStart) / ullTraces;
+}
+
+/**
+ * @brief      Measure the drain of full trace buffers, from trace_drain_start()
+ *             to trace_drain_stop()
+ *
+ * @param      pdSize  Returns the size of the files per trace line [in bytes]
+ *
+ * @return     Throughput [in entries/s]
+ */
+static double bench_drain(double *pdSize)
+{
+    trace_t *pxTrace = gpxTraceBench16384;
+    uint64_t ullLines = 0, ullBytes = 0, ullNs = 0, ullStart;
+    trace_drain_stats_t xStats;
+
+    *pdSize = 0;
+    while (ullLines < BENCH_DUMP_LINES)
+    {
+        bench_fill(pxTrace);
+        ullStart = bench_ns();
+        if (!trace_drain_start(BENCH_DRAIN_PATH, &pxTrace, 1))
+        {
+            return 0;
+        }
+        trace_drain_stop();
+        ullNs += bench_ns() - ullStart;
+        trace_drain_stats(&xStats);
+        bench_drain_clean(&xStats);
+        ullLines += xStats.ullLines;
+        ullBytes += xStats.ullBytes;
+    }
+    *pdSize = (double)ullBytes / ullLines;
+    return (double)ullLines * 1e9 / ullNs;
+}
+#endif // defined(TRACE_USE_DRAIN)
+
+#if defined(TRACE_USE_ARENA)
+/**
+ * @brief      Measure trace() to a trace buffer of trace_alloc()
+ *
+ * @return     Latency [in ns/op]
+ */
+static double bench_arena_trace(void)
+{
+    trace_t *This = trace_alloc("Bench Arena", BENCH_DEPTH, true, TRACE_MODE_LINE);
+    uint64_t ullStart;
+    uint32_t ulIdx;
+
+    if (This == NULL)
+    {
+        return 0;
+    }
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        trace(This, "bench", ulIdx);
+    }
+    ullStart = bench_ns() - ullStart;
+    trace_free(This);
+    return (double)ullStart / gulTraces;
+}
+
+/**
+ * @brief      Measure a trace buffer allocated, registered, unregistered and freed
+ *
+ * @return     Cost of trace_alloc() and trace_free() [in ns/op]
+ */
+static double bench_arena_alloc(void)
+{
+    uint64_t ullStart;
+    uint32_t ulIdx;
+
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < BENCH_ALLOCS; ulIdx++)
+    {
+        trace_free(trace_alloc("Bench Arena", BENCH_DEPTH, true, TRACE_MODE_LINE));
+    }
+    return (double)(bench_ns() - ullStart) / BENCH_ALLOCS;
+}
+#endif // defined(TRACE_USE_ARENA)
+
+/**
+ * @brief      Measure trace_dump_all() of the full trace buffers
+ *
+ * @return     Throughput [in entries/s]
+ */
+static double bench_dump_all(void)
+{
+    uint32_t ulLines = 0, ulDumps, ulIdx;
+    uint64_t ullStart;
+
+    bench_fill(gpxTraceBench64);
+    bench_fill(gpxTraceBench1024);
+    bench_fill(gpxTraceBench16384);
+    ulLines = TRACE_DEPTH(gpxTraceBench64) + TRACE_DEPTH(gpxTraceBench1024) + TRACE_DEPTH(gpxTraceBench16384);
+    ulDumps = (BENCH_DUMP_LINES + ulLines - 1) / ulLines;
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < ulDumps; ulIdx++)
+    {
+        trace_dump_all(false);
+    }
+    return (double)ulDumps * ulLines * 1e9 / (bench_ns() - ullStart);
+}
+
+#if defined(TRACE_USE_QUERY)
+/**
+ * @brief      Measure trace_query() of the full trace buffers, which hold a
+ *             single trace line matching the filter of the selective query
+ *
+ * @param[in]  bAll  true - match all trace lines, false - the single one
+ *
+ * @return     Throughput [in entries/s]
+ */
+static double bench_query(bool bAll)
+{
+    trace_query_t xQuery = { .pcMatch = bAll ? NULL : "needle" };
+    uint32_t ulLines = 0, ulQueries, ulIdx;
+    uint64_t ullStart;
+    size_t xText = 0;
+
+    bench_fill(gpxTraceBench64);
+    bench_fill(gpxTraceBench1024);
+    bench_fill(gpxTraceBench16384);
+    trace(gpxTraceBench16384, "bench needle", 0);
+    ulLines = TRACE_DEPTH(gpxTraceBench64) + TRACE_DEPTH(gpxTraceBench1024) + TRACE_DEPTH(gpxTraceBench16384);
+    ulQueries = (BENCH_DUMP_LINES + ulLines - 1) / ulLines;
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < ulQueries; ulIdx++)
+    {
+        trace_query(&xQuery, bench_sink, &xText);
+    }
+    return (double)ulQueries * ulLines * 1e9 / (bench_ns() - ullStart);
+}
+#endif // defined(TRACE_USE_QUERY)
+
+#if defined(TRACE_USE_SAMPLING)
+/**
+ * @brief      Measure TRACE_SAMPLED() interleaved with TRACE() into a wrap buffer,
+ *             then check the trace lines of trace_dump_binary_buf().  The calls
+ *             only counted must not move the slots the trace lines are written to.
+ *
+ * @param      pdValid  Returns the share of the trace lines dumped in order [in %]
+ *
+ * @return     Cost of the call sites [in ns/op]
+ */
+static double bench_sampled(double *pdValid)
+{
+    const trace_bin_hdr_t *pxHdr = (const trace_bin_hdr_t *)gaucBin;
+    uint32_t ulIdx, ulSeq = 0, ulInOrder = 0;
+    uint64_t ullStart, ullEnd;
+
+    // Step 1: 1 in 4 calls is stored by TRACE(), the others are sampled
+    trace_dump(gpxTraceBench64, true);
+    ullStart = bench_ns();
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        if (ulIdx % 4 == 3)
+        {
+            TRACE(Bench64, "bench", ulIdx);
+        }
+        else
+        {
+            TRACE_SAMPLED(Bench64, "bench sampled", ulIdx, BENCH_SAMPLE_RATE);
+        }
+    }
+    ullEnd = bench_ns();
+    // Step 2: Walk the dumped ring from the oldest trace line, the sequence numbers
+    //         must be consecutive
+    trace_dump_binary_buf(gpxTraceBench64, gaucBin, sizeof(gaucBin));
+    for (ulIdx = 0; pxHdr->ulMagic == TRACE_BIN_MAGIC && pxHdr->xSeq.ucSize && ulIdx < pxHdr->ulValid; ulIdx++)
+    {
+        const uint8_t *pucLine = &gaucBin[pxHdr->usHdrSize + ((pxHdr->ulFirst + ulIdx) % pxHdr->ulDepth) * pxHdr->usLineSize];
+        uint32_t ulLineSeq;
+        memcpy(&ulLineSeq, &pucLine[pxHdr->xSeq.ucOffset], sizeof(ulLineSeq));
+        if (ulLineSeq != 0 && (ulIdx == 0 || ulLineSeq == ulSeq + 1))
+        {
+            ulInOrder++;
+        }
+        ulSeq = ulLineSeq;
+    }
+    *pdValid = 100.0 * ulInOrder / TRACE_DEPTH(gpxTraceBench64);
+    return (double)(ullEnd - ullStart) / gulTraces;
+}
+#endif // defined(TRACE_USE_SAMPLING)
+
+/********************* Exported Functions ********************/
+int main(int argc, char *argv[])
+{
+    trace_t *apxDump[] = { gpxTraceBench64, gpxTraceBench1024, gpxTraceBench16384 };
+    int iMaxThreads = BENCH_MAX_THREADS;
+    bool bHeader = true;
+    int iOpt, iThreads, idx;
+
+    while ((iOpt = getopt(argc, argv, "nt:j:")) != -1)
+    {
+        switch (iOpt)
+        {
+            case 'n': bHeader = false; break;
+            case 't': gulTraces = strtoul(optarg, NULL, 0); break;
+            case 'j': iMaxThreads = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n] [-t traces] [-j max threads]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iMaxThreads < 1 || iMaxThreads > BENCH_MAX_THREADS)
+    {
+        iMaxThreads = BENCH_MAX_THREADS;
+    }
+    if (gulTraces == 0)
+    {
+        gulTraces = BENCH_TRACES;
+    }
+
+    if (bHeader)
+    {
+        printf("config,test,threads,depth,wrap,value,unit\n");
+    }
+    // Step 1: trace() from a single thread, wrap and no-wrap
+    bench_result("trace", 1, BENCH_DEPTH, true, bench_trace(1, true), "ns/op");
+    bench_result("trace", 1, BENCH_DEPTH, false, bench_trace(1, false), "ns/op");
+    bench_result("trace_disabled", 1, TRACE_DEPTH(gpxTraceBench64), true, bench_trace_disabled(), "ns/op");
+#if defined(TRACE_USE_INSTRUMENT)
+    bench_result("func_call", 1, TRACE_DEPTH(gpxTraceBenchFunc), true, bench_func(true), "ns/op");
+    bench_result("func_call_disabled", 1, TRACE_DEPTH(gpxTraceBenchFunc), true, bench_func(false), "ns/op");
+#endif // defined(TRACE_USE_INSTRUMENT)
+#if defined(TRACE_USE_DRAIN)
+    {
+        double dValue;
+        bench_result("trace_drained", 1, TRACE_DEPTH(gpxTraceBench16384), true, bench_drained(&dValue), "ns/op");
+        bench_result("trace_drained_lost", 1, TRACE_DEPTH(gpxTraceBench16384), true, dValue, "%");
+    }
+#endif // defined(TRACE_USE_DRAIN)
+#if defined(TRACE_USE_SAMPLING)
+    {
+        double dValid;
+        bench_result("trace_sampled", 1, TRACE_DEPTH(gpxTraceBench64), true, bench_sampled(&dValid), "ns/op");
+        bench_result("trace_sampled_valid", 1, TRACE_DEPTH(gpxTraceBench64), true, dValid, "%");
+        if (dValid < 100.0)
+        {
+            fprintf(stderr, "%s: trace lines of the sampled wrap buffer lost\n", BENCH_CONFIG);
+            return 1;
+        }
+    }
+#endif // defined(TRACE_USE_SAMPLING)
+#if defined(TRACE_USE_ARENA)
+    bench_result("trace_arena", 1, BENCH_DEPTH, true, bench_arena_trace(), "ns/op");
+    bench_result("trace_alloc_free", 1, BENCH_DEPTH, true, bench_arena_alloc(), "ns/op");
+#endif // defined(TRACE_USE_ARENA)
+#if defined(TRACE_USE_ATOMIC) || defined(__TRACE_MUTEX_H__)
+    // Step 2: trace() contended by many threads
+    for (iThreads = 2; iThreads <= iMaxThreads; iThreads *= 2)
+    {
+        bench_result("trace", iThreads, BENCH_DEPTH, true, bench_trace(iThreads, true), "ns/op");
+        bench_result("trace", iThreads, BENCH_DEPTH, false, bench_trace(iThreads, false), "ns/op");
+    }
+#else
+    (void)iThreads;
+#endif // defined(TRACE_USE_ATOMIC) || defined(__TRACE_MUTEX_H__)
+    // Step 3: Dump throughput at several depths
+    for (idx = 0; idx < sizeof(apxDump) / sizeof(apxDump[0]); idx++)
+    {
+        bench_result("trace_dump", 1, TRACE_DEPTH(apxDump[idx]), true, bench_dump(apxDump[idx], false), "entries/s");
+        bench_result("trace_dump_binary", 1, TRACE_DEPTH(apxDump[idx]), true, bench_dump(apxDump[idx], true), "entries/s");
+#if defined(TRACE_USE_FAST_DUMP)
+        bench_result("trace_dump_text", 1, TRACE_DEPTH(apxDump[idx]), true, bench_dump_text(apxDump[idx]), "entries/s");
+#endif // defined(TRACE_USE_FAST_DUMP)
+    }
+#if defined(TRACE_USE_DRAIN)
+    {
+        double dSize;
+        bench_result("trace_drain", 1, TRACE_DEPTH(gpxTraceBench16384), true, bench_drain(&dSize), "entries/s");
+        bench_result("trace_drain_size", 1, TRACE_DEPTH(gpxTraceBench16384), true, dSize, "bytes/line");
+    }
+#endif // defined(TRACE_USE_DRAIN)
+    bench_result("trace_dump_all", 1, TRACE_DEPTH(gpxTraceBench64) + TRACE_DEPTH(gpxTraceBench1024) + TRACE_DEPTH(gpxTraceBench16384),
+                 true, bench_dump_all(), "entries/s");
+#if defined(TRACE_USE_QUERY)
+    bench_result("trace_query_all", 1, TRACE_DEPTH(gpxTraceBench64) + TRACE_DEPTH(gpxTraceBench1024) + TRACE_DEPTH(gpxTraceBench16384),
+                 true, bench_query(true), "entries/s");
+    bench_result("trace_query_match", 1, TRACE_DEPTH(gpxTraceBench64) + TRACE_DEPTH(gpxTraceBench1024) + TRACE_DEPTH(gpxTraceBench16384),
+                 true, bench_query(false), "entries/s");
+#endif // defined(TRACE_USE_QUERY)
+    return 0;
+}
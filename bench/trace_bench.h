@@ -0,0 +1,36 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Forced include (gcc -include) of the benchmark suite.  Maps TRACE_OUTPUT
+ * onto bench_output(), which formats the dump without writing it, so the dump
+ * benchmarks measure trace_dump() rather than the terminal.
+ */
+#ifndef __TRACE_BENCH_H__
+#define __TRACE_BENCH_H__
+
+extern int bench_output(const char *pcFormat, ...);
+
+#define TRACE_OUTPUT(...)       bench_output(__VA_ARGS__)
+
+#endif // __TRACE_BENCH_H__
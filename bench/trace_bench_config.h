@@ -0,0 +1,33 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Trace buffers of the benchmark suite (bench/trace_bench.c), one per depth
+ * measured by the dump benchmarks
+ */
+TRACE_CONFIG(Bench64, "Bench 64", 64, true)
+TRACE_CONFIG(Bench1024, "Bench 1024", 1024, true)
+TRACE_CONFIG(Bench16384, "Bench 16384", 16384, true)
+#if defined(TRACE_USE_INSTRUMENT)
+TRACE_CONFIG(BenchFunc, "Bench Func", 4096, true)
+#endif // defined(TRACE_USE_INSTRUMENT)
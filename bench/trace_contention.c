@@ -0,0 +1,129 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+ * Contention benchmark for trace().  A shared wrap buffer is hammered from
+ * 1 to N threads and the cost of each trace() call is reported in ns/trace.
+ * Build with TRACE_USE_ATOMIC for the lock-free path, or force include
+ * bench/trace_mutex.h for the mutex protected baseline (see makefile).
+ *
+ * Usage: trace_contention [max threads] [traces per thread]
+ */
+/********************* System Headers ************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/********************* Local Headers *************************/
+#include "trace.h"
+
+/*********************** Constants ***************************/
+#define BENCH_DEPTH             4096
+#define BENCH_MAX_THREADS       8
+#define BENCH_TRACES            1000000
+
+/********************* Global Variables **********************/
+#ifdef __TRACE_MUTEX_H__
+pthread_mutex_t gxTraceMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif // __TRACE_MUTEX_H__
+
+static trace_line_t gaxBenchLine[BENCH_DEPTH];
+static trace_t gxBench;
+static uint32_t gulTraces = BENCH_TRACES;
+
+/********************* Local Functions ***********************/
+// A per-thread tick keeps the time stamp out of the contention being measured
+uint32_t fake_tick(void)
+{
+    static __thread uint32_t ulTick = 0;
+    return ulTick++;
+}
+
+static uint64_t bench_ns(void)
+{
+    struct timespec xTs;
+    clock_gettime(CLOCK_MONOTONIC, &xTs);
+    return (uint64_t)xTs.tv_sec * 1000000000ull + xTs.tv_nsec;
+}
+
+static void *bench_thread(void *pvArg)
+{
+    uint32_t ulIdx;
+    for (ulIdx = 0; ulIdx < gulTraces; ulIdx++)
+    {
+        trace(&gxBench, "bench", ulIdx);
+    }
+    return pvArg;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t axThread[BENCH_MAX_THREADS];
+    int iMaxThreads = (argc > 1) ? atoi(argv[1]) : BENCH_MAX_THREADS;
+    int iThreads, idx;
+
+    if (argc > 2)
+    {
+        gulTraces = strtoul(argv[2], NULL, 0);
+    }
+    if (iMaxThreads < 1 || iMaxThreads > BENCH_MAX_THREADS)
+    {
+        iMaxThreads = BENCH_MAX_THREADS;
+    }
+
+#if defined(TRACE_USE_ATOMIC)
+    printf("trace() contention: TRACE_USE_ATOMIC, %u traces/thread" TRACE_NEWLINE, gulTraces);
+#else
+    printf("trace() contention: TRACE_LOCK, %u traces/thread" TRACE_NEWLINE, gulTraces);
+#endif // defined(TRACE_USE_ATOMIC)
+    printf("%8s %12s %14s" TRACE_NEWLINE, "threads", "ns/trace", "Mtrace/s");
+    for (iThreads = 1; iThreads <= iMaxThreads; iThreads *= 2)
+    {
+        uint64_t ullStart, ullElapsed;
+
+        trace_init(&gxBench, "Bench", gaxBenchLine, BENCH_DEPTH, true);
+        ullStart = bench_ns();
+        for (idx = 0; idx < iThreads; idx++)
+        {
+            pthread_create(&axThread[idx], NULL, bench_thread, NULL);
+        }
+        for (idx = 0; idx < iThreads; idx++)
+        {
+            pthread_join(axThread[idx], NULL);
+        }
+        ullElapsed = bench_ns() - ullStart;
+        // ns/trace is the average latency seen by each thread
+        printf("%8d %12.2f %14.2f" TRACE_NEWLINE, iThreads,
+               (double)ullElapsed / gulTraces,
+               (double)gulTraces * iThreads * 1000.0 / ullElapsed);
+        if (trace_total(&gxBench) != gulTraces * iThreads)
+        {
+            printf("ERROR: lost traces (%u of %u)" TRACE_NEWLINE, trace_total(&gxBench), gulTraces * iThreads);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Please refer to trace.hpp for the procedure reference
+/********************* System Headers ************************/
+#include <cstdio>
+// Step 4: Include trace.hpp to the C++ source to be instrumented
+#include "trace.hpp"
+
+/*********************** Constants ***************************/
+#define RX_TRACE_DEPTH  16
+
+/********************* Global Variables **********************/
+// A trace buffer of C++ with its depth as a constant
+static trc::buffer<RX_TRACE_DEPTH> gxRx("Rx Trace");
+// The trace buffers of trace_config.h, shared with C
+static trc::ref gxTest(gpxTraceTest);
+static trc::ref gxError(gpxTraceError);
+
+enum class state_t : uint8_t { IDLE, BUSY };
+
+/********************* Local Functions ***********************/
+// Step 1a: This mimics a tick which is used for optional time stamping
+extern "C" uint32_t fake_tick(void)
+{
+    static uint32_t ulTick = 0;
+    return ulTick += 10;
+}
+
+static void rx_frame(uint16_t usLen)
+{
+    gxRx.trace("rx frame", usLen);
+    if (usLen > 1500)
+    {
+        gxError.trace<TRACE_LEVEL_ERROR>("rx frame too long", usLen);
+    }
+}
+
+/********************* Exported Functions ********************/
+int main(void)
+{
+    uint16_t usLen;
+
+    // Example 1: Trace to the trace buffers of C++ and C
+    printf("\nExample 1: Trace from C++ to the trace buffers of C++ and C\n");
+    gxTest.trace("C++ Start", 0);
+    gxTest.trace("State", state_t::BUSY);
+    for (usLen = 1000; usLen < 2000; usLen += 100)
+    {
+        rx_frame(usLen);
+    }
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+    gxTest.trace(trc::msg<"C++ End">, usLen);
+#else
+    gxTest.trace("C++ End", usLen);
+#endif // __cpp_nontype_template_args
+    gxRx.dump(true);
+
+    // Example 2: trace_dump_all() dumps the trace buffers of trace_config.h
+    printf("\nExample 2: Dump all traces\n");
+    TRACE_DUMP_ALL(true);
+    return 0;
+}
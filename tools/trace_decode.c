@@ -0,0 +1,1986 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+ * Host side decoder for the binary records written by trace_dump_binary().
+ * The records are turned back into the text format of trace_dump(), into
+ * JSON or CSV for further processing, or into the Chrome trace-event JSON of
+ * trace_export_chrome() for chrome://tracing or the Perfetto UI.  The files of
+ * the drain of TRACE_USE_DRAIN are decoded too, also several of them catenated
+ * in order, e.g. "cat app.* | trace_decode".
+ *
+ * A query merges the trace lines of the binary records, e.g. of
+ * trace_dump_binary_all(), into one stream in order of time, and outputs only
+ * the ones matching its filters, e.g. "trace_decode -b Error -b Test -s crc dump.bin".
+ * The filters run on the raw trace lines, so only the matches are formatted.
+ * The trace lines of a drain file are filtered in the order they were drained,
+ * without -i.
+ *
+ * Usage: trace_decode [-t | -j | -c | -p] [-q] [-b name] [-s text] [-i id] [-v min:max]
+ *                     [-w from:to] [-T tid] [-n max] [file]
+ *   -t  Text in the format of trace_dump() (default)
+ *   -j  JSON
+ *   -c  CSV
+ *   -p  Chrome trace-event JSON
+ *   -q  Query, implied by each of the filters below
+ *   -b  Only the trace buffer of this name, may be repeated
+ *   -s  Only the messages holding this text
+ *   -i  Only the message of this ID (TRACE_USE_MSG_ID), or at this address
+ *   -v  Only the values from min to max, either may be left out
+ *   -w  Only the trace lines from time to time [in ns], either may be left out
+ *   -T  Only the trace lines of this thread ID
+ *   -n  Only the oldest max matches
+ *   Reads from stdin if no file is given
+ */
+/********************* System Headers ************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/********************* Local Headers *************************/
+#include "trace_bin.h"
+
+/*********************** Typedefs ****************************/
+// Output formats
+typedef enum
+{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+    FORMAT_CHROME,
+} format_t;
+
+// String table entry
+typedef struct
+{
+    uint64_t ullKey;                // Value of the message field that refers to the string
+    const char *pcString;           // The string (not null terminated)
+    uint16_t usLen;                 // Length of the string
+} decode_str_t;
+
+// A decoded record
+typedef struct
+{
+    trace_bin_hdr_t xHdr;           // Record header
+    const uint8_t *pucRing;         // The raw ring
+    decode_str_t *axStr;            // String table
+    uint32_t ulStrs;                // Number of entries in the string table
+} decode_rec_t;
+
+// Converts the time stamps of a record, from oldest to newest, for output
+typedef struct
+{
+    uint64_t ullHz;                 // Tick rate, 0 - time stamps of TRACE_GET_TICK [in ms]
+    bool     bCompact;              // true - 32-bit time stamps of 64-bit ticks
+    uint8_t  ucShift;               // Compact time stamps hold the lower bits of (tick >> ucShift)
+    bool     bStarted;              // true - ulFirst and ulLast are set
+    uint32_t ulFirst;               // First compact time stamp
+    uint32_t ulLast;                // Last compact time stamp
+    uint64_t ullTick;               // Tick of the last time stamp
+    uint64_t ullLast;               // Last time stamp output, in ns if ullHz is set
+} decode_clock_t;
+
+// A trace buffer of a drain file
+typedef struct
+{
+    decode_str_t xName;             // Name of the trace buffer, usLen of 0 - not named yet
+    uint32_t ulTid;                 // Thread ID of the owner of a shard, otherwise 0
+    uint64_t ullStamp;              // Time stamp of the previous trace line, extended to 64 bits
+    decode_clock_t xClock;          // Converts the time stamps for output
+} decode_drain_buf_t;
+
+// The state of a drain file
+typedef struct
+{
+    trace_drain_hdr_t xHdr;         // File header
+    decode_str_t *axStr;            // Messages, by index
+    uint32_t ulStrs;                // Number of entries in axStr
+    decode_drain_buf_t *axBuf;      // Trace buffers, by id
+    uint32_t ulBufs;                // Number of entries in axBuf
+} decode_drain_t;
+
+// Filters of a query, each matches all trace lines if not given
+typedef struct
+{
+    bool     bQuery;                // true - merge the binary records and filter the trace lines
+    const char **apcBuf;            // Names of the trace buffers, NULL - all
+    uint32_t ulBufs;                // Number of names in apcBuf
+    const char *pcMatch;            // Text the message holds, NULL - any
+    bool     bKey;                  // true - only the message ullKey
+    uint64_t ullKey;                // ID or address of the message
+    uint64_t ullValueMin;           // Lowest value
+    uint64_t ullValueMax;           // Highest value
+    bool     bTime;                 // true - only the trace lines from ullTimeFrom to ullTimeTo
+    uint64_t ullTimeFrom;           // Start of the window [in ns]
+    uint64_t ullTimeTo;             // End of the window, inclusive [in ns]
+    uint32_t ulTid;                 // Thread ID, 0 - any
+    uint64_t ullMax;                // Number of trace lines output, 0 - no limit
+    uint64_t ullLines;              // Number of trace lines output so far
+} decode_query_t;
+
+// A trace line of a binary record that matches the query
+typedef struct
+{
+    uint64_t ullNs;                 // Time of the trace line [in ns], 0 - no time stamp
+    uint32_t ulOrder;               // Order the trace line was found in, keeps the sort stable
+    uint32_t ulSlot;                // Slot of the trace line
+    const decode_rec_t *pxRec;      // The record
+    const uint8_t *pucLine;         // The trace line
+} decode_hit_t;
+
+/********************* Global Variables **********************/
+static uint32_t gulEvents = 0;      // FORMAT_CHROME: number of events output
+static decode_query_t gxQuery = { .ullValueMax = UINT32_MAX };  // Filters of the query
+
+/********************* Local Functions ***********************/
+/**
+ * @brief      Read the whole input into memory
+ *
+ * @param      pxFile   Input file
+ * @param      pxSize   Returns the size of the input
+ *
+ * @return     The input, or NULL if out of memory
+ */
+static uint8_t *decode_read(FILE *pxFile, size_t *pxSize)
+{
+    size_t xCap = 1 << 16, xSize = 0, xRead;
+    uint8_t *pucBuf = malloc(xCap);
+
+    while (pucBuf && (xRead = fread(&pucBuf[xSize], 1, xCap - xSize, pxFile)) > 0)
+    {
+        xSize += xRead;
+        if (xSize == xCap)
+        {
+            uint8_t *pucNew = realloc(pucBuf, xCap *= 2);
+            if (pucNew == NULL)
+            {
+                free(pucBuf);
+                return NULL;
+            }
+            pucBuf = pucNew;
+        }
+    }
+    *pxSize = xSize;
+    return pucBuf;
+}
+
+/**
+ * @brief      Read a field of a trace line
+ *
+ * @param      pucLine  The trace line
+ * @param[in]  xField   Location of the field
+ *
+ * @return     Value of the field, 0 if not present
+ */
+static uint64_t decode_field(const uint8_t *pucLine, trace_bin_field_t xField)
+{
+    uint8_t  uc;
+    uint16_t us;
+    uint32_t ul;
+    uint64_t ull;
+
+    switch (xField.ucSize)
+    {
+        case 1: memcpy(&uc, &pucLine[xField.ucOffset], 1); return uc;
+        case 2: memcpy(&us, &pucLine[xField.ucOffset], 2); return us;
+        case 4: memcpy(&ul, &pucLine[xField.ucOffset], 4); return ul;
+        case 8: memcpy(&ull, &pucLine[xField.ucOffset], 8); return ull;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief      Extend the next time stamp to a 64-bit tick (see trace_clock_next)
+ *
+ * @param      pxClock   The clock
+ * @param[in]  ullStamp  Time stamp of the next trace
+ *
+ * @return     The tick of the trace
+ */
+static uint64_t decode_clock_next(decode_clock_t *pxClock, uint64_t ullStamp)
+{
+    if (!pxClock->bCompact)
+    {
+        return pxClock->ullTick = ullStamp;
+    }
+    if (!pxClock->bStarted)
+    {
+        pxClock->ulFirst = pxClock->ulLast = (uint32_t)ullStamp;
+        pxClock->bStarted = true;
+    }
+    pxClock->ullTick += (uint64_t)(int64_t)(int32_t)((uint32_t)ullStamp - pxClock->ulLast) << pxClock->ucShift;
+    pxClock->ulLast = (uint32_t)ullStamp;
+    return pxClock->ullTick;
+}
+
+/**
+ * @brief      Set up the clock of a record.  Compact time stamps are run from
+ *             oldest to newest, then anchored to the tick of the newest trace
+ *             (see trace_clock_anchor)
+ *
+ * @param      pxRec    The record
+ * @param      pxClock  Returns the clock
+ */
+static void decode_clock_start(const decode_rec_t *pxRec, decode_clock_t *pxClock)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    uint32_t ulIdx, ulOffset, ulLeft;
+    uint64_t ullNewest;
+
+    memset(pxClock, 0, sizeof(*pxClock));
+    if (!(pxHdr->ucFlags & TRACE_BIN_TICK64) || pxHdr->ullTickHz == 0)
+    {
+        return;
+    }
+    pxClock->ullHz = pxHdr->ullTickHz;
+    pxClock->bCompact = pxHdr->xStamp.ucSize == sizeof(uint32_t);
+    pxClock->ucShift = pxHdr->ucTickShift;
+    if (!pxClock->bCompact)
+    {
+        return;
+    }
+    if (pxHdr->ucFlags & TRACE_BIN_RECORDS)
+    {
+        for (ulOffset = pxHdr->ulFirst, ulLeft = pxHdr->ulValid; ulLeft && pxHdr->ulDepth - ulOffset >= pxHdr->usLineSize; )
+        {
+            const uint8_t *pucLine = &pxRec->pucRing[ulOffset];
+            uint16_t usSize;
+            memcpy(&usSize, pucLine, sizeof(usSize));
+            if (usSize < pxHdr->usLineSize || usSize > ulLeft || usSize > pxHdr->ulDepth - ulOffset)
+            {
+                break;
+            }
+            if (pucLine[2] != TRACE_REC_PAD)
+            {
+                decode_clock_next(pxClock, decode_field(pucLine, pxHdr->xStamp));
+            }
+            ulLeft -= usSize;
+            ulOffset = (ulOffset + usSize) % pxHdr->ulDepth;
+        }
+    }
+    else
+    {
+        for (ulIdx = 0; ulIdx < pxHdr->ulValid; ulIdx++)
+        {
+            const uint8_t *pucLine = &pxRec->pucRing[(size_t)((pxHdr->ulFirst + ulIdx) % pxHdr->ulDepth) * pxHdr->usLineSize];
+            if (pxHdr->xSeq.ucSize == 0 || decode_field(pucLine, pxHdr->xSeq) != 0)
+            {
+                decode_clock_next(pxClock, decode_field(pucLine, pxHdr->xStamp));
+            }
+        }
+    }
+    ullNewest = ((pxHdr->ullTickBase >> pxClock->ucShift) +
+                 (uint64_t)(int64_t)(int32_t)(pxClock->ulLast - (uint32_t)(pxHdr->ullTickBase >> pxClock->ucShift))) << pxClock->ucShift;
+    pxClock->ullTick = ullNewest - pxClock->ullTick;
+    pxClock->ulLast = pxClock->ulFirst;
+}
+
+/**
+ * @brief      Convert the next time stamp of a record to nanoseconds
+ *
+ * @param      pxClock   The clock of the record
+ * @param[in]  ullStamp  The time stamp
+ *
+ * @return     The time of the trace [in ns]
+ */
+static uint64_t decode_clock_ns(decode_clock_t *pxClock, uint64_t ullStamp)
+{
+    if (pxClock->ullHz == 0)
+    {
+        return (uint64_t)(uint32_t)ullStamp * 1000000ull;   // Tick [in ms]
+    }
+    // NOTE: Split to avoid overflow of the tick * 10^9
+    ullStamp = decode_clock_next(pxClock, ullStamp);
+    return ullStamp / pxClock->ullHz * 1000000000ull + ullStamp % pxClock->ullHz * 1000000000ull / pxClock->ullHz;
+}
+
+/**
+ * @brief      Output the time stamp of a trace, and the time since the previous trace
+ *
+ * @param[in]  eFormat   Output format
+ * @param      pxClock   The clock of the record
+ * @param[in]  ullStamp  The time stamp
+ */
+static void decode_put_stamp(format_t eFormat, decode_clock_t *pxClock, uint64_t ullStamp)
+{
+    uint64_t ullNs;
+    long long llDelta;
+
+    if (pxClock->ullHz == 0)
+    {
+        uint32_t ulStamp = (uint32_t)ullStamp, ulDelta = ulStamp - (uint32_t)pxClock->ullLast;
+        switch (eFormat)
+        {
+            case FORMAT_TEXT: printf("%10d ms|", ulDelta); break;
+            case FORMAT_JSON: printf("\"stamp\": %u, ", ulStamp); break;
+            case FORMAT_CSV: printf("%u,%d", ulStamp, (int32_t)ulDelta); break;
+            default: break;
+        }
+        pxClock->ullLast = ulStamp;
+        return;
+    }
+    ullNs = decode_clock_ns(pxClock, ullStamp);
+    llDelta = pxClock->ullLast ? (long long)(ullNs - pxClock->ullLast) : 0;
+    switch (eFormat)
+    {
+        case FORMAT_TEXT:
+            printf("%7llu.%09llu s|%12lld ns|", (unsigned long long)(ullNs / 1000000000ull), (unsigned long long)(ullNs % 1000000000ull), llDelta);
+            break;
+        case FORMAT_JSON: printf("\"stamp\": %llu, ", (unsigned long long)ullNs); break;
+        case FORMAT_CSV: printf("%llu,%lld", (unsigned long long)ullNs, llDelta); break;
+        default: break;
+    }
+    pxClock->ullLast = ullNs;
+}
+
+/**
+ * @brief      Look up a string in the string table of a record
+ *
+ * @param      pxRec   The record
+ * @param[in]  ullKey  Key of the string
+ *
+ * @return     The string table entry, NULL if not found
+ */
+static const decode_str_t *decode_string(const decode_rec_t *pxRec, uint64_t ullKey)
+{
+    uint32_t ulIdx;
+    for (ulIdx = 0; ulIdx < pxRec->ulStrs; ulIdx++)
+    {
+        if (pxRec->axStr[ulIdx].ullKey == ullKey)
+        {
+            return &pxRec->axStr[ulIdx];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief      Check a field of the record header lies within a trace line
+ *
+ * @param      pxHdr   The record header
+ * @param[in]  xField  Location of the field
+ *
+ * @return     true - within, or not present, false - corrupt
+ */
+static bool decode_field_valid(const trace_bin_hdr_t *pxHdr, trace_bin_field_t xField)
+{
+    return xField.ucSize == 0 || (uint32_t)xField.ucOffset + xField.ucSize <= pxHdr->usLineSize;
+}
+
+/**
+ * @brief      Parse the record at the start of the input
+ *
+ * @param      pucData  The input
+ * @param[in]  xSize    Size of the input
+ * @param      pxRec    Returns the record.  axStr must be freed by the caller
+ *
+ * @return     Size of the record, 0 if the input is not a valid record
+ */
+static size_t decode_record(const uint8_t *pucData, size_t xSize, decode_rec_t *pxRec)
+{
+    size_t xPos, xRing;
+    uint32_t ulCap = 0;
+    bool bBigEndian = false;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    bBigEndian = true;
+#endif // __BYTE_ORDER__
+    // Step 1: Check the record header
+    if (xSize < TRACE_BIN_HDR_MIN)
+    {
+        return 0;
+    }
+    // NOTE: A shorter header from before the optional fields were added leaves them 0
+    memset(&pxRec->xHdr, 0, sizeof(pxRec->xHdr));
+    memcpy(&pxRec->xHdr, pucData, TRACE_BIN_HDR_MIN);
+    if (pxRec->xHdr.ulMagic != TRACE_BIN_MAGIC || pxRec->xHdr.usVersion != TRACE_BIN_VERSION ||
+        pxRec->xHdr.usHdrSize < TRACE_BIN_HDR_MIN || pxRec->xHdr.usHdrSize > xSize)
+    {
+        fprintf(stderr, "trace_decode: not a trace record (or byte order differs from host)\n");
+        return 0;
+    }
+    memcpy(&pxRec->xHdr, pucData, (pxRec->xHdr.usHdrSize < sizeof(pxRec->xHdr)) ? pxRec->xHdr.usHdrSize : sizeof(pxRec->xHdr));
+    if (((pxRec->xHdr.ucFlags & TRACE_BIN_BIG_ENDIAN) != 0) != bBigEndian)
+    {
+        fprintf(stderr, "trace_decode: byte order of target differs from host\n");
+        return 0;
+    }
+    // NOTE: The ring is indexed modulo ulDepth, and the fields are read within a trace line
+    if (pxRec->xHdr.ulDepth == 0 || pxRec->xHdr.ulFirst > pxRec->xHdr.ulDepth || pxRec->xHdr.ulValid > pxRec->xHdr.ulDepth ||
+        !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xStamp) || !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xMessage) ||
+        !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xValue) || !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xSeq) ||
+        !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xTid) || !decode_field_valid(&pxRec->xHdr, pxRec->xHdr.xEvent))
+    {
+        fprintf(stderr, "trace_decode: corrupt trace record header\n");
+        return 0;
+    }
+    // Step 2: Locate the raw ring
+    xPos = pxRec->xHdr.usHdrSize;
+    // NOTE: The ring of variable length records is ulDepth bytes
+    xRing = (pxRec->xHdr.ucFlags & TRACE_BIN_RECORDS) ? pxRec->xHdr.ulDepth : (size_t)pxRec->xHdr.ulDepth * pxRec->xHdr.usLineSize;
+    if (xSize - xPos < xRing)
+    {
+        fprintf(stderr, "trace_decode: truncated trace record\n");
+        return 0;
+    }
+    if ((pxRec->xHdr.ucFlags & TRACE_BIN_AGG) && pxRec->xHdr.usLineSize < sizeof(trace_agg_t))
+    {
+        fprintf(stderr, "trace_decode: call sites do not match trace_agg_t\n");
+        return 0;
+    }
+    pxRec->pucRing = &pucData[xPos];
+    xPos += xRing;
+    // Step 3: Parse the string table
+    pxRec->axStr = NULL;
+    pxRec->ulStrs = 0;
+    for (;;)
+    {
+        decode_str_t xStr;
+        if (xSize - xPos < sizeof(uint64_t) + sizeof(uint16_t))
+        {
+            fprintf(stderr, "trace_decode: truncated string table\n");
+            free(pxRec->axStr);
+            return 0;
+        }
+        memcpy(&xStr.ullKey, &pucData[xPos], sizeof(uint64_t));
+        memcpy(&xStr.usLen, &pucData[xPos + sizeof(uint64_t)], sizeof(uint16_t));
+        xPos += sizeof(uint64_t) + sizeof(uint16_t);
+        if (xStr.ullKey == TRACE_BIN_END_KEY)
+        {
+            break;
+        }
+        if (xSize - xPos < xStr.usLen)
+        {
+            fprintf(stderr, "trace_decode: truncated string table\n");
+            free(pxRec->axStr);
+            return 0;
+        }
+        xStr.pcString = (const char *)&pucData[xPos];
+        xPos += xStr.usLen;
+        if (pxRec->ulStrs == ulCap)
+        {
+            ulCap = ulCap ? ulCap * 2 : 64;
+            pxRec->axStr = realloc(pxRec->axStr, ulCap * sizeof(decode_str_t));
+            if (pxRec->axStr == NULL)
+            {
+                return 0;
+            }
+        }
+        pxRec->axStr[pxRec->ulStrs++] = xStr;
+    }
+    return xPos;
+}
+
+/**
+ * @brief      Output a string, escaped for the output format
+ *
+ * @param[in]  eFormat  Output format
+ * @param      pxStr    The string, NULL if unknown
+ * @param[in]  ullKey   Key of the string, shown if the string is unknown
+ */
+static void decode_put_string(format_t eFormat, const decode_str_t *pxStr, uint64_t ullKey)
+{
+    uint16_t usIdx;
+
+    if (pxStr == NULL)
+    {
+        printf((eFormat == FORMAT_TEXT) ? "<0x%llx>" : "\"<0x%llx>\"", (unsigned long long)ullKey);
+        return;
+    }
+    if (eFormat == FORMAT_TEXT)
+    {
+        printf("%.*s", pxStr->usLen, pxStr->pcString);
+        return;
+    }
+    putchar('"');
+    for (usIdx = 0; usIdx < pxStr->usLen; usIdx++)
+    {
+        unsigned char ucChar = pxStr->pcString[usIdx];
+        if (eFormat == FORMAT_CSV)
+        {
+            // CSV escapes a quote by doubling it
+            if (ucChar == '"')
+            {
+                putchar('"');
+            }
+            putchar(ucChar);
+        }
+        else if (ucChar == '"' || ucChar == '\\')
+        {
+            printf("\\%c", ucChar);
+        }
+        else if (ucChar < 0x20)
+        {
+            printf("\\u%04x", ucChar);
+        }
+        else
+        {
+            putchar(ucChar);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief      Gets the mark of trace_dump() for the event type of a trace line
+ *
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ *
+ * @return     The mark
+ */
+static const char *decode_event_mark(uint8_t ucEvent)
+{
+    return (ucEvent == TRACE_EVENT_BEGIN) ? "-> " : (ucEvent == TRACE_EVENT_END) ? "<- " : "";
+}
+
+/**
+ * @brief      Output a trace line as a trace event of FORMAT_CHROME up to its
+ *             arguments, which the caller completes (see trace_export_event)
+ *
+ * @param      pxRec       The record
+ * @param      pxClock     The clock of the record
+ * @param      pucLine     The trace line or record header
+ * @param      pxMessage   The message, NULL if unknown
+ * @param[in]  ullMessage  Key of the message
+ */
+static void decode_put_event(const decode_rec_t *pxRec, decode_clock_t *pxClock, const uint8_t *pucLine, const decode_str_t *pxMessage, uint64_t ullMessage)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    uint8_t ucEvent = (uint8_t)decode_field(pucLine, pxHdr->xEvent);
+    uint32_t ulTid = (uint32_t)decode_field(pucLine, pxHdr->xTid);
+    uint64_t ullNs;
+
+    // NOTE: Without time stamps the events are placed 1 us apart in order
+    ullNs = pxHdr->xStamp.ucSize ? decode_clock_ns(pxClock, decode_field(pucLine, pxHdr->xStamp)) : (uint64_t)gulEvents * 1000ull;
+    printf("%s\n  {\"name\": ", gulEvents ? "," : "");
+    decode_put_string(FORMAT_CHROME, pxMessage, ullMessage);
+    printf(", \"cat\": ");
+    decode_put_string(FORMAT_CHROME, decode_string(pxRec, pxHdr->ullName), pxHdr->ullName);
+    printf(", \"ph\": %s, \"ts\": %llu.%03llu, \"pid\": 1, \"tid\": %u, \"args\": {",
+           (ucEvent == TRACE_EVENT_BEGIN) ? "\"B\"" : (ucEvent == TRACE_EVENT_END) ? "\"E\"" : "\"i\", \"s\": \"t\"",
+           (unsigned long long)(ullNs / 1000ull), (unsigned long long)(ullNs % 1000ull), ulTid ? ulTid : pxHdr->ulTid);
+    gulEvents++;
+}
+
+/**
+ * @brief      Output an argument of a variable length record
+ *
+ * @param[in]  eFormat  Output format
+ * @param      pucArg   The stored argument
+ * @param      pucEnd   End of the record
+ * @param[in]  bPtr64   true - pointers are 64-bit
+ *
+ * @return     The next stored argument, NULL if the argument is truncated
+ */
+static const uint8_t *decode_put_arg(format_t eFormat, const uint8_t *pucArg, const uint8_t *pucEnd, bool bPtr64)
+{
+    union
+    {
+        uint32_t ul;
+        int32_t  l;
+        uint64_t ull;
+        int64_t  ll;
+        double   d;
+    } xVal;
+    uint8_t ucType, ucLen, ucIdx;
+    size_t xSize;
+
+    if (pucArg >= pucEnd)
+    {
+        return NULL;
+    }
+    ucType = *pucArg++;
+    switch (ucType)
+    {
+        case TRACE_ARG_U32:
+        case TRACE_ARG_I32:
+            xSize = sizeof(uint32_t);
+            break;
+        case TRACE_ARG_PTR:
+            xSize = bPtr64 ? sizeof(uint64_t) : sizeof(uint32_t);
+            break;
+        case TRACE_ARG_STR:
+            xSize = (pucArg < pucEnd) ? 1 + *pucArg : 1;
+            break;
+        default:
+            xSize = sizeof(uint64_t);
+            break;
+    }
+    if ((size_t)(pucEnd - pucArg) < xSize)
+    {
+        return NULL;
+    }
+    xVal.ull = 0;
+    switch (ucType)
+    {
+        case TRACE_ARG_U32:
+            memcpy(&xVal.ul, pucArg, xSize);
+            printf((eFormat == FORMAT_JSON) ? "%u" : "0x%08x (%u)", xVal.ul, xVal.ul);
+            break;
+        case TRACE_ARG_I32:
+            memcpy(&xVal.l, pucArg, xSize);
+            printf("%d", xVal.l);
+            break;
+        case TRACE_ARG_I64:
+            memcpy(&xVal.ll, pucArg, xSize);
+            printf("%lld", (long long)xVal.ll);
+            break;
+        case TRACE_ARG_PTR:
+            if (xSize == sizeof(uint32_t))
+            {
+                memcpy(&xVal.ul, pucArg, xSize);
+                xVal.ull = xVal.ul;
+            }
+            else
+            {
+                memcpy(&xVal.ull, pucArg, xSize);
+            }
+            printf((eFormat == FORMAT_JSON) ? "\"0x%llx\"" : "0x%llx", (unsigned long long)xVal.ull);
+            break;
+        case TRACE_ARG_DOUBLE:
+            memcpy(&xVal.d, pucArg, xSize);
+            // NOTE: JSON has no representation of infinity and NaN
+            if (eFormat == FORMAT_JSON && xVal.d - xVal.d != 0)
+            {
+                printf("null");
+            }
+            else
+            {
+                printf((eFormat == FORMAT_JSON) ? "%.17g" : "%g", xVal.d);
+            }
+            break;
+        case TRACE_ARG_STR:
+            ucLen = *pucArg;
+            if (eFormat == FORMAT_JSON)
+            {
+                decode_str_t xStr = { .pcString = (const char *)pucArg + 1, .usLen = ucLen };
+                decode_put_string(eFormat, &xStr, 0);
+            }
+            else
+            {
+                // CSV outputs the arguments in a quoted field, so double the quotes
+                const char *pcQuote = (eFormat == FORMAT_CSV) ? "\"\"" : "\"";
+                printf("%s", pcQuote);
+                for (ucIdx = 0; ucIdx < ucLen; ucIdx++)
+                {
+                    if (pucArg[1 + ucIdx] == '"' && eFormat == FORMAT_CSV)
+                    {
+                        putchar('"');
+                    }
+                    putchar(pucArg[1 + ucIdx]);
+                }
+                printf("%s", pcQuote);
+            }
+            break;
+        default:
+            memcpy(&xVal.ull, pucArg, xSize);
+            printf((eFormat == FORMAT_JSON) ? "%llu" : "0x%016llx (%llu)", (unsigned long long)xVal.ull, (unsigned long long)xVal.ull);
+            break;
+    }
+    return pucArg + xSize;
+}
+
+/**
+ * @brief      Output the variable length records of a TRACE_MODE_ARGS buffer
+ *
+ * @param      pxRec    The record of the trace buffer
+ * @param[in]  eFormat  Output format
+ */
+static void decode_output_records(const decode_rec_t *pxRec, format_t eFormat)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    const decode_str_t *pxName = decode_string(pxRec, pxHdr->ullName);
+    bool bStamp = pxHdr->xStamp.ucSize != 0;
+    bool bPtr64 = (pxHdr->ucFlags & TRACE_BIN_PTR_64) != 0;
+    bool bTid = pxHdr->xTid.ucSize != 0;
+    uint32_t ulOffset = pxHdr->ulFirst, ulLeft = pxHdr->ulValid;
+    bool bFirstLine = true;
+    decode_clock_t xClock;
+
+    decode_clock_start(pxRec, &xClock);
+
+    while (ulLeft && ulOffset < pxHdr->ulDepth)
+    {
+        const uint8_t *pucLine = &pxRec->pucRing[ulOffset];
+        uint32_t ulSlot = ulOffset;
+        uint16_t usSize;
+        uint8_t ucArgs, ucFlags, ucIdx;
+        uint64_t ullMessage, ullStamp;
+        uint32_t ulTid;
+        uint8_t ucEvent;
+        const decode_str_t *pxMessage;
+        const uint8_t *pucArg, *pucEnd;
+
+        if (pxHdr->ulDepth - ulOffset < pxHdr->usLineSize)
+        {
+            break;
+        }
+        memcpy(&usSize, pucLine, sizeof(usSize));
+        ucArgs = pucLine[2];
+        ucFlags = pucLine[3];
+        if (usSize < pxHdr->usLineSize || usSize > ulLeft || usSize > pxHdr->ulDepth - ulOffset)
+        {
+            fprintf(stderr, "trace_decode: corrupt record at offset %u\n", ulOffset);
+            break;
+        }
+        ulLeft -= usSize;
+        ulOffset = (ulOffset + usSize) % pxHdr->ulDepth;
+        // Skip the padding and the records still being written when dumped
+        if (ucArgs == TRACE_REC_PAD || !(ucFlags & TRACE_REC_DONE))
+        {
+            continue;
+        }
+        ullMessage = decode_field(pucLine, pxHdr->xMessage);
+        ullStamp = decode_field(pucLine, pxHdr->xStamp);
+        ulTid = bTid ? (uint32_t)decode_field(pucLine, pxHdr->xTid) : pxHdr->ulTid;
+        ucEvent = (uint8_t)decode_field(pucLine, pxHdr->xEvent);
+        pxMessage = decode_string(pxRec, ullMessage);
+        if (ullMessage == 0 && !(pxHdr->ucFlags & TRACE_BIN_MSG_ID))
+        {
+            continue;
+        }
+        pucArg = &pucLine[pxHdr->usLineSize];
+        pucEnd = &pucLine[usSize];
+        switch (eFormat)
+        {
+            case FORMAT_TEXT:
+                printf("  %6d|", ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                if (bTid)
+                {
+                    printf("%8u|", ulTid);
+                }
+                printf(" %s", decode_event_mark(ucEvent));
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(": ");
+                break;
+            case FORMAT_JSON:
+                printf("%s\n    {\"slot\": %u, ", bFirstLine ? "" : ",", ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                if (bTid)
+                {
+                    printf("\"tid\": %u, \"event\": %u, ", ulTid, ucEvent);
+                }
+                printf("\"message\": ");
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(", \"args\": [");
+                break;
+            case FORMAT_CSV:
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf(",%u,%u,", ulTid, ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                else
+                {
+                    printf(",");
+                }
+                putchar(',');
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(",\"");
+                break;
+            case FORMAT_CHROME:
+                decode_put_event(pxRec, &xClock, pucLine, pxMessage, ullMessage);
+                printf("\"args\": [");
+                break;
+        }
+        for (ucIdx = 0; ucIdx < ucArgs && pucArg; ucIdx++)
+        {
+            if (ucIdx)
+            {
+                printf(", ");
+            }
+            pucArg = decode_put_arg((eFormat == FORMAT_CHROME) ? FORMAT_JSON : eFormat, pucArg, pucEnd, bPtr64);
+        }
+        printf((eFormat == FORMAT_JSON) ? "]}" : (eFormat == FORMAT_CHROME) ? "]}}" : (eFormat == FORMAT_CSV) ? "\"\n" : "\n");
+        bFirstLine = false;
+    }
+}
+
+/**
+ * @brief      Gets the number of used call sites of a TRACE_MODE_AGG record
+ *
+ * @param      pxRec  The record
+ *
+ * @return     Number of call sites with a key
+ */
+static uint32_t decode_agg_sites(const decode_rec_t *pxRec)
+{
+    uint32_t ulIdx, ulSites = 0;
+
+    for (ulIdx = 0; ulIdx < pxRec->xHdr.ulDepth; ulIdx++)
+    {
+        uint64_t ullKey;
+        memcpy(&ullKey, &pxRec->pucRing[(size_t)ulIdx * pxRec->xHdr.usLineSize + offsetof(trace_agg_t, ullKey)], sizeof(ullKey));
+        ulSites += (ullKey != 0);
+    }
+    return ulSites;
+}
+
+/**
+ * @brief      Output the call sites of a TRACE_MODE_AGG record (see trace_dump_agg).
+ *             Their statistics are not trace lines, so CSV and trace events skip them.
+ *
+ * @param      pxRec    The record
+ * @param[in]  eFormat  Output format
+ */
+static void decode_output_agg(const decode_rec_t *pxRec, format_t eFormat)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    const char *pcUnit = "value";
+    uint32_t ulIdx, ulBuckets;
+    bool bFirst = true;
+    uint8_t ucBucket;
+
+    // The histograms count the time stamp differences of a TRACE_MODE_AGG_GAP buffer
+    if (pxHdr->xStamp.ucSize)
+    {
+        pcUnit = (pxHdr->ucFlags & TRACE_BIN_TICK64) ? "gap ns" : "gap ms";
+    }
+    if (eFormat == FORMAT_TEXT)
+    {
+        printf("  %10s|%10s|%10s|%10s| %s\n", "count", "min", "max", "mean", "message");
+    }
+    else if (eFormat != FORMAT_JSON)
+    {
+        return;
+    }
+    for (ulIdx = 0; ulIdx < pxHdr->ulDepth; ulIdx++)
+    {
+        const decode_str_t *pxMessage;
+        trace_agg_t xAgg;
+
+        memcpy(&xAgg, &pxRec->pucRing[(size_t)ulIdx * pxHdr->usLineSize], sizeof(xAgg));
+        if (xAgg.ullKey == 0 || xAgg.ulCount == 0)
+        {
+            continue;
+        }
+        pxMessage = decode_string(pxRec, xAgg.ullKey);
+        if (eFormat == FORMAT_TEXT)
+        {
+            // Like trace_dump(), only print call sites with a valid message
+            if (pxMessage == NULL)
+            {
+                continue;
+            }
+            printf("  %10u|%10u|%10u|%10llu| ", xAgg.ulCount, ~xAgg.ulNotMin, xAgg.ulMax, (unsigned long long)(xAgg.ullSum / xAgg.ulCount));
+            decode_put_string(eFormat, pxMessage, xAgg.ullKey);
+            printf("\n  %10s|", pcUnit);
+        }
+        else
+        {
+            printf("%s\n    {\"slot\": %u, \"message\": ", bFirst ? "" : ",", ulIdx);
+            decode_put_string(eFormat, pxMessage, xAgg.ullKey);
+            printf(", \"count\": %u, \"min\": %u, \"max\": %u, \"sum\": %llu, \"unit\": \"%s\", \"hist\": [",
+                   xAgg.ulCount, ~xAgg.ulNotMin, xAgg.ulMax, (unsigned long long)xAgg.ullSum, pcUnit);
+        }
+        bFirst = false;
+        // Output the lower bound and number of calls of each used bucket
+        for (ucBucket = 0, ulBuckets = 0; ucBucket < TRACE_AGG_BUCKETS; ucBucket++)
+        {
+            uint64_t ullBound = ucBucket ? 1ull << (ucBucket - 1) : 0;
+            if (xAgg.aulHist[ucBucket] == 0)
+            {
+                continue;
+            }
+            if (pxHdr->xStamp.ucSize && (pxHdr->ucFlags & TRACE_BIN_TICK64) && pxHdr->ullTickHz)
+            {
+                ullBound <<= pxHdr->ucTickShift;
+                ullBound = ullBound / pxHdr->ullTickHz * 1000000000ull + ullBound % pxHdr->ullTickHz * 1000000000ull / pxHdr->ullTickHz;
+            }
+            if (eFormat == FORMAT_TEXT)
+            {
+                printf(" %llu:%u", (unsigned long long)ullBound, xAgg.aulHist[ucBucket]);
+            }
+            else
+            {
+                printf("%s[%llu, %u]", ulBuckets++ ? ", " : "", (unsigned long long)ullBound, xAgg.aulHist[ucBucket]);
+            }
+        }
+        printf((eFormat == FORMAT_TEXT) ? "\n" : "]}");
+    }
+}
+
+/**
+ * @brief      Output a record
+ *
+ * @param      pxRec    The record
+ * @param[in]  eFormat  Output format
+ * @param[in]  bFirst   true - first record of the input
+ */
+static void decode_output(const decode_rec_t *pxRec, format_t eFormat, bool bFirst)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    const decode_str_t *pxName = decode_string(pxRec, pxHdr->ullName);
+    bool bStamp = pxHdr->xStamp.ucSize != 0;
+    bool bTid = pxHdr->xTid.ucSize != 0;
+    uint32_t ulIdx;
+    decode_clock_t xClock;
+
+    // Step 1: Output the banner
+    switch (eFormat)
+    {
+        case FORMAT_TEXT:
+            printf("\n====TRACE[");
+            decode_put_string(eFormat, pxName, pxHdr->ullName);
+            if (pxHdr->ucFlags & TRACE_BIN_AGG)
+            {
+                printf("] (total:%d, sites:%d/%d)====  \n", pxHdr->ulCount, decode_agg_sites(pxRec), pxHdr->ulDepth);
+            }
+            else if (pxHdr->ucFlags & TRACE_BIN_RECORDS)
+            {
+                printf("] (total:%d, depth:%d bytes)====  \n", pxHdr->ulCount, pxHdr->ulDepth);
+            }
+            else if (pxHdr->ulTid)
+            {
+                printf("] (total:%d, depth:%d, tid:%u)====  \n", pxHdr->ulCount, pxHdr->ulDepth, pxHdr->ulTid);
+            }
+            else
+            {
+                printf("] (total:%d, depth:%d)====  \n", pxHdr->ulCount, pxHdr->ulDepth);
+            }
+            break;
+        case FORMAT_JSON:
+            printf("%s\n  {\"name\": ", bFirst ? "[" : ",");
+            decode_put_string(eFormat, pxName, pxHdr->ullName);
+            printf(", \"mode\": %u, \"wrap\": %s, \"total\": %u, \"depth\": %u, \"tid\": %u, ",
+                   pxHdr->ucMode, pxHdr->bIsWrap ? "true" : "false", pxHdr->ulCount, pxHdr->ulDepth, pxHdr->ulTid);
+            if (pxHdr->ulTrigger)
+            {
+                // NOTE: Offset of the trace line marked by the trigger from the oldest valid trace line
+                printf("\"trigger\": %u, ", pxHdr->ulTrigger - 1);
+            }
+            printf("\"lines\": [");
+            break;
+        case FORMAT_CSV:
+            if (bFirst)
+            {
+                printf("buffer,tid,slot,stamp,delta,message,value\n");
+            }
+            break;
+        default:
+            break;
+    }
+    // Step 2: Output the valid trace lines in order of oldest to newest
+    if (pxHdr->ucFlags & TRACE_BIN_RECORDS)
+    {
+        decode_output_records(pxRec, eFormat);
+        if (eFormat == FORMAT_JSON)
+        {
+            printf("\n  ]}");
+        }
+        return;
+    }
+    if (pxHdr->ucFlags & TRACE_BIN_AGG)
+    {
+        decode_output_agg(pxRec, eFormat);
+        if (eFormat == FORMAT_JSON)
+        {
+            printf("\n  ]}");
+        }
+        return;
+    }
+    decode_clock_start(pxRec, &xClock);
+    for (ulIdx = 0; ulIdx < pxHdr->ulValid; ulIdx++)
+    {
+        uint32_t ulSlot = (pxHdr->ulFirst + ulIdx) % pxHdr->ulDepth;
+        const uint8_t *pucLine = &pxRec->pucRing[(size_t)ulSlot * pxHdr->usLineSize];
+        uint64_t ullMessage = decode_field(pucLine, pxHdr->xMessage);
+        uint32_t ulValue = (uint32_t)decode_field(pucLine, pxHdr->xValue);
+        uint64_t ullStamp = decode_field(pucLine, pxHdr->xStamp);
+        uint32_t ulTid = bTid ? (uint32_t)decode_field(pucLine, pxHdr->xTid) : pxHdr->ulTid;
+        uint8_t ucEvent = (uint8_t)decode_field(pucLine, pxHdr->xEvent);
+        const decode_str_t *pxMessage = decode_string(pxRec, ullMessage);
+
+        if (eFormat == FORMAT_TEXT && pxHdr->ulTrigger == ulIdx + 1)
+        {
+            printf("  ------ trigger ------\n");
+        }
+        // Skip empty trace lines, which only have a NULL message pointer
+        if (ullMessage == 0 && !(pxHdr->ucFlags & TRACE_BIN_MSG_ID))
+        {
+            continue;
+        }
+        // Skip trace lines that were being written or overwritten when dumped
+        if (pxHdr->xSeq.ucSize && decode_field(pucLine, pxHdr->xSeq) == 0)
+        {
+            continue;
+        }
+        switch (eFormat)
+        {
+            case FORMAT_TEXT:
+                printf("  %6d|", ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                if (bTid)
+                {
+                    printf("%8u|", ulTid);
+                }
+                printf(" %s", decode_event_mark(ucEvent));
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(": 0x%08x (%d)\n", ulValue, ulValue);
+                break;
+            case FORMAT_JSON:
+                printf("%s\n    {\"slot\": %u, ", (ulIdx == 0) ? "" : ",", ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                if (bTid)
+                {
+                    printf("\"tid\": %u, \"event\": %u, ", ulTid, ucEvent);
+                }
+                printf("\"message\": ");
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(", \"value\": %u}", ulValue);
+                break;
+            case FORMAT_CSV:
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf(",%u,%u,", ulTid, ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, ullStamp);
+                }
+                else
+                {
+                    printf(",");
+                }
+                putchar(',');
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(",%u\n", ulValue);
+                break;
+            case FORMAT_CHROME:
+                decode_put_event(pxRec, &xClock, pucLine, pxMessage, ullMessage);
+                printf("\"value\": %u}}", ulValue);
+                break;
+        }
+    }
+    if (eFormat == FORMAT_TEXT && pxHdr->ulTrigger && pxHdr->ulTrigger == pxHdr->ulValid + 1)
+    {
+        printf("  ------ trigger ------\n");
+    }
+    if (eFormat == FORMAT_JSON)
+    {
+        printf("\n  ]}");
+    }
+}
+
+/**
+ * @brief      Check if a trace buffer is selected by the query
+ *
+ * @param      pxName  Name of the trace buffer, NULL if unknown
+ *
+ * @return     true - selected, false - filtered out
+ */
+static bool decode_query_buffer(const decode_str_t *pxName)
+{
+    uint32_t ulIdx;
+
+    if (gxQuery.apcBuf == NULL)
+    {
+        return true;
+    }
+    for (ulIdx = 0; pxName && ulIdx < gxQuery.ulBufs; ulIdx++)
+    {
+        if (strlen(gxQuery.apcBuf[ulIdx]) == pxName->usLen && memcmp(gxQuery.apcBuf[ulIdx], pxName->pcString, pxName->usLen) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief      Check if a message holds the text of the query
+ *
+ * @param      pxStr  The message, NULL if unknown
+ *
+ * @return     true - match, false - no match
+ */
+static bool decode_query_text(const decode_str_t *pxStr)
+{
+    size_t xLen = strlen(gxQuery.pcMatch);
+    size_t xPos;
+
+    for (xPos = 0; pxStr && xPos + xLen <= pxStr->usLen; xPos++)
+    {
+        if (memcmp(&pxStr->pcString[xPos], gxQuery.pcMatch, xLen) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief      Check a trace line against the filters of the query, other than
+ *             the trace buffer and the text of the message
+ *
+ * @param[in]  ullKey   Key of the message
+ * @param[in]  ulValue  Value of the trace line
+ * @param[in]  ulTid    Thread ID of the trace line
+ * @param[in]  bStamp   true - the trace line has a time stamp
+ * @param[in]  ullNs    Time of the trace line [in ns]
+ *
+ * @return     true - match, false - no match
+ */
+static bool decode_query_match(uint64_t ullKey, uint32_t ulValue, uint32_t ulTid, bool bStamp, uint64_t ullNs)
+{
+    // NOTE: A trace line without a time stamp is outside of any window
+    return (!gxQuery.bKey || ullKey == gxQuery.ullKey) &&
+           ulValue >= gxQuery.ullValueMin && ulValue <= gxQuery.ullValueMax &&
+           (!gxQuery.ulTid || ulTid == gxQuery.ulTid) &&
+           (!gxQuery.bTime || (bStamp && ullNs >= gxQuery.ullTimeFrom && ullNs <= gxQuery.ullTimeTo));
+}
+
+/**
+ * @brief      Parse a range of the command line, "min:max", "min:", ":max" or "value"
+ *
+ * @param      pcArg   The range
+ * @param      pullLo  Returns the lower bound, left as is if not given
+ * @param      pullHi  Returns the upper bound, left as is if not given
+ *
+ * @return     true - parsed, false - not a range
+ */
+static bool decode_query_range(const char *pcArg, uint64_t *pullLo, uint64_t *pullHi)
+{
+    const char *pcSep = strchr(pcArg, ':');
+    char *pcEnd;
+
+    if (pcSep == NULL)
+    {
+        *pullLo = *pullHi = strtoull(pcArg, &pcEnd, 0);
+        return pcEnd != pcArg && *pcEnd == '\0';
+    }
+    if (pcSep != pcArg)
+    {
+        *pullLo = strtoull(pcArg, &pcEnd, 0);
+        if (pcEnd != pcSep)
+        {
+            return false;
+        }
+    }
+    if (pcSep[1] != '\0')
+    {
+        *pullHi = strtoull(&pcSep[1], &pcEnd, 0);
+        if (*pcEnd != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Orders the matches of a query by time, then as found
+static int decode_hit_cmp(const void *pvA, const void *pvB)
+{
+    const decode_hit_t *pxA = pvA, *pxB = pvB;
+
+    if (pxA->ullNs != pxB->ullNs)
+    {
+        return (pxA->ullNs < pxB->ullNs) ? -1 : 1;
+    }
+    return (pxA->ulOrder < pxB->ulOrder) ? -1 : (pxA->ulOrder > pxB->ulOrder);
+}
+
+/**
+ * @brief      Collect the trace lines of a binary record that match the query
+ *
+ * @param      pxRec    The record
+ * @param      ppxHit   The matches, grown for the new ones
+ * @param      pulHits  Number of matches
+ *
+ * @return     true - collected, false - out of memory
+ */
+static bool decode_query_collect(const decode_rec_t *pxRec, decode_hit_t **ppxHit, uint32_t *pulHits)
+{
+    const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+    bool bTid = pxHdr->xTid.ucSize != 0;
+    bool *abMatch = NULL;
+    uint32_t ulIdx;
+    decode_clock_t xClock;
+
+    // The text is searched once per message of the string table, not per trace line
+    if (gxQuery.pcMatch)
+    {
+        abMatch = malloc((pxRec->ulStrs + 1) * sizeof(bool));
+        if (abMatch == NULL)
+        {
+            return false;
+        }
+        for (ulIdx = 0; ulIdx < pxRec->ulStrs; ulIdx++)
+        {
+            abMatch[ulIdx] = decode_query_text(&pxRec->axStr[ulIdx]);
+        }
+    }
+    decode_clock_start(pxRec, &xClock);
+    for (ulIdx = 0; ulIdx < pxHdr->ulValid; ulIdx++)
+    {
+        uint32_t ulSlot = (pxHdr->ulFirst + ulIdx) % pxHdr->ulDepth;
+        const uint8_t *pucLine = &pxRec->pucRing[(size_t)ulSlot * pxHdr->usLineSize];
+        uint64_t ullMessage = decode_field(pucLine, pxHdr->xMessage);
+        uint64_t ullNs = 0;
+        const decode_str_t *pxMessage;
+
+        // Skip trace lines that were being written or overwritten when dumped
+        if (pxHdr->xSeq.ucSize && decode_field(pucLine, pxHdr->xSeq) == 0)
+        {
+            continue;
+        }
+        // NOTE: The clock is run over all trace lines, so it keeps track of the ones skipped
+        if (pxHdr->xStamp.ucSize)
+        {
+            ullNs = decode_clock_ns(&xClock, decode_field(pucLine, pxHdr->xStamp));
+        }
+        // Skip empty trace lines, which only have a NULL message pointer
+        if ((ullMessage == 0 && !(pxHdr->ucFlags & TRACE_BIN_MSG_ID)) ||
+            !decode_query_match(ullMessage, (uint32_t)decode_field(pucLine, pxHdr->xValue),
+                                bTid ? (uint32_t)decode_field(pucLine, pxHdr->xTid) : pxHdr->ulTid, pxHdr->xStamp.ucSize != 0, ullNs))
+        {
+            continue;
+        }
+        if (abMatch && ((pxMessage = decode_string(pxRec, ullMessage)) == NULL || !abMatch[pxMessage - pxRec->axStr]))
+        {
+            continue;
+        }
+        if ((*pulHits & (*pulHits - 1)) == 0)
+        {
+            decode_hit_t *axHit = realloc(*ppxHit, (*pulHits ? *pulHits * 2 : 64) * sizeof(decode_hit_t));
+            if (axHit == NULL)
+            {
+                free(abMatch);
+                return false;
+            }
+            *ppxHit = axHit;
+        }
+        (*ppxHit)[*pulHits] = (decode_hit_t){ .ullNs = ullNs, .ulOrder = *pulHits, .ulSlot = ulSlot, .pxRec = pxRec, .pucLine = pucLine };
+        (*pulHits)++;
+    }
+    free(abMatch);
+    return true;
+}
+
+/**
+ * @brief      Output the trace lines of the binary records that match the query,
+ *             merged in order of time.  Without time stamps the trace buffers
+ *             follow one another.  Records and call sites are not merged.
+ *
+ * @param      axRec    The records
+ * @param[in]  ulRecs   Number of records
+ * @param[in]  eFormat  Output format
+ * @param      pbFirst  true - nothing output yet, cleared once something is
+ *
+ * @return     true - output, false - out of memory
+ */
+static bool decode_query(const decode_rec_t *axRec, uint32_t ulRecs, format_t eFormat, bool *pbFirst)
+{
+    decode_hit_t *axHit = NULL;
+    uint32_t ulHits = 0, ulRings = 0, ulIdx;
+    int iNameLen = 0;
+    bool bTid = false;
+    decode_clock_t xClock;
+
+    // Step 1: Collect the matches of the selected trace buffers
+    for (ulIdx = 0; ulIdx < ulRecs; ulIdx++)
+    {
+        const trace_bin_hdr_t *pxHdr = &axRec[ulIdx].xHdr;
+        const decode_str_t *pxName = decode_string(&axRec[ulIdx], pxHdr->ullName);
+
+        if ((pxHdr->ucFlags & (TRACE_BIN_RECORDS | TRACE_BIN_AGG)) || !decode_query_buffer(pxName))
+        {
+            continue;
+        }
+        if (!decode_query_collect(&axRec[ulIdx], &axHit, &ulHits))
+        {
+            free(axHit);
+            return false;
+        }
+        ulRings++;
+        bTid |= pxHdr->xTid.ucSize != 0 || pxHdr->ulTid != 0;
+        if (pxName && pxName->usLen > iNameLen)
+        {
+            iNameLen = pxName->usLen;
+        }
+    }
+    // Step 2: Merge them in order of time, the oldest first
+    qsort(axHit, ulHits, sizeof(decode_hit_t), decode_hit_cmp);
+    if (gxQuery.ullMax && ulHits > gxQuery.ullMax - gxQuery.ullLines)
+    {
+        ulHits = (uint32_t)(gxQuery.ullMax - gxQuery.ullLines);
+    }
+    gxQuery.ullLines += ulHits;
+    // Step 3: Format only the matches
+    if (eFormat == FORMAT_TEXT)
+    {
+        printf("\n====TRACE QUERY (rings:%u)====  \n", ulRings);
+    }
+    else if (eFormat == FORMAT_CSV && *pbFirst && ulHits)
+    {
+        printf("buffer,tid,slot,stamp,delta,message,value\n");
+    }
+    // NOTE: The time of a match is already in ns, or ms without TRACE_BIN_TICK64
+    memset(&xClock, 0, sizeof(xClock));
+    for (ulIdx = 0; ulIdx < ulHits; ulIdx++)
+    {
+        const decode_rec_t *pxRec = axHit[ulIdx].pxRec;
+        const trace_bin_hdr_t *pxHdr = &pxRec->xHdr;
+        const uint8_t *pucLine = axHit[ulIdx].pucLine;
+        const decode_str_t *pxName = decode_string(pxRec, pxHdr->ullName);
+        uint64_t ullMessage = decode_field(pucLine, pxHdr->xMessage);
+        const decode_str_t *pxMessage = decode_string(pxRec, ullMessage);
+        uint32_t ulValue = (uint32_t)decode_field(pucLine, pxHdr->xValue);
+        uint32_t ulTid = pxHdr->xTid.ucSize ? (uint32_t)decode_field(pucLine, pxHdr->xTid) : pxHdr->ulTid;
+        uint8_t ucEvent = (uint8_t)decode_field(pucLine, pxHdr->xEvent);
+        bool bStamp = pxHdr->xStamp.ucSize != 0;
+        uint64_t ullNs = axHit[ulIdx].ullNs;
+
+        xClock.ullHz = ((pxHdr->ucFlags & TRACE_BIN_TICK64) && pxHdr->ullTickHz) ? 1000000000ull : 0;
+        switch (eFormat)
+        {
+            case FORMAT_TEXT:
+                printf("  ");
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf("%*s|", pxName ? iNameLen - pxName->usLen : 0, "");
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, xClock.ullHz ? ullNs : ullNs / 1000000ull);
+                }
+                if (bTid)
+                {
+                    printf("%8u|", ulTid);
+                }
+                printf(" %s", decode_event_mark(ucEvent));
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(": 0x%08x (%d)\n", ulValue, ulValue);
+                break;
+            case FORMAT_JSON:
+                printf("%s\n  {\"buffer\": ", *pbFirst ? "[" : ",");
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf(", \"slot\": %u, ", axHit[ulIdx].ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, xClock.ullHz ? ullNs : ullNs / 1000000ull);
+                }
+                if (bTid)
+                {
+                    printf("\"tid\": %u, \"event\": %u, ", ulTid, ucEvent);
+                }
+                printf("\"message\": ");
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(", \"value\": %u}", ulValue);
+                break;
+            case FORMAT_CSV:
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf(",%u,%u,", ulTid, axHit[ulIdx].ulSlot);
+                if (bStamp)
+                {
+                    decode_put_stamp(eFormat, &xClock, xClock.ullHz ? ullNs : ullNs / 1000000ull);
+                }
+                else
+                {
+                    printf(",");
+                }
+                putchar(',');
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(",%u\n", ulValue);
+                break;
+            case FORMAT_CHROME:
+                // NOTE: Without time stamps the events are placed 1 us apart in order
+                if (!bStamp)
+                {
+                    ullNs = (uint64_t)gulEvents * 1000ull;
+                }
+                printf("%s\n  {\"name\": ", gulEvents ? "," : "");
+                decode_put_string(eFormat, pxMessage, ullMessage);
+                printf(", \"cat\": ");
+                decode_put_string(eFormat, pxName, pxHdr->ullName);
+                printf(", \"ph\": %s, \"ts\": %llu.%03llu, \"pid\": 1, \"tid\": %u, \"args\": {\"value\": %u}}",
+                       (ucEvent == TRACE_EVENT_BEGIN) ? "\"B\"" : (ucEvent == TRACE_EVENT_END) ? "\"E\"" : "\"i\", \"s\": \"t\"",
+                       (unsigned long long)(ullNs / 1000ull), (unsigned long long)(ullNs % 1000ull), ulTid, ulValue);
+                gulEvents++;
+                break;
+        }
+        *pbFirst = false;
+    }
+    free(axHit);
+    return true;
+}
+
+/**
+ * @brief      Read an unsigned LEB128 varint of a drain file
+ *
+ * @param      ppucData  The input, advanced past the varint
+ * @param      pucEnd    End of the input
+ * @param      pullValue Returns the value
+ *
+ * @return     true - read, false - truncated
+ */
+static bool decode_varint(const uint8_t **ppucData, const uint8_t *pucEnd, uint64_t *pullValue)
+{
+    const uint8_t *pucData = *ppucData;
+    uint64_t ullValue = 0;
+    int iShift;
+
+    for (iShift = 0; pucData < pucEnd && iShift < 64; iShift += 7)
+    {
+        uint8_t ucByte = *pucData++;
+        ullValue |= (uint64_t)(ucByte & 0x7F) << iShift;
+        if (!(ucByte & 0x80))
+        {
+            *ppucData = pucData;
+            *pullValue = ullValue;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief      Read the length and characters of a string of a drain file
+ *
+ * @param      ppucData  The input, advanced past the string
+ * @param      pucEnd    End of the input
+ * @param      pxStr     Returns the string, which points into the input
+ *
+ * @return     true - read, false - truncated
+ */
+static bool decode_drain_text(const uint8_t **ppucData, const uint8_t *pucEnd, decode_str_t *pxStr)
+{
+    uint64_t ullLen;
+
+    if (!decode_varint(ppucData, pucEnd, &ullLen) || ullLen > UINT16_MAX || ullLen > (uint64_t)(pucEnd - *ppucData))
+    {
+        return false;
+    }
+    pxStr->pcString = (const char *)*ppucData;
+    pxStr->usLen = (uint16_t)ullLen;
+    *ppucData += ullLen;
+    return true;
+}
+
+/**
+ * @brief      Gets a trace buffer of a drain file, growing the table for a new id
+ *
+ * @param      pxDrain  The drain file
+ * @param[in]  ullId    Id of the trace buffer
+ *
+ * @return     The trace buffer, NULL if out of memory
+ */
+static decode_drain_buf_t *decode_drain_buf(decode_drain_t *pxDrain, uint64_t ullId)
+{
+    if (ullId >= UINT16_MAX)
+    {
+        return NULL;
+    }
+    if (ullId >= pxDrain->ulBufs)
+    {
+        uint32_t ulBufs = (uint32_t)ullId + 1;
+        decode_drain_buf_t *axBuf = realloc(pxDrain->axBuf, ulBufs * sizeof(decode_drain_buf_t));
+        if (axBuf == NULL)
+        {
+            return NULL;
+        }
+        memset(&axBuf[pxDrain->ulBufs], 0, (ulBufs - pxDrain->ulBufs) * sizeof(decode_drain_buf_t));
+        pxDrain->axBuf = axBuf;
+        pxDrain->ulBufs = ulBufs;
+    }
+    return &pxDrain->axBuf[ullId];
+}
+
+/**
+ * @brief      Output a trace line of a drain file
+ *
+ * @param      pxDrain    The drain file
+ * @param[in]  eFormat    Output format
+ * @param      pxBuf      The trace buffer
+ * @param      pxMessage  The message, NULL if unknown
+ * @param[in]  ullIdx     Index of the message
+ * @param[in]  ulValue    Value of the trace line
+ * @param[in]  ulTid      Thread ID of the trace line
+ * @param[in]  ucEvent    One of TRACE_EVENT_xxx
+ * @param[in]  bFirst     true - first output of the decoder
+ */
+static void decode_drain_line(decode_drain_t *pxDrain, format_t eFormat, decode_drain_buf_t *pxBuf, const decode_str_t *pxMessage,
+                              uint64_t ullIdx, uint32_t ulValue, uint32_t ulTid, uint8_t ucEvent, bool bFirst)
+{
+    const trace_drain_hdr_t *pxHdr = &pxDrain->xHdr;
+    bool bStamp = pxHdr->ucStampSize != 0;
+    bool bTid = (pxHdr->ucFlags & TRACE_BIN_SPANS) || ulTid;
+    // NOTE: A compact time stamp is extended to (tick >> ucTickShift)
+    uint64_t ullStamp = (pxBuf->xClock.ullHz && pxHdr->ucStampSize == sizeof(uint32_t)) ? pxBuf->ullStamp << pxHdr->ucTickShift : pxBuf->ullStamp;
+    uint64_t ullNs;
+
+    switch (eFormat)
+    {
+        case FORMAT_TEXT:
+            printf("  ");
+            decode_put_string(eFormat, &pxBuf->xName, 0);
+            printf("|");
+            if (bStamp)
+            {
+                decode_put_stamp(eFormat, &pxBuf->xClock, ullStamp);
+            }
+            if (bTid)
+            {
+                printf("%8u|", ulTid);
+            }
+            printf(" %s", decode_event_mark(ucEvent));
+            decode_put_string(eFormat, pxMessage, ullIdx);
+            printf(": 0x%08x (%d)\n", ulValue, ulValue);
+            break;
+        case FORMAT_JSON:
+            printf("%s\n  {\"buffer\": ", bFirst ? "[" : ",");
+            decode_put_string(eFormat, &pxBuf->xName, 0);
+            printf(", ");
+            if (bStamp)
+            {
+                decode_put_stamp(eFormat, &pxBuf->xClock, ullStamp);
+            }
+            if (bTid)
+            {
+                printf("\"tid\": %u, \"event\": %u, ", ulTid, ucEvent);
+            }
+            printf("\"message\": ");
+            decode_put_string(eFormat, pxMessage, ullIdx);
+            printf(", \"value\": %u}", ulValue);
+            break;
+        case FORMAT_CSV:
+            if (bFirst)
+            {
+                printf("buffer,tid,slot,stamp,delta,message,value\n");
+            }
+            decode_put_string(eFormat, &pxBuf->xName, 0);
+            printf(",%u,,", ulTid);
+            if (bStamp)
+            {
+                decode_put_stamp(eFormat, &pxBuf->xClock, ullStamp);
+            }
+            else
+            {
+                printf(",");
+            }
+            putchar(',');
+            decode_put_string(eFormat, pxMessage, ullIdx);
+            printf(",%u\n", ulValue);
+            break;
+        case FORMAT_CHROME:
+            // NOTE: Without time stamps the events are placed 1 us apart in order
+            ullNs = (bStamp && pxBuf->xClock.ullHz) ? decode_clock_ns(&pxBuf->xClock, ullStamp) :
+                    bStamp ? (uint64_t)(uint32_t)ullStamp * 1000000ull : (uint64_t)gulEvents * 1000ull;
+            printf("%s\n  {\"name\": ", gulEvents ? "," : "");
+            decode_put_string(eFormat, pxMessage, ullIdx);
+            printf(", \"cat\": ");
+            decode_put_string(eFormat, &pxBuf->xName, 0);
+            printf(", \"ph\": %s, \"ts\": %llu.%03llu, \"pid\": %u, \"tid\": %u, \"args\": {\"value\": %u}}",
+                   (ucEvent == TRACE_EVENT_BEGIN) ? "\"B\"" : (ucEvent == TRACE_EVENT_END) ? "\"E\"" : "\"i\", \"s\": \"t\"",
+                   (unsigned long long)(ullNs / 1000ull), (unsigned long long)(ullNs % 1000ull), pxHdr->ulPid, ulTid, ulValue);
+            gulEvents++;
+            break;
+    }
+}
+
+/**
+ * @brief      Check a trace line of a drain file against the query, and count it
+ *             if it matches
+ *
+ * @param      pxDrain    The drain file
+ * @param      pxBuf      The trace buffer
+ * @param      pxMessage  The message, NULL if unknown
+ * @param[in]  ulValue    Value of the trace line
+ * @param[in]  ulTid      Thread ID of the trace line
+ *
+ * @return     true - match, false - no match
+ */
+static bool decode_drain_match(decode_drain_t *pxDrain, decode_drain_buf_t *pxBuf, const decode_str_t *pxMessage, uint32_t ulValue, uint32_t ulTid)
+{
+    const trace_drain_hdr_t *pxHdr = &pxDrain->xHdr;
+    uint64_t ullStamp = (pxBuf->xClock.ullHz && pxHdr->ucStampSize == sizeof(uint32_t)) ? pxBuf->ullStamp << pxHdr->ucTickShift : pxBuf->ullStamp;
+    uint64_t ullNs = pxBuf->xClock.ullHz ? decode_clock_ns(&pxBuf->xClock, ullStamp) : (uint64_t)(uint32_t)ullStamp * 1000000ull;
+
+    // NOTE: A drain file refers to a message by its index in the file, so -i doesn't apply
+    if ((gxQuery.ullMax && gxQuery.ullLines >= gxQuery.ullMax) || !decode_query_buffer(&pxBuf->xName) ||
+        !decode_query_match(gxQuery.bKey ? gxQuery.ullKey : 0, ulValue, ulTid, pxHdr->ucStampSize != 0, ullNs) ||
+        (gxQuery.pcMatch && !decode_query_text(pxMessage)))
+    {
+        return false;
+    }
+    gxQuery.ullLines++;
+    return true;
+}
+
+/**
+ * @brief      Gets the size of a drain file, up to the header of the next file
+ *             in order of the same process if the files are catenated
+ *
+ * @param      pucData  The input, starting with the file header
+ * @param[in]  xSize    Size of the input
+ *
+ * @return     Size of the file
+ */
+static size_t decode_drain_size(const uint8_t *pucData, size_t xSize)
+{
+    trace_drain_hdr_t xHdr, xNext;
+    size_t xPos;
+
+    memcpy(&xHdr, pucData, sizeof(xHdr));
+    for (xPos = xHdr.usHdrSize; xSize - xPos >= sizeof(xNext); xPos++)
+    {
+        // NOTE: A message may hold the magic, so the header must follow on
+        if (pucData[xPos] == (uint8_t)TRACE_DRAIN_MAGIC || pucData[xPos] == (uint8_t)(TRACE_DRAIN_MAGIC >> 24))
+        {
+            memcpy(&xNext, &pucData[xPos], sizeof(xNext));
+            if (xNext.ulMagic == TRACE_DRAIN_MAGIC && xNext.usVersion == TRACE_DRAIN_VERSION &&
+                xNext.ulPid == xHdr.ulPid && xNext.ulFile == xHdr.ulFile + 1)
+            {
+                return xPos;
+            }
+        }
+    }
+    return xSize;
+}
+
+/**
+ * @brief      Decode and output a drain file
+ *
+ * @param      pucData  The input, starting with the file header
+ * @param[in]  xSize    Size of the input
+ * @param[in]  eFormat  Output format
+ * @param      pbFirst  true - nothing output yet, cleared once something is
+ *
+ * @return     Size of the file, up to the header of the next file, 0 if the input is not valid
+ */
+static size_t decode_drain(const uint8_t *pucData, size_t xSize, format_t eFormat, bool *pbFirst)
+{
+    const uint8_t *pucPos, *pucEnd = pucData + xSize;
+    decode_drain_t xDrain;
+    bool bBigEndian = false, bTruncated = false;
+    uint64_t ullTag;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    bBigEndian = true;
+#endif // __BYTE_ORDER__
+    // Step 1: Check the file header
+    memset(&xDrain, 0, sizeof(xDrain));
+    if (xSize < sizeof(xDrain.xHdr))
+    {
+        fprintf(stderr, "trace_decode: truncated drain file\n");
+        return 0;
+    }
+    memcpy(&xDrain.xHdr, pucData, sizeof(xDrain.xHdr));
+    if (xDrain.xHdr.usVersion != TRACE_DRAIN_VERSION || xDrain.xHdr.usHdrSize < sizeof(xDrain.xHdr) || xDrain.xHdr.usHdrSize > xSize)
+    {
+        fprintf(stderr, "trace_decode: not a drain file\n");
+        return 0;
+    }
+    if (((xDrain.xHdr.ucFlags & TRACE_BIN_BIG_ENDIAN) != 0) != bBigEndian)
+    {
+        fprintf(stderr, "trace_decode: byte order of target differs from host\n");
+        return 0;
+    }
+    if (eFormat == FORMAT_TEXT)
+    {
+        time_t xStart = (time_t)xDrain.xHdr.ullStartTime;
+        char acStart[32];
+        strftime(acStart, sizeof(acStart), "%Y-%m-%d %H:%M:%S", localtime(&xStart));
+        printf("\n====TRACE DRAIN[file %u] (pid:%u, start:%s)====  \n", xDrain.xHdr.ulFile, xDrain.xHdr.ulPid, acStart);
+    }
+    pucEnd = pucData + decode_drain_size(pucData, xSize);
+    // Step 2: Decode the entries up to the header of the next file
+    for (pucPos = pucData + xDrain.xHdr.usHdrSize; pucPos < pucEnd; )
+    {
+        uint64_t ullId, ullIdx, ullValue, ullTid = 0, ullEvent = TRACE_EVENT_INSTANT;
+        decode_drain_buf_t *pxBuf;
+        decode_str_t xStr;
+
+        ullTag = *pucPos++;
+        if (!decode_varint(&pucPos, pucEnd, &ullId) || (pxBuf = decode_drain_buf(&xDrain, ullId)) == NULL)
+        {
+            bTruncated = true;
+            break;
+        }
+        if (ullTag == TRACE_DRAIN_BUF)
+        {
+            if (!decode_varint(&pucPos, pucEnd, &ullTid) || !decode_drain_text(&pucPos, pucEnd, &xStr))
+            {
+                bTruncated = true;
+                break;
+            }
+            pxBuf->xName = xStr;
+            pxBuf->ulTid = (uint32_t)ullTid;
+            pxBuf->ullStamp = xDrain.xHdr.ullStampBase;
+            if (xDrain.xHdr.ucFlags & TRACE_BIN_TICK64)
+            {
+                pxBuf->xClock.ullHz = xDrain.xHdr.ullTickHz;
+            }
+            else
+            {
+                // NOTE: The first delta of a tick in ms is from the start of the file
+                pxBuf->xClock.ullLast = (uint32_t)xDrain.xHdr.ullStampBase;
+            }
+        }
+        else if (ullTag == TRACE_DRAIN_STR)
+        {
+            // NOTE: The id field of a message is its index
+            if (!decode_drain_text(&pucPos, pucEnd, &xStr))
+            {
+                bTruncated = true;
+                break;
+            }
+            xStr.ullKey = ullId;
+            if (ullId >= xDrain.ulStrs)
+            {
+                decode_str_t *axStr = realloc(xDrain.axStr, (ullId + 1) * sizeof(decode_str_t));
+                if (axStr == NULL)
+                {
+                    bTruncated = true;
+                    break;
+                }
+                memset(&axStr[xDrain.ulStrs], 0, (ullId + 1 - xDrain.ulStrs) * sizeof(decode_str_t));
+                xDrain.axStr = axStr;
+                xDrain.ulStrs = (uint32_t)ullId + 1;
+            }
+            xDrain.axStr[ullId] = xStr;
+        }
+        else if (ullTag == TRACE_DRAIN_LINE)
+        {
+            uint64_t ullDelta;
+            if (!decode_varint(&pucPos, pucEnd, &ullDelta) || !decode_varint(&pucPos, pucEnd, &ullIdx) ||
+                !decode_varint(&pucPos, pucEnd, &ullValue) ||
+                ((xDrain.xHdr.ucFlags & TRACE_BIN_SPANS) &&
+                 (!decode_varint(&pucPos, pucEnd, &ullTid) || !decode_varint(&pucPos, pucEnd, &ullEvent))))
+            {
+                bTruncated = true;
+                break;
+            }
+            // The zigzag encoded difference to the previous time stamp of the trace buffer
+            pxBuf->ullStamp += (uint64_t)((int64_t)(ullDelta >> 1) ^ -(int64_t)(ullDelta & 1));
+            if (!(xDrain.xHdr.ucFlags & TRACE_BIN_SPANS))
+            {
+                ullTid = pxBuf->ulTid;
+            }
+            if (gxQuery.bQuery && !decode_drain_match(&xDrain, pxBuf, (ullIdx < xDrain.ulStrs) ? &xDrain.axStr[ullIdx] : NULL,
+                                                      (uint32_t)ullValue, (uint32_t)ullTid))
+            {
+                continue;
+            }
+            decode_drain_line(&xDrain, eFormat, pxBuf, (ullIdx < xDrain.ulStrs) ? &xDrain.axStr[ullIdx] : NULL, ullIdx,
+                              (uint32_t)ullValue, (uint32_t)ullTid, (uint8_t)ullEvent, *pbFirst);
+            *pbFirst = false;
+        }
+        else if (ullTag == TRACE_DRAIN_LOST)
+        {
+            if (!decode_varint(&pucPos, pucEnd, &ullValue))
+            {
+                bTruncated = true;
+                break;
+            }
+            if (gxQuery.bQuery && !decode_query_buffer(&pxBuf->xName))
+            {
+                continue;
+            }
+            if (eFormat == FORMAT_TEXT)
+            {
+                printf("  ------ ");
+                decode_put_string(eFormat, &pxBuf->xName, 0);
+                printf(": %llu lost ------\n", (unsigned long long)ullValue);
+            }
+            else
+            {
+                fprintf(stderr, "trace_decode: %.*s: %llu trace lines lost\n", pxBuf->xName.usLen, pxBuf->xName.pcString,
+                        (unsigned long long)ullValue);
+            }
+        }
+        else
+        {
+            bTruncated = true;
+            break;
+        }
+    }
+    // NOTE: The last entry of a file still being written, or of a process that crashed, may be
+    //       cut short.  Decoding goes on with the next file
+    if (bTruncated)
+    {
+        fprintf(stderr, "trace_decode: truncated or corrupt drain file %u\n", xDrain.xHdr.ulFile);
+    }
+    free(xDrain.axStr);
+    free(xDrain.axBuf);
+    return pucEnd - pucData;
+}
+
+/********************* Exported Functions ********************/
+int main(int argc, char *argv[])
+{
+    format_t eFormat = FORMAT_TEXT;
+    FILE *pxFile = stdin;
+    uint8_t *pucData;
+    size_t xSize, xPos = 0;
+    bool bFirst = true, bArg = true;
+    decode_rec_t *axRec = NULL;     // Query: the binary records to merge
+    uint32_t ulRecs = 0, ulIdx;
+    int iOpt;
+    char *pcEnd;
+
+    while ((iOpt = getopt(argc, argv, "tjcpqb:s:i:v:w:T:n:")) != -1)
+    {
+        switch (iOpt)
+        {
+            case 't': eFormat = FORMAT_TEXT; break;
+            case 'j': eFormat = FORMAT_JSON; break;
+            case 'c': eFormat = FORMAT_CSV; break;
+            case 'p': eFormat = FORMAT_CHROME; break;
+            case 'q': break;
+            case 'b':
+                if (gxQuery.apcBuf == NULL && (gxQuery.apcBuf = calloc(argc, sizeof(char *))) == NULL)
+                {
+                    fprintf(stderr, "trace_decode: out of memory\n");
+                    return 1;
+                }
+                gxQuery.apcBuf[gxQuery.ulBufs++] = optarg;
+                break;
+            case 's': gxQuery.pcMatch = optarg; break;
+            case 'i':
+                gxQuery.bKey = true;
+                gxQuery.ullKey = strtoull(optarg, &pcEnd, 0);
+                bArg = pcEnd != optarg && *pcEnd == '\0';
+                break;
+            case 'v': bArg = decode_query_range(optarg, &gxQuery.ullValueMin, &gxQuery.ullValueMax); break;
+            case 'w':
+                gxQuery.bTime = true;
+                gxQuery.ullTimeTo = UINT64_MAX;
+                bArg = decode_query_range(optarg, &gxQuery.ullTimeFrom, &gxQuery.ullTimeTo);
+                break;
+            case 'T':
+                gxQuery.ulTid = (uint32_t)strtoul(optarg, &pcEnd, 0);
+                bArg = pcEnd != optarg && *pcEnd == '\0';
+                break;
+            case 'n':
+                gxQuery.ullMax = strtoull(optarg, &pcEnd, 0);
+                bArg = pcEnd != optarg && *pcEnd == '\0';
+                break;
+            default:
+                bArg = false;
+                break;
+        }
+        if (!bArg)
+        {
+            fprintf(stderr, "Usage: %s [-t | -j | -c | -p] [-q] [-b name] [-s text] [-i id] [-v min:max] [-w from:to] "
+                            "[-T tid] [-n max] [file]\n", argv[0]);
+            return 1;
+        }
+        gxQuery.bQuery |= iOpt != 't' && iOpt != 'j' && iOpt != 'c' && iOpt != 'p';
+    }
+    if (optind < argc && (pxFile = fopen(argv[optind], "rb")) == NULL)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    pucData = decode_read(pxFile, &xSize);
+    if (pucData == NULL)
+    {
+        fprintf(stderr, "trace_decode: out of memory\n");
+        return 1;
+    }
+    if (eFormat == FORMAT_CHROME)
+    {
+        printf("{\"traceEvents\": [");
+    }
+    // Decode the records one after another
+    while (xPos < xSize)
+    {
+        decode_rec_t xRec;
+        size_t xRecSize;
+        uint32_t ulMagic = 0;
+
+        // A drain file is decoded as a whole
+        memcpy(&ulMagic, &pucData[xPos], (xSize - xPos < sizeof(ulMagic)) ? xSize - xPos : sizeof(ulMagic));
+        if (ulMagic == TRACE_DRAIN_MAGIC)
+        {
+            xRecSize = decode_drain(&pucData[xPos], xSize - xPos, eFormat, &bFirst);
+            if (xRecSize == 0)
+            {
+                free(pucData);
+                return 1;
+            }
+            xPos += xRecSize;
+            continue;
+        }
+        xRecSize = decode_record(&pucData[xPos], xSize - xPos, &xRec);
+        if (xRecSize == 0)
+        {
+            free(pucData);
+            return 1;
+        }
+        xPos += xRecSize;
+        // A query merges the records once all of them are read
+        if (gxQuery.bQuery)
+        {
+            decode_rec_t *axNew = realloc(axRec, (ulRecs + 1) * sizeof(decode_rec_t));
+            if (axNew == NULL)
+            {
+                fprintf(stderr, "trace_decode: out of memory\n");
+                free(xRec.axStr);
+                break;
+            }
+            axRec = axNew;
+            axRec[ulRecs++] = xRec;
+            continue;
+        }
+        decode_output(&xRec, eFormat, bFirst);
+        free(xRec.axStr);
+        bFirst = false;
+    }
+    if (gxQuery.bQuery && ulRecs && !decode_query(axRec, ulRecs, eFormat, &bFirst))
+    {
+        fprintf(stderr, "trace_decode: out of memory\n");
+    }
+    for (ulIdx = 0; ulIdx < ulRecs; ulIdx++)
+    {
+        free(axRec[ulIdx].axStr);
+    }
+    free(axRec);
+    free(gxQuery.apcBuf);
+    if (eFormat == FORMAT_JSON)
+    {
+        printf(bFirst ? "[]\n" : "\n]\n");
+    }
+    else if (eFormat == FORMAT_CHROME)
+    {
+        printf("\n], \"displayTimeUnit\": \"ns\"}\n");
+    }
+    free(pucData);
+    return 0;
+}
@@ -0,0 +1,765 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Live reader of the trace buffers of another process built with TRACE_USE_SHM.
+ * Attaches read-only to the shared memory segment of the process and tails the
+ * new trace lines of each trace buffer in the text format of trace_dump(), so
+ * the process only pays for storing its traces.  The target does not take part:
+ * the trace lines are followed by the free running index of each trace buffer,
+ * and checked against their sequence numbers with TRACE_USE_SLOT_SEQ.
+ *
+ * The file of a session of TRACE_USE_PERSIST is read the same way.  Once its
+ * process ended, e.g. it crashed, the trace lines left in the file are output
+ * and the ones torn by the end of the process are discarded.
+ *
+ * Usage: trace_reader [-1] [-i <ms>] [-n <nice>] <pid | segment name | file>
+ *   -1  Output the trace lines in the trace buffers once and exit
+ *   -i  Poll interval [in ms] (default 100)
+ *   -n  Niceness of the reader (default 19, the lowest priority)
+ *   Exits once the target exits, after its last trace lines
+ *
+ * Message strings of the target are read from the segment with TRACE_USE_MSG_ID.
+ * Otherwise they are read from the target with process_vm_readv(), or, without
+ * ptrace access, from the file mapped at the message pointer (e.g. the .rodata
+ * of the executable).  Once the target ended, they are read from its executable
+ * (64-bit ELF), relocated by the address it was loaded at.  Without
+ * TRACE_USE_SLOT_SEQ a trace line is only output a poll interval after it was
+ * claimed, when its writer is assumed to be done.
+ */
+/********************* System Headers ************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <elf.h>
+
+/********************* Local Headers *************************/
+#include "trace_bin.h"
+
+/*********************** Constants ***************************/
+#define READER_SHM_NAME         "/trace.%u"     // TRACE_SHM_NAME of trace.h
+#define READER_NAME_MAX         64              // Maximum length of the name of a segment
+#define READER_MSG_MAX          256             // Maximum length of a message string read from the target
+#define READER_CACHE            4096            // Number of message strings cached, a power of two
+#define READER_ATTACH_MS        1000            // Time to wait for the target to set up the segment [in ms]
+#define READER_PAGE             4096            // process_vm_readv() is done a page at a time
+
+// Sequence number of a trace line of the free running index, skipping 0 at the 32-bit wrap (TRACE_SEQ() of trace.h)
+#define READER_SEQ(ullIdx)      ((uint32_t)(ullIdx) + 1 ? (uint32_t)(ullIdx) + 1 : 1)
+
+/*********************** Typedefs ****************************/
+// Reader state of a trace buffer
+typedef struct
+{
+    const trace_shm_buf_t *pxDesc;  // Descriptor of the trace buffer
+    const uint8_t *pucTrace;        // The trace_t of the trace buffer
+    const uint8_t *pucRing;         // The ring
+    const char *pcName;             // Name of the trace buffer
+    uint64_t ullNext;               // Free running index of the next trace line to output
+    uint64_t ullSettled;            // Without sequence numbers: index of the previous poll, the trace lines before it are complete
+    uint32_t ulLost;                // Number of trace lines overwritten before they were output
+    uint32_t ulTorn;                // Number of trace lines left incomplete by the end of the target
+    bool     bStarted;              // true - a trace line was output, the clock is running
+    uint32_t ulLastStamp;           // Time stamp of the last trace line output
+    uint64_t ullTick;               // Tick of the last trace line output
+    uint64_t ullLastNs;             // Time of the last trace line output [in ns]
+} reader_buf_t;
+
+// Cached message string of the target
+typedef struct
+{
+    uint64_t ullPtr;                // Message pointer, 0 - unused
+    char *   pcString;              // The string, NULL - could not be read
+} reader_str_t;
+
+/********************* Global Variables **********************/
+static const trace_shm_hdr_t *gpxHdr = NULL;    // The segment
+static pid_t gxPid = 0;                         // Process ID of the target
+static int gfdFile = -1;                        // File of TRACE_USE_PERSIST, -1 - shared memory segment
+static bool gbEnded = false;                    // true - the target ended
+static reader_str_t gaxCache[READER_CACHE];     // Message strings read from the target
+
+/********************* Local Functions ***********************/
+/**
+ * @brief      Atomically read a field of the target
+ *
+ * @param      pucBase  Start of the trace line or trace_t
+ * @param[in]  xField   Location of the field
+ *
+ * @return     Value of the field, 0 if not present
+ */
+static uint64_t reader_load(const uint8_t *pucBase, trace_bin_field_t xField)
+{
+    const void *pvField = &pucBase[xField.ucOffset];
+    switch (xField.ucSize)
+    {
+        case 1: return __atomic_load_n((const uint8_t *)pvField, __ATOMIC_ACQUIRE);
+        case 2: return __atomic_load_n((const uint16_t *)pvField, __ATOMIC_ACQUIRE);
+        case 4: return __atomic_load_n((const uint32_t *)pvField, __ATOMIC_ACQUIRE);
+        case 8: return __atomic_load_n((const uint64_t *)pvField, __ATOMIC_ACQUIRE);
+        default: return 0;
+    }
+}
+
+/**
+ * @brief      Read a field of a copy of a trace line
+ *
+ * @param      pucLine  The trace line
+ * @param[in]  xField   Location of the field
+ *
+ * @return     Value of the field, 0 if not present
+ */
+static uint64_t reader_field(const uint8_t *pucLine, trace_bin_field_t xField)
+{
+    uint8_t  uc;
+    uint16_t us;
+    uint32_t ul;
+    uint64_t ull;
+
+    switch (xField.ucSize)
+    {
+        case 1: memcpy(&uc, &pucLine[xField.ucOffset], 1); return uc;
+        case 2: memcpy(&us, &pucLine[xField.ucOffset], 2); return us;
+        case 4: memcpy(&ul, &pucLine[xField.ucOffset], 4); return ul;
+        case 8: memcpy(&ull, &pucLine[xField.ucOffset], 8); return ull;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief      Read a message string from the file mapped at its address in the target
+ *
+ * @param[in]  ullPtr  Message pointer
+ *
+ * @return     The string to be freed, NULL if not file backed
+ */
+static char *reader_target_file(uint64_t ullPtr)
+{
+    char acPath[READER_NAME_MAX], acLine[512], acFile[384];
+    char *pcString = NULL;
+    FILE *pxMaps;
+
+    snprintf(acPath, sizeof(acPath), "/proc/%u/maps", (unsigned)gxPid);
+    if ((pxMaps = fopen(acPath, "r")) == NULL)
+    {
+        return NULL;
+    }
+    while (pcString == NULL && fgets(acLine, sizeof(acLine), pxMaps))
+    {
+        unsigned long long ullStart, ullEnd, ullOffset;
+        char acBuf[READER_MSG_MAX];
+        ssize_t xRead;
+        int fd;
+
+        if (sscanf(acLine, "%llx-%llx %*s %llx %*s %*s %383s", &ullStart, &ullEnd, &ullOffset, acFile) != 4 ||
+            ullPtr < ullStart || ullPtr >= ullEnd || acFile[0] != '/')
+        {
+            continue;
+        }
+        if ((fd = open(acFile, O_RDONLY)) < 0)
+        {
+            break;
+        }
+        xRead = pread(fd, acBuf, sizeof(acBuf) - 1, ullOffset + (ullPtr - ullStart));
+        close(fd);
+        if (xRead > 0)
+        {
+            acBuf[xRead] = '\0';
+            pcString = strdup(acBuf);
+        }
+        break;
+    }
+    fclose(pxMaps);
+    return pcString;
+}
+
+/**
+ * @brief      Read a message string from the executable of a target that ended,
+ *             relocating the message pointer by the address it was loaded at
+ *
+ * @param[in]  ullPtr  Message pointer
+ *
+ * @return     The string to be freed, NULL if not in the executable
+ */
+static char *reader_target_exe(uint64_t ullPtr)
+{
+    char acBuf[READER_MSG_MAX];
+    char *pcString = NULL;
+    uint64_t ullBase = UINT64_MAX, ullAddr;
+    Elf64_Ehdr xEhdr;
+    Elf64_Phdr xPhdr;
+    uint16_t usIdx;
+    int fd;
+
+    if (gpxHdr->ulExe == 0 || gpxHdr->ullImage == 0 || ullPtr < gpxHdr->ullImage ||
+        (fd = open((const char *)gpxHdr + gpxHdr->ulExe, O_RDONLY)) < 0)
+    {
+        return NULL;
+    }
+    if (pread(fd, &xEhdr, sizeof(xEhdr), 0) != sizeof(xEhdr) || memcmp(xEhdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+        xEhdr.e_ident[EI_CLASS] != ELFCLASS64 || xEhdr.e_phentsize != sizeof(xPhdr))
+    {
+        close(fd);
+        return NULL;
+    }
+    // Step 1: The executable is loaded at its lowest loadable segment
+    for (usIdx = 0; usIdx < xEhdr.e_phnum; usIdx++)
+    {
+        if (pread(fd, &xPhdr, sizeof(xPhdr), xEhdr.e_phoff + (uint64_t)usIdx * sizeof(xPhdr)) == sizeof(xPhdr) &&
+            xPhdr.p_type == PT_LOAD && xPhdr.p_vaddr < ullBase)
+        {
+            ullBase = xPhdr.p_vaddr & ~(uint64_t)(READER_PAGE - 1);
+        }
+    }
+    // Step 2: Read the string from the loadable segment of the relocated message pointer
+    ullAddr = ullPtr - gpxHdr->ullImage + ullBase;
+    for (usIdx = 0; usIdx < xEhdr.e_phnum && pcString == NULL; usIdx++)
+    {
+        ssize_t xRead;
+        if (pread(fd, &xPhdr, sizeof(xPhdr), xEhdr.e_phoff + (uint64_t)usIdx * sizeof(xPhdr)) != sizeof(xPhdr) ||
+            xPhdr.p_type != PT_LOAD || ullAddr < xPhdr.p_vaddr || ullAddr >= xPhdr.p_vaddr + xPhdr.p_filesz)
+        {
+            continue;
+        }
+        xRead = pread(fd, acBuf, sizeof(acBuf) - 1, xPhdr.p_offset + (ullAddr - xPhdr.p_vaddr));
+        if (xRead > 0)
+        {
+            acBuf[xRead] = '\0';
+            pcString = strdup(acBuf);
+        }
+        break;
+    }
+    close(fd);
+    return pcString;
+}
+
+/**
+ * @brief      Check if the target still runs
+ *
+ * @return     true - running, false - ended
+ */
+static bool reader_target_alive(void)
+{
+    if (__atomic_load_n(&gpxHdr->ucState, __ATOMIC_ACQUIRE) != TRACE_SHM_RUNNING)
+    {
+        return false;
+    }
+    if (gfdFile >= 0)
+    {
+        // NOTE: The target holds an exclusive lock on its file until it ends
+        if (flock(gfdFile, LOCK_SH | LOCK_NB) != 0)
+        {
+            return true;
+        }
+        flock(gfdFile, LOCK_UN);
+        return false;
+    }
+    return kill(gxPid, 0) == 0 || errno != ESRCH;
+}
+
+/**
+ * @brief      Read a message string from the memory of the target
+ *
+ * @param[in]  ullPtr  Message pointer
+ *
+ * @return     The string to be freed, NULL if it could not be read
+ */
+static char *reader_target_string(uint64_t ullPtr)
+{
+    char acBuf[READER_MSG_MAX];
+    size_t xLen = 0;
+
+    if (gbEnded)
+    {
+        return reader_target_exe(ullPtr);
+    }
+    // Step 1: Read a page at a time, so a string at the end of a mapping is not lost
+    while (xLen < sizeof(acBuf) - 1)
+    {
+        size_t xChunk = READER_PAGE - ((ullPtr + xLen) & (READER_PAGE - 1));
+        struct iovec xLocal, xRemote;
+
+        if (xChunk > sizeof(acBuf) - 1 - xLen)
+        {
+            xChunk = sizeof(acBuf) - 1 - xLen;
+        }
+        xLocal.iov_base = &acBuf[xLen];
+        xLocal.iov_len = xChunk;
+        xRemote.iov_base = (void *)(uintptr_t)(ullPtr + xLen);
+        xRemote.iov_len = xChunk;
+        if (process_vm_readv(gxPid, &xLocal, 1, &xRemote, 1, 0) != (ssize_t)xChunk)
+        {
+            break;
+        }
+        if (memchr(&acBuf[xLen], '\0', xChunk))
+        {
+            return strdup(acBuf);
+        }
+        xLen += xChunk;
+    }
+    if (xLen)
+    {
+        acBuf[xLen] = '\0';
+        return strdup(acBuf);
+    }
+    // Step 2: Without ptrace access to the target, read it from the file it was mapped from
+    return reader_target_file(ullPtr);
+}
+
+/**
+ * @brief      Gets the message string of a trace line
+ *
+ * @param[in]  ullMsg     Message field of the trace line
+ * @param      acUnknown  Receives the text shown for an unknown message
+ * @param[in]  xSize      Size of acUnknown
+ *
+ * @return     The message string
+ */
+static const char *reader_message(uint64_t ullMsg, char *acUnknown, size_t xSize)
+{
+    if (gpxHdr->ucFlags & TRACE_BIN_MSG_ID)
+    {
+        const uint32_t *pulTable = (const uint32_t *)((const uint8_t *)gpxHdr + gpxHdr->ulMsgTable);
+        uint16_t usMsgId = (uint16_t)ullMsg;
+        uint32_t ulIdx = usMsgId & ~gpxHdr->usMsgDyn, ulOffset = 0;
+
+        if (usMsgId & gpxHdr->usMsgDyn)
+        {
+            ulIdx = (ulIdx < gpxHdr->ulMsgDynMax) ? gpxHdr->usMsgLink + ulIdx : UINT32_MAX;
+        }
+        else if (ulIdx >= gpxHdr->usMsgLink)
+        {
+            ulIdx = UINT32_MAX;
+        }
+        if (ulIdx != UINT32_MAX)
+        {
+            ulOffset = __atomic_load_n(&pulTable[ulIdx], __ATOMIC_ACQUIRE);
+        }
+        if (ulOffset >= gpxHdr->ulStrings && ulOffset < gpxHdr->ulStrings + gpxHdr->ulStrSize)
+        {
+            return (const char *)gpxHdr + ulOffset;
+        }
+        snprintf(acUnknown, xSize, "<msg %u>", usMsgId);
+        return acUnknown;
+    }
+    else
+    {
+        uint32_t ulHash = (uint32_t)(ullMsg >> 2) * 2654435761u, ulProbe;
+        char *pcString;
+
+        // Open addressing on the message pointer, as the messages are mostly constant strings
+        for (ulProbe = 0; ulProbe < READER_CACHE; ulProbe++)
+        {
+            reader_str_t *pxStr = &gaxCache[(ulHash + ulProbe) & (READER_CACHE - 1)];
+            if (pxStr->ullPtr == ullMsg)
+            {
+                pcString = pxStr->pcString;
+                break;
+            }
+            if (pxStr->ullPtr == 0)
+            {
+                pxStr->ullPtr = ullMsg;
+                pcString = pxStr->pcString = reader_target_string(ullMsg);
+                break;
+            }
+        }
+        if (ulProbe == READER_CACHE)
+        {
+            // NOTE: The cache is full, so the string is read again each time
+            static char *pcLast = NULL;
+            free(pcLast);
+            pcString = pcLast = reader_target_string(ullMsg);
+        }
+        if (pcString)
+        {
+            return pcString;
+        }
+        snprintf(acUnknown, xSize, "<0x%llx>", (unsigned long long)ullMsg);
+        return acUnknown;
+    }
+}
+
+/**
+ * @brief      Output the time stamp of a trace line, and the time since the
+ *             previous trace line of the trace buffer
+ *
+ * @param      pxBuf     The trace buffer
+ * @param[in]  ullStamp  The time stamp
+ */
+static void reader_put_stamp(reader_buf_t *pxBuf, uint64_t ullStamp)
+{
+    uint64_t ullHz = __atomic_load_n(&gpxHdr->ullTickHz, __ATOMIC_RELAXED);
+    uint8_t ucShift = gpxHdr->ucTickShift;
+    uint64_t ullNs;
+    long long llDelta;
+
+    if (!(gpxHdr->ucFlags & TRACE_BIN_TICK64) || ullHz == 0)
+    {
+        printf("%10d ms|", (int32_t)((uint32_t)ullStamp - pxBuf->ulLastStamp));
+        pxBuf->ulLastStamp = (uint32_t)ullStamp;
+        return;
+    }
+    // Extend a 32-bit time stamp from the previous one, or the first from the tick of the newest trace
+    if (gpxHdr->xStamp.ucSize != sizeof(uint32_t))
+    {
+        pxBuf->ullTick = ullStamp;
+    }
+    else if (pxBuf->bStarted)
+    {
+        pxBuf->ullTick += (uint64_t)(int64_t)(int32_t)((uint32_t)ullStamp - pxBuf->ulLastStamp) << ucShift;
+    }
+    else
+    {
+        uint64_t ullBase = reader_load(pxBuf->pucTrace, gpxHdr->xTickBase) >> ucShift;
+        pxBuf->ullTick = (ullBase + (uint64_t)(int64_t)(int32_t)((uint32_t)ullStamp - (uint32_t)ullBase)) << ucShift;
+    }
+    pxBuf->ulLastStamp = (uint32_t)ullStamp;
+    // NOTE: Split to avoid overflow of the tick * 10^9
+    ullNs = pxBuf->ullTick / ullHz * 1000000000ull + pxBuf->ullTick % ullHz * 1000000000ull / ullHz;
+    llDelta = pxBuf->bStarted ? (long long)(ullNs - pxBuf->ullLastNs) : 0;
+    printf("%7llu.%09llu s|%12lld ns|", (unsigned long long)(ullNs / 1000000000ull), (unsigned long long)(ullNs % 1000000000ull), llDelta);
+    pxBuf->ullLastNs = ullNs;
+}
+
+/**
+ * @brief      Output a trace line in the format of trace_dump(), after the name
+ *             of its trace buffer
+ *
+ * @param      pxBuf    The trace buffer
+ * @param      pucLine  Copy of the trace line
+ * @param[in]  ulSlot   Slot of the trace line
+ * @param[in]  iWidth   Width of the names of the trace buffers
+ */
+static void reader_put_line(reader_buf_t *pxBuf, const uint8_t *pucLine, uint32_t ulSlot, int iWidth)
+{
+    uint64_t ullMsg = reader_field(pucLine, gpxHdr->xMessage);
+    uint32_t ulValue = (uint32_t)reader_field(pucLine, gpxHdr->xValue);
+    uint8_t ucEvent = (uint8_t)reader_field(pucLine, gpxHdr->xEvent);
+    char acUnknown[32];
+
+    printf("%-*s %6u|", iWidth, pxBuf->pcName, ulSlot);
+    if (gpxHdr->xStamp.ucSize)
+    {
+        reader_put_stamp(pxBuf, reader_field(pucLine, gpxHdr->xStamp));
+    }
+    if (gpxHdr->xTid.ucSize)
+    {
+        printf("%8u|", (uint32_t)reader_field(pucLine, gpxHdr->xTid));
+    }
+    // NOTE: The function addresses of TRACE_USE_INSTRUMENT are not resolved to symbols
+    if (pxBuf->pxDesc->bFunc)
+    {
+        snprintf(acUnknown, sizeof(acUnknown), "<fn 0x%llx>", (unsigned long long)ullMsg);
+    }
+    printf(" %s%s: 0x%08x (%d)\n", (ucEvent == TRACE_EVENT_BEGIN) ? "-> " : (ucEvent == TRACE_EVENT_END) ? "<- " : "",
+           pxBuf->pxDesc->bFunc ? acUnknown : reader_message(ullMsg, acUnknown, sizeof(acUnknown)), ulValue, ulValue);
+    pxBuf->bStarted = true;
+}
+
+/**
+ * @brief      Output the number of trace lines skipped
+ *
+ * @param      pxBuf    The trace buffer
+ * @param[in]  iWidth   Width of the names of the trace buffers
+ * @param      pulLost  Number of trace lines overwritten before they were output, cleared
+ * @param      pulTorn  Number of trace lines left incomplete, cleared
+ */
+static void reader_put_skipped(reader_buf_t *pxBuf, int iWidth, uint32_t *pulLost, uint32_t *pulTorn)
+{
+    if (*pulLost)
+    {
+        printf("%-*s  ------ %u lost ------\n", iWidth, pxBuf->pcName, *pulLost);
+        pxBuf->ulLost += *pulLost;
+        *pulLost = 0;
+    }
+    if (*pulTorn)
+    {
+        printf("%-*s  ------ %u torn ------\n", iWidth, pxBuf->pcName, *pulTorn);
+        pxBuf->ulTorn += *pulTorn;
+        *pulTorn = 0;
+    }
+}
+
+/**
+ * @brief      Output the new trace lines of a trace buffer
+ *
+ * @param      pxBuf   The trace buffer
+ * @param[in]  iWidth  Width of the names of the trace buffers
+ * @param[in]  bFinal  true - output up to the newest trace line, as no more are written
+ *                     to the trace lines, false - only the complete ones
+ */
+static void reader_poll(reader_buf_t *pxBuf, int iWidth, bool bFinal)
+{
+    const uint32_t ulDepth = pxBuf->pxDesc->ulDepth;
+    const bool bSeq = gpxHdr->xSeq.ucSize != 0;
+    uint64_t ullIdx = reader_load(pxBuf->pucTrace, gpxHdr->xIdx);
+    uint64_t ullEnd, ullOldest = 0;
+    uint32_t ulLost = 0, ulTorn = 0;
+    uint8_t aucLine[UINT16_MAX];
+
+    // NOTE: The indices are only compared by their difference, so a wrap is not taken for a reset
+    // Step 1: A trace buffer reset by the target starts over
+    if ((int64_t)(ullIdx - pxBuf->ullNext) < 0)
+    {
+        printf("%-*s  ------ reset ------\n", iWidth, pxBuf->pcName);
+        pxBuf->ullNext = pxBuf->ullSettled = pxBuf->ulLastStamp = 0;
+        pxBuf->bStarted = false;
+    }
+    // Step 2: Find the trace lines to output.  Without sequence numbers, only the
+    //         trace lines claimed by the previous poll are known to be written
+    ullEnd = (bSeq || bFinal || (int64_t)(ullIdx - pxBuf->ullSettled) < 0) ? ullIdx : pxBuf->ullSettled;
+    pxBuf->ullSettled = ullIdx;
+    if (pxBuf->pxDesc->bIsWrap)
+    {
+        ullOldest = (ullIdx > ulDepth) ? ullIdx - ulDepth : 0;
+    }
+    else if (ullEnd > ulDepth)
+    {
+        ullEnd = ulDepth;
+    }
+    if ((int64_t)(ullOldest - pxBuf->ullNext) > 0)
+    {
+        ulLost = (uint32_t)(ullOldest - pxBuf->ullNext);
+        pxBuf->ullNext = ullOldest;
+    }
+    // Step 3: Copy and output each trace line, unless overwritten in the meantime
+    for (; (int64_t)(ullEnd - pxBuf->ullNext) > 0; pxBuf->ullNext++)
+    {
+        uint32_t ulSlot = (uint32_t)(pxBuf->ullNext % ulDepth);
+        const uint8_t *pucLine = &pxBuf->pucRing[(size_t)ulSlot * gpxHdr->usLineSize];
+        uint32_t ulSeq = 0;
+
+        if (bSeq)
+        {
+            ulSeq = (uint32_t)reader_load(pucLine, gpxHdr->xSeq);
+        }
+        memcpy(aucLine, pucLine, gpxHdr->usLineSize);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (bSeq)
+        {
+            // Per slot seqlock (see trace_read): stop at a trace line still being written,
+            // which is torn if it's never completed.  The sequence numbers wrap at 2^32
+            if (ulSeq != READER_SEQ(pxBuf->ullNext) || (uint32_t)reader_load(pucLine, gpxHdr->xSeq) != ulSeq)
+            {
+                if (ulSeq == 0 || (int32_t)(ulSeq - READER_SEQ(pxBuf->ullNext)) < 0)
+                {
+                    if (!bFinal)
+                    {
+                        break;
+                    }
+                    ulTorn++;
+                }
+                else
+                {
+                    ulLost++;
+                }
+                continue;
+            }
+        }
+        else if (pxBuf->pxDesc->bIsWrap && (int64_t)(reader_load(pxBuf->pucTrace, gpxHdr->xIdx) - pxBuf->ullNext) > ulDepth)
+        {
+            ulLost++;
+            continue;
+        }
+        // Skip empty trace lines, which only have a NULL message pointer
+        if (!(gpxHdr->ucFlags & TRACE_BIN_MSG_ID) && reader_field(aucLine, gpxHdr->xMessage) == 0)
+        {
+            continue;
+        }
+        reader_put_skipped(pxBuf, iWidth, &ulLost, &ulTorn);
+        reader_put_line(pxBuf, aucLine, ulSlot, iWidth);
+    }
+    reader_put_skipped(pxBuf, iWidth, &ulLost, &ulTorn);
+}
+
+/**
+ * @brief      Attach read-only to the segment of the target, or to its file
+ *
+ * @param      pcName  Name of the segment, or of the file
+ *
+ * @return     The segment, NULL if it is not a valid one
+ */
+static const trace_shm_hdr_t *reader_attach(const char *pcName)
+{
+    const trace_shm_hdr_t *pxHdr;
+    struct stat xStat;
+    int fd, iWait;
+    uint8_t ucOrder = 0;
+
+    // A file is one of TRACE_USE_PERSIST, which stays open to check the lock of the target
+    if (stat(pcName, &xStat) == 0 && S_ISREG(xStat.st_mode))
+    {
+        fd = gfdFile = open(pcName, O_RDONLY);
+    }
+    else
+    {
+        fd = shm_open(pcName, O_RDONLY, 0);
+    }
+    if (fd < 0)
+    {
+        perror(pcName);
+        return NULL;
+    }
+    if (fstat(fd, &xStat) != 0 || (size_t)xStat.st_size < sizeof(*pxHdr) ||
+        (pxHdr = mmap(NULL, xStat.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: not a trace segment\n", pcName);
+        close(fd);
+        return NULL;
+    }
+    if (gfdFile < 0)
+    {
+        close(fd);
+    }
+    // The target sets the magic last, once the segment is set up
+    for (iWait = 0; iWait < READER_ATTACH_MS && __atomic_load_n(&pxHdr->ulMagic, __ATOMIC_ACQUIRE) != TRACE_SHM_MAGIC; iWait++)
+    {
+        usleep(1000);
+    }
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    ucOrder = TRACE_BIN_BIG_ENDIAN;
+#endif // __BYTE_ORDER__
+    if (pxHdr->ulMagic != TRACE_SHM_MAGIC || pxHdr->usVersion != TRACE_SHM_VERSION || pxHdr->usHdrSize != sizeof(*pxHdr) ||
+        pxHdr->ullSize > (uint64_t)xStat.st_size || (pxHdr->ucFlags & TRACE_BIN_BIG_ENDIAN) != ucOrder)
+    {
+        fprintf(stderr, "%s: not a trace segment of version %u\n", pcName, TRACE_SHM_VERSION);
+        munmap((void *)pxHdr, xStat.st_size);
+        return NULL;
+    }
+    return pxHdr;
+}
+
+/********************* Exported Functions ********************/
+int main(int argc, char *argv[])
+{
+    char acName[READER_NAME_MAX], acStart[32];
+    const trace_shm_buf_t *axDesc;
+    reader_buf_t *axBuf;
+    time_t xStart;
+    bool bOnce = false;
+    int iOpt, iInterval = 100, iNice = 19, iWidth = 0;
+    uint16_t usIdx;
+
+    while ((iOpt = getopt(argc, argv, "1i:n:")) != -1)
+    {
+        switch (iOpt)
+        {
+            case '1': bOnce = true; break;
+            case 'i': iInterval = atoi(optarg); break;
+            case 'n': iNice = atoi(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-1] [-i <ms>] [-n <nice>] <pid | segment name | file>\n", argv[0]);
+        return 1;
+    }
+    // Step 1: Attach to the segment of the process, or of the given name
+    if (isdigit((unsigned char)argv[optind][0]))
+    {
+        snprintf(acName, sizeof(acName), READER_SHM_NAME, (unsigned)atoi(argv[optind]));
+    }
+    else
+    {
+        snprintf(acName, sizeof(acName), "%s", argv[optind]);
+    }
+    if ((gpxHdr = reader_attach(acName)) == NULL)
+    {
+        return 1;
+    }
+    gxPid = gpxHdr->ulPid;
+    gbEnded = !reader_target_alive();
+    // NOTE: The formatting is left to the reader, so it should not compete with the target
+    setpriority(PRIO_PROCESS, 0, iNice);
+    xStart = (time_t)gpxHdr->ullStartTime;
+    strftime(acStart, sizeof(acStart), "%Y-%m-%d %H:%M:%S", localtime(&xStart));
+    printf("====TRACE SESSION[%s] (pid:%u, start:%s, %s)====\n", gpxHdr->ulExe ? (const char *)gpxHdr + gpxHdr->ulExe : "?",
+           (unsigned)gxPid, acStart, !gbEnded ? "running" : (gpxHdr->ucState == TRACE_SHM_EXITED) ? "exited" : "crashed");
+
+    // Step 2: Start each trace buffer of trace lines at its oldest valid trace line
+    axDesc = (const trace_shm_buf_t *)(gpxHdr + 1);
+    axBuf = calloc(gpxHdr->usBufs, sizeof(*axBuf));
+    if (axBuf == NULL)
+    {
+        fprintf(stderr, "trace_reader: out of memory\n");
+        return 1;
+    }
+    for (usIdx = 0; usIdx < gpxHdr->usBufs; usIdx++)
+    {
+        reader_buf_t *pxBuf = &axBuf[usIdx];
+        uint64_t ullIdx;
+
+        pxBuf->pxDesc = &axDesc[usIdx];
+        pxBuf->pucTrace = (const uint8_t *)gpxHdr + axDesc[usIdx].ullTrace;
+        pxBuf->pucRing = (const uint8_t *)gpxHdr + axDesc[usIdx].ullRing;
+        pxBuf->pcName = axDesc[usIdx].ulName ? (const char *)gpxHdr + axDesc[usIdx].ulName : "?";
+        ullIdx = reader_load(pxBuf->pucTrace, gpxHdr->xIdx);
+        pxBuf->ullNext = (axDesc[usIdx].bIsWrap && ullIdx > axDesc[usIdx].ulDepth) ? ullIdx - axDesc[usIdx].ulDepth : 0;
+        if ((int)strlen(pxBuf->pcName) > iWidth)
+        {
+            iWidth = strlen(pxBuf->pcName);
+        }
+        printf("====TRACE[%s] (depth:%u%s)====\n", pxBuf->pcName, axDesc[usIdx].ulDepth, axDesc[usIdx].bLines ? "" : ", not read");
+    }
+
+    // Step 3: Tail the trace buffers until the target ends
+    for (;;)
+    {
+        // NOTE: Once the target ended, its trace lines are final
+        gbEnded = gbEnded || !reader_target_alive();
+        for (usIdx = 0; usIdx < gpxHdr->usBufs; usIdx++)
+        {
+            if (axBuf[usIdx].pxDesc->bLines)
+            {
+                reader_poll(&axBuf[usIdx], iWidth, bOnce || gbEnded);
+            }
+        }
+        fflush(stdout);
+        if (bOnce || gbEnded)
+        {
+            break;
+        }
+        usleep(iInterval * 1000);
+    }
+    if (gbEnded)
+    {
+        fprintf(stderr, "trace_reader: process %u %s\n", (unsigned)gxPid, (gpxHdr->ucState == TRACE_SHM_EXITED) ? "exited" : "ended without exit()");
+    }
+    free(axBuf);
+    return 0;
+}
@@ -24,141 +24,5505 @@ SOFTWARE.
 */
 
 /********************* System Headers ************************/
+#if defined(TRACE_USE_INSTRUMENT) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE             // dladdr() and dl_iterate_phdr()
+#endif // defined(TRACE_USE_INSTRUMENT) && !defined(_GNU_SOURCE)
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+// NOTE: TRACE_USE_PERSIST implies TRACE_USE_SHM, which trace.h defines later
+#if defined(TRACE_USE_HUGEPAGE) || defined(TRACE_USE_SHM) || defined(TRACE_USE_PERSIST) || defined(TRACE_USE_ARENA)
+#include <sys/mman.h>
+#endif // defined(TRACE_USE_HUGEPAGE) || defined(TRACE_USE_SHM) || defined(TRACE_USE_PERSIST) || defined(TRACE_USE_ARENA)
+#if defined(TRACE_USE_SHM) || defined(TRACE_USE_PERSIST)
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif // defined(TRACE_USE_SHM) || defined(TRACE_USE_PERSIST)
+#if defined(TRACE_USE_PERSIST)
+#include <sys/file.h>
+#endif // defined(TRACE_USE_PERSIST)
+#if defined(TRACE_USE_INSTRUMENT)
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // defined(TRACE_USE_INSTRUMENT)
+#if defined(TRACE_USE_SHARDS)
+#include <pthread.h>
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_DRAIN)
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif // defined(TRACE_USE_DRAIN)
+// NOTE: TRACE_USE_ARENA implies TRACE_USE_REGISTRY, which trace.h defines later
+#if defined(TRACE_USE_REGISTRY) || defined(TRACE_USE_ARENA)
+#include <sched.h>
+#endif // defined(TRACE_USE_REGISTRY) || defined(TRACE_USE_ARENA)
+#if defined(TRACE_USE_ARENA)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif // defined(TRACE_USE_ARENA)
 
 /********************* Local Headers *************************/
 #include "trace.h"
+#include "trace_bin.h"
+
+/*********************** Constants ***************************/
+#define TRACE_BIN_CHUNK         256     // Size of the staging buffer for binary output [in bytes]
+#define TRACE_BIN_CACHE         64      // Number of entries in the string table duplicate filter
+#define TRACE_REC_ALIGN         8       // Alignment of the records of a TRACE_MODE_ARGS buffer [in bytes]
+#define TRACE_JSON_MAX          128     // Maximum length of a formatted piece of JSON output [in bytes]
+#define TRACE_EXPORT_PID        1       // Process ID of the events of trace_export_chrome()
+#define TRACE_TEXT_CHUNK        4096    // Size of the staging buffer of the text formatter [in bytes]
+#define TRACE_TEXT_FIELDS       128     // Room for the fields of a trace line, besides the message [in bytes]
+#define TRACE_SHM_NAME_MAX      256     // Maximum length of the name of the shared memory segment, or of its file
+#define TRACE_FUNC_SYM_LEN      48      // Room for the object and offset of a function without a symbol [in bytes]
+#define TRACE_DRAIN_SLEEP_US    50      // Shortest time the drain sleeps while the writers are busy [in us]
+#define TRACE_DRAIN_CHUNK       65536   // Size of the staging buffer of the drain [in bytes]
+#define TRACE_DRAIN_STR_MAX     1024    // Messages and names are cut to this length in the drain files [in bytes]
+#define TRACE_DRAIN_LINE_MAX    (3 * (16 + TRACE_DRAIN_STR_MAX) + 96)   // Entries staged for a trace line at most, with its name, message and overruns [in bytes]
+#define TRACE_ARENA_NODES       1024    // Number of NUMA nodes in the node mask of mbind()
+#define TRACE_ARENA_MPOL_PREFERRED  1   // Policy of mbind() that places the pages on a node while it has room
 
 /*********************** Macros ******************************/
+#if defined(TRACE_USE_SHARDS)
+#define TRACE_SHARD_KEY_NONE    0xFF    // trace_t::ucShardKey while a thread assigns it, or when out of slots
+#endif // defined(TRACE_USE_SHARDS)
+
+#define TRACE_POS_INIT  .ullIdx = 0, .ulSlot = 0, .ulCount = 0,
+
+#if defined(TRACE_USE_LARGE)
+#define TRACE_DEPTH_INIT(depth) .ulDepth = depth,
+// NOTE: The slot of a trace index is masked, so the depth must be a power of two
+#define TRACE_DEPTH_CHECK(trcName, depth) \
+    _Static_assert(((depth) & ((depth) - 1)) == 0, "Depth of trace " #trcName " is not a power of two");
+#else
+#define TRACE_DEPTH_INIT(depth) .usDepth = depth,
+#define TRACE_DEPTH_CHECK(trcName, depth)
+#endif // defined(TRACE_USE_LARGE)
+
+#if defined(TRACE_USE_INSTRUMENT)
+// NOTE: The trace buffer of TRACE_FUNC_BUFFER is marked at build time, so the calls before main() are resolved too
+#define TRACE_FUNC_INIT(trcName) \
+    .bFunc = (__builtin_strcmp(#trcName, TRACE_STR(TRACE_FUNC_BUFFER)) == 0),
+#define TRACE_STR(x)            TRACE_STR_(x)
+#define TRACE_STR_(x)           #x
+
+// The hooks, and the functions they call, are never instrumented themselves
+#define TRACE_FUNC_HOOK         __attribute__((no_instrument_function))
+
+// Reasons the calls of a thread are not traced (see gucTraceFuncOff)
+#define TRACE_FUNC_OFF_THREAD   0x01    // Disabled by trace_func_thread()
+#define TRACE_FUNC_OFF_HOOK     0x02    // Within a hook, e.g. calls of trace.c built with -finstrument-functions
+#else
+#define TRACE_FUNC_INIT(trcName)
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_HUGEPAGE)
+// Rings of a huge page or more start on a huge page, so they can be backed by huge pages
+#define TRACE_RING_ALIGNED(depth, mode) \
+    __attribute__((aligned((TRACE_LINES(depth, mode) * sizeof(trace_line_t) >= TRACE_HUGE_PAGE) ? TRACE_HUGE_PAGE : sizeof(void *))))
+#else
+#define TRACE_RING_ALIGNED(depth, mode)
+#endif // defined(TRACE_USE_HUGEPAGE)
+
 // NOTE: This macro creates the trace buffer objects in memory
-#define TRACE_INSTANTIATE(trcName, hdrName, depth, isWrap) \
-    trace_line_t gaxTrace##trcName##Line[depth]; \
+#define TRACE_INSTANTIATE(trcName, hdrName, depth, isWrap, mode) \
+    TRACE_DEPTH_CHECK(trcName, depth) \
+    trace_line_t gaxTrace##trcName##Line[TRACE_LINES(depth, mode)] TRACE_RING_ALIGNED(depth, mode); \
     trace_t gxTrace##trcName = { \
-        .usDepth = depth, \
+        TRACE_DEPTH_INIT(depth) \
         .bIsWrap = isWrap, \
-        .usIdx = 0, \
-        .ulCount = 0, \
+        .ucMode = mode, \
+        .ulEnable = TRACE_ENABLE_ALL, \
+        TRACE_FUNC_INIT(trcName) \
+        TRACE_POS_INIT \
         .axLine = gaxTrace##trcName##Line, \
         .name = hdrName, \
     }; \
     trace_t *gpxTrace##trcName = &gxTrace##trcName;
 
+// Message string of a trace line or record, and its key in the binary string table
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_LINE_MSG(pxLine)  trace_msg_string((pxLine)->usMsgId)
+#define TRACE_LINE_KEY(pxLine)  ((pxLine)->usMsgId)
+#else
+#define TRACE_LINE_MSG(pxLine)  ((pxLine)->pcMessage)
+#define TRACE_LINE_KEY(pxLine)  ((uintptr_t)(pxLine)->pcMessage)
+#endif // defined(TRACE_USE_MSG_ID)
+
+// Message string of a trace line of a trace buffer, the symbol of the function of TRACE_FUNC_BUFFER
+#if defined(TRACE_USE_INSTRUMENT)
+#define TRACE_LINE_NAME(This, pxLine)   ((This)->bFunc ? trace_func_symbol((pxLine)->pcMessage) : TRACE_LINE_MSG(pxLine))
+#else
+#define TRACE_LINE_NAME(This, pxLine)   TRACE_LINE_MSG(pxLine)
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+// Thread ID and event type of a trace line or record, and the columns trace_dump() shows them in
+#if defined(TRACE_USE_SPANS)
+#define TRACE_LINE_TID(pxLine)      ((pxLine)->ulTid)
+#define TRACE_LINE_EVENT(pxLine)    ((pxLine)->ucEvent)
+#define TRACE_TID_FMT               "%8u|"
+#define TRACE_TID_ARG(pxLine)       (pxLine)->ulTid,
+#define TRACE_EVENT_FMT             "%s"
+#define TRACE_EVENT_ARG(pxLine)     TRACE_EVENT_MARK((pxLine)->ucEvent),
+#else
+#define TRACE_LINE_TID(pxLine)      0
+#define TRACE_LINE_EVENT(pxLine)    TRACE_EVENT_INSTANT
+#define TRACE_TID_FMT
+#define TRACE_TID_ARG(pxLine)
+#define TRACE_EVENT_FMT
+#define TRACE_EVENT_ARG(pxLine)
+#endif // defined(TRACE_USE_SPANS)
+#define TRACE_EVENT_MARK(ucEvent)   (((ucEvent) == TRACE_EVENT_BEGIN) ? "-> " : ((ucEvent) == TRACE_EVENT_END) ? "<- " : "")
+
+// Time stamp of a trace line or record, 0 without time stamps
+#if defined(TRACE_GET_TICK)
+#define TRACE_LINE_STAMP(pxLine)    ((pxLine)->xTimeStamp)
+#else
+#define TRACE_LINE_STAMP(pxLine)    0
+#endif // defined(TRACE_GET_TICK)
+
+// NOTE: Signed difference keeps the order of time stamps across a tick wrap
+#define TRACE_STAMP_BEFORE(xA, xB)  ((trace_stamp_t)((xA) - (xB)) > ((trace_stamp_t)-1 >> 1))
+
+// Describes a field of a trace line or record in the binary record header
+#define TRACE_BIN_FIELD(xField, type, member) \
+    do { (xField).ucOffset = offsetof(type, member); (xField).ucSize = sizeof(((type *)0)->member); } while (0)
+
+#if defined(TRACE_USE_ARGS)
+// Capacity of the byte ring of a TRACE_MODE_ARGS buffer [in bytes]
+#define TRACE_REC_CAP(This)     ((uint32_t)(TRACE_DEPTH(This) * sizeof(trace_line_t)) & ~(uint32_t)(TRACE_REC_ALIGN - 1))
+
+// NOTE: A record is reserved in several steps, so the lock-free mode uses a spin lock instead.
+//       It's only tried TRACE_REC_SPIN times, so a trace never waits for a writer preempted
+//       while holding it.  TRACE_REC_LOCK() is false if the record is only to be counted
+#if defined(TRACE_USE_ATOMIC)
+#define TRACE_REC_SPIN          64
+#define TRACE_REC_LOCK(This)    trace_rec_lock(This)
+#define TRACE_REC_UNLOCK(This)  __atomic_clear(&(This)->ucLock, __ATOMIC_RELEASE)
+#else
+#define TRACE_REC_LOCK(This)    ({ TRACE_LOCK(); true; })
+#define TRACE_REC_UNLOCK(This)  TRACE_UNLOCK()
+#endif // defined(TRACE_USE_ATOMIC)
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_AGG)
+// Key of the call site of a message, and the message of a call site key (see trace_agg_t::ullKey)
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_AGG_KEY(xMsg)     (((xMsg) == TRACE_MSG_NONE) ? 0 : (uint64_t)(xMsg) + 1)
+#define TRACE_AGG_MSG(ullKey)   trace_msg_string((uint16_t)((ullKey) - 1))
+#else
+#define TRACE_AGG_KEY(xMsg)     ((uint64_t)(uintptr_t)(xMsg))
+#define TRACE_AGG_MSG(ullKey)   ((const char *)(uintptr_t)(ullKey))
+#endif // defined(TRACE_USE_MSG_ID)
+#define TRACE_AGG_STAMPED       (1ull << 63)    // Set in trace_agg_t::ullLast once a call is time stamped
+
+// NOTE: The lock-free mode updates the statistics of a call site with atomics, otherwise under TRACE_LOCK()
+#if defined(TRACE_USE_ATOMIC)
+#define TRACE_AGG_LOCK()
+#define TRACE_AGG_UNLOCK()
+#define TRACE_AGG_ADD(pxVar, xAdd)  __atomic_fetch_add(pxVar, xAdd, __ATOMIC_RELAXED)
+#else
+#define TRACE_AGG_LOCK()            TRACE_LOCK()
+#define TRACE_AGG_UNLOCK()          TRACE_UNLOCK()
+#define TRACE_AGG_ADD(pxVar, xAdd)  (*(pxVar) += (xAdd))
+#endif // defined(TRACE_USE_ATOMIC)
+#endif // defined(TRACE_USE_AGG)
+
 // NOTE: This macro is used to create an array of trace buffers
-#define TRACE_ELEMENT(trcName, hdrName, depth, isWrap)  &gxTrace##trcName,
+#define TRACE_ELEMENT(trcName, hdrName, depth, isWrap, mode)    &gxTrace##trcName,
+
+#if defined(TRACE_USE_SHM)
+// NOTE: This macro is used to create an array of the trace buffer pointers of the TRACE* macros
+#define TRACE_REFERENCE(trcName, hdrName, depth, isWrap, mode)  &gpxTrace##trcName,
+
+// Offset of the next cache line in the shared memory segment
+#define TRACE_SHM_ALIGN(xOff)   (((xOff) + TRACE_CACHE_LINE - 1) & ~(uint64_t)(TRACE_CACHE_LINE - 1))
+#endif // defined(TRACE_USE_SHM)
+
+#if defined(TRACE_USE_REGISTRY)
+// NOTE: The registry and the arena change rarely, so their writers take a spin lock, yielding to its owner
+#define TRACE_SPIN_LOCK(pucLock)    do { while (__atomic_test_and_set(pucLock, __ATOMIC_ACQUIRE)) { sched_yield(); } } while (0)
+#define TRACE_SPIN_UNLOCK(pucLock)  __atomic_clear(pucLock, __ATOMIC_RELEASE)
+
+// Trace buffer registered in a slot of the registry, NULL - free
+#define TRACE_REG_GET(ulSlot)       __atomic_load_n(&gapxTraceReg[ulSlot], __ATOMIC_ACQUIRE)
+#endif // defined(TRACE_USE_REGISTRY)
+
+/*********************** Typedefs ****************************/
+#if defined(TRACE_USE_ARGS)
+// Header of a record in the byte ring of a TRACE_MODE_ARGS buffer, followed by the arguments
+typedef struct
+{
+    uint16_t usSize;                // Size of the record including the header [in bytes]
+    uint8_t  ucArgs;                // Number of arguments, TRACE_REC_PAD for padding
+    uint8_t  ucFlags;               // TRACE_REC_xxx
+#if defined(TRACE_GET_TICK)
+    trace_stamp_t xTimeStamp;       // Time stamp
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+    uint16_t usMsgId;               // Message ID
+#else
+    char *   pcMessage;             // Message string
+#endif // defined(TRACE_USE_MSG_ID)
+#if defined(TRACE_USE_SPANS)
+    uint32_t ulTid;                 // Thread ID of the caller
+    uint8_t  ucEvent;               // One of TRACE_EVENT_xxx
+#endif // defined(TRACE_USE_SPANS)
+} trace_rec_t;
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_TICK64)
+// Extends the time stamps of a trace buffer, from oldest to newest, to 64-bit ticks
+typedef struct
+{
+    uint64_t ullTick;               // Tick of the last time stamp
+    trace_stamp_t xFirst;           // First time stamp
+    trace_stamp_t xLast;            // Last time stamp
+    bool     bStarted;              // true - xFirst and xLast are set
+} trace_clock_t;
+#endif // defined(TRACE_USE_TICK64)
+
+// Output stream of trace_dump_binary()
+typedef struct
+{
+    trace_sink_t pfnSink;               // Receives the binary record
+    void *   pvCtx;                     // Context passed to pfnSink
+    size_t   xSize;                     // Number of bytes output so far
+    size_t   xChunk;                    // Number of bytes staged in aucChunk
+    uint8_t  aucChunk[TRACE_BIN_CHUNK]; // Stages the small writes
+} trace_bin_out_t;
+
+// Output stream and state of trace_export_chrome()
+typedef struct
+{
+    trace_bin_out_t xOut;               // Output stream
+    const char *pcCat;                  // Name of the trace buffer being exported
+    uint32_t ulTid;                     // Thread ID of the shard being exported, otherwise 0
+    uint32_t ulEvents;                  // Number of events exported so far
+#if defined(TRACE_USE_TICK64)
+    trace_clock_t xClock;               // Extends the time stamps of the trace buffer
+#endif // defined(TRACE_USE_TICK64)
+} trace_export_t;
+
+#if defined(TRACE_USE_QUERY)
+// Cursor of trace_query() on the valid trace lines of a trace buffer or shard
+typedef struct
+{
+    trace_t *pxTrace;                   // Trace buffer or shard read
+    const char *pcName;                 // Name of the trace buffer
+    uint32_t ulTid;                     // Thread ID of the owner of a shard, otherwise 0
+    uint64_t ullNext;                   // Free running index of the next trace line to read
+    uint32_t ulLeft;                    // Number of trace lines left to read
+    bool     bHead;                     // true - xHead holds the oldest unmerged match
+    trace_line_t xHead;
+    uint64_t ullTime;                   // Time of xHead [in ns with TRACE_USE_TICK64, otherwise its time stamp]
+#if defined(TRACE_USE_TICK64)
+    trace_clock_t xClock;               // Extends the time stamps of the trace buffer
+#endif // defined(TRACE_USE_TICK64)
+} trace_query_cur_t;
+
+// Cached match of a message to the substring of trace_query()
+typedef struct
+{
+    uintptr_t xKey;                     // Key of the message (TRACE_LINE_KEY)
+    bool     bUsed;                     // true - xKey and bMatch are set
+    bool     bMatch;                    // true - the message holds the substring
+} trace_query_msg_t;
+
+// Output stream and state of trace_query()
+typedef struct
+{
+    const trace_query_t *pxQuery;       // The filter
+    trace_bin_out_t xOut;               // Output stream
+    uint32_t ulCursors;                 // Number of cursors in axCursor
+    size_t   xNameLen;                  // Length of the longest name of a trace buffer, the width of its column
+    trace_query_cur_t axCursor[TRACE_QUERY_MAX];
+    trace_query_msg_t axMsg[TRACE_QUERY_MSGS];
+} trace_query_run_t;
+#endif // defined(TRACE_USE_QUERY)
+
+// Caller buffer of trace_dump_binary_buf()
+typedef struct
+{
+    uint8_t *pucBuf;                    // Buffer to write to
+    size_t   xSize;                     // Size of the buffer
+    size_t   xUsed;                     // Number of bytes written so far
+} trace_bin_buf_t;
+
+#if defined(TRACE_USE_FAST_DUMP)
+// Output stream of the text formatter
+typedef struct
+{
+    trace_sink_t pfnSink;               // Receives the text
+    void *   pvCtx;                     // Context passed to pfnSink
+    size_t   xSize;                     // Number of bytes output so far
+    size_t   xLen;                      // Number of bytes staged in acBuf
+    char     acBuf[TRACE_TEXT_CHUNK];   // Stages the text of many trace lines
+} trace_text_t;
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+#if defined(TRACE_USE_INSTRUMENT)
+// Cached symbol of a function address
+typedef struct
+{
+    const void *pvFunc;                 // Function address, NULL - free
+    const char *pcName;                 // Symbol, or acName
+    char     acName[TRACE_FUNC_SYM_LEN]; // Object and offset of a function without a symbol
+} trace_func_sym_t;
+
+// Function symbol of the symbol table of the executable
+typedef struct
+{
+    uintptr_t xAddr;                    // Address of the function, as loaded
+    uint32_t ulSize;                    // Size of the function [in bytes]
+    uint32_t ulName;                    // Offset of the symbol in the string table
+} trace_func_elf_t;
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_ARENA)
+// Header of a block of the arena, on the cache line before the block
+typedef struct
+{
+    size_t   xSize;                     // Size of the block including the header [in bytes]
+    size_t   xPrev;                     // Size of the block before, 0 - first block
+    bool     bFree;                     // true - free, false - allocated
+} __attribute__((aligned(TRACE_CACHE_LINE))) trace_arena_blk_t;
+#endif // defined(TRACE_USE_ARENA)
+
+#if defined(TRACE_USE_DRAIN)
+// Read cursor of a trace buffer or shard followed by the drain
+typedef struct
+{
+    trace_t *pxTrace;                   // The trace buffer or shard
+    trace_t *pxSel;                     // The trace buffer passed to trace_drain_start()
+    uint64_t ullNext;                   // Free running index of the next trace line to drain
+    uint64_t ullLost;                   // Number of trace lines overwritten before they were drained
+    trace_stamp_t xLast;                // Time stamp of the previous trace line in the file
+    bool     bNamed;                    // true - the file names the trace buffer
+} trace_drain_buf_t;
+
+// State of the drain thread
+typedef struct
+{
+    char     acPath[TRACE_SHM_NAME_MAX];    // Path the names of the files start with
+    int      fd;                        // The file being written, -1 - none
+    uint32_t ulFile;                    // Number of the file being written
+    uint64_t ullFileSize;               // Size of the file being written so far [in bytes]
+    uint64_t ullStampBase;              // Time stamp the file started at
+    trace_t *apxSel[TRACE_DRAIN_MAX];   // The trace buffers to drain
+    uint32_t ulSels;                    // Number of trace buffers to drain
+#if defined(TRACE_USE_REGISTRY)
+    uint32_t aulSelSlot[TRACE_DRAIN_MAX];   // 1 + registry slot of each trace buffer to drain, 0 - not registered
+    uint32_t aulSelSerial[TRACE_DRAIN_MAX]; // Registration of each trace buffer to drain (see gaulTraceRegSerial)
+    uint32_t ulRegGen;                  // Generation of the registry the trace buffers were selected at
+    bool     bReg;                      // true - follow the registered trace buffers as they come and go
+#endif // defined(TRACE_USE_REGISTRY)
+    trace_drain_buf_t axBuf[TRACE_DRAIN_MAX];   // Read cursors, the index is the id of the trace buffer in the files
+    uint32_t ulBufs;                    // Number of read cursors
+    uint64_t aullStrKey[TRACE_DRAIN_STRS];  // Message of each slot of the message index of the file
+    uint32_t aulStrIdx[TRACE_DRAIN_STRS];   // 1 + index of the message of each slot in the file, 0 - free
+    uint32_t ulStrs;                    // Number of messages in the file
+    size_t   xChunk;                    // Number of bytes staged in aucChunk
+    uint8_t  aucChunk[TRACE_DRAIN_CHUNK];   // Stages the entries of many trace lines
+    trace_drain_stats_t xStats;         // Statistics, read by other threads
+} trace_drain_t;
+#endif // defined(TRACE_USE_DRAIN)
 
 /********************* Configuration *************************/
 /********************* Global Variables **********************/
 #ifdef TRACE_USE_CONFIG_FILE
 // Instantiate the trace buffers
-#undef  TRACE_CONFIG
-#define TRACE_CONFIG    TRACE_INSTANTIATE
+#undef  TRACE_CONFIG_EX
+#define TRACE_CONFIG_EX TRACE_INSTANTIATE
 #include TRACE_USE_CONFIG_FILE
 
 // Define the trace buffer array
-#undef  TRACE_CONFIG
-#define TRACE_CONFIG    TRACE_ELEMENT
+#undef  TRACE_CONFIG_EX
+#define TRACE_CONFIG_EX TRACE_ELEMENT
 trace_t * gapxTraceAll[] =
 {
     #include TRACE_USE_CONFIG_FILE
 };
+
+#if defined(TRACE_USE_SHM)
+// Define the array of the trace buffer pointers, which are moved to the shared memory segment
+#undef  TRACE_CONFIG_EX
+#define TRACE_CONFIG_EX TRACE_REFERENCE
+static trace_t ** const gappxTraceRef[] =
+{
+    #include TRACE_USE_CONFIG_FILE
+};
+#endif // defined(TRACE_USE_SHM)
 #endif // TRACE_USE_CONFIG
 
-/********************* Exported Functions ********************/
-void trace_init(trace_t *This, char *name, trace_line_t *pxLine, uint16_t usDepth, bool bIsWrap)
+#if defined(TRACE_USE_MSG_ID)
+static const char *gapcTraceMsgDyn[TRACE_MSG_DYN_MAX];      // Messages interned at run time, indexed by ID & ~TRACE_MSG_DYN
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_HZ)
+static uint64_t gullTraceTickHz = 0;                        // Rate of TRACE_GET_TICK64() [in Hz], 0 - not calibrated
+#endif // defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_HZ)
+
+#if defined(TRACE_USE_SHARDS)
+static uint8_t gucShardKeys = 0;                            // Number of shard slots handed out
+static TRACE_THREAD_LOCAL trace_t *gapxShard[TRACE_SHARD_MAX]; // This thread's shard of each TRACE_MODE_SHARD buffer
+static pthread_key_t gxShardExit;                           // Frees the shards of a thread as it exits
+static pthread_once_t gxShardOnce = PTHREAD_ONCE_INIT;      // Creates gxShardExit once
+#endif // defined(TRACE_USE_SHARDS)
+
+#if defined(TRACE_USE_SPANS)
+TRACE_THREAD_LOCAL uint32_t gulTraceTid = 0;                // This thread's ID, 0 - not read yet
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_USE_SHM)
+static trace_shm_hdr_t *gpxTraceShm = NULL;                 // The shared memory segment, NULL - not created
+static char gacTraceShmName[TRACE_SHM_NAME_MAX];            // Name of the shared memory segment
+extern const char __executable_start[] __attribute__((weak));   // Start of the executable, set by the linker
+#endif // defined(TRACE_USE_SHM)
+
+#if defined(TRACE_USE_INSTRUMENT)
+static TRACE_THREAD_LOCAL uint32_t gulTraceFuncDepth = 0;  // Call depth of this thread
+static TRACE_THREAD_LOCAL uint32_t gulTraceFuncSkip = 0;   // 1 + call depth of the excluded function running, 0 - none
+static TRACE_THREAD_LOCAL uint8_t gucTraceFuncOff = 0;     // TRACE_FUNC_OFF_xxx, 0 - traced
+static const void *gapvTraceFuncExclude[TRACE_FUNC_EXCLUDE_MAX];   // Functions excluded by trace_func_exclude()
+static uint32_t gulTraceFuncExcludes = 0;                  // Number of slots of gapvTraceFuncExclude taken
+static trace_func_sym_t gaxTraceFuncSym[TRACE_FUNC_SYM_CACHE];  // Symbols resolved by trace_func_symbol()
+static trace_func_elf_t *gaxTraceFuncElf = NULL;           // Function symbols of the executable, by address
+static uint32_t gulTraceFuncElfs = 0;                      // Number of function symbols of the executable
+static char *gpcTraceFuncElfStr = NULL;                    // String table of the symbols of the executable
+static bool gbTraceFuncElf = false;                        // true - the symbol table was read
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_PERSIST)
+static char gacTracePrev[TRACE_SHM_NAME_MAX + sizeof(TRACE_PERSIST_PREV)];   // File of the previous session, "" - none
+static bool gbTracePrevCrashed = false;                     // true - the previous session ended without exit()
+#endif // defined(TRACE_USE_PERSIST)
+
+#if defined(TRACE_USE_DRAIN)
+static trace_drain_t gxTraceDrain = { .fd = -1 };          // State of the drain thread
+static pthread_t gxTraceDrainThread;                        // The drain thread
+static bool gbTraceDrainRun = false;                        // true - the drain thread was started
+static bool gbTraceDrainStop = false;                       // true - the drain thread is asked to stop
+#endif // defined(TRACE_USE_DRAIN)
+
+#if defined(TRACE_USE_REGISTRY)
+static trace_t *gapxTraceReg[TRACE_REGISTRY_MAX];           // Trace buffers registered at run time, NULL - free slot
+static uint32_t gaulTraceRegSerial[TRACE_REGISTRY_MAX];     // Generation each slot was registered at, tells a reused slot
+static uint32_t gulTraceRegSlots = 0;                       // Number of slots the readers scan
+static uint32_t gaulTraceRegPins[TRACE_REGISTRY_MAX];       // Number of readers holding each slot (see trace_reg_pin())
+static uint32_t gulTraceRegGen = 0;                         // Generation, counts the registrations and removals
+static uint8_t gucTraceRegLock = 0;                         // Spin lock of the writers of the registry
+#endif // defined(TRACE_USE_REGISTRY)
+
+#if defined(TRACE_USE_ARENA)
+static uint8_t *gpucTraceArena = NULL;                      // The pool, NULL - not set up
+static size_t gxTraceArenaSize = 0;                         // Size of the pool [in bytes]
+static size_t gxTraceArenaUsed = 0;                         // Number of bytes allocated, including the block headers
+static uint8_t gucTraceArenaLock = 0;                       // Spin lock of the pool
+#endif // defined(TRACE_USE_ARENA)
+
+/********************* Local Functions ***********************/
+#if defined(TRACE_USE_HUGEPAGE)
+/**
+ * @brief      Ask for the huge pages within a ring to be backed by huge pages.
+ *             Must be called before the ring is first written.
+ *
+ * @param      pvRing  The ring
+ * @param[in]  xSize   Size of the ring [in bytes]
+ */
+static void trace_huge_advise(void *pvRing, size_t xSize)
 {
-    This->usDepth = usDepth;
-    This->bIsWrap = bIsWrap;
-    This->usIdx = 0;
-    This->ulCount = 0;
-    This->axLine = pxLine;
-    This->name = name;
+    uintptr_t xStart = ((uintptr_t)pvRing + TRACE_HUGE_PAGE - 1) & ~(uintptr_t)(TRACE_HUGE_PAGE - 1);
+    uintptr_t xEnd = ((uintptr_t)pvRing + xSize) & ~(uintptr_t)(TRACE_HUGE_PAGE - 1);
+
+    if (xEnd > xStart)
+    {
+        madvise((void *)xStart, xEnd - xStart, MADV_HUGEPAGE);
+    }
 }
 
-void trace(trace_t *This, char *pcMessage, uint32_t ulValue)
+#ifdef TRACE_USE_CONFIG_FILE
+/**
+ * @brief      Advise the rings of the configured trace buffers at startup, before the first trace
+ */
+__attribute__((constructor)) static void trace_huge_startup(void)
 {
-    // Step 1: Lock the resource
-    TRACE_LOCK();
-    // Step 2: Always count the number of trace calls
-    This->ulCount++;
-    // Only store if there is room in the buffer (i.e. no-wrap case)
-    if (This->usIdx < This->usDepth)
+    int idx;
+    for (idx = 0; idx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); idx++)
+    {
+        trace_t *This = gapxTraceAll[idx];
+        trace_huge_advise(This->axLine, TRACE_LINES(TRACE_DEPTH(This), This->ucMode) * sizeof(trace_line_t));
+    }
+}
+#endif // TRACE_USE_CONFIG_FILE
+#endif // defined(TRACE_USE_HUGEPAGE)
+
+#if defined(TRACE_USE_REGISTRY)
+/**
+ * @brief      Gets the number of slots of the registry to scan
+ *
+ * @return     Number of slots
+ */
+static inline uint32_t trace_reg_slots(void)
+{
+    return __atomic_load_n(&gulTraceRegSlots, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief      Pin a slot of the registry.  The trace buffer in it stays registered
+ *             until trace_reg_unpin(), as trace_unregister() waits for the readers
+ *             pinning its slot.  A slot should not be pinned across blocking I/O.
+ *
+ * @param[in]  ulSlot  Slot of the registry
+ *
+ * @return     Trace buffer registered in the slot, NULL - free, the slot is not pinned
+ */
+static trace_t *trace_reg_pin(uint32_t ulSlot)
+{
+    trace_t *This;
+
+    // NOTE: Sequentially consistent with the removal of trace_unregister(), so either the
+    //       reader sees the slot freed, or trace_unregister() sees the reader
+    __atomic_add_fetch(&gaulTraceRegPins[ulSlot], 1, __ATOMIC_SEQ_CST);
+    This = __atomic_load_n(&gapxTraceReg[ulSlot], __ATOMIC_SEQ_CST);
+    if (This == NULL)
+    {
+        __atomic_sub_fetch(&gaulTraceRegPins[ulSlot], 1, __ATOMIC_RELEASE);
+    }
+    return This;
+}
+
+/**
+ * @brief      Unpin a slot of the registry pinned by trace_reg_pin()
+ *
+ * @param[in]  ulSlot  Slot of the registry
+ */
+static inline void trace_reg_unpin(uint32_t ulSlot)
+{
+    __atomic_sub_fetch(&gaulTraceRegPins[ulSlot], 1, __ATOMIC_RELEASE);
+}
+#endif // defined(TRACE_USE_REGISTRY)
+
+#if defined(TRACE_USE_SHM)
+/**
+ * @brief      Copy a string to the strings of the shared memory segment
+ *
+ * @param      pcString  The string, NULL - none
+ *
+ * @return     Offset of the copy in the segment, 0 if none or out of room
+ */
+static uint32_t trace_shm_string(const char *pcString)
+{
+    uint32_t ulLen, ulUsed;
+
+    if (pcString == NULL)
+    {
+        return 0;
+    }
+    // NOTE: Messages may be interned by many threads, so the room is claimed with a fetch-add
+    ulLen = strlen(pcString) + 1;
+    ulUsed = __atomic_fetch_add(&gpxTraceShm->ulStrUsed, ulLen, __ATOMIC_RELAXED);
+    if (ulUsed + ulLen > gpxTraceShm->ulStrSize)
+    {
+        return 0;
+    }
+    memcpy((char *)gpxTraceShm + gpxTraceShm->ulStrings + ulUsed, pcString, ulLen);
+    return gpxTraceShm->ulStrings + ulUsed;
+}
+
+#if defined(TRACE_USE_MSG_ID)
+/**
+ * @brief      Publish the string of a message ID to the message table of the
+ *             shared memory segment
+ *
+ * @param[in]  usMsgId    Message ID
+ * @param      pcMessage  Message string
+ */
+static void trace_shm_msg(uint16_t usMsgId, const char *pcMessage)
+{
+    uint32_t *pulTable;
+    uint32_t ulIdx = (usMsgId & TRACE_MSG_DYN) ? gpxTraceShm->usMsgLink + (usMsgId & ~TRACE_MSG_DYN) : usMsgId;
+
+    // The reader only sees the offset once the string is copied
+    pulTable = (uint32_t *)((char *)gpxTraceShm + gpxTraceShm->ulMsgTable);
+    __atomic_store_n(&pulTable[ulIdx], trace_shm_string(pcMessage), __ATOMIC_RELEASE);
+}
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_PERSIST)
+/**
+ * @brief      Create the file of the segment, keeping the file of the previous
+ *             session.  The file stays locked until the process ends, so another
+ *             instance of the program can't take it over.
+ *
+ * @param[in]  ullSize  Size of the segment [in bytes]
+ * @param      pcExe    Path of the executable
+ *
+ * @return     The segment, NULL if the file can't be created
+ */
+static trace_shm_hdr_t *trace_shm_create(uint64_t ullSize, const char *pcExe)
+{
+    const char *pcProgram = strrchr(pcExe, '/');
+    trace_shm_hdr_t *pxHdr = MAP_FAILED;
+    trace_shm_hdr_t xPrev;
+    int fd;
+
+    // Step 1: Lock the file of the program
+    snprintf(gacTraceShmName, sizeof(gacTraceShmName), TRACE_PERSIST_FILE, pcProgram ? pcProgram + 1 : "trace");
+    fd = open(gacTraceShmName, O_RDWR | O_CREAT | O_CLOEXEC, TRACE_SHM_MODE);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    // Step 2: Keep the file of the previous session, and lock a new one
+    if (pread(fd, &xPrev, sizeof(xPrev), 0) == sizeof(xPrev) && xPrev.ulMagic == TRACE_SHM_MAGIC)
     {
-        // Step 3.1: get the current index and increment
-        uint16_t usIdx = This->usIdx;
-        This->usIdx++;
-        // If Trace Wrap is enabled, then reset index
-        if (This->bIsWrap && This->usIdx >= This->usDepth)
+        snprintf(gacTracePrev, sizeof(gacTracePrev), "%s" TRACE_PERSIST_PREV, gacTraceShmName);
+        // NOTE: The lock was free, so a session still marked as running ended without exit()
+        gbTracePrevCrashed = (xPrev.ucState == TRACE_SHM_RUNNING);
+        if (rename(gacTraceShmName, gacTracePrev) != 0)
         {
-            This->usIdx = 0;
+            gacTracePrev[0] = '\0';
         }
-		// Step 3.2: Unlock the resource
-        TRACE_UNLOCK();
-        // Step 3.3: Store the trace line.  Assume there is enough time to write at slot before wrap
-#if defined(TRACE_GET_TICK)
-        This->axLine[usIdx].ulTimeStamp = TRACE_GET_TICK();  // Tick [in ms]
-#endif // defined(TRACE_GET_TICK)
-        This->axLine[usIdx].pcMessage = pcMessage;
-        This->axLine[usIdx].ulValue = ulValue;
+        close(fd);
+        fd = open(gacTraceShmName, O_RDWR | O_CREAT | O_CLOEXEC, TRACE_SHM_MODE);
+        if (fd < 0)
+        {
+            return NULL;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(fd);
+            return NULL;
+        }
+    }
+    // Step 3: Map the file zeroed.  It stays open, holding the lock, until the process ends
+    if (ftruncate(fd, 0) == 0 && ftruncate(fd, ullSize) == 0)
+    {
+        pxHdr = mmap(NULL, ullSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     }
-	else
-	{
-		// Step 3: Unlock the resource
-        TRACE_UNLOCK();
-	}
+    if (pxHdr == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    return pxHdr;
 }
+#else
+/**
+ * @brief      Create the shared memory segment, replacing the one of a former
+ *             process with the same ID
+ *
+ * @param[in]  ullSize  Size of the segment [in bytes]
+ * @param      pcExe    Path of the executable
+ *
+ * @return     The segment, NULL if it can't be created
+ */
+static trace_shm_hdr_t *trace_shm_create(uint64_t ullSize, const char *pcExe)
+{
+    trace_shm_hdr_t *pxHdr = MAP_FAILED;
+    int fd;
 
-#ifdef TRACE_OUTPUT
-void trace_dump(trace_t *This, bool bReset)
+    (void)pcExe;
+    snprintf(gacTraceShmName, sizeof(gacTraceShmName), TRACE_SHM_NAME, (unsigned)getpid());
+    shm_unlink(gacTraceShmName);
+    fd = shm_open(gacTraceShmName, O_CREAT | O_EXCL | O_RDWR, TRACE_SHM_MODE);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (ftruncate(fd, ullSize) == 0)
+    {
+        pxHdr = mmap(NULL, ullSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pxHdr == MAP_FAILED)
+    {
+        shm_unlink(gacTraceShmName);
+        return NULL;
+    }
+    return pxHdr;
+}
+#endif // defined(TRACE_USE_PERSIST)
+
+/**
+ * @brief      Create the shared memory segment at startup, ahead of the constructors
+ *             that may trace, and move the configured trace buffers into it.  The
+ *             trace buffers stay where they are if the segment can't be created.
+ */
+__attribute__((constructor(101))) static void trace_shm_startup(void)
 {
-    uint16_t usIdx, usIdy, usOffset;
+    const size_t xBufs = sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]);
+    trace_shm_hdr_t *pxHdr;
+    trace_shm_buf_t *axBuf;
+    uint32_t ulStrSize = 0, ulMsgs = 0;
+    uint64_t ullOff, ullSize;
+    size_t xIdx;
+    char acExe[TRACE_SHM_NAME_MAX];
+    ssize_t xExe;
+#if defined(TRACE_USE_MSG_ID)
+    const uint16_t usMsgLink = __stop_trace_msg - __start_trace_msg;  // NOTE: 0 if there are none
+#endif // defined(TRACE_USE_MSG_ID)
+
+    // Step 1: Size the header, descriptors, message table and strings, followed by the trace buffers
+    xExe = readlink("/proc/self/exe", acExe, sizeof(acExe) - 1);
+    acExe[(xExe > 0) ? xExe : 0] = '\0';
+    ulStrSize += strlen(acExe) + 1;
+    for (xIdx = 0; xIdx < xBufs; xIdx++)
+    {
+        ulStrSize += strlen(gapxTraceAll[xIdx]->name) + 1;
+    }
+#if defined(TRACE_USE_MSG_ID)
+    for (xIdx = 0; xIdx < usMsgLink; xIdx++)
+    {
+        ulStrSize += __start_trace_msg[xIdx] ? strlen(__start_trace_msg[xIdx]) + 1 : 0;
+    }
+    ulStrSize += TRACE_SHM_STR_DYN;
+    ulMsgs = usMsgLink + TRACE_MSG_DYN_MAX;
+#endif // defined(TRACE_USE_MSG_ID)
+    ullOff = sizeof(trace_shm_hdr_t) + xBufs * sizeof(trace_shm_buf_t) + ulMsgs * sizeof(uint32_t);
+    ullSize = TRACE_SHM_ALIGN(ullOff + ulStrSize);
+    for (xIdx = 0; xIdx < xBufs; xIdx++)
+    {
+        trace_t *This = gapxTraceAll[xIdx];
+        ullSize += TRACE_SHM_ALIGN(sizeof(trace_t)) + TRACE_SHM_ALIGN(TRACE_LINES(TRACE_DEPTH(This), This->ucMode) * sizeof(trace_line_t));
+    }
+
+    // Step 2: Create the segment
+    if ((pxHdr = trace_shm_create(ullSize, acExe)) == NULL)
+    {
+        return;
+    }
+
+    // Step 3: Describe the layout of the trace lines and trace buffers
+    gpxTraceShm = pxHdr;
+    pxHdr->usVersion = TRACE_SHM_VERSION;
+    pxHdr->usHdrSize = sizeof(*pxHdr);
+    pxHdr->ullSize = ullSize;
+    pxHdr->ulPid = getpid();
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    pxHdr->ucFlags |= TRACE_BIN_BIG_ENDIAN;
+#endif // __BYTE_ORDER__
+    pxHdr->ucFlags |= (sizeof(void *) == sizeof(uint64_t)) ? TRACE_BIN_PTR_64 : 0;
+#if defined(TRACE_USE_TICK64)
+    pxHdr->ucFlags |= TRACE_BIN_TICK64;
+    pxHdr->ucTickShift = TRACE_TICK_SHIFT;
+#if defined(TRACE_TICK_HZ)
+    pxHdr->ullTickHz = TRACE_TICK_HZ;
+#else
+    // NOTE: Set by trace_tick_calibrate()
+    pxHdr->ullTickHz = __atomic_load_n(&gullTraceTickHz, __ATOMIC_RELAXED);
+#endif // defined(TRACE_TICK_HZ)
+#if defined(TRACE_TICK_COMPACT)
+    TRACE_BIN_FIELD(pxHdr->xTickBase, trace_t, ullTickBase);
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+    pxHdr->usBufs = xBufs;
+    pxHdr->usLineSize = sizeof(trace_line_t);
 #if defined(TRACE_GET_TICK)
-    uint32_t ulLastStamp = 0;
+    TRACE_BIN_FIELD(pxHdr->xStamp, trace_line_t, xTimeStamp);
 #endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+    pxHdr->ucFlags |= TRACE_BIN_MSG_ID;
+    TRACE_BIN_FIELD(pxHdr->xMessage, trace_line_t, usMsgId);
+#else
+    TRACE_BIN_FIELD(pxHdr->xMessage, trace_line_t, pcMessage);
+#endif // defined(TRACE_USE_MSG_ID)
+    TRACE_BIN_FIELD(pxHdr->xValue, trace_line_t, ulValue);
+#if defined(TRACE_USE_SLOT_SEQ)
+    TRACE_BIN_FIELD(pxHdr->xSeq, trace_line_t, ulSeq);
+#endif // defined(TRACE_USE_SLOT_SEQ)
+#if defined(TRACE_USE_SPANS)
+    TRACE_BIN_FIELD(pxHdr->xTid, trace_line_t, ulTid);
+    TRACE_BIN_FIELD(pxHdr->xEvent, trace_line_t, ucEvent);
+#endif // defined(TRACE_USE_SPANS)
+    // NOTE: The free running index is the one of trace_valid()
+    TRACE_BIN_FIELD(pxHdr->xIdx, trace_t, ullIdx);
+    TRACE_BIN_FIELD(pxHdr->xCount, trace_t, ulCount);
+#if defined(TRACE_USE_MSG_ID)
+    pxHdr->usMsgLink = usMsgLink;
+    pxHdr->usMsgDyn = TRACE_MSG_DYN;
+    pxHdr->ulMsgDynMax = TRACE_MSG_DYN_MAX;
+    pxHdr->ulMsgTable = sizeof(trace_shm_hdr_t) + xBufs * sizeof(trace_shm_buf_t);
+#endif // defined(TRACE_USE_MSG_ID)
+    pxHdr->ulStrings = ullOff;
+    pxHdr->ulStrSize = ulStrSize;
+    // The executable and where it is loaded, to find the message strings of the session after it ended
+    pxHdr->ulExe = trace_shm_string(acExe);
+    pxHdr->ullImage = (uintptr_t)__executable_start;
+    pxHdr->ullStartTime = time(NULL);
+    pxHdr->ucState = TRACE_SHM_RUNNING;
 
-    TRACE_DUMP_LOCK();
+    // Step 4: Move the trace buffers to the segment, and point the TRACE* macros at them
+    axBuf = (trace_shm_buf_t *)(pxHdr + 1);
+    ullOff = TRACE_SHM_ALIGN(ullOff + ulStrSize);
+    for (xIdx = 0; xIdx < xBufs; xIdx++)
+    {
+        trace_t *This = gapxTraceAll[xIdx];
+        trace_t *pxTrace = (trace_t *)((char *)pxHdr + ullOff);
+        size_t xRing = TRACE_LINES(TRACE_DEPTH(This), This->ucMode) * sizeof(trace_line_t);
 
-    usOffset = (This->bIsWrap) ? This->usIdx : 0;
-    TRACE_OUTPUT(TRACE_NEWLINE "====TRACE[%s] (total:%d, depth:%d)====  " TRACE_NEWLINE, This->name, This->ulCount, This->usDepth);
-    // Output the trace buffer
-    for (usIdx = 0; usIdx < This->usDepth; usIdx++)
+        axBuf[xIdx].ullTrace = ullOff;
+        ullOff += TRACE_SHM_ALIGN(sizeof(trace_t));
+        axBuf[xIdx].ullRing = ullOff;
+        axBuf[xIdx].ulDepth = TRACE_DEPTH(This);
+        axBuf[xIdx].ulName = trace_shm_string(This->name);
+        axBuf[xIdx].ucMode = This->ucMode;
+        axBuf[xIdx].bIsWrap = This->bIsWrap;
+#if defined(TRACE_USE_INSTRUMENT)
+        axBuf[xIdx].bFunc = This->bFunc;
+#endif // defined(TRACE_USE_INSTRUMENT)
+#if defined(TRACE_USE_SHARDS)
+        axBuf[xIdx].bLines = (This->ucMode == TRACE_MODE_LINE);
+#else
+        axBuf[xIdx].bLines = (This->ucMode == TRACE_MODE_LINE || This->ucMode == TRACE_MODE_SHARD);
+#endif // defined(TRACE_USE_SHARDS)
+        *pxTrace = *This;
+        pxTrace->axLine = (trace_line_t *)((char *)pxHdr + ullOff);
+        memcpy(pxTrace->axLine, This->axLine, xRing);
+        ullOff += TRACE_SHM_ALIGN(xRing);
+        gapxTraceAll[xIdx] = pxTrace;
+        *gappxTraceRef[xIdx] = pxTrace;
+    }
+#if defined(TRACE_USE_MSG_ID)
+    // Step 5: Publish the link time messages, and any interned so far
+    for (xIdx = 0; xIdx < usMsgLink; xIdx++)
     {
-        usIdy = (usOffset + usIdx) % This->usDepth;
-        // Only print valid messages
-        if (This->axLine[usIdy].pcMessage && usIdy < This->ulCount)
-        {
-            uint32_t ulValue = This->axLine[usIdy].ulValue;
-#if defined(TRACE_GET_TICK)
-            uint32_t ulStamp = This->axLine[usIdy].ulTimeStamp;
-            TRACE_OUTPUT("  %6d|%10d ms| %s: 0x%08x (%d)" TRACE_NEWLINE, usIdy, ulStamp - ulLastStamp, This->axLine[usIdy].pcMessage, ulValue, ulValue);
-            ulLastStamp = ulStamp;
+        trace_shm_msg(xIdx, __start_trace_msg[xIdx]);
+    }
+    for (xIdx = 0; xIdx < TRACE_MSG_DYN_MAX; xIdx++)
+    {
+        trace_shm_msg(TRACE_MSG_DYN | xIdx, __atomic_load_n(&gapcTraceMsgDyn[xIdx], __ATOMIC_ACQUIRE));
+    }
+#endif // defined(TRACE_USE_MSG_ID)
+    // Step 6: Let the readers attach
+    __atomic_store_n(&pxHdr->ulMagic, TRACE_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief      Mark the session as exited, and remove the name of the shared memory
+ *             segment.  The segment stays mapped for the traces of later destructors,
+ *             and is freed once the readers detach.  The file of TRACE_USE_PERSIST
+ *             is kept for the next session.
+ */
+__attribute__((destructor)) static void trace_shm_exit(void)
+{
+    if (gpxTraceShm)
+    {
+        __atomic_store_n(&gpxTraceShm->ucState, TRACE_SHM_EXITED, __ATOMIC_RELEASE);
+#if !defined(TRACE_USE_PERSIST)
+        shm_unlink(gacTraceShmName);
+#endif // !defined(TRACE_USE_PERSIST)
+    }
+}
+#endif // defined(TRACE_USE_SHM)
+
+/**
+ * @brief      Gets the oldest trace line and the number of valid trace lines
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param      pullFirst  Returns the free running index of the oldest trace line,
+ *                        its slot is TRACE_SLOT(This, *pullFirst)
+ *
+ * @return     Number of valid trace lines
+ */
+static uint32_t trace_valid(trace_t *This, uint64_t *pullFirst)
+{
+#if defined(TRACE_USE_ATOMIC)
+    uint64_t ullIdx = __atomic_load_n(&This->ullIdx, __ATOMIC_ACQUIRE);
 #else
-            TRACE_OUTPUT("  %6d| %s: 0x%08x (%d)" TRACE_NEWLINE, usIdy, This->axLine[usIdy].pcMessage, ulValue, ulValue);
-#endif // defined(TRACE_GET_TICK)
+    uint64_t ullIdx = This->ullIdx;
+#endif // defined(TRACE_USE_ATOMIC)
+#if defined(TRACE_USE_TRIGGER)
+    // A frozen buffer holds the trace lines up to the stop, later traces were only counted
+    if (TRACE_FROZEN(This, ullIdx))
+    {
+        ullIdx = This->ullStop;
+    }
+#endif // defined(TRACE_USE_TRIGGER)
+    *pullFirst = 0;
+    if (ullIdx < TRACE_DEPTH(This))
+    {
+        return (uint32_t)ullIdx;
+    }
+    if (This->bIsWrap)
+    {
+        *pullFirst = ullIdx - TRACE_DEPTH(This);
+    }
+    return TRACE_DEPTH(This);
+}
+
+/**
+ * @brief      Copy a trace line.  With TRACE_USE_SLOT_SEQ the copy is checked
+ *             against the writers, so no lock is needed.
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param[in]  ullIdx  Free running index of the trace line
+ * @param      pxOut   Receives the trace line
+ *
+ * @return     true - valid, false - being written or overwritten by a newer trace
+ */
+static inline bool trace_read(trace_t *This, uint64_t ullIdx, trace_line_t *pxOut)
+{
+    const trace_line_t *pxLine = &This->axLine[TRACE_SLOT(This, ullIdx)];
+#if defined(TRACE_USE_SLOT_SEQ)
+    uint32_t ulSeq = __atomic_load_n(&pxLine->ulSeq, __ATOMIC_ACQUIRE);
+    memcpy(pxOut, pxLine, sizeof(*pxOut));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return ulSeq == TRACE_SEQ(ullIdx) && __atomic_load_n(&pxLine->ulSeq, __ATOMIC_RELAXED) == ulSeq;
+#else
+    *pxOut = *pxLine;
+    return true;
+#endif // defined(TRACE_USE_SLOT_SEQ)
+}
+
+/**
+ * @brief      Reset the trace buffer for a new capture
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+static void trace_reset(trace_t *This)
+{
+#if defined(TRACE_USE_ATOMIC)
+    __atomic_store_n(&This->ullIdx, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&This->ulCount, 0, __ATOMIC_RELAXED);
+#else
+    This->ullIdx = 0;
+    This->ulCount = 0;
+#endif // defined(TRACE_USE_ATOMIC)
+    This->ulSlot = 0;
+#if defined(TRACE_USE_ARGS)
+    This->ulHead = 0;
+    This->ulTail = 0;
+    This->ulUsed = 0;
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        memset(This->axLine, 0, TRACE_DEPTH(This) * sizeof(trace_agg_t));
+    }
+#endif // defined(TRACE_USE_AGG)
+#if defined(TRACE_USE_TRIGGER)
+    if (This->ucTrig != TRACE_TRIG_OFF)
+    {
+        __atomic_store_n(&This->ucTrig, TRACE_TRIG_ARMED, __ATOMIC_RELEASE);
+    }
+#endif // defined(TRACE_USE_TRIGGER)
+#if defined(TRACE_USE_SAMPLING)
+    {
+        trace_site_t *pxSite;
+        for (pxSite = __atomic_load_n(&This->pxSite, __ATOMIC_ACQUIRE); pxSite; pxSite = pxSite->pxNext)
+        {
+            pxSite->ulCalls = 0;
+            pxSite->ulStored = 0;
+            pxSite->ulFolded = 0;
         }
     }
-    // Reset the trace buffer for a new capture
-    if (bReset)
+#endif // defined(TRACE_USE_SAMPLING)
+}
+
+#if defined(TRACE_USE_SAMPLING) || defined(TRACE_USE_SHARDS)
+/**
+ * @brief      Count calls in the total of a trace buffer without storing them
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ulCalls  Number of calls
+ */
+static void trace_count(trace_t *This, uint32_t ulCalls)
+{
+#if defined(TRACE_USE_ATOMIC)
+    __atomic_fetch_add(&This->ulCount, ulCalls, __ATOMIC_RELAXED);
+#else
+    TRACE_LOCK();
+    This->ulCount += ulCalls;
+    TRACE_UNLOCK();
+#endif // defined(TRACE_USE_ATOMIC)
+}
+#endif // defined(TRACE_USE_SAMPLING) || defined(TRACE_USE_SHARDS)
+
+#if defined(TRACE_USE_SHARDS)
+/**
+ * @brief      Claim the next trace line of a shard.  A shard has a single
+ *             writer, so neither a lock nor an atomic read-modify-write is used.
+ *
+ * @param      This     Pointer to the shard
+ * @param      pullIdx  Returns the free running index of the trace line
+ *
+ * @return     Trace line to write, or NULL if the trace is only counted
+ */
+static inline trace_line_t *trace_claim_private(trace_t *This, uint64_t *pullIdx)
+{
+    trace_line_t *pxLine;
+#if defined(TRACE_USE_ATOMIC)
+    uint64_t ullIdx = __atomic_load_n(&This->ullIdx, __ATOMIC_RELAXED);
+    if (!This->bIsWrap && ullIdx >= TRACE_DEPTH(This))
     {
-        This->usIdx = 0;
-        This->ulCount = 0;
+        __atomic_store_n(&This->ulCount, This->ulCount + 1, __ATOMIC_RELAXED);
+        return NULL;
     }
+    __atomic_store_n(&This->ullIdx, ullIdx + 1, __ATOMIC_RELAXED);
+#else
+    uint64_t ullIdx = This->ullIdx;
+    if (!This->bIsWrap && ullIdx >= TRACE_DEPTH(This))
+    {
+        This->ulCount++;
+        return NULL;
+    }
+    This->ullIdx = ullIdx + 1;
+#endif // defined(TRACE_USE_ATOMIC)
+    // The slot is reset at the depth, so no division
+    pxLine = &This->axLine[This->ulSlot];
+    if (++This->ulSlot >= TRACE_DEPTH(This))
+    {
+        This->ulSlot = 0;
+    }
+    *pullIdx = ullIdx;
+    return pxLine;
+}
 
-    TRACE_DUMP_UNLOCK();
+/**
+ * @brief      Gets the thread local shard slot of a TRACE_MODE_SHARD buffer,
+ *             assigning one on first use
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     1 + shard slot, or 0 if being assigned by another thread, or all
+ *             TRACE_SHARD_MAX slots are taken
+ */
+static uint8_t trace_shard_key(trace_t *This)
+{
+    uint8_t ucKey = __atomic_load_n(&This->ucShardKey, __ATOMIC_ACQUIRE);
+    uint8_t ucNew;
+
+    // Step 1: Claim the assignment, so a single thread takes a slot for the trace buffer
+    if (ucKey || !__atomic_compare_exchange_n(&This->ucShardKey, &ucKey, TRACE_SHARD_KEY_NONE, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        return (ucKey == TRACE_SHARD_KEY_NONE) ? 0 : ucKey;
+    }
+    // Step 2: Take the next free slot.  Out of slots, the trace buffer keeps TRACE_SHARD_KEY_NONE
+    ucNew = __atomic_load_n(&gucShardKeys, __ATOMIC_RELAXED);
+    do
+    {
+        if (ucNew >= TRACE_SHARD_MAX)
+        {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&gucShardKeys, &ucNew, ucNew + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ucNew++;
+    __atomic_store_n(&This->ucShardKey, ucNew, __ATOMIC_RELEASE);
+    return ucNew;
 }
 
-#ifdef TRACE_USE_CONFIG_FILE
-void trace_dump_all(bool bReset)
+/**
+ * @brief      Free the shards of a thread as it exits, so other threads take
+ *             them over rather than allocating new ones
+ *
+ * @param      pvArg  The thread's gapxShard
+ */
+static void trace_shard_exit(void *pvArg)
 {
+    trace_t **apxShard = pvArg;
     int idx;
-    for (idx = 0; idx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); idx++)
+
+    for (idx = 0; idx < TRACE_SHARD_MAX; idx++)
     {
-        trace_dump(gapxTraceAll[idx], bReset);
+        if (apxShard[idx])
+        {
+            __atomic_store_n(&apxShard[idx]->bShardFree, true, __ATOMIC_RELEASE);
+            apxShard[idx] = NULL;
+        }
     }
 }
-#endif // TRACE_USE_CONFIG_FILE
-#else
-void trace_dump(trace_t *This, bool bReset) { This = This; bReset = bReset; }
-void trace_dump_all(void) {}
-#endif // TRACE_OUTPUT
+
+/**
+ * @brief      Create the key that calls trace_shard_exit() as a thread exits
+ */
+static void trace_shard_once(void)
+{
+    pthread_key_create(&gxShardExit, trace_shard_exit);
+}
+
+/**
+ * @brief      Allocate a shard for the calling thread and add it to the shard list
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     Pointer to the new shard, or NULL if out of memory
+ */
+static trace_t *trace_shard_alloc(trace_t *This)
+{
+    // NOTE: The header and ring share one cache aligned block
+    size_t size = (sizeof(trace_t) + TRACE_DEPTH(This) * sizeof(trace_line_t) + TRACE_CACHE_LINE - 1) & ~(size_t)(TRACE_CACHE_LINE - 1);
+    trace_t *pxShard;
+    bool bFree;
+
+    // Step 1: Take over the shard of an exited thread.  Its trace lines are dropped,
+    //         as they would be attributed to the new owner, its total is kept
+    for (pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+    {
+        bFree = true;
+        if (__atomic_load_n(&pxShard->bShardFree, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&pxShard->bShardFree, &bFree, false, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            trace_count(This, trace_total(pxShard));
+            trace_reset(pxShard);
+            pxShard->ulTid = TRACE_GET_TID();
+            return pxShard;
+        }
+    }
+    // Step 2: Allocate a new one
+    pxShard = TRACE_MALLOC(size);
+    if (pxShard == NULL)
+    {
+        return NULL;
+    }
+#if defined(TRACE_USE_HUGEPAGE)
+    trace_huge_advise(pxShard, size);
+#endif // defined(TRACE_USE_HUGEPAGE)
+    memset(pxShard, 0, size);
+    trace_init(pxShard, This->name, (trace_line_t *)(pxShard + 1), TRACE_DEPTH(This), This->bIsWrap);
+    pxShard->ulTid = TRACE_GET_TID();
+#if defined(TRACE_USE_INSTRUMENT)
+    pxShard->bFunc = This->bFunc;
+#endif // defined(TRACE_USE_INSTRUMENT)
+    // Publish the shard to the dump
+    pxShard->pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&This->pxShard, &pxShard->pxShard, pxShard, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return pxShard;
+}
+
+/**
+ * @brief      Trace to the calling thread's shard of a TRACE_MODE_SHARD buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value to store
+ */
+static void trace_shard(trace_t *This, uint8_t ucEvent, trace_msg_t xMsg, uint32_t ulValue)
+{
+    uint8_t ucKey = trace_shard_key(This);
+    trace_t *pxShard;
+    trace_line_t *pxLine;
+    uint64_t ullIdx;
+
+    // NOTE: A trace without a shard is only counted in the total of the trace buffer
+    if (ucKey == 0)
+    {
+        trace_count(This, 1);
+        return;
+    }
+    // Step 1: Get a shard lazily on this thread's first trace call, to be freed as it exits
+    pxShard = gapxShard[ucKey - 1];
+    if (pxShard == NULL)
+    {
+        pxShard = gapxShard[ucKey - 1] = trace_shard_alloc(This);
+        if (pxShard == NULL)
+        {
+            trace_count(This, 1);
+            return;
+        }
+        pthread_once(&gxShardOnce, trace_shard_once);
+        pthread_setspecific(gxShardExit, gapxShard);
+    }
+    // Step 2: Trace to the private ring
+    pxLine = trace_claim_private(pxShard, &ullIdx);
+    if (pxLine)
+    {
+        trace_store(pxShard, pxLine, ullIdx, ucEvent, xMsg, ulValue);
+    }
+}
+#endif // defined(TRACE_USE_SHARDS)
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Gets the size of an argument as stored in a record
+ *
+ * @param      pxArg  The argument
+ *
+ * @return     Size of the value, excluding the type [in bytes]
+ */
+static inline uint32_t trace_arg_size(const trace_arg_t *pxArg)
+{
+    switch (pxArg->ucType)
+    {
+        case TRACE_ARG_U32:
+        case TRACE_ARG_I32:
+            return sizeof(uint32_t);
+        case TRACE_ARG_PTR:
+            return sizeof(void *);
+        case TRACE_ARG_STR:
+            return 1 + (pxArg->pc ? strnlen(pxArg->pc, TRACE_ARG_STR_MAX) : 0);
+        default:
+            return sizeof(uint64_t);
+    }
+}
+
+/**
+ * @brief      Store an argument in a record
+ *
+ * @param      pucDst  Where to store the argument
+ * @param      pxArg   The argument
+ *
+ * @return     Where to store the next argument
+ */
+static inline uint8_t *trace_arg_put(uint8_t *pucDst, const trace_arg_t *pxArg)
+{
+    uint32_t ulSize = trace_arg_size(pxArg);
+
+    *pucDst++ = pxArg->ucType;
+    switch (pxArg->ucType)
+    {
+        case TRACE_ARG_U32:
+        case TRACE_ARG_I32:
+            memcpy(pucDst, &pxArg->ul, ulSize);
+            break;
+        case TRACE_ARG_PTR:
+            memcpy(pucDst, &pxArg->pv, ulSize);
+            break;
+        case TRACE_ARG_STR:
+            // NOTE: Strings are stored inline as a length and up to TRACE_ARG_STR_MAX characters
+            *pucDst = (uint8_t)(ulSize - 1);
+            memcpy(pucDst + 1, pxArg->pc, ulSize - 1);
+            break;
+        default:
+            memcpy(pucDst, &pxArg->ull, ulSize);
+            break;
+    }
+    return pucDst + ulSize;
+}
+
+/**
+ * @brief      Gets an argument as the value of a trace line
+ *
+ * @param      pxArg  The argument
+ *
+ * @return     The lower 32 bits of the argument
+ */
+static inline uint32_t trace_arg_value(const trace_arg_t *pxArg)
+{
+    switch (pxArg->ucType)
+    {
+        case TRACE_ARG_U32:
+        case TRACE_ARG_I32:
+            return pxArg->ul;
+        case TRACE_ARG_PTR:
+            return (uint32_t)(uintptr_t)pxArg->pv;
+        case TRACE_ARG_STR:
+            return (uint32_t)(uintptr_t)pxArg->pc;
+        case TRACE_ARG_DOUBLE:
+            return (uint32_t)(int32_t)pxArg->d;
+        default:
+            return (uint32_t)pxArg->ull;
+    }
+}
+
+#if defined(TRACE_USE_ATOMIC)
+/**
+ * @brief      Try the spin lock of a TRACE_MODE_ARGS buffer a bounded number of times
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     true - locked, false - held by another writer all along
+ */
+static inline bool trace_rec_lock(trace_t *This)
+{
+    uint32_t ulSpin;
+
+    for (ulSpin = 0; ulSpin < TRACE_REC_SPIN; ulSpin++)
+    {
+        if (!__atomic_test_and_set(&This->ucLock, __ATOMIC_ACQUIRE))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+#endif // defined(TRACE_USE_ATOMIC)
+
+/**
+ * @brief      Add a record of typed arguments to the byte ring of a
+ *             TRACE_MODE_ARGS buffer.  The record is reserved in one step
+ *             under the lock, evicting the oldest records if wrap is enabled,
+ *             then the arguments are copied and the record marked as done.
+ *             A record still being copied is never evicted, the new record is
+ *             only counted instead.
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ucArgs   Number of arguments
+ * @param      axArg    The arguments
+ */
+static void trace_rec_write(trace_t *This, uint8_t ucEvent, trace_msg_t xMsg, uint8_t ucArgs, const trace_arg_t *axArg)
+{
+    uint8_t *pucRing = (uint8_t *)This->axLine;
+    uint32_t ulCap = TRACE_REC_CAP(This);
+    uint32_t ulSize = sizeof(trace_rec_t), ulPad;
+    trace_rec_t *pxRec = NULL;
+    uint8_t *pucArg;
+    uint8_t ucIdx;
+
+    // Step 1: Size the record
+    for (ucIdx = 0; ucIdx < ucArgs; ucIdx++)
+    {
+        ulSize += 1 + trace_arg_size(&axArg[ucIdx]);
+    }
+    ulSize = (ulSize + TRACE_REC_ALIGN - 1) & ~(uint32_t)(TRACE_REC_ALIGN - 1);
+
+    // Step 2: Reserve the record.  A record larger than the ring is only counted
+#if defined(TRACE_USE_ATOMIC)
+    __atomic_fetch_add(&This->ulCount, 1, __ATOMIC_RELAXED);
+#endif // defined(TRACE_USE_ATOMIC)
+    if (!TRACE_REC_LOCK(This))
+    {
+        return;
+    }
+#if !defined(TRACE_USE_ATOMIC)
+    This->ulCount++;
+#endif // !defined(TRACE_USE_ATOMIC)
+    while (ulSize <= ulCap)
+    {
+        trace_rec_t *pxTail;
+        if (This->ulUsed == 0)
+        {
+            This->ulHead = 0;
+            This->ulTail = 0;
+        }
+        // A record does not wrap around the end of the ring, so pad to the end
+        ulPad = (This->ulHead + ulSize > ulCap) ? ulCap - This->ulHead : 0;
+        if (This->ulUsed + ulPad + ulSize <= ulCap)
+        {
+            if (ulPad)
+            {
+                pxRec = (trace_rec_t *)&pucRing[This->ulHead];
+                pxRec->usSize = ulPad;
+                pxRec->ucArgs = TRACE_REC_PAD;
+                pxRec->ucFlags = TRACE_REC_DONE;
+                This->ulHead = 0;
+                This->ulUsed += ulPad;
+            }
+            pxRec = (trace_rec_t *)&pucRing[This->ulHead];
+            pxRec->usSize = ulSize;
+            pxRec->ucArgs = ucArgs;
+            pxRec->ucFlags = 0;
+#if defined(TRACE_GET_TICK)
+            pxRec->xTimeStamp = trace_stamp(This);
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+            pxRec->usMsgId = xMsg;
+#else
+            pxRec->pcMessage = xMsg;
+#endif // defined(TRACE_USE_MSG_ID)
+#if defined(TRACE_USE_SPANS)
+            pxRec->ulTid = trace_tid();
+            pxRec->ucEvent = ucEvent;
+#endif // defined(TRACE_USE_SPANS)
+            This->ulHead = (This->ulHead + ulSize) % ulCap;
+            This->ulUsed += ulSize;
+            break;
+        }
+        // A full no-wrap buffer only counts the trace
+        if (!This->bIsWrap)
+        {
+            break;
+        }
+        // Evict the oldest record, unless its writer is still copying the arguments
+        pxTail = (trace_rec_t *)&pucRing[This->ulTail];
+        if (!(__atomic_load_n(&pxTail->ucFlags, __ATOMIC_ACQUIRE) & TRACE_REC_DONE))
+        {
+            break;
+        }
+        This->ulTail = (This->ulTail + pxTail->usSize) % ulCap;
+        This->ulUsed -= pxTail->usSize;
+    }
+    TRACE_REC_UNLOCK(This);
+#if !defined(TRACE_USE_SPANS)
+    (void)ucEvent;
+#endif // !defined(TRACE_USE_SPANS)
+
+    // Step 3: Store the arguments.  The record is not evicted until marked as done
+    if (pxRec)
+    {
+        pucArg = (uint8_t *)(pxRec + 1);
+        for (ucIdx = 0; ucIdx < ucArgs; ucIdx++)
+        {
+            pucArg = trace_arg_put(pucArg, &axArg[ucIdx]);
+        }
+        __atomic_store_n(&pxRec->ucFlags, TRACE_REC_DONE, __ATOMIC_RELEASE);
+    }
+}
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_AGG)
+/**
+ * @brief      Gets the log2 histogram bucket of a value
+ *
+ * @param[in]  ullValue  The value
+ *
+ * @return     0 for 0, otherwise 1 + the index of the highest set bit, up to TRACE_AGG_BUCKETS - 1
+ */
+static inline uint8_t trace_agg_bucket(uint64_t ullValue)
+{
+    uint8_t ucBucket = ullValue ? 64 - __builtin_clzll(ullValue) : 0;
+    return (ucBucket < TRACE_AGG_BUCKETS) ? ucBucket : TRACE_AGG_BUCKETS - 1;
+}
+
+/**
+ * @brief      Raise a statistic of a call site to a value
+ *
+ * @param      pulStat   The statistic
+ * @param[in]  ulValue   The value
+ */
+static inline void trace_agg_max(uint32_t *pulStat, uint32_t ulValue)
+{
+#if defined(TRACE_USE_ATOMIC)
+    uint32_t ulOld = __atomic_load_n(pulStat, __ATOMIC_RELAXED);
+    while (ulValue > ulOld && !__atomic_compare_exchange_n(pulStat, &ulOld, ulValue, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+    if (ulValue > *pulStat)
+    {
+        *pulStat = ulValue;
+    }
+#endif // defined(TRACE_USE_ATOMIC)
+}
+
+/**
+ * @brief      Gets the call site of a message in a TRACE_MODE_AGG buffer,
+ *             claiming an unused one on the first call
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param[in]  ullKey  Key of the call site
+ *
+ * @return     The call site, or NULL if all call sites are used by other messages
+ */
+static inline trace_agg_t *trace_agg_site(trace_t *This, uint64_t ullKey)
+{
+    trace_agg_t *axAgg = (trace_agg_t *)This->axLine;
+    uint32_t ulHash = (uint32_t)((ullKey * 0x9E3779B97F4A7C15ull) >> 32);
+    uint32_t ulProbe;
+
+    // Open addressing on the key, claiming an unused call site with a compare-and-swap
+    for (ulProbe = 0; ulProbe < TRACE_DEPTH(This); ulProbe++)
+    {
+        trace_agg_t *pxAgg = &axAgg[TRACE_SLOT(This, ulHash + ulProbe)];
+#if defined(TRACE_USE_ATOMIC)
+        uint64_t ullSite = __atomic_load_n(&pxAgg->ullKey, __ATOMIC_RELAXED);
+        if (ullSite == 0 &&
+            __atomic_compare_exchange_n(&pxAgg->ullKey, &ullSite, ullKey, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            return pxAgg;
+        }
+        if (ullSite == ullKey)
+        {
+            return pxAgg;
+        }
+#else
+        if (pxAgg->ullKey == 0)
+        {
+            pxAgg->ullKey = ullKey;
+        }
+        if (pxAgg->ullKey == ullKey)
+        {
+            return pxAgg;
+        }
+#endif // defined(TRACE_USE_ATOMIC)
+    }
+    return NULL;
+}
+
+/**
+ * @brief      Add a call to the statistics of its call site in a TRACE_MODE_AGG buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value of the call
+ */
+static void trace_agg(trace_t *This, trace_msg_t xMsg, uint32_t ulValue)
+{
+    uint64_t ullKey = TRACE_AGG_KEY(xMsg);
+    trace_agg_t *pxAgg;
+    uint64_t ullHist = ulValue;
+    bool bHist = true;
+
+    TRACE_AGG_LOCK();
+    // Step 1: Always count the number of trace calls, even without a call site
+#if defined(TRACE_USE_ATOMIC)
+    __atomic_fetch_add(&This->ulCount, 1, __ATOMIC_RELAXED);
+#else
+    This->ulCount++;
+#endif // defined(TRACE_USE_ATOMIC)
+    pxAgg = ullKey ? trace_agg_site(This, ullKey) : NULL;
+    if (pxAgg)
+    {
+#if defined(TRACE_GET_TICK)
+        // Step 2: A TRACE_MODE_AGG_GAP buffer histograms the time since the last call,
+        //         which the first call doesn't have
+        if (This->ucMode == TRACE_MODE_AGG_GAP)
+        {
+            trace_stamp_t xNow = trace_stamp(This);
+            uint64_t ullLast;
+#if defined(TRACE_USE_ATOMIC)
+            ullLast = __atomic_exchange_n(&pxAgg->ullLast, (uint64_t)xNow | TRACE_AGG_STAMPED, __ATOMIC_RELAXED);
+#else
+            ullLast = pxAgg->ullLast;
+            pxAgg->ullLast = (uint64_t)xNow | TRACE_AGG_STAMPED;
+#endif // defined(TRACE_USE_ATOMIC)
+            bHist = (ullLast & TRACE_AGG_STAMPED) != 0;
+            ullHist = (trace_stamp_t)(xNow - (trace_stamp_t)(ullLast & ~TRACE_AGG_STAMPED));
+        }
+#endif // defined(TRACE_GET_TICK)
+        // Step 3: Update the statistics
+        TRACE_AGG_ADD(&pxAgg->ulCount, 1);
+        TRACE_AGG_ADD(&pxAgg->ullSum, ulValue);
+        trace_agg_max(&pxAgg->ulMax, ulValue);
+        trace_agg_max(&pxAgg->ulNotMin, ~ulValue);
+        if (bHist)
+        {
+            TRACE_AGG_ADD(&pxAgg->aulHist[trace_agg_bucket(ullHist)], 1);
+        }
+    }
+    TRACE_AGG_UNLOCK();
+}
+#endif // defined(TRACE_USE_AGG)
+
+#if defined(TRACE_USE_TRIGGER)
+/**
+ * @brief      Checks if a trace matches the trigger of an armed trace buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value of the trace
+ *
+ * @return     true - the trace triggers
+ */
+static bool trace_trigger_match(trace_t *This, trace_msg_t xMsg, uint32_t ulValue)
+{
+#if defined(TRACE_USE_MSG_ID)
+    const char *pcMessage = trace_msg_string(xMsg);
+#else
+    const char *pcMessage = xMsg;
+#endif // defined(TRACE_USE_MSG_ID)
+
+    if (This->pcTrigMsg == NULL && This->pfnTrigCond == NULL)
+    {
+        return false;
+    }
+    // NOTE: A message has a different ID per call site, so messages match by string
+    if (This->pcTrigMsg && (pcMessage == NULL || (pcMessage != This->pcTrigMsg && strcmp(pcMessage, This->pcTrigMsg) != 0)))
+    {
+        return false;
+    }
+    return This->pfnTrigCond == NULL || This->pfnTrigCond(pcMessage, ulValue);
+}
+
+/**
+ * @brief      Triggers an armed trace buffer, once
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ullTrig  Trace index of the trace line marked by the trigger
+ * @param[in]  ullStop  Trace index to freeze at
+ */
+static void trace_trigger_fire(trace_t *This, uint64_t ullTrig, uint64_t ullStop)
+{
+    uint8_t ucArmed = TRACE_TRIG_ARMED;
+
+    if (__atomic_compare_exchange_n(&This->ucTrig, &ucArmed, TRACE_TRIG_FIRING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        This->ullTrig = ullTrig;
+        This->ullStop = ullStop;
+        __atomic_store_n(&This->ucTrig, TRACE_TRIG_FIRED, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief      Gets the position of the trigger among the valid trace lines
+ *
+ * @param      This      Pointer to the TRACE object
+ * @param[in]  ullFirst  Trace index of the first valid trace line
+ * @param[in]  ulValid   Number of valid trace lines
+ *
+ * @return     1 + position of the trace line marked by the trigger, 0 if none.  ulValid + 1
+ *             marks the end of the trace buffer (i.e. triggered after the last trace line)
+ */
+static uint32_t trace_trigger_pos(trace_t *This, uint64_t ullFirst, uint32_t ulValid)
+{
+    uint64_t ullPos;
+
+    if (__atomic_load_n(&This->ucTrig, __ATOMIC_ACQUIRE) != TRACE_TRIG_FIRED)
+    {
+        return 0;
+    }
+    ullPos = This->ullTrig - ullFirst;
+    return (ullPos <= ulValid) ? (uint32_t)ullPos + 1 : 0;
+}
+#endif // defined(TRACE_USE_TRIGGER)
+
+/**
+ * @brief      Add a trace line to the trace buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value to store
+ */
+static inline void trace_write(trace_t *This, uint8_t ucEvent, trace_msg_t xMsg, uint32_t ulValue)
+{
+#if defined(TRACE_USE_SHARDS)
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        trace_shard(This, ucEvent, xMsg, ulValue);
+        return;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_ARGS)
+    // A TRACE_MODE_ARGS buffer stores the value as a record of one argument
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        trace_arg_t xArg = trace_arg_u32(ulValue);
+        trace_rec_write(This, ucEvent, xMsg, 1, &xArg);
+        return;
+    }
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    // A TRACE_MODE_AGG buffer counts a span once, at its begin
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        if (ucEvent != TRACE_EVENT_END)
+        {
+            trace_agg(This, xMsg, ulValue);
+        }
+        return;
+    }
+#endif // defined(TRACE_USE_AGG)
+    trace_line_write(This, TRACE_DEPTH(This), ucEvent, xMsg, ulValue);
+}
+
+#if defined(TRACE_USE_TICK64)
+/**
+ * @brief      Gets the rate of TRACE_GET_TICK64(), calibrating it if not done yet
+ *
+ * @return     The tick rate [in Hz]
+ */
+static uint64_t trace_tick_hz(void)
+{
+#if defined(TRACE_TICK_HZ)
+    return TRACE_TICK_HZ;
+#else
+    uint64_t ullHz = __atomic_load_n(&gullTraceTickHz, __ATOMIC_RELAXED);
+    return ullHz ? ullHz : trace_tick_calibrate();
+#endif // defined(TRACE_TICK_HZ)
+}
+
+#if !defined(TRACE_TICK_HZ)
+/**
+ * @brief      Calibrates the tick rate at startup, before the first trace
+ */
+__attribute__((constructor)) static void trace_tick_startup(void)
+{
+    trace_tick_calibrate();
+}
+#endif // !defined(TRACE_TICK_HZ)
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_SAMPLING)
+/**
+ * @brief      Count the calls a call site skipped since they were last counted.
+ *             The skipped calls are only counted here, so the hot path of a
+ *             skipped call only updates the call site.
+ *
+ * @param      pxSite  The call site
+ */
+static void trace_site_fold(trace_site_t *pxSite)
+{
+    uint32_t ulSkipped = __atomic_load_n(&pxSite->ulCalls, __ATOMIC_RELAXED) - __atomic_load_n(&pxSite->ulStored, __ATOMIC_RELAXED);
+    uint32_t ulFolded = __atomic_load_n(&pxSite->ulFolded, __ATOMIC_RELAXED);
+
+    // NOTE: A call being stored may briefly look skipped, so only ever count forward
+    do
+    {
+        if ((int32_t)(ulSkipped - ulFolded) <= 0)
+        {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&pxSite->ulFolded, &ulFolded, ulSkipped, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    trace_count(pxSite->This, ulSkipped - ulFolded);
+}
+
+/**
+ * @brief      Count the skipped calls of all call sites of a trace buffer
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+static void trace_sites_fold(trace_t *This)
+{
+    trace_site_t *pxSite;
+    for (pxSite = __atomic_load_n(&This->pxSite, __ATOMIC_ACQUIRE); pxSite; pxSite = pxSite->pxNext)
+    {
+        trace_site_fold(pxSite);
+    }
+}
+
+/**
+ * @brief      Store a call of a call site, adding the call site to the list of
+ *             the trace buffer on its first call
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxSite   The call site
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value to store
+ */
+static void trace_site_write(trace_t *This, trace_site_t *pxSite, trace_msg_t xMsg, uint32_t ulValue)
+{
+    trace_t *pxOwner = NULL;
+
+    if (__atomic_load_n(&pxSite->This, __ATOMIC_ACQUIRE) == NULL)
+    {
+#if defined(TRACE_USE_MSG_ID)
+        pxSite->usMsgId = xMsg;
+#else
+        pxSite->pcMessage = xMsg;
+#endif // defined(TRACE_USE_MSG_ID)
+        // Only the caller that claims the call site lists it
+        if (__atomic_compare_exchange_n(&pxSite->This, &pxOwner, This, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            pxSite->pxNext = __atomic_load_n(&This->pxSite, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&This->pxSite, &pxSite->pxNext, pxSite, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        }
+    }
+    __atomic_fetch_add(&pxSite->ulStored, 1, __ATOMIC_RELAXED);
+    trace_write(This, TRACE_EVENT_INSTANT, xMsg, ulValue);
+    trace_site_fold(pxSite);
+}
+
+/**
+ * @brief      Counts a call of a TRACE_RATELIMITED() call site and checks if it is
+ *             within its rate.  A generic cell rate algorithm: the call is stored
+ *             unless it is more than ulBurst - 1 intervals ahead of its schedule,
+ *             so the first call is always stored.
+ *
+ * @param      pxSite  The call site
+ *
+ * @return     true - store the call, false - skip it
+ */
+static bool trace_site_admit(trace_site_t *pxSite)
+{
+#if defined(TRACE_USE_TICK64)
+    uint64_t ullNow = TRACE_GET_TICK64(), ullHz = trace_tick_hz();
+#elif defined(TRACE_GET_TICK)
+    uint64_t ullNow = (uint64_t)TRACE_GET_TICK() * 1000ull, ullHz = 1000000ull;   // [in us]
+#else
+    // NOTE: Without a time stamp the schedule never catches up, so only the first burst is stored
+    uint64_t ullNow = 0, ullHz = 1;
+#endif // defined(TRACE_USE_TICK64)
+    uint64_t ullInterval = (ullHz / pxSite->ulRate) ? ullHz / pxSite->ulRate : 1;
+    uint64_t ullLimit = ullInterval * (pxSite->ulBurst - 1);
+    uint64_t ullNext = __atomic_load_n(&pxSite->ullNext, __ATOMIC_RELAXED), ullNew;
+
+    __atomic_fetch_add(&pxSite->ulCalls, 1, __ATOMIC_RELAXED);
+    do
+    {
+        uint64_t ullStart = ullNext;
+        // A schedule further ahead than possible means the tick wrapped, so restart it
+        if ((int64_t)(ullStart - ullNow) > (int64_t)(ullLimit + ullInterval))
+        {
+            ullStart = ullNow;
+        }
+        if ((int64_t)(ullStart - ullNow) > (int64_t)ullLimit)
+        {
+            return false;
+        }
+        ullNew = (((int64_t)(ullStart - ullNow) > 0) ? ullStart : ullNow) + ullInterval;
+    } while (!__atomic_compare_exchange_n(&pxSite->ullNext, &ullNext, ullNew, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
+#endif // defined(TRACE_USE_SAMPLING)
+
+#if defined(TRACE_USE_INSTRUMENT)
+/**
+ * @brief      Trace the entry or exit of a function to TRACE_FUNC_BUFFER, if enabled
+ *             for TRACE_LEVEL_DEFAULT and TRACE_CATEGORY_DEFAULT
+ *
+ * @param[in]  ucEvent  TRACE_EVENT_BEGIN or TRACE_EVENT_END
+ * @param      pvFunc   Address of the function
+ * @param[in]  ulValue  Call depth, with TRACE_FUNC_EXIT for an exit
+ */
+static inline TRACE_FUNC_HOOK void trace_func_write(uint8_t ucEvent, void *pvFunc, uint32_t ulValue)
+{
+    trace_t *This = TRACE_CAT(gpxTrace, TRACE_FUNC_BUFFER);
+    const uint32_t ulBits = TRACE_ENABLE_BITS(TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT);
+
+    if ((This->ulEnable & ulBits) == ulBits)
+    {
+        gucTraceFuncOff |= TRACE_FUNC_OFF_HOOK;
+        trace_write(This, ucEvent, (trace_msg_t)pvFunc, ulValue);
+        gucTraceFuncOff &= ~TRACE_FUNC_OFF_HOOK;
+    }
+}
+
+/**
+ * @brief      Checks if a function is excluded by trace_func_exclude()
+ *
+ * @param      pvFunc  Address of the function
+ *
+ * @return     true - excluded, false - traced
+ */
+static inline TRACE_FUNC_HOOK bool trace_func_excluded(const void *pvFunc)
+{
+    uint32_t ulIdx, ulExcludes = __atomic_load_n(&gulTraceFuncExcludes, __ATOMIC_ACQUIRE);
+
+    // NOTE: A slot taken but not yet written is NULL, which matches no function
+    for (ulIdx = 0; ulIdx < ulExcludes && ulIdx < TRACE_FUNC_EXCLUDE_MAX; ulIdx++)
+    {
+        if (__atomic_load_n(&gapvTraceFuncExclude[ulIdx], __ATOMIC_RELAXED) == pvFunc)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief      Gets the load bias of the executable, the first object of dl_iterate_phdr()
+ */
+static int trace_func_bias(struct dl_phdr_info *pxInfo, size_t xSize, void *pvCtx)
+{
+    (void)xSize;
+    *(uintptr_t *)pvCtx = pxInfo->dlpi_addr;
+    return 1;
+}
+
+/**
+ * @brief      Orders the function symbols by address
+ */
+static int trace_func_elf_cmp(const void *pvA, const void *pvB)
+{
+    const trace_func_elf_t *pxA = pvA, *pxB = pvB;
+    return (pxA->xAddr > pxB->xAddr) - (pxA->xAddr < pxB->xAddr);
+}
+
+/**
+ * @brief      Reads the function symbols of the symbol table of the executable once,
+ *             which also has the static functions dladdr() does not know
+ */
+static void trace_func_elf_load(void)
+{
+    ElfW(Ehdr) xEhdr;
+    ElfW(Shdr) *axShdr = NULL;
+    ElfW(Sym) *axSym = NULL;
+    uintptr_t xBias = 0;
+    uint32_t ulSyms = 0, ulIdx;
+    int fd;
+
+    if (gbTraceFuncElf)
+    {
+        return;
+    }
+    gbTraceFuncElf = true;
+    if ((fd = open("/proc/self/exe", O_RDONLY)) < 0)
+    {
+        return;
+    }
+    // Step 1: Find the symbol table and its string table
+    if (pread(fd, &xEhdr, sizeof(xEhdr), 0) == sizeof(xEhdr) && memcmp(xEhdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+        xEhdr.e_shentsize == sizeof(ElfW(Shdr)) && (axShdr = malloc(xEhdr.e_shnum * sizeof(ElfW(Shdr)))) != NULL &&
+        pread(fd, axShdr, xEhdr.e_shnum * sizeof(ElfW(Shdr)), xEhdr.e_shoff) == (ssize_t)(xEhdr.e_shnum * sizeof(ElfW(Shdr))))
+    {
+        for (ulIdx = 0; ulIdx < xEhdr.e_shnum; ulIdx++)
+        {
+            ElfW(Shdr) *pxSym = &axShdr[ulIdx], *pxStr = &axShdr[axShdr[ulIdx].sh_link % xEhdr.e_shnum];
+            if (pxSym->sh_type != SHT_SYMTAB || pxSym->sh_entsize != sizeof(ElfW(Sym)))
+            {
+                continue;
+            }
+            axSym = malloc(pxSym->sh_size);
+            gpcTraceFuncElfStr = malloc(pxStr->sh_size + 1);
+            if (axSym && gpcTraceFuncElfStr && pread(fd, axSym, pxSym->sh_size, pxSym->sh_offset) == (ssize_t)pxSym->sh_size &&
+                pread(fd, gpcTraceFuncElfStr, pxStr->sh_size, pxStr->sh_offset) == (ssize_t)pxStr->sh_size)
+            {
+                gpcTraceFuncElfStr[pxStr->sh_size] = '\0';
+                ulSyms = pxSym->sh_size / sizeof(ElfW(Sym));
+            }
+            break;
+        }
+    }
+    close(fd);
+    // Step 2: Keep the defined functions, sorted by their address as loaded
+    if (ulSyms && (gaxTraceFuncElf = malloc(ulSyms * sizeof(trace_func_elf_t))) != NULL)
+    {
+        dl_iterate_phdr(trace_func_bias, &xBias);
+        for (ulIdx = 0; ulIdx < ulSyms; ulIdx++)
+        {
+            if (ELF64_ST_TYPE(axSym[ulIdx].st_info) == STT_FUNC && axSym[ulIdx].st_value && axSym[ulIdx].st_shndx != SHN_UNDEF)
+            {
+                trace_func_elf_t *pxElf = &gaxTraceFuncElf[gulTraceFuncElfs++];
+                pxElf->xAddr = xBias + axSym[ulIdx].st_value;
+                pxElf->ulSize = axSym[ulIdx].st_size;
+                pxElf->ulName = axSym[ulIdx].st_name;
+            }
+        }
+        qsort(gaxTraceFuncElf, gulTraceFuncElfs, sizeof(trace_func_elf_t), trace_func_elf_cmp);
+    }
+    free(axSym);
+    free(axShdr);
+}
+
+/**
+ * @brief      Finds the function symbol of the executable an address is in
+ *
+ * @param[in]  xAddr  The address
+ *
+ * @return     The function symbol, NULL if none
+ */
+static const trace_func_elf_t *trace_func_elf_find(uintptr_t xAddr)
+{
+    uint32_t ulLo = 0, ulHi;
+
+    trace_func_elf_load();
+    ulHi = gulTraceFuncElfs;
+    // Binary search for the last function at or before the address
+    while (ulLo < ulHi)
+    {
+        uint32_t ulMid = (ulLo + ulHi) / 2;
+        if (gaxTraceFuncElf[ulMid].xAddr <= xAddr)
+        {
+            ulLo = ulMid + 1;
+        }
+        else
+        {
+            ulHi = ulMid;
+        }
+    }
+    if (ulLo && xAddr - gaxTraceFuncElf[ulLo - 1].xAddr < (gaxTraceFuncElf[ulLo - 1].ulSize ? gaxTraceFuncElf[ulLo - 1].ulSize : 1))
+    {
+        return &gaxTraceFuncElf[ulLo - 1];
+    }
+    return NULL;
+}
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+/********************* Exported Functions ********************/
+void trace_init(trace_t *This, char *name, trace_line_t *pxLine, uint32_t ulDepth, bool bIsWrap)
+{
+#if defined(TRACE_USE_LARGE)
+    // Round down to a power of two, leaving the extra trace lines unused
+    while (ulDepth & (ulDepth - 1))
+    {
+        ulDepth &= ulDepth - 1;
+    }
+#endif // defined(TRACE_USE_LARGE)
+    TRACE_DEPTH(This) = ulDepth;
+    This->bIsWrap = bIsWrap;
+    This->ucMode = TRACE_MODE_LINE;
+    This->ulEnable = TRACE_ENABLE_ALL;
+    This->ullIdx = 0;
+    This->ulSlot = 0;
+    This->ulCount = 0;
+    This->axLine = pxLine;
+    This->name = name;
+#if defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+    This->ullTickBase = 0;
+#endif // defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+#if defined(TRACE_USE_ARGS)
+    This->ucLock = 0;
+    This->ulHead = 0;
+    This->ulTail = 0;
+    This->ulUsed = 0;
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_SHARDS)
+    This->ucShardKey = 0;
+    This->pxShard = NULL;
+    This->ulTid = 0;
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_SAMPLING)
+    This->pxSite = NULL;
+#endif // defined(TRACE_USE_SAMPLING)
+#if defined(TRACE_USE_TRIGGER)
+    This->ucTrig = TRACE_TRIG_OFF;
+#endif // defined(TRACE_USE_TRIGGER)
+#if defined(TRACE_USE_INSTRUMENT)
+    This->bFunc = false;
+#endif // defined(TRACE_USE_INSTRUMENT)
+}
+
+void trace(trace_t *This, char *pcMessage, uint32_t ulValue)
+{
+#if defined(TRACE_USE_MSG_ID)
+    trace_write(This, TRACE_EVENT_INSTANT, trace_msg_id(pcMessage), ulValue);
+#else
+    trace_write(This, TRACE_EVENT_INSTANT, pcMessage, ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+}
+
+uint32_t trace_snapshot(trace_t *This, trace_line_t *axLine, uint32_t ulMax)
+{
+    uint64_t ullFirst;
+    uint32_t ulValid, ulIdx, ulCopied = 0;
+
+    if (This->ucMode != TRACE_MODE_LINE)
+    {
+        return 0;
+    }
+    // Copy the most recent usMax trace lines
+    ulValid = trace_valid(This, &ullFirst);
+    if (ulValid > ulMax)
+    {
+        ullFirst += ulValid - ulMax;
+        ulValid = ulMax;
+    }
+    for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+    {
+        if (trace_read(This, ullFirst + ulIdx, &axLine[ulCopied]))
+        {
+            ulCopied++;
+        }
+    }
+    return ulCopied;
+}
+
+void trace_set_level(trace_t *This, uint8_t ucLevel)
+{
+    uint32_t ulLevels = (ucLevel >= TRACE_LEVEL_BITS) ? (1u << TRACE_LEVEL_BITS) - 1 : (1u << ucLevel) - 1;
+    This->ulEnable = (This->ulEnable & ~((1u << TRACE_LEVEL_BITS) - 1)) | ulLevels;
+}
+
+void trace_set_categories(trace_t *This, uint32_t ulCategories)
+{
+    This->ulEnable = (This->ulEnable & ((1u << TRACE_LEVEL_BITS) - 1)) | (ulCategories << TRACE_LEVEL_BITS);
+}
+
+#if defined(TRACE_USE_TICK64)
+uint64_t trace_tick_calibrate(void)
+{
+#if defined(TRACE_TICK_HZ)
+    return TRACE_TICK_HZ;
+#else
+    struct timespec xStart, xNow;
+    uint64_t ullStart, ullNs, ullHz;
+
+    // Count the ticks over a busy wait on the raw monotonic clock
+    clock_gettime(CLOCK_MONOTONIC_RAW, &xStart);
+    ullStart = TRACE_GET_TICK64();
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &xNow);
+        ullNs = (uint64_t)(xNow.tv_sec - xStart.tv_sec) * 1000000000ull + xNow.tv_nsec - xStart.tv_nsec;
+    } while (ullNs < TRACE_TICK_CALIBRATE_MS * 1000000ull);
+    ullHz = (TRACE_GET_TICK64() - ullStart) * 1000000000ull / ullNs;
+    __atomic_store_n(&gullTraceTickHz, ullHz, __ATOMIC_RELAXED);
+#if defined(TRACE_USE_SHM)
+    if (gpxTraceShm)
+    {
+        __atomic_store_n(&gpxTraceShm->ullTickHz, ullHz, __ATOMIC_RELAXED);
+    }
+#endif // defined(TRACE_USE_SHM)
+    return ullHz;
+#endif // defined(TRACE_TICK_HZ)
+}
+
+uint64_t trace_tick_ns(uint64_t ullTicks)
+{
+    uint64_t ullHz = trace_tick_hz();
+    // NOTE: Split to avoid overflow of ullTicks * 10^9
+    return ullTicks / ullHz * 1000000000ull + ullTicks % ullHz * 1000000000ull / ullHz;
+}
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_MSG_ID)
+void trace_id(trace_t *This, uint16_t usMsgId, uint32_t ulValue)
+{
+    trace_write(This, TRACE_EVENT_INSTANT, usMsgId, ulValue);
+}
+
+uint16_t trace_msg_id(const char *pcMessage)
+{
+    uint32_t ulHash = (uint32_t)((uintptr_t)pcMessage >> 2) * 2654435761u;
+    uint16_t usIdx, usProbe;
+
+    if (pcMessage == NULL)
+    {
+        return TRACE_MSG_NONE;
+    }
+    // Open addressing on the message pointer, claiming an empty entry with a compare-and-swap
+    for (usProbe = 0; usProbe < TRACE_MSG_DYN_MAX; usProbe++)
+    {
+        const char *pcEntry;
+        usIdx = (ulHash + usProbe) % TRACE_MSG_DYN_MAX;
+        pcEntry = __atomic_load_n(&gapcTraceMsgDyn[usIdx], __ATOMIC_ACQUIRE);
+        if (pcEntry == NULL &&
+            __atomic_compare_exchange_n(&gapcTraceMsgDyn[usIdx], &pcEntry, pcMessage, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+#if defined(TRACE_USE_SHM)
+            if (gpxTraceShm)
+            {
+                trace_shm_msg(TRACE_MSG_DYN | usIdx, pcMessage);
+            }
+#endif // defined(TRACE_USE_SHM)
+            return TRACE_MSG_DYN | usIdx;
+        }
+        if (pcEntry == pcMessage)
+        {
+            return TRACE_MSG_DYN | usIdx;
+        }
+    }
+    return TRACE_MSG_NONE;
+}
+
+const char *trace_msg_string(uint16_t usMsgId)
+{
+    if (usMsgId == TRACE_MSG_NONE)
+    {
+        return NULL;
+    }
+    if (usMsgId & TRACE_MSG_DYN)
+    {
+        usMsgId &= ~TRACE_MSG_DYN;
+        return (usMsgId < TRACE_MSG_DYN_MAX) ? __atomic_load_n(&gapcTraceMsgDyn[usMsgId], __ATOMIC_ACQUIRE) : NULL;
+    }
+    return (__start_trace_msg + usMsgId < __stop_trace_msg) ? __start_trace_msg[usMsgId] : NULL;
+}
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_INSTRUMENT)
+TRACE_FUNC_HOOK void __cyg_profile_func_enter(void *pvFunc, void *pvCall);
+TRACE_FUNC_HOOK void __cyg_profile_func_exit(void *pvFunc, void *pvCall);
+
+void __cyg_profile_func_enter(void *pvFunc, void *pvCall)
+{
+    uint32_t ulDepth = gulTraceFuncDepth++;
+
+    (void)pvCall;
+    if (gulTraceFuncSkip || gucTraceFuncOff)
+    {
+        return;
+    }
+    // An excluded function is skipped with the functions it calls, until it returns
+    if (trace_func_excluded(pvFunc))
+    {
+        gulTraceFuncSkip = ulDepth + 1;
+        return;
+    }
+    if (ulDepth < TRACE_FUNC_DEPTH_MAX)
+    {
+        trace_func_write(TRACE_EVENT_BEGIN, pvFunc, ulDepth);
+    }
+}
+
+void __cyg_profile_func_exit(void *pvFunc, void *pvCall)
+{
+    // NOTE: The exits skipped by longjmp() or exceptions leave the depth too deep, which is kept from wrapping
+    uint32_t ulDepth = gulTraceFuncDepth ? --gulTraceFuncDepth : 0;
+
+    (void)pvCall;
+    if (gulTraceFuncSkip)
+    {
+        if (gulTraceFuncSkip == ulDepth + 1)
+        {
+            gulTraceFuncSkip = 0;
+        }
+        return;
+    }
+    if (gucTraceFuncOff == 0 && ulDepth < TRACE_FUNC_DEPTH_MAX)
+    {
+        trace_func_write(TRACE_EVENT_END, pvFunc, ulDepth | TRACE_FUNC_EXIT);
+    }
+}
+
+bool trace_func_exclude(const void *pvFunc)
+{
+    uint32_t ulIdx = __atomic_fetch_add(&gulTraceFuncExcludes, 1, __ATOMIC_ACQ_REL);
+
+    if (pvFunc == NULL || ulIdx >= TRACE_FUNC_EXCLUDE_MAX)
+    {
+        return false;
+    }
+    __atomic_store_n(&gapvTraceFuncExclude[ulIdx], pvFunc, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool trace_func_exclude_symbol(const char *pcSymbol)
+{
+    void *pvFunc = dlsym(RTLD_DEFAULT, pcSymbol);
+    uint32_t ulIdx;
+
+    // The static functions are only in the symbol table of the executable
+    if (pvFunc == NULL)
+    {
+        trace_func_elf_load();
+        for (ulIdx = 0; ulIdx < gulTraceFuncElfs && pvFunc == NULL; ulIdx++)
+        {
+            if (strcmp(gpcTraceFuncElfStr + gaxTraceFuncElf[ulIdx].ulName, pcSymbol) == 0)
+            {
+                pvFunc = (void *)gaxTraceFuncElf[ulIdx].xAddr;
+            }
+        }
+    }
+    return trace_func_exclude(pvFunc);
+}
+
+void trace_func_thread(bool bEnable)
+{
+    if (bEnable)
+    {
+        gucTraceFuncOff &= ~TRACE_FUNC_OFF_THREAD;
+    }
+    else
+    {
+        gucTraceFuncOff |= TRACE_FUNC_OFF_THREAD;
+    }
+}
+
+const char *trace_func_symbol(const void *pvFunc)
+{
+    trace_func_sym_t *pxSym = &gaxTraceFuncSym[((uint32_t)((uintptr_t)pvFunc >> 4) * 2654435761u >> 16) & (TRACE_FUNC_SYM_CACHE - 1)];
+    const trace_func_elf_t *pxElf;
+    Dl_info xInfo;
+
+    if (pxSym->pvFunc == pvFunc && pxSym->pcName)
+    {
+        return pxSym->pcName;
+    }
+    // Step 1: The exported symbol of the function
+    memset(&xInfo, 0, sizeof(xInfo));
+    if (dladdr(pvFunc, &xInfo) && xInfo.dli_sname && xInfo.dli_saddr == pvFunc)
+    {
+        pxSym->pcName = xInfo.dli_sname;
+    }
+    // Step 2: The symbol table of the executable, e.g. for a static function
+    else if ((pxElf = trace_func_elf_find((uintptr_t)pvFunc)) != NULL)
+    {
+        pxSym->pcName = gpcTraceFuncElfStr + pxElf->ulName;
+    }
+    // Step 3: The nearest exported symbol, or the object, and the offset from it
+    else
+    {
+        const char *pcObject = xInfo.dli_fname ? strrchr(xInfo.dli_fname, '/') : NULL;
+        if (xInfo.dli_sname)
+        {
+            snprintf(pxSym->acName, sizeof(pxSym->acName), "%s+0x%lx", xInfo.dli_sname, (unsigned long)((uintptr_t)pvFunc - (uintptr_t)xInfo.dli_saddr));
+        }
+        else if (xInfo.dli_fname)
+        {
+            snprintf(pxSym->acName, sizeof(pxSym->acName), "%s+0x%lx", pcObject ? pcObject + 1 : xInfo.dli_fname,
+                     (unsigned long)((uintptr_t)pvFunc - (uintptr_t)xInfo.dli_fbase));
+        }
+        else
+        {
+            snprintf(pxSym->acName, sizeof(pxSym->acName), "%p", pvFunc);
+        }
+        pxSym->pcName = pxSym->acName;
+    }
+    pxSym->pvFunc = pvFunc;
+    return pxSym->pcName;
+}
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_SHM)
+const char *trace_shm_name(void)
+{
+    return gpxTraceShm ? gacTraceShmName : NULL;
+}
+#endif // defined(TRACE_USE_SHM)
+
+#if defined(TRACE_USE_PERSIST)
+const char *trace_persist_previous(bool *pbCrashed)
+{
+    if (pbCrashed)
+    {
+        *pbCrashed = gbTracePrevCrashed;
+    }
+    return gacTracePrev[0] ? gacTracePrev : NULL;
+}
+#endif // defined(TRACE_USE_PERSIST)
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Add a record of typed arguments, or the first argument as the
+ *             value for a trace buffer of another mode
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param[in]  xMsg    Message string or ID
+ * @param[in]  ucArgs  Number of arguments
+ * @param      axArg   The arguments
+ */
+static void trace_args_write(trace_t *This, trace_msg_t xMsg, uint8_t ucArgs, const trace_arg_t *axArg)
+{
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        trace_rec_write(This, TRACE_EVENT_INSTANT, xMsg, ucArgs, axArg);
+    }
+    else
+    {
+        trace_write(This, TRACE_EVENT_INSTANT, xMsg, ucArgs ? trace_arg_value(&axArg[0]) : 0);
+    }
+}
+
+void trace_args(trace_t *This, char *pcMessage, uint8_t ucArgs, const trace_arg_t *axArg)
+{
+#if defined(TRACE_USE_MSG_ID)
+    trace_args_write(This, trace_msg_id(pcMessage), ucArgs, axArg);
+#else
+    trace_args_write(This, pcMessage, ucArgs, axArg);
+#endif // defined(TRACE_USE_MSG_ID)
+}
+
+#if defined(TRACE_USE_MSG_ID)
+void trace_args_id(trace_t *This, uint16_t usMsgId, uint8_t ucArgs, const trace_arg_t *axArg)
+{
+    trace_args_write(This, usMsgId, ucArgs, axArg);
+}
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_SPANS)
+void trace_event(trace_t *This, uint8_t ucEvent, char *pcMessage, uint32_t ulValue)
+{
+#if defined(TRACE_USE_MSG_ID)
+    trace_write(This, ucEvent, trace_msg_id(pcMessage), ulValue);
+#else
+    trace_write(This, ucEvent, pcMessage, ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+}
+
+#if defined(TRACE_USE_MSG_ID)
+void trace_event_id(trace_t *This, uint8_t ucEvent, uint16_t usMsgId, uint32_t ulValue)
+{
+    trace_write(This, ucEvent, usMsgId, ulValue);
+}
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_USE_TRIGGER)
+void trace_trigger_arm(trace_t *This, const char *pcMessage, trace_cond_t pfnCond, uint32_t ulPost)
+{
+    // NOTE: Disarm while the trigger is changed, so no trace sees half of it
+    __atomic_store_n(&This->ucTrig, TRACE_TRIG_OFF, __ATOMIC_RELEASE);
+    This->pcTrigMsg = pcMessage;
+    This->pfnTrigCond = pfnCond;
+    This->ulPost = ulPost;
+    __atomic_store_n(&This->ucTrig, TRACE_TRIG_ARMED, __ATOMIC_RELEASE);
+}
+
+void trace_trigger_disarm(trace_t *This)
+{
+    __atomic_store_n(&This->ucTrig, TRACE_TRIG_OFF, __ATOMIC_RELEASE);
+}
+
+void trace_trigger(trace_t *This)
+{
+#if defined(TRACE_USE_ATOMIC)
+    uint64_t ullIdx = __atomic_load_n(&This->ullIdx, __ATOMIC_RELAXED);
+#else
+    uint64_t ullIdx = This->ullIdx;
+#endif // defined(TRACE_USE_ATOMIC)
+    trace_trigger_fire(This, ullIdx, ullIdx + This->ulPost);
+}
+
+bool trace_triggered(trace_t *This)
+{
+#if defined(TRACE_USE_ATOMIC)
+    return TRACE_FROZEN(This, __atomic_load_n(&This->ullIdx, __ATOMIC_RELAXED));
+#else
+    return TRACE_FROZEN(This, This->ullIdx);
+#endif // defined(TRACE_USE_ATOMIC)
+}
+
+void trace_trigger_hit(trace_t *This, uint64_t ullIdx, trace_msg_t xMsg, uint32_t ulValue)
+{
+    // The trace line of the trigger is kept before the ulPost trace lines after it
+    if (trace_trigger_match(This, xMsg, ulValue))
+    {
+        trace_trigger_fire(This, ullIdx, ullIdx + 1 + This->ulPost);
+    }
+}
+#endif // defined(TRACE_USE_TRIGGER)
+
+#if defined(TRACE_USE_SAMPLING)
+void trace_sampled(trace_t *This, trace_site_t *pxSite, char *pcMessage, uint32_t ulValue)
+{
+#if defined(TRACE_USE_MSG_ID)
+    trace_site_write(This, pxSite, trace_msg_id(pcMessage), ulValue);
+#else
+    trace_site_write(This, pxSite, pcMessage, ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+}
+
+void trace_ratelimited(trace_t *This, trace_site_t *pxSite, char *pcMessage, uint32_t ulValue)
+{
+    if (trace_site_admit(pxSite))
+    {
+        trace_sampled(This, pxSite, pcMessage, ulValue);
+    }
+}
+
+#if defined(TRACE_USE_MSG_ID)
+void trace_sampled_id(trace_t *This, trace_site_t *pxSite, uint16_t usMsgId, uint32_t ulValue)
+{
+    trace_site_write(This, pxSite, usMsgId, ulValue);
+}
+
+void trace_ratelimited_id(trace_t *This, trace_site_t *pxSite, uint16_t usMsgId, uint32_t ulValue)
+{
+    if (trace_site_admit(pxSite))
+    {
+        trace_site_write(This, pxSite, usMsgId, ulValue);
+    }
+}
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_SAMPLING)
+
+#if defined(TRACE_USE_TICK64)
+/**
+ * @brief      Extends the next time stamp to a 64-bit tick
+ *
+ * @param      pxClock  The clock
+ * @param[in]  xStamp   Time stamp of the next trace
+ *
+ * @return     The tick of the trace
+ */
+static inline uint64_t trace_clock_next(trace_clock_t *pxClock, trace_stamp_t xStamp)
+{
+#if defined(TRACE_TICK_COMPACT)
+    if (!pxClock->bStarted)
+    {
+        pxClock->xFirst = pxClock->xLast = xStamp;
+        pxClock->bStarted = true;
+    }
+    // NOTE: Signed difference, as the traces of concurrent writers may be slightly out of order
+    pxClock->ullTick += (uint64_t)(int64_t)(int32_t)(xStamp - pxClock->xLast) << TRACE_TICK_SHIFT;
+    pxClock->xLast = xStamp;
+    return pxClock->ullTick;
+#else
+    return pxClock->ullTick = xStamp;
+#endif // defined(TRACE_TICK_COMPACT)
+}
+
+#if defined(TRACE_TICK_COMPACT)
+/**
+ * @brief      Anchors a clock that was run over all time stamps of a trace buffer
+ *             to the tick of its newest trace, and rewinds it to the first time stamp
+ *
+ * @param      pxClock  The clock
+ * @param[in]  ullBase  Tick of the newest trace (trace_t::ullTickBase)
+ */
+static void trace_clock_anchor(trace_clock_t *pxClock, uint64_t ullBase)
+{
+    uint64_t ullNewest = ((ullBase >> TRACE_TICK_SHIFT) +
+                          (uint64_t)(int64_t)(int32_t)(pxClock->xLast - (trace_stamp_t)(ullBase >> TRACE_TICK_SHIFT))) << TRACE_TICK_SHIFT;
+    pxClock->ullTick = ullNewest - pxClock->ullTick;
+    pxClock->xLast = pxClock->xFirst;
+}
+
+/**
+ * @brief      Sets up a clock for the valid trace lines of a trace buffer
+ *
+ * @param      This      Pointer to the TRACE object
+ * @param[in]  ullFirst  Free running index of the oldest trace line
+ * @param[in]  ulValid   Number of valid trace lines
+ * @param      pxClock   Returns the clock
+ */
+static void trace_clock_lines(trace_t *This, uint64_t ullFirst, uint32_t ulValid, trace_clock_t *pxClock)
+{
+    trace_line_t xLine;
+    uint32_t ulIdx;
+
+    for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+    {
+        if (trace_read(This, ullFirst + ulIdx, &xLine))
+        {
+            trace_clock_next(pxClock, xLine.xTimeStamp);
+        }
+    }
+    trace_clock_anchor(pxClock, __atomic_load_n(&This->ullTickBase, __ATOMIC_RELAXED));
+}
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Sets up a clock for the records of a TRACE_MODE_ARGS buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxClock  Returns the clock
+ */
+static void trace_clock_records(trace_t *This, trace_clock_t *pxClock)
+{
+    const uint8_t *pucRing = (const uint8_t *)This->axLine;
+    uint32_t ulCap = TRACE_REC_CAP(This);
+    uint32_t ulOffset = This->ulTail, ulLeft = This->ulUsed;
+
+    while (ulLeft)
+    {
+        const trace_rec_t *pxRec = (const trace_rec_t *)&pucRing[ulOffset];
+        if (pxRec->usSize == 0 || pxRec->usSize > ulLeft)
+        {
+            break;
+        }
+        // NOTE: The time stamp is set when the record is reserved, padding has none
+        if (pxRec->ucArgs != TRACE_REC_PAD)
+        {
+            trace_clock_next(pxClock, pxRec->xTimeStamp);
+        }
+        ulOffset = (ulOffset + pxRec->usSize) % ulCap;
+        ulLeft -= pxRec->usSize;
+    }
+    trace_clock_anchor(pxClock, __atomic_load_n(&This->ullTickBase, __ATOMIC_RELAXED));
+}
+#endif // defined(TRACE_USE_ARGS)
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_FAST_DUMP)
+// Copies a string literal to the text and moves past it
+#define TRACE_TEXT_LIT(pc, pcLit)   do { memcpy(pc, pcLit, sizeof(pcLit) - 1); (pc) += sizeof(pcLit) - 1; } while (0)
+
+// Pairs of decimal digits of 00 to 99, so a division converts two digits
+static const char gacTraceDigits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * @brief      Initialize the text output stream
+ *
+ * @param      pxText   Output stream
+ * @param[in]  pfnSink  Receives the text
+ * @param      pvCtx    Context passed to pfnSink
+ */
+static void trace_text_init(trace_text_t *pxText, trace_sink_t pfnSink, void *pvCtx)
+{
+    pxText->pfnSink = pfnSink;
+    pxText->pvCtx = pvCtx;
+    pxText->xSize = 0;
+    pxText->xLen = 0;
+}
+
+/**
+ * @brief      Flush the staged text to the sink
+ *
+ * @param      pxText  Output stream
+ */
+static void trace_text_flush(trace_text_t *pxText)
+{
+    if (pxText->xLen)
+    {
+        pxText->pfnSink(pxText->pvCtx, pxText->acBuf, pxText->xLen);
+        pxText->xSize += pxText->xLen;
+        pxText->xLen = 0;
+    }
+}
+
+/**
+ * @brief      Get room for up to TRACE_TEXT_CHUNK bytes of text.  The caller
+ *             writes the text and passes the end of it to trace_text_commit()
+ *
+ * @param      pxText  Output stream
+ * @param[in]  xNeed   Room needed [in bytes]
+ *
+ * @return     Where to write the text
+ */
+static inline char *trace_text_reserve(trace_text_t *pxText, size_t xNeed)
+{
+    if (pxText->xLen + xNeed > TRACE_TEXT_CHUNK)
+    {
+        trace_text_flush(pxText);
+    }
+    return &pxText->acBuf[pxText->xLen];
+}
+
+/**
+ * @brief      Keep the text written to the room from trace_text_reserve()
+ *
+ * @param      pxText  Output stream
+ * @param      pcEnd   End of the text
+ */
+static inline void trace_text_commit(trace_text_t *pxText, char *pcEnd)
+{
+    pxText->xLen = pcEnd - pxText->acBuf;
+}
+
+/**
+ * @brief      Output a string.  A string too long to stage is passed on directly
+ *
+ * @param      pxText  Output stream
+ * @param      pcStr   The string
+ * @param[in]  xLen    Length of the string
+ */
+static inline void trace_text_put(trace_text_t *pxText, const char *pcStr, size_t xLen)
+{
+    if (pxText->xLen + xLen > TRACE_TEXT_CHUNK)
+    {
+        trace_text_flush(pxText);
+        if (xLen > TRACE_TEXT_CHUNK)
+        {
+            pxText->pfnSink(pxText->pvCtx, pcStr, xLen);
+            pxText->xSize += xLen;
+            return;
+        }
+    }
+    memcpy(&pxText->acBuf[pxText->xLen], pcStr, xLen);
+    pxText->xLen += xLen;
+}
+
+/**
+ * @brief      Convert a number to decimal, right aligned like printf("%*llu")
+ *
+ * @param      pc       Where to write the text
+ * @param[in]  ullMag   Magnitude of the number
+ * @param[in]  bNeg     true - the number is negative
+ * @param[in]  iWidth   Minimum width of the text
+ * @param[in]  cPad     Pads the text to the width, ' ' or '0'
+ *
+ * @return     The end of the text
+ */
+static inline char *trace_text_dec(char *pc, uint64_t ullMag, bool bNeg, int iWidth, char cPad)
+{
+    char acDigits[21];
+    char *pcDigit = &acDigits[sizeof(acDigits)];
+    int iLen;
+
+    while (ullMag >= 100)
+    {
+        pcDigit -= 2;
+        memcpy(pcDigit, &gacTraceDigits[(ullMag % 100) * 2], 2);
+        ullMag /= 100;
+    }
+    if (ullMag >= 10)
+    {
+        pcDigit -= 2;
+        memcpy(pcDigit, &gacTraceDigits[ullMag * 2], 2);
+    }
+    else
+    {
+        *--pcDigit = '0' + (char)ullMag;
+    }
+    if (bNeg)
+    {
+        *--pcDigit = '-';
+    }
+    iLen = (int)(&acDigits[sizeof(acDigits)] - pcDigit);
+    for (; iWidth > iLen; iWidth--)
+    {
+        *pc++ = cPad;
+    }
+    memcpy(pc, pcDigit, iLen);
+    return pc + iLen;
+}
+
+// Signed decimal of printf("%*d") and printf("%*lld")
+static inline char *trace_text_int(char *pc, int64_t llValue, int iWidth)
+{
+    return trace_text_dec(pc, (llValue < 0) ? 0 - (uint64_t)llValue : (uint64_t)llValue, llValue < 0, iWidth, ' ');
+}
+
+// Hexadecimal of printf("%08x")
+static inline char *trace_text_hex(char *pc, uint32_t ulValue)
+{
+    int idx;
+    for (idx = 7; idx >= 0; idx--)
+    {
+        pc[idx] = "0123456789abcdef"[ulValue & 0xF];
+        ulValue >>= 4;
+    }
+    return pc + 8;
+}
+
+/**
+ * @brief      Output the text of trace_dump() of a TRACE_MODE_LINE buffer, up
+ *             to the table of the sampled call sites
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param      pxText  Output stream
+ */
+static void trace_text_lines(trace_t *This, trace_text_t *pxText)
+{
+    uint64_t ullFirst;
+    uint32_t ulIdx, ulValid;
+    trace_line_t xLine;
+    const char *pcLast = NULL;
+    size_t xMsgLen = 0;
+    char *pc;
+#if defined(TRACE_USE_TICK64)
+    trace_clock_t xClock = { 0 };
+    uint64_t ullLastNs = 0;
+#elif defined(TRACE_GET_TICK)
+    uint32_t ulLastStamp = 0;
+#endif // defined(TRACE_USE_TICK64)
+#if defined(TRACE_USE_TRIGGER)
+    uint32_t ulTrigger;
+#endif // defined(TRACE_USE_TRIGGER)
+
+    ulValid = trace_valid(This, &ullFirst);
+    // Step 1: Output the banner
+    trace_text_put(pxText, TRACE_NEWLINE "====TRACE[", sizeof(TRACE_NEWLINE "====TRACE[") - 1);
+    trace_text_put(pxText, This->name, strlen(This->name));
+    pc = trace_text_reserve(pxText, TRACE_TEXT_FIELDS);
+    TRACE_TEXT_LIT(pc, "] (total:");
+    pc = trace_text_int(pc, (int32_t)trace_total(This), 0);
+    TRACE_TEXT_LIT(pc, ", depth:");
+    pc = trace_text_int(pc, (int32_t)TRACE_DEPTH(This), 0);
+    TRACE_TEXT_LIT(pc, ")====  " TRACE_NEWLINE);
+    trace_text_commit(pxText, pc);
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_lines(This, ullFirst, ulValid, &xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+#if defined(TRACE_USE_TRIGGER)
+    ulTrigger = trace_trigger_pos(This, ullFirst, ulValid);
+#endif // defined(TRACE_USE_TRIGGER)
+    // Step 2: Output the valid trace lines, the same as the format strings of trace_dump()
+    for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+    {
+        const char *pcMessage;
+#if defined(TRACE_USE_TRIGGER)
+        if (ulTrigger == ulIdx + 1)
+        {
+            trace_text_put(pxText, "  ------ trigger ------" TRACE_NEWLINE, sizeof("  ------ trigger ------" TRACE_NEWLINE) - 1);
+        }
+#endif // defined(TRACE_USE_TRIGGER)
+        // Only output valid messages
+        pcMessage = trace_read(This, ullFirst + ulIdx, &xLine) ? TRACE_LINE_NAME(This, &xLine) : NULL;
+        if (pcMessage == NULL)
+        {
+            continue;
+        }
+        // NOTE: Trace lines mostly repeat a few messages, so the length of the last one is kept
+#if defined(TRACE_USE_INSTRUMENT)
+        // NOTE: The cache of trace_func_symbol() reuses its buffers, so a symbol is always measured
+        if (pcMessage != pcLast || This->bFunc)
+#else
+        if (pcMessage != pcLast)
+#endif // defined(TRACE_USE_INSTRUMENT)
+        {
+            pcLast = pcMessage;
+            xMsgLen = strlen(pcMessage);
+        }
+        // A message too long to stage with the fields is output on its own
+        pc = trace_text_reserve(pxText, (xMsgLen <= TRACE_TEXT_CHUNK - TRACE_TEXT_FIELDS) ? TRACE_TEXT_FIELDS + xMsgLen : TRACE_TEXT_FIELDS);
+        TRACE_TEXT_LIT(pc, "  ");
+        pc = trace_text_int(pc, (int32_t)TRACE_SLOT(This, ullFirst + ulIdx), 6);
+        *pc++ = '|';
+#if defined(TRACE_USE_TICK64)
+        {
+            uint64_t ullNs = trace_tick_ns(trace_clock_next(&xClock, xLine.xTimeStamp));
+            pc = trace_text_dec(pc, ullNs / 1000000000ull, false, 7, ' ');
+            *pc++ = '.';
+            pc = trace_text_dec(pc, ullNs % 1000000000ull, false, 9, '0');
+            TRACE_TEXT_LIT(pc, " s|");
+            pc = trace_text_int(pc, ullLastNs ? (int64_t)(ullNs - ullLastNs) : 0, 12);
+            TRACE_TEXT_LIT(pc, " ns|");
+            ullLastNs = ullNs;
+        }
+#elif defined(TRACE_GET_TICK)
+        pc = trace_text_int(pc, (int32_t)(xLine.xTimeStamp - ulLastStamp), 10);
+        TRACE_TEXT_LIT(pc, " ms|");
+        ulLastStamp = xLine.xTimeStamp;
+#endif // defined(TRACE_USE_TICK64)
+#if defined(TRACE_USE_SPANS)
+        pc = trace_text_dec(pc, xLine.ulTid, false, 8, ' ');
+        *pc++ = '|';
+        *pc++ = ' ';
+        if (xLine.ucEvent == TRACE_EVENT_BEGIN)
+        {
+            TRACE_TEXT_LIT(pc, "-> ");
+        }
+        else if (xLine.ucEvent == TRACE_EVENT_END)
+        {
+            TRACE_TEXT_LIT(pc, "<- ");
+        }
+#else
+        *pc++ = ' ';
+#endif // defined(TRACE_USE_SPANS)
+        if (xMsgLen <= TRACE_TEXT_CHUNK - TRACE_TEXT_FIELDS)
+        {
+            memcpy(pc, pcMessage, xMsgLen);
+            pc += xMsgLen;
+        }
+        else
+        {
+            trace_text_commit(pxText, pc);
+            trace_text_put(pxText, pcMessage, xMsgLen);
+            pc = trace_text_reserve(pxText, TRACE_TEXT_FIELDS);
+        }
+        TRACE_TEXT_LIT(pc, ": 0x");
+        pc = trace_text_hex(pc, xLine.ulValue);
+        TRACE_TEXT_LIT(pc, " (");
+        pc = trace_text_int(pc, (int32_t)xLine.ulValue, 0);
+        TRACE_TEXT_LIT(pc, ")" TRACE_NEWLINE);
+        trace_text_commit(pxText, pc);
+    }
+#if defined(TRACE_USE_TRIGGER)
+    if (ulTrigger == ulValid + 1)
+    {
+        trace_text_put(pxText, "  ------ trigger ------" TRACE_NEWLINE, sizeof("  ------ trigger ------" TRACE_NEWLINE) - 1);
+    }
+#endif // defined(TRACE_USE_TRIGGER)
+}
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+#ifdef TRACE_OUTPUT
+#if defined(TRACE_USE_FAST_DUMP)
+// Sink of the text formatter for trace_dump()
+static void trace_text_output(void *pvCtx, const void *pvData, size_t xSize)
+{
+    (void)pvCtx;
+    TRACE_OUTPUT("%.*s", (int)xSize, (const char *)pvData);
+}
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+#if defined(TRACE_USE_TICK64)
+/**
+ * @brief      Output the absolute time of a trace and the time since the previous trace
+ *
+ * @param[in]  ullTick    Tick of the trace
+ * @param      pullLast   Time of the previous trace [in ns], 0 - none
+ */
+static void trace_dump_tick(uint64_t ullTick, uint64_t *pullLast)
+{
+    uint64_t ullNs = trace_tick_ns(ullTick);
+
+    TRACE_OUTPUT("%7llu.%09llu s|%12lld ns|", (unsigned long long)(ullNs / 1000000000ull), (unsigned long long)(ullNs % 1000000000ull),
+                 *pullLast ? (long long)(ullNs - *pullLast) : 0LL);
+    *pullLast = ullNs;
+}
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_SHARDS)
+/**
+ * @brief      Dump the shards of a TRACE_MODE_SHARD buffer as one view, merged
+ *             in order of oldest to newest time stamp
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param[in]  bReset  true - reset trace, false - leave as is
+ */
+static void trace_dump_shards(trace_t *This, bool bReset)
+{
+    trace_t *pxShard;
+    uint32_t ulTotal = trace_total(This);  // Calls only counted, e.g. skipped by TRACE_SAMPLED()
+    uint16_t usShards = 0, usIdx;
+#if defined(TRACE_USE_TICK64)
+    uint64_t ullLastNs = 0;
+#elif defined(TRACE_GET_TICK)
+    uint32_t ulLastStamp = 0;
+#endif // defined(TRACE_USE_TICK64)
+
+    // Step 1: Count the shards and the traces
+    for (pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+    {
+        usShards++;
+        ulTotal += trace_total(pxShard);
+    }
+    TRACE_OUTPUT(TRACE_NEWLINE "====TRACE[%s] (total:%d, depth:%d, shards:%d)====  " TRACE_NEWLINE, This->name, ulTotal, TRACE_DEPTH(This), usShards);
+    if (usShards == 0)
+    {
+        return;
+    }
+
+    {
+        // Step 2: Open a cursor on the valid trace lines of each shard
+        struct
+        {
+            trace_t *pxShard;
+            uint64_t ullNext;       // Free running index of the next trace line to read
+            uint32_t ulLeft;        // Number of trace lines left to read
+            bool     bHead;         // true - xHead holds the oldest unmerged trace line
+            trace_line_t xHead;
+#if defined(TRACE_USE_TICK64)
+            trace_clock_t xClock;   // Extends the time stamps of the shard
+#endif // defined(TRACE_USE_TICK64)
+        } axCursor[usShards];
+
+        usIdx = 0;
+        for (pxShard = This->pxShard; pxShard && usIdx < usShards; pxShard = pxShard->pxShard, usIdx++)
+        {
+            axCursor[usIdx].pxShard = pxShard;
+            axCursor[usIdx].ulLeft = trace_valid(pxShard, &axCursor[usIdx].ullNext);
+            axCursor[usIdx].bHead = false;
+#if defined(TRACE_USE_TICK64)
+            memset(&axCursor[usIdx].xClock, 0, sizeof(axCursor[usIdx].xClock));
+#if defined(TRACE_TICK_COMPACT)
+            trace_clock_lines(pxShard, axCursor[usIdx].ullNext, axCursor[usIdx].ulLeft, &axCursor[usIdx].xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+        }
+        // Step 3: k-way merge, repeatedly outputting the oldest head of all cursors
+        for (;;)
+        {
+            int iNext = -1;
+            trace_line_t *pxLine;
+            uint32_t ulValue;
+
+            for (usIdx = 0; usIdx < usShards; usIdx++)
+            {
+                // Read the next valid trace line of the shard
+                while (!axCursor[usIdx].bHead && axCursor[usIdx].ulLeft)
+                {
+                    axCursor[usIdx].bHead = trace_read(axCursor[usIdx].pxShard, axCursor[usIdx].ullNext++, &axCursor[usIdx].xHead);
+                    axCursor[usIdx].ulLeft--;
+                }
+                if (!axCursor[usIdx].bHead)
+                {
+                    continue;
+                }
+#if defined(TRACE_GET_TICK)
+                if (iNext < 0 || TRACE_STAMP_BEFORE(axCursor[usIdx].xHead.xTimeStamp, axCursor[iNext].xHead.xTimeStamp))
+#else
+                // Without a time stamp the shards are output one after another
+                if (iNext < 0)
+#endif // defined(TRACE_GET_TICK)
+                {
+                    iNext = usIdx;
+                }
+            }
+            if (iNext < 0)
+            {
+                break;
+            }
+            pxLine = &axCursor[iNext].xHead;
+            ulValue = pxLine->ulValue;
+#if defined(TRACE_USE_TICK64)
+            TRACE_OUTPUT("  %6d|", TRACE_SLOT(This, axCursor[iNext].ullNext - 1));
+            trace_dump_tick(trace_clock_next(&axCursor[iNext].xClock, pxLine->xTimeStamp), &ullLastNs);
+            TRACE_OUTPUT("%8u| " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE, axCursor[iNext].pxShard->ulTid,
+                         TRACE_EVENT_ARG(pxLine) TRACE_LINE_NAME(This, pxLine), ulValue, ulValue);
+#elif defined(TRACE_GET_TICK)
+            TRACE_OUTPUT("  %6d|%10d ms|%8u| " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE, TRACE_SLOT(This, axCursor[iNext].ullNext - 1),
+                         pxLine->xTimeStamp - ulLastStamp, axCursor[iNext].pxShard->ulTid, TRACE_EVENT_ARG(pxLine) TRACE_LINE_NAME(This, pxLine), ulValue, ulValue);
+            ulLastStamp = pxLine->xTimeStamp;
+#else
+            TRACE_OUTPUT("  %6d|%8u| " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE, TRACE_SLOT(This, axCursor[iNext].ullNext - 1),
+                         axCursor[iNext].pxShard->ulTid, TRACE_EVENT_ARG(pxLine) TRACE_LINE_NAME(This, pxLine), ulValue, ulValue);
+#endif // defined(TRACE_GET_TICK)
+            axCursor[iNext].bHead = false;
+        }
+    }
+    // Reset the shards for a new capture
+    if (bReset)
+    {
+        for (pxShard = This->pxShard; pxShard; pxShard = pxShard->pxShard)
+        {
+            trace_reset(pxShard);
+        }
+    }
+}
+#endif // defined(TRACE_USE_SHARDS)
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Output an argument of a record
+ *
+ * @param      pucArg  The stored argument
+ * @param      pcSep   Separator to output before the argument
+ *
+ * @return     The next stored argument
+ */
+static const uint8_t *trace_dump_arg(const uint8_t *pucArg, const char *pcSep)
+{
+    trace_arg_t xArg;
+    uint8_t ucLen;
+
+    xArg.ucType = *pucArg++;
+    switch (xArg.ucType)
+    {
+        case TRACE_ARG_U32:
+            memcpy(&xArg.ul, pucArg, sizeof(xArg.ul));
+            TRACE_OUTPUT("%s0x%08x (%u)", pcSep, xArg.ul, xArg.ul);
+            return pucArg + sizeof(xArg.ul);
+        case TRACE_ARG_I32:
+            memcpy(&xArg.l, pucArg, sizeof(xArg.l));
+            TRACE_OUTPUT("%s%d", pcSep, xArg.l);
+            return pucArg + sizeof(xArg.l);
+        case TRACE_ARG_I64:
+            memcpy(&xArg.ll, pucArg, sizeof(xArg.ll));
+            TRACE_OUTPUT("%s%lld", pcSep, (long long)xArg.ll);
+            return pucArg + sizeof(xArg.ll);
+        case TRACE_ARG_PTR:
+            memcpy(&xArg.pv, pucArg, sizeof(xArg.pv));
+            TRACE_OUTPUT("%s0x%llx", pcSep, (unsigned long long)(uintptr_t)xArg.pv);
+            return pucArg + sizeof(xArg.pv);
+        case TRACE_ARG_DOUBLE:
+            memcpy(&xArg.d, pucArg, sizeof(xArg.d));
+            TRACE_OUTPUT("%s%g", pcSep, xArg.d);
+            return pucArg + sizeof(xArg.d);
+        case TRACE_ARG_STR:
+            ucLen = *pucArg++;
+            TRACE_OUTPUT("%s\"%.*s\"", pcSep, ucLen, (const char *)pucArg);
+            return pucArg + ucLen;
+        default:
+            memcpy(&xArg.ull, pucArg, sizeof(xArg.ull));
+            TRACE_OUTPUT("%s0x%016llx (%llu)", pcSep, (unsigned long long)xArg.ull, (unsigned long long)xArg.ull);
+            return pucArg + sizeof(xArg.ull);
+    }
+}
+
+/**
+ * @brief      Dump the records of a TRACE_MODE_ARGS buffer
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+static void trace_dump_records(trace_t *This)
+{
+    const uint8_t *pucRing = (const uint8_t *)This->axLine;
+    uint32_t ulCap = TRACE_REC_CAP(This);
+    uint32_t ulOffset = This->ulTail, ulLeft = This->ulUsed;
+#if defined(TRACE_USE_TICK64)
+    trace_clock_t xClock = { 0 };
+    uint64_t ullLastNs = 0;
+#elif defined(TRACE_GET_TICK)
+    uint32_t ulLastStamp = 0;
+#endif // defined(TRACE_USE_TICK64)
+
+    TRACE_OUTPUT(TRACE_NEWLINE "====TRACE[%s] (total:%d, depth:%d bytes)====  " TRACE_NEWLINE, This->name, trace_total(This), ulCap);
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_records(This, &xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+    // Output the records from oldest to newest
+    while (ulLeft)
+    {
+        trace_rec_t *pxRec = (trace_rec_t *)&pucRing[ulOffset];
+        const char *pcMessage;
+        const uint8_t *pucArg;
+        uint8_t ucIdx;
+
+        if (pxRec->usSize == 0 || pxRec->usSize > ulLeft)
+        {
+            break;
+        }
+        // Only print records that are completely written and have a valid message
+        pcMessage = TRACE_LINE_MSG(pxRec);
+        if (pxRec->ucArgs != TRACE_REC_PAD && (__atomic_load_n(&pxRec->ucFlags, __ATOMIC_ACQUIRE) & TRACE_REC_DONE) && pcMessage)
+        {
+#if defined(TRACE_USE_TICK64)
+            TRACE_OUTPUT("  %6d|", ulOffset);
+            trace_dump_tick(trace_clock_next(&xClock, pxRec->xTimeStamp), &ullLastNs);
+            TRACE_OUTPUT(TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: ", TRACE_TID_ARG(pxRec) TRACE_EVENT_ARG(pxRec) pcMessage);
+#elif defined(TRACE_GET_TICK)
+            TRACE_OUTPUT("  %6d|%10d ms|" TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: ", ulOffset, pxRec->xTimeStamp - ulLastStamp,
+                         TRACE_TID_ARG(pxRec) TRACE_EVENT_ARG(pxRec) pcMessage);
+            ulLastStamp = pxRec->xTimeStamp;
+#else
+            TRACE_OUTPUT("  %6d|" TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: ", ulOffset, TRACE_TID_ARG(pxRec) TRACE_EVENT_ARG(pxRec) pcMessage);
+#endif // defined(TRACE_GET_TICK)
+            pucArg = (const uint8_t *)(pxRec + 1);
+            for (ucIdx = 0; ucIdx < pxRec->ucArgs; ucIdx++)
+            {
+                pucArg = trace_dump_arg(pucArg, ucIdx ? ", " : "");
+            }
+            TRACE_OUTPUT(TRACE_NEWLINE);
+        }
+        ulOffset = (ulOffset + pxRec->usSize) % ulCap;
+        ulLeft -= pxRec->usSize;
+    }
+}
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_AGG)
+/**
+ * @brief      Dump the statistics of the call sites of a TRACE_MODE_AGG buffer,
+ *             with the lower bound and number of calls of each used histogram bucket
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+static void trace_dump_agg(trace_t *This)
+{
+    const trace_agg_t *axAgg = (const trace_agg_t *)This->axLine;
+    const char *pcUnit = "value";
+    uint32_t ulIdx, ulSites = 0;
+    uint8_t ucBucket;
+
+#if defined(TRACE_USE_TICK64)
+    if (This->ucMode == TRACE_MODE_AGG_GAP)
+    {
+        pcUnit = "gap ns";
+    }
+#elif defined(TRACE_GET_TICK)
+    if (This->ucMode == TRACE_MODE_AGG_GAP)
+    {
+        pcUnit = "gap ms";
+    }
+#endif // defined(TRACE_USE_TICK64)
+    for (ulIdx = 0; ulIdx < TRACE_DEPTH(This); ulIdx++)
+    {
+        ulSites += (axAgg[ulIdx].ullKey != 0);
+    }
+    TRACE_OUTPUT(TRACE_NEWLINE "====TRACE[%s] (total:%d, sites:%d/%d)====  " TRACE_NEWLINE, This->name, trace_total(This), ulSites, TRACE_DEPTH(This));
+    TRACE_OUTPUT("  %10s|%10s|%10s|%10s| %s" TRACE_NEWLINE, "count", "min", "max", "mean", "message");
+    for (ulIdx = 0; ulIdx < TRACE_DEPTH(This); ulIdx++)
+    {
+        const trace_agg_t *pxAgg = &axAgg[ulIdx];
+        // Only print used call sites with a valid message
+        const char *pcMessage = pxAgg->ullKey ? TRACE_AGG_MSG(pxAgg->ullKey) : NULL;
+        uint32_t ulCount = pxAgg->ulCount;
+        if (pcMessage == NULL || ulCount == 0)
+        {
+            continue;
+        }
+        TRACE_OUTPUT("  %10u|%10u|%10u|%10llu| %s" TRACE_NEWLINE, ulCount, ~pxAgg->ulNotMin, pxAgg->ulMax,
+                     (unsigned long long)(pxAgg->ullSum / ulCount), pcMessage);
+        TRACE_OUTPUT("  %10s|", pcUnit);
+        for (ucBucket = 0; ucBucket < TRACE_AGG_BUCKETS; ucBucket++)
+        {
+            uint64_t ullBound = ucBucket ? 1ull << (ucBucket - 1) : 0;
+            if (pxAgg->aulHist[ucBucket] == 0)
+            {
+                continue;
+            }
+#if defined(TRACE_USE_TICK64)
+            if (This->ucMode == TRACE_MODE_AGG_GAP)
+            {
+#if defined(TRACE_TICK_COMPACT)
+                ullBound <<= TRACE_TICK_SHIFT;
+#endif // defined(TRACE_TICK_COMPACT)
+                ullBound = trace_tick_ns(ullBound);
+            }
+#endif // defined(TRACE_USE_TICK64)
+            TRACE_OUTPUT(" %llu:%u", (unsigned long long)ullBound, pxAgg->aulHist[ucBucket]);
+        }
+        TRACE_OUTPUT(TRACE_NEWLINE);
+    }
+}
+#endif // defined(TRACE_USE_AGG)
+
+#if defined(TRACE_USE_SAMPLING)
+/**
+ * @brief      Dump the call sites of TRACE_SAMPLED() and TRACE_RATELIMITED() of a
+ *             trace buffer, with their sampling and the share of the calls stored
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+static void trace_dump_sites(trace_t *This)
+{
+    trace_site_t *pxSite = __atomic_load_n(&This->pxSite, __ATOMIC_ACQUIRE);
+
+    if (pxSite == NULL)
+    {
+        return;
+    }
+    TRACE_OUTPUT("  %10s|%10s|%12s| %s" TRACE_NEWLINE, "calls", "stored", "sampling", "message");
+    for (; pxSite; pxSite = pxSite->pxNext)
+    {
+        char acRate[24];
+        if (pxSite->ulBurst)
+        {
+            snprintf(acRate, sizeof(acRate), "%u/s+%u", pxSite->ulRate, pxSite->ulBurst);
+        }
+        else
+        {
+            snprintf(acRate, sizeof(acRate), "1/%u", pxSite->ulRate);
+        }
+#if defined(TRACE_USE_MSG_ID)
+        TRACE_OUTPUT("  %10u|%10u|%12s| %s" TRACE_NEWLINE, pxSite->ulCalls, pxSite->ulStored, acRate, trace_msg_string(pxSite->usMsgId));
+#else
+        TRACE_OUTPUT("  %10u|%10u|%12s| %s" TRACE_NEWLINE, pxSite->ulCalls, pxSite->ulStored, acRate, pxSite->pcMessage);
+#endif // defined(TRACE_USE_MSG_ID)
+    }
+}
+#endif // defined(TRACE_USE_SAMPLING)
+
+void trace_dump(trace_t *This, bool bReset)
+{
+#if defined(TRACE_USE_FAST_DUMP)
+    trace_text_t xText;
+#else
+    uint64_t ullFirst;
+    uint32_t ulIdx, ulValid;
+#if defined(TRACE_USE_TRIGGER)
+    uint32_t ulTrigger;
+#endif // defined(TRACE_USE_TRIGGER)
+    trace_line_t xLine;
+#if defined(TRACE_USE_TICK64)
+    trace_clock_t xClock = { 0 };
+    uint64_t ullLastNs = 0;
+#elif defined(TRACE_GET_TICK)
+    uint32_t ulLastStamp = 0;
+#endif // defined(TRACE_USE_TICK64)
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+    TRACE_DUMP_LOCK();
+#if defined(TRACE_USE_SAMPLING)
+    trace_sites_fold(This);
+#endif // defined(TRACE_USE_SAMPLING)
+
+#if defined(TRACE_USE_SHARDS)
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        trace_dump_shards(This, bReset);
+#if defined(TRACE_USE_SAMPLING)
+        trace_dump_sites(This);
+#endif // defined(TRACE_USE_SAMPLING)
+        // The trace buffer itself holds the traces only counted, e.g. of the shards taken over
+        if (bReset)
+        {
+            trace_reset(This);
+        }
+        TRACE_DUMP_UNLOCK();
+        return;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_ARGS)
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        trace_dump_records(This);
+#if defined(TRACE_USE_SAMPLING)
+        trace_dump_sites(This);
+#endif // defined(TRACE_USE_SAMPLING)
+        if (bReset)
+        {
+            trace_reset(This);
+        }
+        TRACE_DUMP_UNLOCK();
+        return;
+    }
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        trace_dump_agg(This);
+#if defined(TRACE_USE_SAMPLING)
+        trace_dump_sites(This);
+#endif // defined(TRACE_USE_SAMPLING)
+        if (bReset)
+        {
+            trace_reset(This);
+        }
+        TRACE_DUMP_UNLOCK();
+        return;
+    }
+#endif // defined(TRACE_USE_AGG)
+
+#if defined(TRACE_USE_FAST_DUMP)
+    trace_text_init(&xText, trace_text_output, NULL);
+    trace_text_lines(This, &xText);
+    trace_text_flush(&xText);
+#else
+    ulValid = trace_valid(This, &ullFirst);
+    TRACE_OUTPUT(TRACE_NEWLINE "====TRACE[%s] (total:%d, depth:%d)====  " TRACE_NEWLINE, This->name, trace_total(This), TRACE_DEPTH(This));
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_lines(This, ullFirst, ulValid, &xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+#if defined(TRACE_USE_TRIGGER)
+    ulTrigger = trace_trigger_pos(This, ullFirst, ulValid);
+#endif // defined(TRACE_USE_TRIGGER)
+    // Output the trace buffer
+    for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+    {
+        uint32_t ulSlot = TRACE_SLOT(This, ullFirst + ulIdx);
+#if defined(TRACE_USE_TRIGGER)
+        if (ulTrigger == ulIdx + 1)
+        {
+            TRACE_OUTPUT("  ------ trigger ------" TRACE_NEWLINE);
+        }
+#endif // defined(TRACE_USE_TRIGGER)
+        // Only print valid messages
+        const char *pcMessage = trace_read(This, ullFirst + ulIdx, &xLine) ? TRACE_LINE_NAME(This, &xLine) : NULL;
+        if (pcMessage)
+        {
+            uint32_t ulValue = xLine.ulValue;
+#if defined(TRACE_USE_TICK64)
+            TRACE_OUTPUT("  %6d|", ulSlot);
+            trace_dump_tick(trace_clock_next(&xClock, xLine.xTimeStamp), &ullLastNs);
+            TRACE_OUTPUT(TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE,
+                         TRACE_TID_ARG(&xLine) TRACE_EVENT_ARG(&xLine) pcMessage, ulValue, ulValue);
+#elif defined(TRACE_GET_TICK)
+            uint32_t ulStamp = xLine.xTimeStamp;
+            TRACE_OUTPUT("  %6d|%10d ms|" TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE, ulSlot, ulStamp - ulLastStamp,
+                         TRACE_TID_ARG(&xLine) TRACE_EVENT_ARG(&xLine) pcMessage, ulValue, ulValue);
+            ulLastStamp = ulStamp;
+#else
+            TRACE_OUTPUT("  %6d|" TRACE_TID_FMT " " TRACE_EVENT_FMT "%s: 0x%08x (%d)" TRACE_NEWLINE, ulSlot,
+                         TRACE_TID_ARG(&xLine) TRACE_EVENT_ARG(&xLine) pcMessage, ulValue, ulValue);
+#endif // defined(TRACE_GET_TICK)
+        }
+    }
+#if defined(TRACE_USE_TRIGGER)
+    if (ulTrigger == ulValid + 1)
+    {
+        TRACE_OUTPUT("  ------ trigger ------" TRACE_NEWLINE);
+    }
+#endif // defined(TRACE_USE_TRIGGER)
+#endif // defined(TRACE_USE_FAST_DUMP)
+#if defined(TRACE_USE_SAMPLING)
+    trace_dump_sites(This);
+#endif // defined(TRACE_USE_SAMPLING)
+    // Reset the trace buffer for a new capture
+    if (bReset)
+    {
+        trace_reset(This);
+    }
+
+    TRACE_DUMP_UNLOCK();
+}
+
+#ifdef TRACE_USE_CONFIG_FILE
+void trace_dump_all(bool bReset)
+{
+    int idx;
+    for (idx = 0; idx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); idx++)
+    {
+        trace_dump(gapxTraceAll[idx], bReset);
+    }
+#if defined(TRACE_USE_REGISTRY)
+    {
+        uint32_t ulSlot, ulSlots = trace_reg_slots();
+        for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+        {
+            trace_t *This = trace_reg_pin(ulSlot);
+            if (This)
+            {
+                trace_dump(This, bReset);
+                trace_reg_unpin(ulSlot);
+            }
+        }
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+}
+#endif // TRACE_USE_CONFIG_FILE
+#else
+void trace_dump(trace_t *This, bool bReset) { This = This; bReset = bReset; }
+void trace_dump_all(void) {}
+#endif // TRACE_OUTPUT
+
+/**
+ * @brief      Flush the staged bytes to the sink
+ *
+ * @param      pxOut  Output stream
+ */
+static void trace_bin_flush(trace_bin_out_t *pxOut)
+{
+    if (pxOut->xChunk)
+    {
+        pxOut->pfnSink(pxOut->pvCtx, pxOut->aucChunk, pxOut->xChunk);
+        pxOut->xChunk = 0;
+    }
+}
+
+/**
+ * @brief      Output a block of bytes.  Small blocks are staged to keep the
+ *             number of sink calls low, large blocks are passed on directly.
+ *
+ * @param      pxOut   Output stream
+ * @param      pvData  Data to output
+ * @param[in]  xSize   Size of the data [in bytes]
+ */
+static void trace_bin_put(trace_bin_out_t *pxOut, const void *pvData, size_t xSize)
+{
+    if (xSize > TRACE_BIN_CHUNK)
+    {
+        trace_bin_flush(pxOut);
+        pxOut->pfnSink(pxOut->pvCtx, pvData, xSize);
+    }
+    else
+    {
+        if (pxOut->xChunk + xSize > TRACE_BIN_CHUNK)
+        {
+            trace_bin_flush(pxOut);
+        }
+        memcpy(&pxOut->aucChunk[pxOut->xChunk], pvData, xSize);
+        pxOut->xChunk += xSize;
+    }
+    pxOut->xSize += xSize;
+}
+
+/**
+ * @brief      Output a string table entry
+ *
+ * @param      pxOut     Output stream
+ * @param      apcSeen   Filter of the strings already output
+ * @param[in]  ullKey    Key of the string
+ * @param      pcString  The string
+ */
+static void trace_bin_string(trace_bin_out_t *pxOut, const char **apcSeen, uint64_t ullKey, const char *pcString)
+{
+    const char **ppcSeen = &apcSeen[ullKey % TRACE_BIN_CACHE];
+    size_t xLen;
+    uint16_t usLen;
+
+    // NOTE: A collision in the filter only costs a duplicate string table entry
+    if (pcString == NULL || *ppcSeen == pcString)
+    {
+        return;
+    }
+    *ppcSeen = pcString;
+    xLen = strlen(pcString);
+    usLen = (xLen > UINT16_MAX) ? UINT16_MAX : (uint16_t)xLen;
+    trace_bin_put(pxOut, &ullKey, sizeof(ullKey));
+    trace_bin_put(pxOut, &usLen, sizeof(usLen));
+    trace_bin_put(pxOut, pcString, usLen);
+}
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Output the byte ring of a TRACE_MODE_ARGS buffer and the strings
+ *             referred to by its records
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxOut    Output stream
+ * @param      pxHdr    Record header, with the fields common to all modes set
+ * @param      apcSeen  Filter of the strings already output
+ */
+static void trace_bin_records(trace_t *This, trace_bin_out_t *pxOut, trace_bin_hdr_t *pxHdr, const char **apcSeen)
+{
+    const uint8_t *pucRing = (const uint8_t *)This->axLine;
+    uint32_t ulCap = TRACE_REC_CAP(This);
+    uint32_t ulOffset = This->ulTail, ulLeft = This->ulUsed;
+
+    // Step 1: Describe the byte ring and the layout of the record header
+    pxHdr->ucFlags |= TRACE_BIN_RECORDS | ((sizeof(void *) == 8) ? TRACE_BIN_PTR_64 : 0);
+    pxHdr->usLineSize = sizeof(trace_rec_t);
+#if defined(TRACE_GET_TICK)
+    TRACE_BIN_FIELD(pxHdr->xStamp, trace_rec_t, xTimeStamp);
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+    TRACE_BIN_FIELD(pxHdr->xMessage, trace_rec_t, usMsgId);
+#else
+    TRACE_BIN_FIELD(pxHdr->xMessage, trace_rec_t, pcMessage);
+#endif // defined(TRACE_USE_MSG_ID)
+#if defined(TRACE_USE_SPANS)
+    TRACE_BIN_FIELD(pxHdr->xTid, trace_rec_t, ulTid);
+    TRACE_BIN_FIELD(pxHdr->xEvent, trace_rec_t, ucEvent);
+#endif // defined(TRACE_USE_SPANS)
+    pxHdr->ulDepth = ulCap;
+    pxHdr->ulFirst = ulOffset;
+    pxHdr->ulValid = ulLeft;
+    trace_bin_put(pxOut, pxHdr, sizeof(*pxHdr));
+    // Step 2: Output the raw ring in one block
+    trace_bin_put(pxOut, pucRing, ulCap);
+    // Step 3: Output the strings referred to by the records
+    trace_bin_string(pxOut, apcSeen, pxHdr->ullName, This->name);
+    while (ulLeft)
+    {
+        const trace_rec_t *pxRec = (const trace_rec_t *)&pucRing[ulOffset];
+        if (pxRec->usSize == 0 || pxRec->usSize > ulLeft)
+        {
+            break;
+        }
+        if (pxRec->ucArgs != TRACE_REC_PAD)
+        {
+            trace_bin_string(pxOut, apcSeen, TRACE_LINE_KEY(pxRec), TRACE_LINE_MSG(pxRec));
+        }
+        ulOffset = (ulOffset + pxRec->usSize) % ulCap;
+        ulLeft -= pxRec->usSize;
+    }
+}
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_AGG)
+/**
+ * @brief      Output the call sites of a TRACE_MODE_AGG buffer and their messages
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxOut    Output stream
+ * @param      pxHdr    Record header, with the fields common to all modes set
+ * @param      apcSeen  Filter of the strings already output
+ */
+static void trace_bin_agg(trace_t *This, trace_bin_out_t *pxOut, trace_bin_hdr_t *pxHdr, const char **apcSeen)
+{
+    const trace_agg_t *axAgg = (const trace_agg_t *)This->axLine;
+    uint32_t ulIdx;
+
+    // Step 1: Describe the call sites
+    pxHdr->ucFlags |= TRACE_BIN_AGG;
+    pxHdr->usLineSize = sizeof(trace_agg_t);
+#if defined(TRACE_GET_TICK)
+    // NOTE: Only set for a TRACE_MODE_AGG_GAP buffer, whose histogram counts time stamp differences
+    if (This->ucMode == TRACE_MODE_AGG_GAP)
+    {
+        TRACE_BIN_FIELD(pxHdr->xStamp, trace_agg_t, ullLast);
+    }
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_COMPACT)
+    // The time stamp differences are whole ticks
+    pxHdr->ucTickShift = 0;
+#endif // defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_COMPACT)
+    pxHdr->ulDepth = TRACE_DEPTH(This);
+    pxHdr->ulFirst = 0;
+    pxHdr->ulValid = TRACE_DEPTH(This);
+    trace_bin_put(pxOut, pxHdr, sizeof(*pxHdr));
+    // Step 2: Output the raw call sites in one block
+    trace_bin_put(pxOut, axAgg, TRACE_DEPTH(This) * sizeof(trace_agg_t));
+    // Step 3: Output the messages of the used call sites
+    trace_bin_string(pxOut, apcSeen, pxHdr->ullName, This->name);
+    for (ulIdx = 0; ulIdx < TRACE_DEPTH(This); ulIdx++)
+    {
+        uint64_t ullKey = axAgg[ulIdx].ullKey;
+        if (ullKey)
+        {
+            trace_bin_string(pxOut, apcSeen, ullKey, TRACE_AGG_MSG(ullKey));
+        }
+    }
+}
+#endif // defined(TRACE_USE_AGG)
+
+/**
+ * @brief      Output the binary record of a trace buffer
+ *
+ * @param      This   Pointer to the TRACE object
+ * @param      pxOut  Output stream
+ */
+static void trace_bin_record(trace_t *This, trace_bin_out_t *pxOut)
+{
+    const char *apcSeen[TRACE_BIN_CACHE] = { NULL };
+    const uint64_t ullEnd = TRACE_BIN_END_KEY;
+    const uint16_t usEnd = 0;
+    trace_bin_hdr_t xHdr;
+    uint64_t ullFirst;
+    uint32_t ulValid, ulIdx;
+
+    // Step 1: Describe the trace buffer
+    memset(&xHdr, 0, sizeof(xHdr));
+    xHdr.ulMagic = TRACE_BIN_MAGIC;
+    xHdr.usVersion = TRACE_BIN_VERSION;
+    xHdr.usHdrSize = sizeof(xHdr);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    xHdr.ucFlags |= TRACE_BIN_BIG_ENDIAN;
+#endif // __BYTE_ORDER__
+#if defined(TRACE_USE_MSG_ID)
+    // The message IDs are the keys of the string table, so the ring needs no pointer fixups
+    xHdr.ucFlags |= TRACE_BIN_MSG_ID;
+#endif // defined(TRACE_USE_MSG_ID)
+    xHdr.ucMode = This->ucMode;
+    xHdr.bIsWrap = This->bIsWrap;
+    xHdr.ulCount = trace_total(This);
+#if defined(TRACE_USE_SHARDS)
+    xHdr.ulTid = This->ulTid;
+#endif // defined(TRACE_USE_SHARDS)
+    xHdr.ullName = TRACE_BIN_NAME_KEY;
+#if defined(TRACE_USE_TICK64)
+    // The time stamps are ticks of TRACE_GET_TICK64(), compact ones are extended against ullTickBase
+    xHdr.ucFlags |= TRACE_BIN_TICK64;
+    xHdr.ucTickShift = TRACE_TICK_SHIFT;
+    xHdr.ullTickHz = trace_tick_hz();
+#if defined(TRACE_TICK_COMPACT)
+    xHdr.ullTickBase = __atomic_load_n(&This->ullTickBase, __ATOMIC_RELAXED);
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+#if defined(TRACE_USE_ARGS)
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        trace_bin_records(This, pxOut, &xHdr, apcSeen);
+    }
+    else
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        trace_bin_agg(This, pxOut, &xHdr, apcSeen);
+    }
+    else
+#endif // defined(TRACE_USE_AGG)
+    {
+        // Step 2: Describe the layout of the trace lines
+        ulValid = trace_valid(This, &ullFirst);
+        xHdr.usLineSize = sizeof(trace_line_t);
+#if defined(TRACE_GET_TICK)
+        TRACE_BIN_FIELD(xHdr.xStamp, trace_line_t, xTimeStamp);
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+        TRACE_BIN_FIELD(xHdr.xMessage, trace_line_t, usMsgId);
+#else
+        TRACE_BIN_FIELD(xHdr.xMessage, trace_line_t, pcMessage);
+#endif // defined(TRACE_USE_MSG_ID)
+        TRACE_BIN_FIELD(xHdr.xValue, trace_line_t, ulValue);
+#if defined(TRACE_USE_SLOT_SEQ)
+        TRACE_BIN_FIELD(xHdr.xSeq, trace_line_t, ulSeq);
+#endif // defined(TRACE_USE_SLOT_SEQ)
+#if defined(TRACE_USE_SPANS)
+        TRACE_BIN_FIELD(xHdr.xTid, trace_line_t, ulTid);
+        TRACE_BIN_FIELD(xHdr.xEvent, trace_line_t, ucEvent);
+#endif // defined(TRACE_USE_SPANS)
+        xHdr.ulDepth = TRACE_DEPTH(This);
+        xHdr.ulFirst = TRACE_SLOT(This, ullFirst);
+        xHdr.ulValid = ulValid;
+#if defined(TRACE_USE_TRIGGER)
+        xHdr.ulTrigger = trace_trigger_pos(This, ullFirst, ulValid);
+#endif // defined(TRACE_USE_TRIGGER)
+        trace_bin_put(pxOut, &xHdr, sizeof(xHdr));
+#if defined(TRACE_USE_SLOT_SEQ)
+        // Step 3: Output the ring a trace line at a time, clearing the sequence number
+        //         of the trace lines being written or overwritten during the copy
+        for (ulIdx = 0; ulIdx < TRACE_DEPTH(This); ulIdx++)
+        {
+            uint64_t ullLine = ullFirst + TRACE_SLOT(This, ulIdx + TRACE_DEPTH(This) - TRACE_SLOT(This, ullFirst));
+            trace_line_t xLine;
+            if (ullLine - ullFirst >= ulValid || !trace_read(This, ullLine, &xLine))
+            {
+                xLine = This->axLine[ulIdx];
+                xLine.ulSeq = 0;
+            }
+            trace_bin_put(pxOut, &xLine, sizeof(xLine));
+        }
+#else
+        // Step 3: Output the raw ring in one block
+        trace_bin_put(pxOut, This->axLine, TRACE_DEPTH(This) * sizeof(trace_line_t));
+#endif // defined(TRACE_USE_SLOT_SEQ)
+        // Step 4: Output the strings referred to by the ring
+        // NOTE: With TRACE_USE_SLOT_SEQ, a trace line overwritten after step 3 may
+        //       be left without its message string
+        trace_bin_string(pxOut, apcSeen, xHdr.ullName, This->name);
+        for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+        {
+            trace_line_t *pxLine = &This->axLine[TRACE_SLOT(This, ullFirst + ulIdx)];
+            trace_bin_string(pxOut, apcSeen, TRACE_LINE_KEY(pxLine), TRACE_LINE_NAME(This, pxLine));
+        }
+    }
+    trace_bin_put(pxOut, &ullEnd, sizeof(ullEnd));
+    trace_bin_put(pxOut, &usEnd, sizeof(usEnd));
+}
+
+/**
+ * @brief      Sink that copies to a caller buffer, truncating at its end
+ */
+static void trace_bin_buf_sink(void *pvCtx, const void *pvData, size_t xSize)
+{
+    trace_bin_buf_t *pxBuf = pvCtx;
+    if (pxBuf->xUsed < pxBuf->xSize)
+    {
+        size_t xCopy = pxBuf->xSize - pxBuf->xUsed;
+        memcpy(&pxBuf->pucBuf[pxBuf->xUsed], pvData, (xSize < xCopy) ? xSize : xCopy);
+    }
+    pxBuf->xUsed += xSize;
+}
+
+size_t trace_dump_binary(trace_t *This, trace_sink_t pfnSink, void *pvCtx)
+{
+    trace_bin_out_t xOut;
+
+    xOut.pfnSink = pfnSink;
+    xOut.pvCtx = pvCtx;
+    xOut.xSize = 0;
+    xOut.xChunk = 0;
+
+    TRACE_DUMP_LOCK();
+#if defined(TRACE_USE_SAMPLING)
+    trace_sites_fold(This);
+#endif // defined(TRACE_USE_SAMPLING)
+#if defined(TRACE_USE_SHARDS)
+    // Each shard is output as a record of its own
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        trace_t *pxShard;
+        for (pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+        {
+            trace_bin_record(pxShard, &xOut);
+        }
+    }
+    else
+#endif // defined(TRACE_USE_SHARDS)
+    {
+        trace_bin_record(This, &xOut);
+    }
+    trace_bin_flush(&xOut);
+    TRACE_DUMP_UNLOCK();
+
+    return xOut.xSize;
+}
+
+size_t trace_dump_binary_buf(trace_t *This, void *pvBuf, size_t xSize)
+{
+    trace_bin_buf_t xBuf = { .pucBuf = pvBuf, .xSize = xSize, .xUsed = 0 };
+    return trace_dump_binary(This, trace_bin_buf_sink, &xBuf);
+}
+
+#if defined(TRACE_USE_FAST_DUMP)
+size_t trace_dump_text(trace_t *This, trace_sink_t pfnSink, void *pvCtx)
+{
+    trace_text_t xText;
+
+    if (This->ucMode != TRACE_MODE_LINE)
+    {
+        return 0;
+    }
+    trace_text_init(&xText, pfnSink, pvCtx);
+    TRACE_DUMP_LOCK();
+    trace_text_lines(This, &xText);
+    trace_text_flush(&xText);
+    TRACE_DUMP_UNLOCK();
+    return xText.xSize;
+}
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+#if defined(TRACE_WRITE)
+/**
+ * @brief      Sink that writes to the file descriptor pointed to by pvCtx
+ */
+static void trace_bin_fd_sink(void *pvCtx, const void *pvData, size_t xSize)
+{
+    const uint8_t *pucData = pvData;
+    while (xSize)
+    {
+        long lWritten = TRACE_WRITE(*(int *)pvCtx, pucData, xSize);
+        if (lWritten <= 0)
+        {
+            break;
+        }
+        pucData += lWritten;
+        xSize -= lWritten;
+    }
+}
+
+size_t trace_dump_binary_fd(trace_t *This, int fd)
+{
+    return trace_dump_binary(This, trace_bin_fd_sink, &fd);
+}
+#endif // defined(TRACE_WRITE)
+
+#ifdef TRACE_USE_CONFIG_FILE
+size_t trace_dump_binary_all(trace_sink_t pfnSink, void *pvCtx)
+{
+    size_t xSize = 0;
+    int idx;
+    for (idx = 0; idx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); idx++)
+    {
+        xSize += trace_dump_binary(gapxTraceAll[idx], pfnSink, pvCtx);
+    }
+#if defined(TRACE_USE_REGISTRY)
+    {
+        uint32_t ulSlot, ulSlots = trace_reg_slots();
+        for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+        {
+            trace_t *This = trace_reg_pin(ulSlot);
+            if (This)
+            {
+                xSize += trace_dump_binary(This, pfnSink, pvCtx);
+                trace_reg_unpin(ulSlot);
+            }
+        }
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+    return xSize;
+}
+#endif // TRACE_USE_CONFIG_FILE
+
+#ifdef TRACE_USE_CONFIG_FILE
+/**
+ * @brief      Output formatted text of up to TRACE_JSON_MAX - 1 characters
+ *
+ * @param      pxOut     Output stream
+ * @param      pcFormat  printf format
+ */
+__attribute__((format(printf, 2, 3))) static void trace_json_printf(trace_bin_out_t *pxOut, const char *pcFormat, ...)
+{
+    char acText[TRACE_JSON_MAX];
+    va_list xArgs;
+    int iLen;
+
+    va_start(xArgs, pcFormat);
+    iLen = vsnprintf(acText, sizeof(acText), pcFormat, xArgs);
+    va_end(xArgs);
+    if (iLen > 0)
+    {
+        trace_bin_put(pxOut, acText, ((size_t)iLen < sizeof(acText)) ? (size_t)iLen : sizeof(acText) - 1);
+    }
+}
+
+/**
+ * @brief      Output a string as a quoted and escaped JSON string
+ *
+ * @param      pxOut     Output stream
+ * @param      pcString  The string
+ * @param[in]  xLen      Length of the string
+ */
+static void trace_json_string(trace_bin_out_t *pxOut, const char *pcString, size_t xLen)
+{
+    size_t xIdx;
+
+    trace_bin_put(pxOut, "\"", 1);
+    for (xIdx = 0; xIdx < xLen; xIdx++)
+    {
+        unsigned char ucChar = pcString[xIdx];
+        if (ucChar == '"' || ucChar == '\\')
+        {
+            trace_json_printf(pxOut, "\\%c", ucChar);
+        }
+        else if (ucChar < 0x20)
+        {
+            trace_json_printf(pxOut, "\\u%04x", ucChar);
+        }
+        else
+        {
+            trace_bin_put(pxOut, &ucChar, 1);
+        }
+    }
+    trace_bin_put(pxOut, "\"", 1);
+}
+
+/**
+ * @brief      Output an event up to its arguments, which the caller completes
+ *
+ * @param      pxExp    The exporter
+ * @param      pcName   Message of the event
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  ulTid    Thread ID of the event, 0 - the thread ID of the shard
+ * @param[in]  xStamp   Time stamp of the event
+ */
+static void trace_export_event(trace_export_t *pxExp, const char *pcName, uint8_t ucEvent, uint32_t ulTid, trace_stamp_t xStamp)
+{
+    const char *pcPhase = (ucEvent == TRACE_EVENT_BEGIN) ? "\"B\"" : (ucEvent == TRACE_EVENT_END) ? "\"E\"" : "\"i\", \"s\": \"t\"";
+    uint64_t ullNs;
+
+#if defined(TRACE_USE_TICK64)
+    ullNs = trace_tick_ns(trace_clock_next(&pxExp->xClock, xStamp));
+#elif defined(TRACE_GET_TICK)
+    ullNs = (uint64_t)xStamp * 1000000ull;     // Tick [in ms]
+#else
+    (void)xStamp;
+    ullNs = (uint64_t)pxExp->ulEvents * 1000ull;
+#endif // defined(TRACE_USE_TICK64)
+    trace_json_printf(&pxExp->xOut, "%s\n  {\"name\": ", pxExp->ulEvents ? "," : "");
+    trace_json_string(&pxExp->xOut, pcName, strlen(pcName));
+    trace_json_printf(&pxExp->xOut, ", \"cat\": ");
+    trace_json_string(&pxExp->xOut, pxExp->pcCat, strlen(pxExp->pcCat));
+    // NOTE: The time stamps of trace events are in us
+    trace_json_printf(&pxExp->xOut, ", \"ph\": %s, \"ts\": %llu.%03llu, \"pid\": %u, \"tid\": %u, \"args\": {", pcPhase,
+                      (unsigned long long)(ullNs / 1000ull), (unsigned long long)(ullNs % 1000ull), TRACE_EXPORT_PID, ulTid ? ulTid : pxExp->ulTid);
+    pxExp->ulEvents++;
+}
+
+/**
+ * @brief      Output the valid trace lines of a trace buffer or shard as events
+ *
+ * @param      This   Pointer to the TRACE object
+ * @param      pxExp  The exporter
+ */
+static void trace_export_lines(trace_t *This, trace_export_t *pxExp)
+{
+    uint64_t ullFirst;
+    uint32_t ulValid, ulIdx;
+    trace_line_t xLine;
+
+    ulValid = trace_valid(This, &ullFirst);
+#if defined(TRACE_USE_TICK64)
+    memset(&pxExp->xClock, 0, sizeof(pxExp->xClock));
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_lines(This, ullFirst, ulValid, &pxExp->xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+    for (ulIdx = 0; ulIdx < ulValid; ulIdx++)
+    {
+        const char *pcMessage = trace_read(This, ullFirst + ulIdx, &xLine) ? TRACE_LINE_NAME(This, &xLine) : NULL;
+        if (pcMessage)
+        {
+            trace_export_event(pxExp, pcMessage, TRACE_LINE_EVENT(&xLine), TRACE_LINE_TID(&xLine), TRACE_LINE_STAMP(&xLine));
+            trace_json_printf(&pxExp->xOut, "\"value\": %u}}", xLine.ulValue);
+        }
+    }
+}
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Output an argument of a record as a JSON value
+ *
+ * @param      pxOut   Output stream
+ * @param      pucArg  The stored argument
+ *
+ * @return     The next stored argument
+ */
+static const uint8_t *trace_export_arg(trace_bin_out_t *pxOut, const uint8_t *pucArg)
+{
+    trace_arg_t xArg;
+    uint8_t ucLen;
+
+    xArg.ucType = *pucArg++;
+    switch (xArg.ucType)
+    {
+        case TRACE_ARG_U32:
+            memcpy(&xArg.ul, pucArg, sizeof(xArg.ul));
+            trace_json_printf(pxOut, "%u", xArg.ul);
+            return pucArg + sizeof(xArg.ul);
+        case TRACE_ARG_I32:
+            memcpy(&xArg.l, pucArg, sizeof(xArg.l));
+            trace_json_printf(pxOut, "%d", xArg.l);
+            return pucArg + sizeof(xArg.l);
+        case TRACE_ARG_I64:
+            memcpy(&xArg.ll, pucArg, sizeof(xArg.ll));
+            trace_json_printf(pxOut, "%lld", (long long)xArg.ll);
+            return pucArg + sizeof(xArg.ll);
+        case TRACE_ARG_PTR:
+            memcpy(&xArg.pv, pucArg, sizeof(xArg.pv));
+            trace_json_printf(pxOut, "\"0x%llx\"", (unsigned long long)(uintptr_t)xArg.pv);
+            return pucArg + sizeof(xArg.pv);
+        case TRACE_ARG_DOUBLE:
+            memcpy(&xArg.d, pucArg, sizeof(xArg.d));
+            // NOTE: JSON has no representation of infinity and NaN
+            if (xArg.d - xArg.d != 0)
+            {
+                trace_json_printf(pxOut, "null");
+            }
+            else
+            {
+                trace_json_printf(pxOut, "%.17g", xArg.d);
+            }
+            return pucArg + sizeof(xArg.d);
+        case TRACE_ARG_STR:
+            ucLen = *pucArg++;
+            trace_json_string(pxOut, (const char *)pucArg, ucLen);
+            return pucArg + ucLen;
+        default:
+            memcpy(&xArg.ull, pucArg, sizeof(xArg.ull));
+            trace_json_printf(pxOut, "%llu", (unsigned long long)xArg.ull);
+            return pucArg + sizeof(xArg.ull);
+    }
+}
+
+/**
+ * @brief      Output the records of a TRACE_MODE_ARGS buffer as events
+ *
+ * @param      This   Pointer to the TRACE object
+ * @param      pxExp  The exporter
+ */
+static void trace_export_records(trace_t *This, trace_export_t *pxExp)
+{
+    const uint8_t *pucRing = (const uint8_t *)This->axLine;
+    uint32_t ulCap = TRACE_REC_CAP(This);
+    uint32_t ulOffset = This->ulTail, ulLeft = This->ulUsed;
+
+#if defined(TRACE_USE_TICK64)
+    memset(&pxExp->xClock, 0, sizeof(pxExp->xClock));
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_records(This, &pxExp->xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+#endif // defined(TRACE_USE_TICK64)
+    while (ulLeft)
+    {
+        const trace_rec_t *pxRec = (const trace_rec_t *)&pucRing[ulOffset];
+        const char *pcMessage;
+        const uint8_t *pucArg;
+        uint8_t ucIdx;
+
+        if (pxRec->usSize == 0 || pxRec->usSize > ulLeft)
+        {
+            break;
+        }
+        // Only export records that are completely written and have a valid message
+        pcMessage = TRACE_LINE_MSG(pxRec);
+        if (pxRec->ucArgs != TRACE_REC_PAD && (__atomic_load_n(&pxRec->ucFlags, __ATOMIC_ACQUIRE) & TRACE_REC_DONE) && pcMessage)
+        {
+            trace_export_event(pxExp, pcMessage, TRACE_LINE_EVENT(pxRec), TRACE_LINE_TID(pxRec), TRACE_LINE_STAMP(pxRec));
+            trace_json_printf(&pxExp->xOut, "\"args\": [");
+            pucArg = (const uint8_t *)(pxRec + 1);
+            for (ucIdx = 0; ucIdx < pxRec->ucArgs; ucIdx++)
+            {
+                if (ucIdx)
+                {
+                    trace_json_printf(&pxExp->xOut, ", ");
+                }
+                pucArg = trace_export_arg(&pxExp->xOut, pucArg);
+            }
+            trace_json_printf(&pxExp->xOut, "]}}");
+        }
+        ulOffset = (ulOffset + pxRec->usSize) % ulCap;
+        ulLeft -= pxRec->usSize;
+    }
+}
+#endif // defined(TRACE_USE_ARGS)
+
+/**
+ * @brief      Export the events of a trace buffer
+ *
+ * @param      This   Pointer to the TRACE object
+ * @param      pxExp  The exporter
+ */
+static void trace_export_buffer(trace_t *This, trace_export_t *pxExp)
+{
+    pxExp->pcCat = This->name;
+    pxExp->ulTid = 0;
+#if defined(TRACE_USE_SHARDS)
+    // Each shard is exported as the events of its owner
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        trace_t *pxShard;
+        for (pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+        {
+            pxExp->ulTid = pxShard->ulTid;
+            trace_export_lines(pxShard, pxExp);
+        }
+        return;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_ARGS)
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        trace_export_records(This, pxExp);
+        return;
+    }
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    // The statistics of a TRACE_MODE_AGG buffer are not events
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        return;
+    }
+#endif // defined(TRACE_USE_AGG)
+    trace_export_lines(This, pxExp);
+}
+
+size_t trace_export_chrome(trace_sink_t pfnSink, void *pvCtx)
+{
+    trace_export_t xExp;
+    int idx;
+
+    memset(&xExp, 0, sizeof(xExp));
+    xExp.xOut.pfnSink = pfnSink;
+    xExp.xOut.pvCtx = pvCtx;
+
+    TRACE_DUMP_LOCK();
+    trace_json_printf(&xExp.xOut, "{\"traceEvents\": [");
+    for (idx = 0; idx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); idx++)
+    {
+        trace_export_buffer(gapxTraceAll[idx], &xExp);
+    }
+#if defined(TRACE_USE_REGISTRY)
+    {
+        uint32_t ulSlot, ulSlots = trace_reg_slots();
+        for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+        {
+            trace_t *This = trace_reg_pin(ulSlot);
+            if (This)
+            {
+                trace_export_buffer(This, &xExp);
+                trace_reg_unpin(ulSlot);
+            }
+        }
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+    trace_json_printf(&xExp.xOut, "\n], \"displayTimeUnit\": \"ns\"}\n");
+    trace_bin_flush(&xExp.xOut);
+    TRACE_DUMP_UNLOCK();
+
+    return xExp.xOut.xSize;
+}
+
+#if defined(TRACE_WRITE)
+size_t trace_export_chrome_fd(int fd)
+{
+    return trace_export_chrome(trace_bin_fd_sink, &fd);
+}
+#endif // defined(TRACE_WRITE)
+
+#if defined(TRACE_USE_QUERY)
+/**
+ * @brief      Open a cursor of the query on the valid trace lines of a trace buffer or shard
+ *
+ * @param      pxRun   The query
+ * @param      This    Pointer to the TRACE object
+ * @param      pcName  Name of the trace buffer
+ * @param[in]  ulTid   Thread ID of the owner of a shard, otherwise 0
+ */
+static void trace_query_cursor(trace_query_run_t *pxRun, trace_t *This, const char *pcName, uint32_t ulTid)
+{
+    trace_query_cur_t *pxCur;
+
+    if (pxRun->ulCursors == TRACE_QUERY_MAX)
+    {
+        return;
+    }
+    pxCur = &pxRun->axCursor[pxRun->ulCursors++];
+    memset(pxCur, 0, sizeof(*pxCur));
+    pxCur->pxTrace = This;
+    pxCur->pcName = pcName;
+    pxCur->ulTid = ulTid;
+    if (strlen(pcName) > pxRun->xNameLen)
+    {
+        pxRun->xNameLen = strlen(pcName);
+    }
+    pxCur->ulLeft = trace_valid(This, &pxCur->ullNext);
+#if defined(TRACE_TICK_COMPACT)
+    trace_clock_lines(This, pxCur->ullNext, pxCur->ulLeft, &pxCur->xClock);
+#endif // defined(TRACE_TICK_COMPACT)
+}
+
+/**
+ * @brief      Open the cursors of the query on a trace buffer, one per shard of a
+ *             TRACE_MODE_SHARD buffer.  Records and statistics are not merged
+ *
+ * @param      pxRun  The query
+ * @param      This   Pointer to the TRACE object
+ */
+static void trace_query_buffer(trace_query_run_t *pxRun, trace_t *This)
+{
+#if defined(TRACE_USE_SHARDS)
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        trace_t *pxShard;
+        for (pxShard = __atomic_load_n(&This->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+        {
+            trace_query_cursor(pxRun, pxShard, This->name, pxShard->ulTid);
+        }
+        return;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_ARGS)
+    if (This->ucMode == TRACE_MODE_ARGS)
+    {
+        return;
+    }
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_AGG)
+    if (TRACE_MODE_IS_AGG(This->ucMode))
+    {
+        return;
+    }
+#endif // defined(TRACE_USE_AGG)
+    trace_query_cursor(pxRun, This, This->name, 0);
+}
+
+/**
+ * @brief      Check if the message of a trace line holds the substring of the
+ *             query.  The result is cached by the key of the message, so a
+ *             message is only searched the first time it is seen
+ *
+ * @param      pxRun   The query
+ * @param      This    Pointer to the TRACE object of the trace line
+ * @param      pxLine  The trace line
+ *
+ * @return     true - match, false - no match
+ */
+static bool trace_query_message(trace_query_run_t *pxRun, trace_t *This, const trace_line_t *pxLine)
+{
+    uintptr_t xKey = (uintptr_t)TRACE_LINE_KEY(pxLine);
+    trace_query_msg_t *pxMsg = &pxRun->axMsg[(xKey ^ (xKey >> 7)) % TRACE_QUERY_MSGS];
+    const char *pcMessage;
+
+    if (!pxMsg->bUsed || pxMsg->xKey != xKey)
+    {
+        pcMessage = TRACE_LINE_NAME(This, pxLine);
+        pxMsg->xKey = xKey;
+        pxMsg->bUsed = true;
+        pxMsg->bMatch = pcMessage && strstr(pcMessage, pxRun->pxQuery->pcMatch);
+    }
+    return pxMsg->bMatch;
+}
+
+/**
+ * @brief      Read the next trace line of a cursor that matches the filter
+ *
+ * @param      pxRun  The query
+ * @param      pxCur  The cursor, its xHead and ullTime receive the trace line
+ *
+ * @return     true - xHead holds a match, false - no trace lines left
+ */
+static bool trace_query_next(trace_query_run_t *pxRun, trace_query_cur_t *pxCur)
+{
+    const trace_query_t *pxQuery = pxRun->pxQuery;
+    trace_line_t *pxLine = &pxCur->xHead;
+
+    // NOTE: The filter is checked on the raw trace line, cheapest first, and nothing is formatted
+    while (pxCur->ulLeft)
+    {
+        pxCur->ulLeft--;
+        if (!trace_read(pxCur->pxTrace, pxCur->ullNext++, pxLine))
+        {
+            continue;
+        }
+        // The clock is run over all trace lines, so it keeps track of the ones skipped
+#if defined(TRACE_USE_TICK64)
+        pxCur->ullTime = trace_tick_ns(trace_clock_next(&pxCur->xClock, pxLine->xTimeStamp));
+        if (pxQuery->bTime && (pxCur->ullTime < pxQuery->ullTimeFrom || pxCur->ullTime > pxQuery->ullTimeTo))
+        {
+            continue;
+        }
+#elif defined(TRACE_GET_TICK)
+        pxCur->ullTime = pxLine->xTimeStamp;
+        if (pxQuery->bTime && (TRACE_STAMP_BEFORE(pxLine->xTimeStamp, (trace_stamp_t)pxQuery->ullTimeFrom) ||
+                               TRACE_STAMP_BEFORE((trace_stamp_t)pxQuery->ullTimeTo, pxLine->xTimeStamp)))
+        {
+            continue;
+        }
+#endif // defined(TRACE_USE_TICK64)
+        if (pxQuery->bValue && (pxLine->ulValue < pxQuery->ulValueMin || pxLine->ulValue > pxQuery->ulValueMax))
+        {
+            continue;
+        }
+        if (pxQuery->ulTid && (pxCur->ulTid ? pxCur->ulTid : TRACE_LINE_TID(pxLine)) != pxQuery->ulTid)
+        {
+            continue;
+        }
+#if defined(TRACE_USE_MSG_ID)
+        if (pxQuery->bMsgId && pxLine->usMsgId != pxQuery->usMsgId)
+        {
+            continue;
+        }
+#endif // defined(TRACE_USE_MSG_ID)
+        // Only valid messages
+        if (TRACE_LINE_MSG(pxLine) == NULL || (pxQuery->pcMatch && !trace_query_message(pxRun, pxCur->pxTrace, pxLine)))
+        {
+            continue;
+        }
+        return pxCur->bHead = true;
+    }
+    return pxCur->bHead = false;
+}
+
+/**
+ * @brief      Output the trace line at the head of a cursor
+ *
+ * @param      pxRun     The query
+ * @param      pxCur     The cursor
+ * @param      pullLast  Time of the previous trace line output
+ */
+static void trace_query_line(trace_query_run_t *pxRun, trace_query_cur_t *pxCur, uint64_t *pullLast)
+{
+    const trace_line_t *pxLine = &pxCur->xHead;
+    const char *pcMessage = TRACE_LINE_NAME(pxCur->pxTrace, pxLine);
+    uint32_t ulValue = pxLine->ulValue;
+    size_t xLen = strlen(pxCur->pcName);
+
+    trace_bin_put(&pxRun->xOut, "  ", 2);
+    trace_bin_put(&pxRun->xOut, pxCur->pcName, xLen);
+    for (; xLen < pxRun->xNameLen; xLen++)
+    {
+        trace_bin_put(&pxRun->xOut, " ", 1);
+    }
+#if defined(TRACE_USE_TICK64)
+    trace_json_printf(&pxRun->xOut, "|%7llu.%09llu s|%12lld ns|", (unsigned long long)(pxCur->ullTime / 1000000000ull),
+                      (unsigned long long)(pxCur->ullTime % 1000000000ull), *pullLast ? (long long)(pxCur->ullTime - *pullLast) : 0LL);
+    *pullLast = pxCur->ullTime;
+#elif defined(TRACE_GET_TICK)
+    trace_json_printf(&pxRun->xOut, "|%10d ms|", (int)(trace_stamp_t)(pxCur->ullTime - *pullLast));
+    *pullLast = pxCur->ullTime;
+#else
+    (void)pullLast;
+    trace_bin_put(&pxRun->xOut, "|", 1);
+#endif // defined(TRACE_USE_TICK64)
+#if defined(TRACE_USE_SPANS) || defined(TRACE_USE_SHARDS)
+    trace_json_printf(&pxRun->xOut, "%8u|", pxCur->ulTid ? pxCur->ulTid : TRACE_LINE_TID(pxLine));
+#endif // defined(TRACE_USE_SPANS) || defined(TRACE_USE_SHARDS)
+    trace_json_printf(&pxRun->xOut, " %s", TRACE_EVENT_MARK(TRACE_LINE_EVENT(pxLine)));
+    if (pcMessage)
+    {
+        trace_bin_put(&pxRun->xOut, pcMessage, strlen(pcMessage));
+    }
+    trace_json_printf(&pxRun->xOut, ": 0x%08x (%d)" TRACE_NEWLINE, ulValue, ulValue);
+}
+
+uint32_t trace_query(const trace_query_t *pxQuery, trace_sink_t pfnSink, void *pvCtx)
+{
+    trace_query_run_t xRun;
+    trace_query_cur_t *pxCur, *pxNext;
+    uint32_t ulIdx, ulLines = 0;
+    uint64_t ullLast = 0;
+#if defined(TRACE_USE_REGISTRY)
+    bool abPinned[TRACE_REGISTRY_MAX];
+    uint32_t ulSlot, ulSlots;
+#endif // defined(TRACE_USE_REGISTRY)
+
+    memset(&xRun, 0, sizeof(xRun));
+    xRun.pxQuery = pxQuery;
+    xRun.xOut.pfnSink = pfnSink;
+    xRun.xOut.pvCtx = pvCtx;
+
+    TRACE_DUMP_LOCK();
+    // Step 1: Open a cursor on each trace buffer or shard selected
+#if defined(TRACE_USE_REGISTRY)
+    // NOTE: The slots of the registered trace buffers are pinned until the merge is done
+    ulSlots = trace_reg_slots();
+    memset(abPinned, 0, sizeof(abPinned));
+#endif // defined(TRACE_USE_REGISTRY)
+    if (pxQuery->apxTrace)
+    {
+        for (ulIdx = 0; ulIdx < pxQuery->ulTraces; ulIdx++)
+        {
+            trace_query_buffer(&xRun, pxQuery->apxTrace[ulIdx]);
+        }
+    }
+    else
+    {
+        for (ulIdx = 0; ulIdx < sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]); ulIdx++)
+        {
+            trace_query_buffer(&xRun, gapxTraceAll[ulIdx]);
+        }
+#if defined(TRACE_USE_REGISTRY)
+        for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+        {
+            trace_t *This = trace_reg_pin(ulSlot);
+            if (This)
+            {
+                abPinned[ulSlot] = true;
+                trace_query_buffer(&xRun, This);
+            }
+        }
+#endif // defined(TRACE_USE_REGISTRY)
+    }
+    trace_json_printf(&xRun.xOut, TRACE_NEWLINE "====TRACE QUERY (rings:%u)====  " TRACE_NEWLINE, xRun.ulCursors);
+    for (ulIdx = 0; ulIdx < xRun.ulCursors; ulIdx++)
+    {
+        trace_query_next(&xRun, &xRun.axCursor[ulIdx]);
+    }
+    // Step 2: k-way merge, repeatedly outputting the oldest match of all cursors
+    while (pxQuery->ulMax == 0 || ulLines < pxQuery->ulMax)
+    {
+        pxNext = NULL;
+        for (ulIdx = 0; ulIdx < xRun.ulCursors; ulIdx++)
+        {
+            pxCur = &xRun.axCursor[ulIdx];
+            if (!pxCur->bHead)
+            {
+                continue;
+            }
+#if defined(TRACE_USE_TICK64)
+            if (pxNext == NULL || pxCur->ullTime < pxNext->ullTime)
+#elif defined(TRACE_GET_TICK)
+            if (pxNext == NULL || TRACE_STAMP_BEFORE(pxCur->xHead.xTimeStamp, pxNext->xHead.xTimeStamp))
+#else
+            // Without a time stamp the trace buffers are output one after another
+            if (pxNext == NULL)
+#endif // defined(TRACE_USE_TICK64)
+            {
+                pxNext = pxCur;
+            }
+        }
+        if (pxNext == NULL)
+        {
+            break;
+        }
+        trace_query_line(&xRun, pxNext, &ullLast);
+        ulLines++;
+        trace_query_next(&xRun, pxNext);
+    }
+#if defined(TRACE_USE_REGISTRY)
+    for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+    {
+        if (abPinned[ulSlot])
+        {
+            trace_reg_unpin(ulSlot);
+        }
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+    trace_bin_flush(&xRun.xOut);
+    TRACE_DUMP_UNLOCK();
+
+    return ulLines;
+}
+
+#ifdef TRACE_OUTPUT
+// Sink of trace_query_dump()
+static void trace_query_output(void *pvCtx, const void *pvData, size_t xSize)
+{
+    (void)pvCtx;
+    TRACE_OUTPUT("%.*s", (int)xSize, (const char *)pvData);
+}
+
+uint32_t trace_query_dump(const trace_query_t *pxQuery)
+{
+    return trace_query(pxQuery, trace_query_output, NULL);
+}
+#else
+uint32_t trace_query_dump(const trace_query_t *pxQuery) { (void)pxQuery; return 0; }
+#endif // TRACE_OUTPUT
+#endif // defined(TRACE_USE_QUERY)
+#endif // TRACE_USE_CONFIG_FILE
+
+#if defined(TRACE_USE_DRAIN)
+/**
+ * @brief      Write the staged entries to the file.  They are dropped if the
+ *             file can't take them, e.g. when the disk is full
+ *
+ * @param      pxDrain  The drain
+ */
+static void trace_drain_flush(trace_drain_t *pxDrain)
+{
+    const uint8_t *pucData = pxDrain->aucChunk;
+    size_t xSize = pxDrain->xChunk;
+
+    while (xSize && pxDrain->fd >= 0)
+    {
+        ssize_t xWritten = write(pxDrain->fd, pucData, xSize);
+        if (xWritten <= 0)
+        {
+            break;
+        }
+        pucData += xWritten;
+        xSize -= xWritten;
+        pxDrain->ullFileSize += xWritten;
+        __atomic_fetch_add(&pxDrain->xStats.ullBytes, (uint64_t)xWritten, __ATOMIC_RELAXED);
+    }
+    pxDrain->xChunk = 0;
+}
+
+/**
+ * @brief      Make room for an entry in the staging buffer
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  xNeed    Maximum size of the entry [in bytes]
+ */
+static inline void trace_drain_reserve(trace_drain_t *pxDrain, size_t xNeed)
+{
+    if (pxDrain->xChunk + xNeed > sizeof(pxDrain->aucChunk))
+    {
+        trace_drain_flush(pxDrain);
+    }
+}
+
+/**
+ * @brief      Stage an unsigned LEB128 varint, 7 bits per byte from the lowest
+ *             with the top bit set on all but the last byte
+ *
+ * @param      pxDrain   The drain
+ * @param[in]  ullValue  The value
+ */
+static inline void trace_drain_varint(trace_drain_t *pxDrain, uint64_t ullValue)
+{
+    uint8_t *pucDst = &pxDrain->aucChunk[pxDrain->xChunk];
+
+    while (ullValue >= 0x80)
+    {
+        *pucDst++ = (uint8_t)ullValue | 0x80;
+        ullValue >>= 7;
+    }
+    *pucDst++ = (uint8_t)ullValue;
+    pxDrain->xChunk = pucDst - pxDrain->aucChunk;
+}
+
+/**
+ * @brief      Stage the length and characters of a string
+ *
+ * @param      pxDrain  The drain
+ * @param      pcText   The string, cut to TRACE_DRAIN_STR_MAX, NULL - empty
+ */
+static void trace_drain_text(trace_drain_t *pxDrain, const char *pcText)
+{
+    size_t xLen = pcText ? strnlen(pcText, TRACE_DRAIN_STR_MAX) : 0;
+
+    trace_drain_varint(pxDrain, xLen);
+    if (xLen)
+    {
+        memcpy(&pxDrain->aucChunk[pxDrain->xChunk], pcText, xLen);
+        pxDrain->xChunk += xLen;
+    }
+}
+
+/**
+ * @brief      Start the file pxDrain->ulFile, and remove the oldest file kept.
+ *             Each file is decoded on its own, so it names the trace buffers and
+ *             messages again, and its time stamp deltas start from its header
+ *
+ * @param      pxDrain  The drain
+ *
+ * @return     true - started, false - the file could not be created
+ */
+static bool trace_drain_open(trace_drain_t *pxDrain)
+{
+    char acName[TRACE_SHM_NAME_MAX + 16];
+    trace_drain_hdr_t xHdr;
+    uint32_t ulId;
+
+    // Step 1: Create the file
+    snprintf(acName, sizeof(acName), TRACE_DRAIN_NAME, pxDrain->acPath, pxDrain->ulFile);
+    pxDrain->fd = open(acName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pxDrain->fd < 0)
+    {
+        return false;
+    }
+    if (TRACE_DRAIN_FILES && pxDrain->ulFile >= TRACE_DRAIN_FILES)
+    {
+        snprintf(acName, sizeof(acName), TRACE_DRAIN_NAME, pxDrain->acPath, pxDrain->ulFile - TRACE_DRAIN_FILES);
+        unlink(acName);
+    }
+    // Step 2: Stage the file header
+    memset(&xHdr, 0, sizeof(xHdr));
+    xHdr.ulMagic = TRACE_DRAIN_MAGIC;
+    xHdr.usVersion = TRACE_DRAIN_VERSION;
+    xHdr.usHdrSize = sizeof(xHdr);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    xHdr.ucFlags |= TRACE_BIN_BIG_ENDIAN;
+#endif // __BYTE_ORDER__
+#if defined(TRACE_USE_MSG_ID)
+    xHdr.ucFlags |= TRACE_BIN_MSG_ID;
+#endif // defined(TRACE_USE_MSG_ID)
+#if defined(TRACE_USE_SPANS)
+    xHdr.ucFlags |= TRACE_BIN_SPANS;
+#endif // defined(TRACE_USE_SPANS)
+#if defined(TRACE_USE_TICK64)
+    xHdr.ucFlags |= TRACE_BIN_TICK64;
+    xHdr.ucTickShift = TRACE_TICK_SHIFT;
+    xHdr.ullTickHz = trace_tick_hz();
+#if defined(TRACE_TICK_COMPACT)
+    pxDrain->ullStampBase = TRACE_GET_TICK64() >> TRACE_TICK_SHIFT;
+#else
+    pxDrain->ullStampBase = TRACE_GET_TICK64();
+#endif // defined(TRACE_TICK_COMPACT)
+#elif defined(TRACE_GET_TICK)
+    pxDrain->ullStampBase = TRACE_GET_TICK();
+#endif // defined(TRACE_USE_TICK64)
+#if defined(TRACE_GET_TICK)
+    xHdr.ucStampSize = sizeof(trace_stamp_t);
+#endif // defined(TRACE_GET_TICK)
+    xHdr.ulFile = pxDrain->ulFile;
+    xHdr.ulPid = getpid();
+    xHdr.ullStampBase = pxDrain->ullStampBase;
+    xHdr.ullStartTime = time(NULL);
+    memcpy(pxDrain->aucChunk, &xHdr, sizeof(xHdr));
+    pxDrain->xChunk = sizeof(xHdr);
+    pxDrain->ullFileSize = 0;
+    // Step 3: Forget the names and messages of the previous file
+    for (ulId = 0; ulId < pxDrain->ulBufs; ulId++)
+    {
+        pxDrain->axBuf[ulId].bNamed = false;
+        pxDrain->axBuf[ulId].xLast = (trace_stamp_t)pxDrain->ullStampBase;
+    }
+    memset(pxDrain->aulStrIdx, 0, sizeof(pxDrain->aulStrIdx));
+    pxDrain->ulStrs = 0;
+    __atomic_fetch_add(&pxDrain->xStats.ulFiles, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief      Close the file once it reached TRACE_DRAIN_FILE_SIZE, and start the next one
+ *
+ * @param      pxDrain  The drain
+ */
+static inline void trace_drain_rotate(trace_drain_t *pxDrain)
+{
+    if (pxDrain->ullFileSize + pxDrain->xChunk >= TRACE_DRAIN_FILE_SIZE)
+    {
+        trace_drain_flush(pxDrain);
+        close(pxDrain->fd);
+        pxDrain->ulFile++;
+        // NOTE: On failure the next poll tries again, the entries until then are dropped
+        trace_drain_open(pxDrain);
+    }
+}
+
+/**
+ * @brief      Start following a trace buffer or shard
+ *
+ * @param      pxDrain  The drain
+ * @param      This     Pointer to the TRACE object
+ * @param      pxSel    The trace buffer passed to trace_drain_start()
+ */
+static void trace_drain_follow(trace_drain_t *pxDrain, trace_t *This, trace_t *pxSel)
+{
+    trace_drain_buf_t *pxBuf;
+    uint32_t ulId, ulFree = pxDrain->ulBufs;
+
+    for (ulId = 0; ulId < pxDrain->ulBufs; ulId++)
+    {
+        if (pxDrain->axBuf[ulId].pxTrace == This)
+        {
+            return;
+        }
+        // NOTE: The cursor of an unregistered trace buffer is taken over with its id, which the file names again
+        if (pxDrain->axBuf[ulId].pxTrace == NULL && ulFree == pxDrain->ulBufs)
+        {
+            ulFree = ulId;
+        }
+    }
+    if (ulFree == TRACE_DRAIN_MAX)
+    {
+        return;
+    }
+    pxBuf = &pxDrain->axBuf[ulFree];
+    memset(pxBuf, 0, sizeof(*pxBuf));
+    pxBuf->pxTrace = This;
+    pxBuf->pxSel = pxSel;
+    pxBuf->xLast = (trace_stamp_t)pxDrain->ullStampBase;
+    // NOTE: trace_drain_lost() reads the cursors from other threads
+    if (ulFree == pxDrain->ulBufs)
+    {
+        __atomic_store_n(&pxDrain->ulBufs, pxDrain->ulBufs + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief      Select a trace buffer to drain.  The records of TRACE_MODE_ARGS
+ *             and the call sites of TRACE_MODE_AGG are not drained
+ *
+ * @param      pxDrain  The drain
+ * @param      This     Pointer to the TRACE object
+ *
+ * @return     true - selected, false - no trace lines, or too many trace buffers
+ */
+static bool trace_drain_select(trace_drain_t *pxDrain, trace_t *This)
+{
+    if (pxDrain->ulSels == TRACE_DRAIN_MAX)
+    {
+        return false;
+    }
+#if defined(TRACE_USE_SHARDS)
+    if (This->ucMode == TRACE_MODE_SHARD)
+    {
+        pxDrain->apxSel[pxDrain->ulSels++] = This;
+        return true;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+    // NOTE: Without TRACE_USE_SHARDS a TRACE_MODE_SHARD buffer holds trace lines
+    if (This->ucMode == TRACE_MODE_LINE || This->ucMode == TRACE_MODE_SHARD)
+    {
+        pxDrain->apxSel[pxDrain->ulSels++] = This;
+        trace_drain_follow(pxDrain, This, This);
+        return true;
+    }
+    return false;
+}
+
+#if defined(TRACE_USE_REGISTRY)
+/**
+ * @brief      Follow the trace buffers registered since the last scan, and drop
+ *             the ones unregistered
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  ulSlots  Number of slots of the registry
+ */
+static void trace_drain_registry(trace_drain_t *pxDrain, uint32_t ulSlots)
+{
+    uint32_t ulSel, ulSlot, ulId;
+
+    pxDrain->ulRegGen = __atomic_load_n(&gulTraceRegGen, __ATOMIC_ACQUIRE);
+    // Step 1: Drop the trace buffers no longer in their slot, and free their cursors
+    //         NOTE: An unregistered trace buffer may be freed already, so it is not read
+    for (ulSel = 0; ulSel < pxDrain->ulSels; )
+    {
+        trace_t *pxSel = pxDrain->apxSel[ulSel];
+
+        ulSlot = pxDrain->aulSelSlot[ulSel];
+        if (ulSlot == 0 || (TRACE_REG_GET(ulSlot - 1) == pxSel &&
+                            __atomic_load_n(&gaulTraceRegSerial[ulSlot - 1], __ATOMIC_RELAXED) == pxDrain->aulSelSerial[ulSel]))
+        {
+            ulSel++;
+            continue;
+        }
+        for (ulId = 0; ulId < pxDrain->ulBufs; ulId++)
+        {
+            if (pxDrain->axBuf[ulId].pxSel == pxSel)
+            {
+                pxDrain->axBuf[ulId].pxTrace = NULL;
+                __atomic_store_n(&pxDrain->axBuf[ulId].pxSel, NULL, __ATOMIC_RELAXED);
+            }
+        }
+        pxDrain->ulSels--;
+        pxDrain->apxSel[ulSel] = pxDrain->apxSel[pxDrain->ulSels];
+        pxDrain->aulSelSlot[ulSel] = pxDrain->aulSelSlot[pxDrain->ulSels];
+        pxDrain->aulSelSerial[ulSel] = pxDrain->aulSelSerial[pxDrain->ulSels];
+    }
+    // Step 2: Select the trace buffers registered, that are not selected yet
+    for (ulSlot = 0; ulSlot < ulSlots; ulSlot++)
+    {
+        trace_t *This = trace_reg_pin(ulSlot);
+        uint32_t ulSerial = __atomic_load_n(&gaulTraceRegSerial[ulSlot], __ATOMIC_RELAXED);
+
+        if (This == NULL)
+        {
+            continue;
+        }
+        for (ulSel = 0; ulSel < pxDrain->ulSels; ulSel++)
+        {
+            if (pxDrain->aulSelSlot[ulSel] == ulSlot + 1 && pxDrain->aulSelSerial[ulSel] == ulSerial)
+            {
+                break;
+            }
+        }
+        if (ulSel == pxDrain->ulSels && trace_drain_select(pxDrain, This))
+        {
+            pxDrain->aulSelSlot[ulSel] = ulSlot + 1;
+            pxDrain->aulSelSerial[ulSel] = ulSerial;
+        }
+        trace_reg_unpin(ulSlot);
+    }
+}
+#endif // defined(TRACE_USE_REGISTRY)
+
+/**
+ * @brief      Pin the registry slot of a trace buffer to drain, so it stays registered
+ *             while it is read.  The trace buffers of trace_drain_start() are not pinned.
+ *
+ * @param      pxDrain  The drain
+ * @param      pxSel    The trace buffer to drain
+ * @param      pulSlot  Returns 1 + registry slot pinned, 0 - none
+ *
+ * @return     true - can be read, false - unregistered since it was selected
+ */
+static bool trace_drain_pin(trace_drain_t *pxDrain, trace_t *pxSel, uint32_t *pulSlot)
+{
+#if defined(TRACE_USE_REGISTRY)
+    uint32_t ulSel, ulSlot;
+    trace_t *pxReg;
+
+    *pulSlot = 0;
+    for (ulSel = 0; ulSel < pxDrain->ulSels && pxDrain->apxSel[ulSel] != pxSel; ulSel++)
+    {
+    }
+    if (ulSel == pxDrain->ulSels)
+    {
+        return false;
+    }
+    ulSlot = pxDrain->aulSelSlot[ulSel];
+    if (ulSlot == 0)
+    {
+        return true;
+    }
+    // NOTE: A slot registered again since is followed anew by the next trace_drain_registry()
+    pxReg = trace_reg_pin(ulSlot - 1);
+    if (pxReg == pxSel && __atomic_load_n(&gaulTraceRegSerial[ulSlot - 1], __ATOMIC_RELAXED) == pxDrain->aulSelSerial[ulSel])
+    {
+        *pulSlot = ulSlot;
+        return true;
+    }
+    if (pxReg)
+    {
+        trace_reg_unpin(ulSlot - 1);
+    }
+    return false;
+#else
+    *pulSlot = 0;
+    return true;
+#endif // defined(TRACE_USE_REGISTRY)
+}
+
+/**
+ * @brief      Unpin the registry slot pinned by trace_drain_pin()
+ *
+ * @param[in]  ulSlot  1 + registry slot pinned, 0 - none
+ */
+static inline void trace_drain_unpin(uint32_t ulSlot)
+{
+#if defined(TRACE_USE_REGISTRY)
+    if (ulSlot)
+    {
+        trace_reg_unpin(ulSlot - 1);
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+}
+
+/**
+ * @brief      Stage the name of a trace buffer, before its first entry in the file
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  ulId     Id of the trace buffer in the files
+ */
+static void trace_drain_name(trace_drain_t *pxDrain, uint32_t ulId)
+{
+    trace_drain_buf_t *pxBuf = &pxDrain->axBuf[ulId];
+    uint32_t ulTid = 0;
+
+    if (pxBuf->bNamed)
+    {
+        return;
+    }
+#if defined(TRACE_USE_SHARDS)
+    if (pxBuf->pxTrace != pxBuf->pxSel)
+    {
+        ulTid = pxBuf->pxTrace->ulTid;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+    trace_drain_reserve(pxDrain, 16 + TRACE_DRAIN_STR_MAX);
+    pxDrain->aucChunk[pxDrain->xChunk++] = TRACE_DRAIN_BUF;
+    trace_drain_varint(pxDrain, ulId);
+    trace_drain_varint(pxDrain, ulTid);
+    trace_drain_text(pxDrain, pxBuf->pxSel->name);
+    pxBuf->bNamed = true;
+}
+
+/**
+ * @brief      Gets the index of the message of a trace line in the file, staging
+ *             the message the first time the file refers to it
+ *
+ * @param      pxDrain  The drain
+ * @param      This     Pointer to the TRACE object
+ * @param      pxLine   The trace line
+ *
+ * @return     Index of the message
+ */
+static uint32_t trace_drain_string(trace_drain_t *pxDrain, trace_t *This, const trace_line_t *pxLine)
+{
+    uint64_t ullKey = TRACE_LINE_KEY(pxLine);
+    uint32_t ulHash = (uint32_t)((ullKey * 0x9E3779B97F4A7C15ull) >> 32) & (TRACE_DRAIN_STRS - 1);
+    uint32_t ulSlot;
+
+    for (ulSlot = ulHash; pxDrain->aulStrIdx[ulSlot]; ulSlot = (ulSlot + 1) & (TRACE_DRAIN_STRS - 1))
+    {
+        if (pxDrain->aullStrKey[ulSlot] == ullKey)
+        {
+            return pxDrain->aulStrIdx[ulSlot] - 1;
+        }
+    }
+    // NOTE: The message index is kept at most 3/4 full, then restarts at 0
+    if (pxDrain->ulStrs == TRACE_DRAIN_STRS / 4 * 3)
+    {
+        memset(pxDrain->aulStrIdx, 0, sizeof(pxDrain->aulStrIdx));
+        pxDrain->ulStrs = 0;
+        ulSlot = ulHash;
+    }
+    trace_drain_reserve(pxDrain, 16 + TRACE_DRAIN_STR_MAX);
+    pxDrain->aucChunk[pxDrain->xChunk++] = TRACE_DRAIN_STR;
+    trace_drain_varint(pxDrain, pxDrain->ulStrs);
+    // NOTE: The symbols of TRACE_USE_INSTRUMENT are resolved under the dump lock
+    TRACE_DUMP_LOCK();
+    trace_drain_text(pxDrain, TRACE_LINE_NAME(This, pxLine));
+    TRACE_DUMP_UNLOCK();
+    pxDrain->aullStrKey[ulSlot] = ullKey;
+    pxDrain->aulStrIdx[ulSlot] = ++pxDrain->ulStrs;
+    return pxDrain->ulStrs - 1;
+}
+
+/**
+ * @brief      Stage the number of trace lines of a trace buffer overwritten
+ *             before they were drained, and add them to its overrun counter
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  ulId     Id of the trace buffer in the files
+ * @param[in]  ullLost  Number of trace lines lost
+ */
+static void trace_drain_overrun(trace_drain_t *pxDrain, uint32_t ulId, uint64_t ullLost)
+{
+    trace_drain_name(pxDrain, ulId);
+    trace_drain_reserve(pxDrain, 16);
+    pxDrain->aucChunk[pxDrain->xChunk++] = TRACE_DRAIN_LOST;
+    trace_drain_varint(pxDrain, ulId);
+    trace_drain_varint(pxDrain, ullLost);
+    __atomic_fetch_add(&pxDrain->axBuf[ulId].ullLost, ullLost, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pxDrain->xStats.ullLost, ullLost, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief      Stage a trace line, with its time stamp as the difference to the
+ *             previous trace line of the trace buffer
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  ulId     Id of the trace buffer in the files
+ * @param      pxLine   The trace line
+ */
+static void trace_drain_line(trace_drain_t *pxDrain, uint32_t ulId, const trace_line_t *pxLine)
+{
+    trace_drain_buf_t *pxBuf = &pxDrain->axBuf[ulId];
+    trace_stamp_t xDelta;
+    int64_t llDelta;
+    uint32_t ulStr;
+
+    trace_drain_name(pxDrain, ulId);
+    ulStr = trace_drain_string(pxDrain, pxBuf->pxTrace, pxLine);
+    // NOTE: The difference wraps at the width of the time stamp, concurrent writers may make it negative
+    xDelta = (trace_stamp_t)(TRACE_LINE_STAMP(pxLine) - pxBuf->xLast);
+    llDelta = (sizeof(trace_stamp_t) == sizeof(uint64_t)) ? (int64_t)xDelta : (int64_t)(int32_t)xDelta;
+    pxBuf->xLast = TRACE_LINE_STAMP(pxLine);
+    trace_drain_reserve(pxDrain, 48);
+    pxDrain->aucChunk[pxDrain->xChunk++] = TRACE_DRAIN_LINE;
+    trace_drain_varint(pxDrain, ulId);
+    trace_drain_varint(pxDrain, ((uint64_t)llDelta << 1) ^ (uint64_t)(llDelta >> 63));
+    trace_drain_varint(pxDrain, ulStr);
+    trace_drain_varint(pxDrain, pxLine->ulValue);
+#if defined(TRACE_USE_SPANS)
+    trace_drain_varint(pxDrain, pxLine->ulTid);
+    trace_drain_varint(pxDrain, pxLine->ucEvent);
+#endif // defined(TRACE_USE_SPANS)
+    __atomic_fetch_add(&pxDrain->xStats.ullLines, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief      Drain the new trace lines of a trace buffer or shard, up to the
+ *             trace line being written or until the staging buffer is full.
+ *             Nothing is written to the file, the trace buffer may be pinned.
+ *
+ * @param      pxDrain  The drain
+ * @param[in]  ulId     Id of the trace buffer in the files
+ *
+ * @return     Backlog of trace lines not drained yet at the poll, in eighths of the ring
+ */
+static uint32_t trace_drain_buffer(trace_drain_t *pxDrain, uint32_t ulId)
+{
+    trace_drain_buf_t *pxBuf = &pxDrain->axBuf[ulId];
+    trace_t *This = pxBuf->pxTrace;
+    uint64_t ullFirst, ullEnd;
+    uint32_t ulFill, ulLost = 0;
+    trace_line_t xLine;
+
+    // Step 1: Catch up with the writers.  A reset trace buffer is drained from its
+    //         start again, the trace lines overwritten since the last poll are lost
+    ullEnd = trace_valid(This, &ullFirst);
+    ullEnd += ullFirst;
+    if (ullEnd < pxBuf->ullNext)
+    {
+        pxBuf->ullNext = ullFirst;
+    }
+    ulFill = (ullEnd - pxBuf->ullNext >= TRACE_DEPTH(This)) ? 8 : (uint32_t)((ullEnd - pxBuf->ullNext) * 8 / TRACE_DEPTH(This));
+    if (ullFirst > pxBuf->ullNext)
+    {
+        // NOTE: Resume half a ring behind the writers, as the oldest trace lines are overwritten next
+        ullFirst += (ullEnd - ullFirst) / 2;
+        trace_drain_overrun(pxDrain, ulId, ullFirst - pxBuf->ullNext);
+        pxBuf->ullNext = ullFirst;
+    }
+    // Step 2: Drain the trace lines, a trace line overwritten while it is read is lost
+    for (; pxBuf->ullNext < ullEnd && pxDrain->xChunk + TRACE_DRAIN_LINE_MAX <= sizeof(pxDrain->aucChunk); pxBuf->ullNext++)
+    {
+        if (trace_read(This, pxBuf->ullNext, &xLine))
+        {
+            if (ulLost)
+            {
+                trace_drain_overrun(pxDrain, ulId, ulLost);
+                ulLost = 0;
+            }
+            trace_drain_line(pxDrain, ulId, &xLine);
+            continue;
+        }
+        // NOTE: A sequence number of 0, or of an older trace, is still being written.  The
+        //       sequence numbers wrap at 2^32, so they are only compared by their difference
+        xLine.ulSeq = __atomic_load_n(&This->axLine[TRACE_SLOT(This, pxBuf->ullNext)].ulSeq, __ATOMIC_RELAXED);
+        if (xLine.ulSeq == 0 || (int32_t)(xLine.ulSeq - TRACE_SEQ(pxBuf->ullNext)) <= 0)
+        {
+            break;
+        }
+        ulLost++;
+    }
+    if (ulLost)
+    {
+        trace_drain_overrun(pxDrain, ulId, ulLost);
+    }
+    return ulFill;
+}
+
+/**
+ * @brief      Drain the new trace lines of all trace buffers followed
+ *
+ * @param      pxDrain  The drain
+ *
+ * @return     Largest backlog of the trace buffers at the poll, in eighths of the ring
+ */
+static uint32_t trace_drain_poll(trace_drain_t *pxDrain)
+{
+    uint32_t ulFill = 0, ulId, ulSlot;
+
+    if (pxDrain->fd < 0 && !trace_drain_open(pxDrain))
+    {
+        return 0;
+    }
+#if defined(TRACE_USE_REGISTRY)
+    // Step 1: Follow the trace buffers registered and unregistered since the last poll
+    if (pxDrain->bReg && __atomic_load_n(&gulTraceRegGen, __ATOMIC_ACQUIRE) != pxDrain->ulRegGen)
+    {
+        trace_drain_registry(pxDrain, trace_reg_slots());
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+#if defined(TRACE_USE_SHARDS)
+    // Step 2: Follow the shards of the threads that started tracing since the last poll
+    for (ulId = 0; ulId < pxDrain->ulSels; ulId++)
+    {
+        trace_t *pxSel = pxDrain->apxSel[ulId];
+        trace_t *pxShard;
+        if (trace_drain_pin(pxDrain, pxSel, &ulSlot))
+        {
+            if (pxSel->ucMode == TRACE_MODE_SHARD)
+            {
+                for (pxShard = __atomic_load_n(&pxSel->pxShard, __ATOMIC_ACQUIRE); pxShard; pxShard = pxShard->pxShard)
+                {
+                    trace_drain_follow(pxDrain, pxShard, pxSel);
+                }
+            }
+            trace_drain_unpin(ulSlot);
+        }
+    }
+#endif // defined(TRACE_USE_SHARDS)
+    // Step 3: Drain them.  A trace buffer is pinned while it is read, and the staging
+    //         buffer is written to the file in between, so trace_unregister() never
+    //         waits for the I/O
+    for (ulId = 0; ulId < pxDrain->ulBufs; ulId++)
+    {
+        trace_drain_buf_t *pxBuf = &pxDrain->axBuf[ulId];
+        uint32_t ulBuf;
+
+        while (pxBuf->pxTrace && trace_drain_pin(pxDrain, pxBuf->pxSel, &ulSlot))
+        {
+            ulBuf = trace_drain_buffer(pxDrain, ulId);
+            trace_drain_unpin(ulSlot);
+            ulFill = (ulBuf > ulFill) ? ulBuf : ulFill;
+            if (pxDrain->xChunk + TRACE_DRAIN_LINE_MAX <= sizeof(pxDrain->aucChunk))
+            {
+                break;
+            }
+            trace_drain_flush(pxDrain);
+        }
+        trace_drain_rotate(pxDrain);
+    }
+    return ulFill;
+}
+
+/**
+ * @brief      The drain thread, which polls the trace buffers until trace_drain_stop()
+ *
+ * @param      pvArg  The drain
+ */
+static void *trace_drain_thread(void *pvArg)
+{
+    const uint32_t ulMaxUs = TRACE_DRAIN_INTERVAL_MS * 1000u;
+    uint32_t ulSleepUs = ulMaxUs, ulFill;
+    bool bSlept = true;
+    struct timespec xSleep;
+    trace_drain_t *pxDrain = pvArg;
+
+    while (!__atomic_load_n(&gbTraceDrainStop, __ATOMIC_ACQUIRE))
+    {
+        // NOTE: Poll sooner while the writers fill the rings, so they don't lap the drain,
+        //       and later while they are quiet.  The backlog found after a sleep tells how
+        //       fast the writers are.  The staged entries are written once the writers are idle
+        ulFill = trace_drain_poll(pxDrain);
+        if (ulFill >= 4)
+        {
+            ulSleepUs = bSlept ? TRACE_DRAIN_SLEEP_US : ulSleepUs;
+            bSlept = false;
+            continue;
+        }
+        if (bSlept && ulFill)
+        {
+            ulSleepUs = (ulSleepUs / 2 > TRACE_DRAIN_SLEEP_US) ? ulSleepUs / 2 : TRACE_DRAIN_SLEEP_US;
+        }
+        else if (bSlept)
+        {
+            ulSleepUs = (ulSleepUs * 2 < ulMaxUs) ? ulSleepUs * 2 : ulMaxUs;
+            trace_drain_flush(pxDrain);
+        }
+        bSlept = true;
+        xSleep.tv_sec = ulSleepUs / 1000000u;
+        xSleep.tv_nsec = ulSleepUs % 1000000u * 1000L;
+        nanosleep(&xSleep, NULL);
+    }
+    // The last poll drains the trace lines traced before trace_drain_stop()
+    while (trace_drain_poll(pxDrain) >= 4)
+    {
+    }
+    trace_drain_flush(pxDrain);
+    return NULL;
+}
+
+/**
+ * @brief      Stop the drain of a process that exits without trace_drain_stop(),
+ *             so the files hold the trace lines traced before exit()
+ */
+__attribute__((destructor)) static void trace_drain_exit(void)
+{
+    trace_drain_stop();
+}
+
+bool trace_drain_start(const char *pcPath, trace_t * const *apxTrace, uint32_t ulTraces)
+{
+    trace_drain_t *pxDrain = &gxTraceDrain;
+    uint32_t ulIdx;
+
+    if (gbTraceDrainRun)
+    {
+        return false;
+    }
+    memset(pxDrain, 0, sizeof(*pxDrain));
+    pxDrain->fd = -1;
+    snprintf(pxDrain->acPath, sizeof(pxDrain->acPath), "%s", pcPath);
+#if defined(TRACE_USE_REGISTRY)
+    pxDrain->bReg = (apxTrace == NULL);
+#endif // defined(TRACE_USE_REGISTRY)
+#ifdef TRACE_USE_CONFIG_FILE
+    if (apxTrace == NULL)
+    {
+        apxTrace = gapxTraceAll;
+        ulTraces = sizeof(gapxTraceAll) / sizeof(gapxTraceAll[0]);
+    }
+#endif // TRACE_USE_CONFIG_FILE
+    // Step 1: Select the trace buffers of trace lines
+    for (ulIdx = 0; apxTrace && ulIdx < ulTraces; ulIdx++)
+    {
+        trace_drain_select(pxDrain, apxTrace[ulIdx]);
+    }
+#if defined(TRACE_USE_REGISTRY)
+    if (pxDrain->bReg)
+    {
+        trace_drain_registry(pxDrain, trace_reg_slots());
+    }
+#endif // defined(TRACE_USE_REGISTRY)
+    // Step 2: Start the first file and the drain thread
+    if (!trace_drain_open(pxDrain))
+    {
+        return false;
+    }
+    gbTraceDrainStop = false;
+    if (pthread_create(&gxTraceDrainThread, NULL, trace_drain_thread, pxDrain) != 0)
+    {
+        close(pxDrain->fd);
+        pxDrain->fd = -1;
+        return false;
+    }
+    gbTraceDrainRun = true;
+    return true;
+}
+
+void trace_drain_stop(void)
+{
+    if (!gbTraceDrainRun)
+    {
+        return;
+    }
+    __atomic_store_n(&gbTraceDrainStop, true, __ATOMIC_RELEASE);
+    pthread_join(gxTraceDrainThread, NULL);
+    gbTraceDrainRun = false;
+    if (gxTraceDrain.fd >= 0)
+    {
+        close(gxTraceDrain.fd);
+        gxTraceDrain.fd = -1;
+    }
+}
+
+uint64_t trace_drain_lost(trace_t *This)
+{
+    uint32_t ulBufs = __atomic_load_n(&gxTraceDrain.ulBufs, __ATOMIC_ACQUIRE);
+    uint64_t ullLost = 0;
+    uint32_t ulId;
+
+    for (ulId = 0; ulId < ulBufs; ulId++)
+    {
+        if (gxTraceDrain.axBuf[ulId].pxSel == This)
+        {
+            ullLost += __atomic_load_n(&gxTraceDrain.axBuf[ulId].ullLost, __ATOMIC_RELAXED);
+        }
+    }
+    return ullLost;
+}
+
+void trace_drain_stats(trace_drain_stats_t *pxStats)
+{
+    pxStats->ullLines = __atomic_load_n(&gxTraceDrain.xStats.ullLines, __ATOMIC_RELAXED);
+    pxStats->ullLost = __atomic_load_n(&gxTraceDrain.xStats.ullLost, __ATOMIC_RELAXED);
+    pxStats->ullBytes = __atomic_load_n(&gxTraceDrain.xStats.ullBytes, __ATOMIC_RELAXED);
+    pxStats->ulFiles = __atomic_load_n(&gxTraceDrain.xStats.ulFiles, __ATOMIC_RELAXED);
+}
+#endif // defined(TRACE_USE_DRAIN)
+
+#if defined(TRACE_USE_REGISTRY)
+bool trace_register(trace_t *This)
+{
+    uint32_t ulSlot, ulFree = TRACE_REGISTRY_MAX;
+    uint32_t ulGen;
+
+    TRACE_SPIN_LOCK(&gucTraceRegLock);
+    // Step 1: Find the trace buffer, or the first free slot
+    for (ulSlot = 0; ulSlot < gulTraceRegSlots; ulSlot++)
+    {
+        if (gapxTraceReg[ulSlot] == This)
+        {
+            TRACE_SPIN_UNLOCK(&gucTraceRegLock);
+            return true;
+        }
+        // NOTE: A slot still pinned may be waited for by trace_unregister(), so it isn't reused yet
+        if (gapxTraceReg[ulSlot] == NULL && ulFree == TRACE_REGISTRY_MAX && __atomic_load_n(&gaulTraceRegPins[ulSlot], __ATOMIC_SEQ_CST) == 0)
+        {
+            ulFree = ulSlot;
+        }
+    }
+    if (ulFree == TRACE_REGISTRY_MAX && gulTraceRegSlots < TRACE_REGISTRY_MAX)
+    {
+        ulFree = gulTraceRegSlots;
+    }
+    if (ulFree == TRACE_REGISTRY_MAX)
+    {
+        TRACE_SPIN_UNLOCK(&gucTraceRegLock);
+        return false;
+    }
+    // Step 2: Publish it.  The readers see the generation of the slot once they see the trace buffer
+    ulGen = gulTraceRegGen + 1;
+    __atomic_store_n(&gaulTraceRegSerial[ulFree], ulGen, __ATOMIC_RELAXED);
+    __atomic_store_n(&gapxTraceReg[ulFree], This, __ATOMIC_RELEASE);
+    if (ulFree == gulTraceRegSlots)
+    {
+        __atomic_store_n(&gulTraceRegSlots, ulFree + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&gulTraceRegGen, ulGen, __ATOMIC_RELEASE);
+    TRACE_SPIN_UNLOCK(&gucTraceRegLock);
+    return true;
+}
+
+void trace_unregister(trace_t *This)
+{
+    uint32_t ulSlot, ulSerial;
+
+    // Step 1: Free the slot
+    TRACE_SPIN_LOCK(&gucTraceRegLock);
+    for (ulSlot = 0; ulSlot < gulTraceRegSlots && gapxTraceReg[ulSlot] != This; ulSlot++)
+    {
+    }
+    if (ulSlot == gulTraceRegSlots)
+    {
+        TRACE_SPIN_UNLOCK(&gucTraceRegLock);
+        return;
+    }
+    ulSerial = gaulTraceRegSerial[ulSlot];
+    __atomic_store_n(&gapxTraceReg[ulSlot], NULL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&gulTraceRegGen, gulTraceRegGen + 1, __ATOMIC_RELEASE);
+    TRACE_SPIN_UNLOCK(&gucTraceRegLock);
+    // Step 2: Wait, outside the lock, for the readers pinning the slot, which may have seen
+    //         the trace buffer.  A slot registered again had no such readers left
+    while (__atomic_load_n(&gaulTraceRegPins[ulSlot], __ATOMIC_SEQ_CST) &&
+           __atomic_load_n(&gaulTraceRegSerial[ulSlot], __ATOMIC_RELAXED) == ulSerial)
+    {
+        sched_yield();
+    }
+}
+#endif // defined(TRACE_USE_REGISTRY)
+
+#if defined(TRACE_USE_ARENA)
+/**
+ * @brief      Map the pool as a single free block, on the arena lock
+ *
+ * @param[in]  xSize  Size of the pool [in bytes]
+ * @param[in]  iNode  NUMA node to place the pool on, -1 - any node
+ *
+ * @return     true - mapped, false - out of memory, or no such node
+ */
+static bool trace_arena_map(size_t xSize, int iNode)
+{
+    size_t xPage = (size_t)sysconf(_SC_PAGESIZE);
+    trace_arena_blk_t *pxBlk;
+    uint8_t *pucPool;
+
+    // Step 1: Map the pool
+    xSize = (xSize + xPage - 1) & ~(xPage - 1);
+    if (xSize == 0)
+    {
+        return false;
+    }
+    pucPool = mmap(NULL, xSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pucPool == MAP_FAILED)
+    {
+        return false;
+    }
+    // Step 2: Place its pages on the node, before they are touched
+    if (iNode >= 0)
+    {
+#if defined(SYS_mbind)
+        unsigned long aulMask[TRACE_ARENA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+        if (iNode < TRACE_ARENA_NODES)
+        {
+            aulMask[iNode / (8 * sizeof(unsigned long))] = 1ul << (iNode % (8 * sizeof(unsigned long)));
+        }
+        // NOTE: mbind() reads one bit less than its maxnode
+        if (iNode >= TRACE_ARENA_NODES ||
+            syscall(SYS_mbind, pucPool, xSize, TRACE_ARENA_MPOL_PREFERRED, aulMask, TRACE_ARENA_NODES + 1, 0) != 0)
+#endif // defined(SYS_mbind)
+        {
+            munmap(pucPool, xSize);
+            return false;
+        }
+    }
+#if defined(TRACE_USE_HUGEPAGE)
+    trace_huge_advise(pucPool, xSize);
+#endif // defined(TRACE_USE_HUGEPAGE)
+    // Step 3: Commit the pages up front, so tracing never faults them in
+    memset(pucPool, 0, xSize);
+    pxBlk = (trace_arena_blk_t *)pucPool;
+    pxBlk->xSize = xSize;
+    pxBlk->xPrev = 0;
+    pxBlk->bFree = true;
+    gpucTraceArena = pucPool;
+    gxTraceArenaSize = xSize;
+    return true;
+}
+
+/**
+ * @brief      Get the block after a block of the pool
+ *
+ * @param      pxBlk  The block
+ *
+ * @return     The next block, NULL if the block ends the pool
+ */
+static trace_arena_blk_t *trace_arena_next(trace_arena_blk_t *pxBlk)
+{
+    uint8_t *pucNext = (uint8_t *)pxBlk + pxBlk->xSize;
+
+    return (pucNext < gpucTraceArena + gxTraceArenaSize) ? (trace_arena_blk_t *)pucNext : NULL;
+}
+
+/**
+ * @brief      Allocate the first free block that fits, on the arena lock
+ *
+ * @param[in]  xSize  Size to allocate [in bytes]
+ *
+ * @return     The memory, on a cache line of its own, NULL if out of room
+ */
+static void *trace_arena_get(size_t xSize)
+{
+    trace_arena_blk_t *pxBlk, *pxRest, *pxNext;
+
+    xSize = (sizeof(trace_arena_blk_t) + xSize + TRACE_CACHE_LINE - 1) & ~(size_t)(TRACE_CACHE_LINE - 1);
+    for (pxBlk = (trace_arena_blk_t *)gpucTraceArena; pxBlk; pxBlk = trace_arena_next(pxBlk))
+    {
+        if (!pxBlk->bFree || pxBlk->xSize < xSize)
+        {
+            continue;
+        }
+        // Split off the rest of the block, if it has room besides its header
+        if (pxBlk->xSize - xSize > sizeof(trace_arena_blk_t))
+        {
+            pxRest = (trace_arena_blk_t *)((uint8_t *)pxBlk + xSize);
+            pxRest->xSize = pxBlk->xSize - xSize;
+            pxRest->xPrev = xSize;
+            pxRest->bFree = true;
+            pxBlk->xSize = xSize;
+            if ((pxNext = trace_arena_next(pxRest)) != NULL)
+            {
+                pxNext->xPrev = pxRest->xSize;
+            }
+        }
+        pxBlk->bFree = false;
+        gxTraceArenaUsed += pxBlk->xSize;
+        return pxBlk + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief      Free a block, merging it with the free blocks around it, on the arena lock
+ *
+ * @param      pvData  The memory of trace_arena_get()
+ */
+static void trace_arena_put(void *pvData)
+{
+    trace_arena_blk_t *pxBlk = (trace_arena_blk_t *)pvData - 1;
+    trace_arena_blk_t *pxNext = trace_arena_next(pxBlk);
+
+    pxBlk->bFree = true;
+    gxTraceArenaUsed -= pxBlk->xSize;
+    if (pxNext && pxNext->bFree)
+    {
+        pxBlk->xSize += pxNext->xSize;
+    }
+    if (pxBlk->xPrev && ((trace_arena_blk_t *)((uint8_t *)pxBlk - pxBlk->xPrev))->bFree)
+    {
+        trace_arena_blk_t *pxPrev = (trace_arena_blk_t *)((uint8_t *)pxBlk - pxBlk->xPrev);
+        pxPrev->xSize += pxBlk->xSize;
+        pxBlk = pxPrev;
+    }
+    if ((pxNext = trace_arena_next(pxBlk)) != NULL)
+    {
+        pxNext->xPrev = pxBlk->xSize;
+    }
+}
+
+/**
+ * @brief      Check the depth of a trace buffer of the pool
+ *
+ * @param      pulDepth  The depth, rounded down to a power of two with TRACE_USE_LARGE
+ * @param[in]  ucMode    One of TRACE_MODE_xxx
+ *
+ * @return     true - valid, false - not a depth or mode trace_alloc() supports
+ */
+static bool trace_arena_depth(uint32_t *pulDepth, uint8_t ucMode)
+{
+#if defined(TRACE_USE_LARGE)
+    while (*pulDepth & (*pulDepth - 1))
+    {
+        *pulDepth &= *pulDepth - 1;
+    }
+#else
+    if (*pulDepth >= (1u << 15))
+    {
+        return false;
+    }
+#endif // defined(TRACE_USE_LARGE)
+#if defined(TRACE_USE_SHARDS)
+    // NOTE: The shards of a TRACE_MODE_SHARD buffer live as long as their threads
+    if (ucMode == TRACE_MODE_SHARD)
+    {
+        return false;
+    }
+#endif // defined(TRACE_USE_SHARDS)
+    return *pulDepth != 0;
+}
+
+/**
+ * @brief      Check a trace buffer was allocated from the pool
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     true - from the pool, false - not
+ */
+static bool trace_arena_owns(trace_t *This)
+{
+    return gpucTraceArena && (uint8_t *)This >= gpucTraceArena && (uint8_t *)This < gpucTraceArena + gxTraceArenaSize;
+}
+
+bool trace_arena_init(size_t xSize, int iNode)
+{
+    bool bMapped = false;
+
+    TRACE_SPIN_LOCK(&gucTraceArenaLock);
+    if (gpucTraceArena == NULL)
+    {
+        bMapped = trace_arena_map(xSize, iNode);
+    }
+    TRACE_SPIN_UNLOCK(&gucTraceArenaLock);
+    return bMapped;
+}
+
+trace_t *trace_alloc(char *name, uint32_t ulDepth, bool bIsWrap, uint8_t ucMode)
+{
+    trace_t *This = NULL;
+    trace_line_t *axLine = NULL;
+    size_t xRing;
+
+    if (!trace_arena_depth(&ulDepth, ucMode))
+    {
+        return NULL;
+    }
+    // Step 1: Take the header and the ring from the pool
+    xRing = TRACE_LINES(ulDepth, ucMode) * sizeof(trace_line_t);
+    TRACE_SPIN_LOCK(&gucTraceArenaLock);
+    if (gpucTraceArena || trace_arena_map(TRACE_ARENA_SIZE, -1))
+    {
+        This = trace_arena_get(sizeof(trace_t));
+        axLine = This ? trace_arena_get(xRing) : NULL;
+    }
+    if (This && axLine == NULL)
+    {
+        trace_arena_put(This);
+        This = NULL;
+    }
+    TRACE_SPIN_UNLOCK(&gucTraceArenaLock);
+    if (This == NULL)
+    {
+        return NULL;
+    }
+    // Step 2: Set up the trace buffer, and list it
+    memset(This, 0, sizeof(*This));
+    memset(axLine, 0, xRing);
+    trace_init(This, name, axLine, ulDepth, bIsWrap);
+    This->ucMode = ucMode;
+    if (!trace_register(This))
+    {
+        TRACE_SPIN_LOCK(&gucTraceArenaLock);
+        trace_arena_put(axLine);
+        trace_arena_put(This);
+        TRACE_SPIN_UNLOCK(&gucTraceArenaLock);
+        return NULL;
+    }
+    return This;
+}
+
+void trace_free(trace_t *This)
+{
+    if (!trace_arena_owns(This))
+    {
+        return;
+    }
+    trace_unregister(This);
+    TRACE_SPIN_LOCK(&gucTraceArenaLock);
+    trace_arena_put(This->axLine);
+    trace_arena_put(This);
+    TRACE_SPIN_UNLOCK(&gucTraceArenaLock);
+}
+
+void trace_arena_usage(size_t *pxUsed, size_t *pxSize)
+{
+    TRACE_SPIN_LOCK(&gucTraceArenaLock);
+    *pxUsed = gxTraceArenaUsed;
+    if (pxSize)
+    {
+        *pxSize = gxTraceArenaSize;
+    }
+    TRACE_SPIN_UNLOCK(&gucTraceArenaLock);
+}
+#endif // defined(TRACE_USE_ARENA)
@@ -38,6 +38,14 @@ SOFTWARE.
  *       TRACE_CONFIG(Error, "Error Trace", 8, false)
  *     e.g.: To create an "Test" trace buffer that can store 20 traces with wrap
  *       TRACE_CONFIG(Test, "Test Trace", 20, true)
+ *   c) Use TRACE_CONFIG_EX() to select a buffer mode other than TRACE_MODE_LINE
+ *     TRACE_CONFIG_EX(<Trace Buffer Name>, <Header>, <Depth of Trace Buffer>, <Wrap Mode>, <Mode>)
+ *     e.g.: To create a "Worker" trace buffer with a private 64 trace ring per thread
+ *       TRACE_CONFIG_EX(Worker, "Worker Trace", 64, true, TRACE_MODE_SHARD)
+ *     e.g.: To create an "Io" trace buffer of typed argument records in 64 trace lines of bytes
+ *       TRACE_CONFIG_EX(Io, "Io Trace", 64, true, TRACE_MODE_ARGS)
+ *     e.g.: To create a "Hot" trace buffer of the statistics of up to 32 call sites
+ *       TRACE_CONFIG_EX(Hot, "Hot Trace", 32, true, TRACE_MODE_AGG)
  *
  * Step 3: Define TRACE_USE_CONFIG_FILE with the file in step 2 in the section below
  *     e.g.: #define TRACE_USE_CONFIG_FILE "trace_config.h"
@@ -49,12 +57,58 @@ SOFTWARE.
  *   TRACE_FILE(<Trace Buffer Name>)
  *   TRACE_FUNC(<Trace Buffer Name>)
  *   TRACE(<Trace Buffer Name>, <message>, <value>)
+ *   TRACE_ARGS(<Trace Buffer Name>, <message>, <value>, ...)    (TRACE_USE_ARGS)
+ *   a) Use the _LVL variants to give a call site a level and category (0 to 23).  Call sites
+ *      above TRACE_LEVEL_MAX or outside TRACE_CATEGORY_MASK compile to nothing
+ *     TRACE_LVL(<Trace Buffer Name>, <level>, <category>, <message>, <value>)
+ *     TRACE_ARGS_LVL(<Trace Buffer Name>, <level>, <category>, <message>, <value>, ...)
+ *     e.g.: TRACE_LVL(Test, TRACE_LEVEL_DEBUG, 2, "queue depth", ulDepth)
+ *   b) Call TRACE_SET_LEVEL(<Trace Buffer Name>, <level>) and
+ *      TRACE_SET_CATEGORIES(<Trace Buffer Name>, <category mask>) to filter at run time
+ *   c) Use TRACE_SCOPE() to trace the begin and end of a block as a span      (TRACE_USE_SPANS)
+ *     TRACE_SCOPE(<Trace Buffer Name>, <message>)
+ *     e.g.: { TRACE_SCOPE(Test, "rx frame"); ... }
+ *   d) Use TRACE_SAMPLED() or TRACE_RATELIMITED() in hot loops, so they don't evict the rare
+ *      traces.  All calls are counted in the total                      (TRACE_USE_SAMPLING)
+ *     TRACE_SAMPLED(<Trace Buffer Name>, <message>, <value>, <store 1 in N calls>)
+ *     TRACE_RATELIMITED(<Trace Buffer Name>, <message>, <value>, <calls per second>, <burst>)
+ *     e.g.: TRACE_SAMPLED(Test, "poll", ulStatus, 1000)
+ *   e) Build with -finstrument-functions to trace the entry and exit of every function to the
+ *      trace buffer TRACE_FUNC_BUFFER, without any macros                 (TRACE_USE_INSTRUMENT)
+ *     e.g.: TRACE_CONFIG_EX(Func, "Func Trace", 4096, true, TRACE_MODE_SHARD) in step 2, and
+ *           gcc -finstrument-functions -finstrument-functions-exclude-file-list=trace.c,trace.h
  *
  * Step 6: Dump the trace using TRACE_DUMP or inspect with JTAG
  *   a) Call TRACE_DUMP(<Trace Buffer Name>, <reset>) to dump the contents of the trace buffer
  *      NOTE: TRACE_OUTPUT must be defined for trace dump to work
  *   b) With a JTAG debugger (e.g. JLinkDebugger), inspecting the global variables and
  *      expanding them in the debugger will show human redable messages.
+ *   c) Call trace_dump_binary() to write the raw trace buffer and decode it on the host
+ *      with tools/trace_decode (i.e. "make trace_decode")
+ *   d) Call trace_snapshot() to copy the trace lines while the writers keep running.  Define
+ *      TRACE_USE_SLOT_SEQ so the trace lines overwritten during the copy are discarded
+ *   e) Call trace_export_chrome() to write all trace buffers as Chrome trace-event JSON, which
+ *      chrome://tracing and the Perfetto UI show as a timeline per thread
+ *   f) Call TRACE_TRIGGER_ARM() to freeze the trace buffer <post> trace lines after a trigger,
+ *      and TRACE_TRIGGERED() to check if it froze, instead of dumping just in case (TRACE_USE_TRIGGER)
+ *     TRACE_TRIGGER_ARM(<Trace Buffer Name>, <message or NULL>, <condition or NULL>, <post>)
+ *     TRACE_TRIGGER(<Trace Buffer Name>)     Triggers an armed trace buffer explicitly
+ *     e.g.: TRACE_TRIGGER_ARM(Test, "crc error", NULL, 8); ... if (TRACE_TRIGGERED(Test)) TRACE_DUMP(Test, true);
+ *   g) Call trace_dump_text() to write the text of trace_dump() to a sink in large chunks, e.g. a
+ *      slow UART, which is much faster than printf() per trace line (TRACE_USE_FAST_DUMP)
+ *   h) Run tools/trace_reader <pid> to tail the trace buffers from another process, which does
+ *      all the formatting, instead of dumping them (TRACE_USE_SHM, i.e. "make trace_reader")
+ *   i) Call trace_persist_previous() at startup to check if the previous session crashed, and
+ *      run tools/trace_reader <file> to decode its trace buffers (TRACE_USE_PERSIST)
+ *   j) Call trace_drain_start() to stream the trace buffers to disk for a capture longer than
+ *      the rings, and decode the files with tools/trace_decode (TRACE_USE_DRAIN)
+ *     e.g.: trace_drain_start("/var/tmp/app", NULL, 0); ... trace_drain_stop();
+ *   k) Call trace_register() for the trace buffers set up at run time, or allocate them with
+ *      trace_alloc(), so the dumps above cover them too (TRACE_USE_REGISTRY, TRACE_USE_ARENA)
+ *     e.g.: pxConn = trace_alloc("Conn 42", 256, true, TRACE_MODE_LINE); ... trace_free(pxConn);
+ *   l) Call trace_query_dump() to output the matching trace lines of several trace buffers as
+ *      one stream in order of time, or run tools/trace_decode -q on their binary dumps (TRACE_USE_QUERY)
+ *     e.g.: trace_query_t xQuery = { .pcMatch = "crc" }; trace_query_dump(&xQuery);
  */
 #ifndef __TRACE_H__
 #define __TRACE_H__
@@ -65,8 +119,12 @@ extern "C" {
 
 /********************* System Headers ************************/
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
+/********************* Local Headers *************************/
+#include "trace_bin.h"
+
 /********************* Platform Configuration ****************/
 // Add platform specific types here
 //----Step 1: Trace Configuration [BEGIN]----
@@ -75,28 +133,370 @@ extern "C" {
 
 // [OPTIONAL] Define the following OS specific macros for thread safe operation
 // #include "your_os_mutex_or_semaphore_here.h"
+#ifndef TRACE_LOCK
 #define TRACE_LOCK()
 #define TRACE_UNLOCK()
+#endif // TRACE_LOCK
+#ifndef TRACE_DUMP_LOCK
 #define TRACE_DUMP_LOCK()
 #define TRACE_DUMP_UNLOCK()
+#endif // TRACE_DUMP_LOCK
+
+// [OPTIONAL] Define TRACE_USE_ATOMIC to claim trace slots with a single lock-free
+// atomic fetch-add instead of TRACE_LOCK()/TRACE_UNLOCK() (requires GCC/Clang)
+// #define TRACE_USE_ATOMIC
+// Size of a cache line.  With TRACE_USE_ATOMIC each trace_t header is aligned
+// to its own cache line to avoid false sharing between hot trace buffers
+#define TRACE_CACHE_LINE        64
+
+// [OPTIONAL] Define TRACE_USE_LARGE for trace buffers deeper than 32767 trace lines.  The
+// depth must be a power of two, so the trace index is masked to a slot instead of divided,
+// or compared and reset
+// #define TRACE_USE_LARGE
+// [OPTIONAL] Define TRACE_USE_HUGEPAGE to back the rings of TRACE_HUGE_PAGE or more with
+// transparent huge pages (Linux), cutting the TLB misses of a large ring
+// #define TRACE_USE_HUGEPAGE
+#define TRACE_HUGE_PAGE         (2u << 20)  // Size of a huge page [in bytes]
+
+// [OPTIONAL] Define TRACE_USE_SHARDS to enable TRACE_MODE_SHARD buffers.  Each thread
+// gets a private trace ring on its first trace call, so tracing touches no shared data.
+// The ring of an exited thread is taken over by the next new thread.  Link with -pthread (POSIX)
+// #define TRACE_USE_SHARDS
+#if defined(TRACE_USE_SHARDS)
+#include <stdlib.h>
+#define TRACE_MALLOC(size)      aligned_alloc(TRACE_CACHE_LINE, size)
+#define TRACE_SHARD_MAX         16      // Maximum number of TRACE_MODE_SHARD buffers, the traces of more are only counted
+#endif // defined(TRACE_USE_SHARDS)
+
+// [OPTIONAL] Define TRACE_USE_SPANS to store the thread ID of the caller and an event type in
+// each trace line, so TRACE_SCOPE() can trace the begin and end of a span (requires GCC/Clang)
+// #define TRACE_USE_SPANS
+#if defined(TRACE_USE_SHARDS) || defined(TRACE_USE_SPANS) || defined(TRACE_USE_INSTRUMENT)
+#include <unistd.h>
+#include <sys/syscall.h>
+#define TRACE_THREAD_LOCAL      __thread
+#define TRACE_GET_TID()         ((uint32_t)syscall(SYS_gettid))
+#endif // defined(TRACE_USE_SHARDS) || defined(TRACE_USE_SPANS) || defined(TRACE_USE_INSTRUMENT)
+
+// [OPTIONAL] Define TRACE_USE_MSG_ID to store a 16-bit message ID in each trace line instead
+// of a message pointer (requires GCC/Clang and an ELF linker).  The IDs of the TRACE* macros
+// are assigned at link time and resolved back to strings only when dumping
+// #define TRACE_USE_MSG_ID
+#define TRACE_MSG_DYN_MAX       256     // Number of messages trace() can intern at run time
+
+// [OPTIONAL] Define TRACE_USE_SLOT_SEQ to add a sequence number to each trace line, so
+// trace_dump() and trace_snapshot() discard the trace lines overwritten while they are
+// read instead of pausing the writers (requires GCC/Clang)
+// #define TRACE_USE_SLOT_SEQ
+
+// [OPTIONAL] Define TRACE_USE_ARGS to enable TRACE_MODE_ARGS buffers and TRACE_ARGS(), which
+// store variable length records of typed arguments in a byte ring
+// #define TRACE_USE_ARGS
+#define TRACE_ARG_STR_MAX       23      // Maximum length of a string argument stored inline
+
+// [OPTIONAL] Define TRACE_USE_AGG to enable TRACE_MODE_AGG and TRACE_MODE_AGG_GAP buffers, which
+// keep the count, minimum, maximum, sum and a log2 histogram per call site instead of trace lines
+// #define TRACE_USE_AGG
+
+// [OPTIONAL] Define TRACE_USE_SAMPLING to enable TRACE_SAMPLED() and TRACE_RATELIMITED(), which
+// only store 1 in N calls, or up to a rate of calls, of a hot call site while counting all calls
+// #define TRACE_USE_SAMPLING
+
+// [OPTIONAL] Define TRACE_USE_TRIGGER to freeze a TRACE_MODE_LINE buffer a number of trace lines
+// after a trigger, like a logic analyzer, keeping the trace lines before and after it
+// #define TRACE_USE_TRIGGER
+
+// [OPTIONAL] Define TRACE_USE_FAST_DUMP to format the trace lines of trace_dump() with a built-in
+// formatter instead of a TRACE_OUTPUT() per trace line, passing TRACE_OUTPUT("%.*s") a few KB of
+// trace lines at a time, and to enable trace_dump_text() to any sink
+// #define TRACE_USE_FAST_DUMP
+
+// [OPTIONAL] Define TRACE_USE_SHM to move the trace buffers of TRACE_USE_CONFIG_FILE into a POSIX shared
+// memory segment at startup, so tools/trace_reader can tail them read-only from another process (Linux).
+// The segment describes its layout (see trace_bin.h) and is removed when the process exits
+// #define TRACE_USE_SHM
+#define TRACE_SHM_NAME          "/trace.%u"     // Name of the segment, formatted with the process ID
+#define TRACE_SHM_MODE          0600            // Permissions of the segment, the reader needs read access
+#define TRACE_SHM_STR_DYN       8192            // Room for the messages interned at run time [in bytes]
+
+// [OPTIONAL] Define TRACE_USE_PERSIST to place the segment of TRACE_USE_SHM in a file, which keeps the trace
+// buffers of a process that crashed or was killed, at the cost of a memory store per trace.  At the next
+// startup the file of the previous session is kept as TRACE_PERSIST_FILE TRACE_PERSIST_PREV, and decoded
+// by tools/trace_reader.  The file survives the process, not the kernel (Linux)
+// #define TRACE_USE_PERSIST
+#define TRACE_PERSIST_FILE      "/var/tmp/%s.trace" // Name of the file, formatted with the name of the program
+#define TRACE_PERSIST_PREV      ".prev"             // Suffix of the file of the previous session
+#if defined(TRACE_USE_PERSIST)
+#if !defined(TRACE_USE_SHM)
+#define TRACE_USE_SHM
+#endif // !defined(TRACE_USE_SHM)
+// NOTE: The trace line being written when the process died is discarded by its sequence number
+#if !defined(TRACE_USE_SLOT_SEQ)
+#define TRACE_USE_SLOT_SEQ
+#endif // !defined(TRACE_USE_SLOT_SEQ)
+#endif // defined(TRACE_USE_PERSIST)
+
+// [OPTIONAL] Define TRACE_USE_INSTRUMENT to trace the entry and exit of the functions built with
+// -finstrument-functions (GCC/Clang) to the trace buffer TRACE_FUNC_BUFFER of TRACE_USE_CONFIG_FILE.
+// A trace line only stores the function address and the call depth, which trace_dump() resolves to
+// the symbol (link with -ldl before glibc 2.34).  trace.c and trace.h must be built without the hooks,
+// e.g. with -finstrument-functions-exclude-file-list=trace.c,trace.h.  A TRACE_MODE_SHARD buffer
+// gives each thread its own ring.  The calls are traced at TRACE_LEVEL_DEFAULT and TRACE_CATEGORY_DEFAULT,
+// so e.g. TRACE_SET_LEVEL(Func, TRACE_LEVEL_OFF) pauses them.  Not supported with TRACE_USE_MSG_ID
+// #define TRACE_USE_INSTRUMENT
+#ifndef TRACE_FUNC_BUFFER
+#define TRACE_FUNC_BUFFER       Func    // Name of the trace buffer of the function calls
+#endif // TRACE_FUNC_BUFFER
+#define TRACE_FUNC_DEPTH_MAX    64      // Calls nested deeper are not traced
+#define TRACE_FUNC_EXCLUDE_MAX  16      // Number of functions trace_func_exclude() can exclude
+#define TRACE_FUNC_SYM_CACHE    1024    // Number of symbols cached by trace_func_symbol(), a power of two
+#if defined(TRACE_USE_INSTRUMENT) && defined(TRACE_USE_MSG_ID)
+#error "TRACE_USE_INSTRUMENT stores the function address in place of the message pointer"
+#endif // defined(TRACE_USE_INSTRUMENT) && defined(TRACE_USE_MSG_ID)
+
+// [OPTIONAL] Define TRACE_USE_DRAIN to enable trace_drain_start(), a background thread that streams the new
+// trace lines of the trace buffers to disk, so a capture is not limited to the depth of the rings.  The
+// writers are never locked: a trace line overwritten before the drain reads it is counted as lost (see
+// trace_drain_lost()).  The stream is split into files of about TRACE_DRAIN_FILE_SIZE, each of which
+// tools/trace_decode decodes on its own.  The time stamps are delta encoded and the values are varints,
+// a few bytes per trace line (see trace_bin.h).  Link with -pthread (POSIX)
+// #define TRACE_USE_DRAIN
+#define TRACE_DRAIN_NAME        "%s.%06u"       // Name of a file, formatted with the path of trace_drain_start() and the file number
+#ifndef TRACE_DRAIN_FILE_SIZE
+#define TRACE_DRAIN_FILE_SIZE   (64u << 20)     // A file is closed and the next one started at this size [in bytes]
+#endif // TRACE_DRAIN_FILE_SIZE
+#ifndef TRACE_DRAIN_FILES
+#define TRACE_DRAIN_FILES       16              // Number of files kept, the oldest is removed, 0 - all
+#endif // TRACE_DRAIN_FILES
+#define TRACE_DRAIN_INTERVAL_MS 10              // Time the drain sleeps once it caught up [in ms]
+#define TRACE_DRAIN_MAX         64              // Number of trace buffers and shards the drain follows
+#define TRACE_DRAIN_STRS        4096            // Number of messages a file refers to by index, a power of two
+#if defined(TRACE_USE_DRAIN)
+// NOTE: The drain tells a trace line being written or overwritten by its sequence number
+#if !defined(TRACE_USE_SLOT_SEQ)
+#define TRACE_USE_SLOT_SEQ
+#endif // !defined(TRACE_USE_SLOT_SEQ)
+#endif // defined(TRACE_USE_DRAIN)
+
+// [OPTIONAL] Define TRACE_USE_REGISTRY to list the trace buffers set up at run time, e.g. by trace_init(), next
+// to the ones of TRACE_USE_CONFIG_FILE.  trace_register() adds a trace buffer to trace_dump_all(),
+// trace_dump_binary_all(), trace_export_chrome() and the drain, and trace_unregister() removes it.  The readers
+// scan the registry without locks, trace_unregister() waits for the readers of its slot (requires GCC/Clang)
+// #define TRACE_USE_REGISTRY
+#define TRACE_REGISTRY_MAX      256     // Number of trace buffers that can be registered
+
+// [OPTIONAL] Define TRACE_USE_ARENA to enable trace_alloc(), which carves registered trace buffers out of one
+// pool set up front by trace_arena_init(), optionally on the memory of a NUMA node (Linux).  Each trace
+// buffer header and ring starts on its own cache line, and trace_free() returns them to the pool, so trace
+// buffers per connection or per worker have a fixed memory use
+// #define TRACE_USE_ARENA
+#ifndef TRACE_ARENA_SIZE
+#define TRACE_ARENA_SIZE        (16u << 20)     // Size of the pool if trace_arena_init() wasn't called [in bytes]
+#endif // TRACE_ARENA_SIZE
+#if defined(TRACE_USE_ARENA)
+#if !defined(TRACE_USE_REGISTRY)
+#define TRACE_USE_REGISTRY
+#endif // !defined(TRACE_USE_REGISTRY)
+#endif // defined(TRACE_USE_ARENA)
+
+// [OPTIONAL] Define TRACE_USE_QUERY to enable trace_query(), which merges the selected trace buffers into one
+// stream in order of time stamp and outputs only the trace lines matching a filter: the message substring or
+// ID, a range of values, a time window or a thread.  The filter runs on the raw trace lines, so only the
+// matches are formatted and the cost of a query follows the size of its result rather than the depth of
+// the trace buffers
+// #define TRACE_USE_QUERY
+#define TRACE_QUERY_MAX         64      // Number of trace buffers and shards a query merges
+#define TRACE_QUERY_MSGS        64      // Number of messages whose match of the substring a query caches
+
+// [OPTIONAL] Build time filter of the TRACE* macros.  Call sites above TRACE_LEVEL_MAX, or
+// of a category not in TRACE_CATEGORY_MASK, compile to nothing
+#ifndef TRACE_LEVEL_MAX
+#define TRACE_LEVEL_MAX         TRACE_LEVEL_VERBOSE
+#endif // TRACE_LEVEL_MAX
+#ifndef TRACE_CATEGORY_MASK
+#define TRACE_CATEGORY_MASK     0xFFFFFF    // Bit per category 0 to 23
+#endif // TRACE_CATEGORY_MASK
 
 // [OPTIONAL] Define TRACE_OUTPUT to enable trace_dump
 // This section maybe customized for platform specific debug facilities
 // #include "your_embedded_DEBUG_OUT_here.h"
+#ifndef TRACE_OUTPUT
 #include <stdio.h>
 #define TRACE_OUTPUT(...)       printf(__VA_ARGS__)
+#endif // TRACE_OUTPUT
+
+// [OPTIONAL] Define TRACE_WRITE to enable trace_dump_binary_fd() to a file descriptor
+// This section maybe customized for platform specific I/O facilities
+#ifndef TRACE_WRITE
+#include <unistd.h>
+#define TRACE_WRITE(fd, pvData, xSize)  write(fd, pvData, xSize)
+#endif // TRACE_WRITE
 
 // [OPTIONAL] Step 1a: Define TRACE_GET_TICK to enable time stamping
 // This section maybe customized for platform specific debug facilities
 // #include "your_embedded_GET_TICK_here.h"
+// NOTE: Define TRACE_NO_TICK to build without time stamps (e.g. to benchmark their cost)
+#ifndef TRACE_NO_TICK
 extern uint32_t fake_tick(void);
 #define TRACE_GET_TICK          fake_tick
+#endif // TRACE_NO_TICK
+
+// [OPTIONAL] Step 1b: Define TRACE_USE_TICK64 to time stamp with a 64-bit cycle counter instead
+// of TRACE_GET_TICK, so trace_dump() prints absolute times and deltas in nanoseconds.  The
+// counter rate is calibrated at startup against CLOCK_MONOTONIC_RAW unless TRACE_TICK_HZ is
+// defined.  TRACE_GET_TICK64 may be defined to read another 64-bit counter.
+// #define TRACE_USE_TICK64
+// Define TRACE_TICK_COMPACT to keep a 32-bit time stamp per trace line, the lower bits of
+// (tick >> TRACE_TICK_SHIFT), which trace_dump() extends against the 64-bit tick of the newest
+// trace of the buffer.  Consecutive traces must be less than 2^31 << TRACE_TICK_SHIFT ticks
+// apart (e.g. 0.7 s at 3 GHz with a shift of 0)
+// #define TRACE_TICK_COMPACT
+#if defined(TRACE_USE_TICK64)
+#include <time.h>
+#ifndef TRACE_GET_TICK64
+#define TRACE_GET_TICK64()      trace_tick64()
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__)
+#define TRACE_TICK_HZ           1000000000ull   // trace_tick64() reads CLOCK_MONOTONIC_RAW [in ns]
+#endif
+#endif // TRACE_GET_TICK64
+#ifndef TRACE_TICK_SHIFT
+#define TRACE_TICK_SHIFT        0
+#endif // TRACE_TICK_SHIFT
+#define TRACE_TICK_CALIBRATE_MS 10      // Duration of the startup calibration [in ms]
+// NOTE: TRACE_GET_TICK stays defined, as it enables the time stamp of the trace line
+#undef  TRACE_GET_TICK
+#define TRACE_GET_TICK          TRACE_GET_TICK64
+#endif // defined(TRACE_USE_TICK64)
 
 // [OPTIONAL] Step 3: Use a customized "trace_config.h" file to define trace buffers
+#ifndef TRACE_USE_CONFIG_FILE
 #define TRACE_USE_CONFIG_FILE   "trace_config.h"
+#endif // TRACE_USE_CONFIG_FILE
 //----Trace Configuration [END]----
 
 /*********************** Macros ******************************/
+// Trace buffer modes
+#define TRACE_MODE_LINE         0       // Single ring of trace lines shared by all callers
+#define TRACE_MODE_SHARD        1       // Private ring per thread, merged by time stamp on dump (TRACE_USE_SHARDS)
+#define TRACE_MODE_ARGS         2       // Byte ring of variable length records of typed arguments (TRACE_USE_ARGS)
+#define TRACE_MODE_AGG          3       // Statistics per call site, with a histogram of the values (TRACE_USE_AGG)
+#define TRACE_MODE_AGG_GAP      4       // Same as TRACE_MODE_AGG, with a histogram of the time between calls
+
+// Set in the value of the trace line of a function exit (TRACE_USE_INSTRUMENT), besides the call depth
+#define TRACE_FUNC_EXIT         0x80000000u
+
+// Trigger states (TRACE_USE_TRIGGER)
+#define TRACE_TRIG_OFF          0       // Never freezes
+#define TRACE_TRIG_ARMED        1       // Waiting for the trigger
+#define TRACE_TRIG_FIRING       2       // Trigger being recorded
+#define TRACE_TRIG_FIRED        3       // Freezes at trace_t::ullStop
+
+// Trace levels.  A call site is traced if its level is at or below the enabled level
+#define TRACE_LEVEL_OFF         0       // Only valid for trace_set_level()
+#define TRACE_LEVEL_ERROR       1
+#define TRACE_LEVEL_WARN        2
+#define TRACE_LEVEL_INFO        3
+#define TRACE_LEVEL_DEBUG       4
+#define TRACE_LEVEL_VERBOSE     5
+
+// Level and category of TRACE(), TRACE_FILE(), TRACE_FUNC() and TRACE_ARGS()
+#define TRACE_LEVEL_DEFAULT     TRACE_LEVEL_INFO
+#define TRACE_CATEGORY_DEFAULT  0
+
+// NOTE: trace_t::ulEnable holds a bit per level followed by a bit per category, so
+//       a call site is checked with a single mask and compare
+#define TRACE_LEVEL_BITS        8
+#define TRACE_CATEGORY_MAX      24
+#define TRACE_ENABLE_ALL        0xFFFFFFFF
+#define TRACE_ENABLE_BITS(level, category)  ((1u << ((level) - 1)) | (1u << (TRACE_LEVEL_BITS + (category))))
+
+// Number of trace lines statically allocated for a trace buffer of the given mode
+// NOTE: Without TRACE_USE_SHARDS a TRACE_MODE_SHARD buffer behaves as TRACE_MODE_LINE.
+//       A TRACE_MODE_ARGS buffer uses its trace lines as a byte ring.
+#if defined(TRACE_USE_SHARDS)
+#define TRACE_LINES_SHARD(depth, mode)  (((mode) == TRACE_MODE_SHARD) ? 1 : (depth))
+#else
+#define TRACE_LINES_SHARD(depth, mode)  (depth)
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_AGG)
+// NOTE: The depth of a TRACE_MODE_AGG buffer is its number of call sites of trace_agg_t
+#define TRACE_MODE_IS_AGG(mode)     ((mode) == TRACE_MODE_AGG || (mode) == TRACE_MODE_AGG_GAP)
+#define TRACE_LINES(depth, mode) \
+    (TRACE_MODE_IS_AGG(mode) ? ((depth) * sizeof(trace_agg_t) + sizeof(trace_line_t) - 1) / sizeof(trace_line_t) : TRACE_LINES_SHARD(depth, mode))
+#else
+#define TRACE_LINES(depth, mode)    TRACE_LINES_SHARD(depth, mode)
+#endif // defined(TRACE_USE_AGG)
+
+// Depth of a trace buffer, and the slot of a free running trace index
+#if defined(TRACE_USE_LARGE)
+#define TRACE_DEPTH(This)           ((This)->ulDepth)
+#define TRACE_SLOT_OF(ullIdx, depth)    ((uint32_t)(ullIdx) & ((depth) - 1))
+#else
+#define TRACE_DEPTH(This)           ((This)->usDepth)
+#define TRACE_SLOT_OF(ullIdx, depth)    ((uint32_t)((ullIdx) % (depth)))
+#endif // defined(TRACE_USE_LARGE)
+#define TRACE_SLOT(This, ullIdx)    TRACE_SLOT_OF(ullIdx, TRACE_DEPTH(This))
+
+// Sequence number of the trace line of a free running trace index (TRACE_USE_SLOT_SEQ).  It
+// skips 0, which marks a trace line being written
+#define TRACE_SEQ(ullIdx)           ((uint32_t)(ullIdx) + 1 ? (uint32_t)(ullIdx) + 1 : 1)
+
+// NOTE: Once triggered, a trace buffer freezes at trace index ullStop, so later traces are only counted
+#if defined(TRACE_USE_TRIGGER)
+#define TRACE_FROZEN(This, ullIdx) \
+    (__atomic_load_n(&(This)->ucTrig, __ATOMIC_ACQUIRE) == TRACE_TRIG_FIRED && (ullIdx) >= (This)->ullStop)
+#else
+#define TRACE_FROZEN(This, ullIdx)  false
+#endif // defined(TRACE_USE_TRIGGER)
+
+#define TRACE_CAT(a, b)         TRACE_CAT_(a, b)
+#define TRACE_CAT_(a, b)        a##b
+
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_MSG_DYN           0x8000  // Message IDs interned at run time by trace()
+#define TRACE_MSG_NONE          0xFFFF  // Message could not be interned
+
+/**
+ * @brief      Gets the link time message ID of a constant message string.  Each
+ *             call site adds a pointer to the message to the "trace_msg" section,
+ *             the index of which is the ID.
+ *
+ * @param      pcMessage  Constant message string
+ */
+#define TRACE_MSG_ID(pcMessage) ({ \
+    static const char * const pcTraceMsg __attribute__((section("trace_msg"), used)) = (pcMessage); \
+    (uint16_t)(&pcTraceMsg - __start_trace_msg); })
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_ARGS) && !defined(__cplusplus)
+/**
+ * @brief      Converts a value to a typed argument of TRACE_ARGS() by its C type
+ *
+ * @param      x     Integer, floating point, pointer or string value
+ */
+#define TRACE_ARG(x) _Generic((x), \
+    _Bool: trace_arg_u32, unsigned char: trace_arg_u32, unsigned short: trace_arg_u32, unsigned int: trace_arg_u32, \
+    char: trace_arg_i32, signed char: trace_arg_i32, short: trace_arg_i32, int: trace_arg_i32, \
+    unsigned long: trace_arg_u64, unsigned long long: trace_arg_u64, \
+    long: trace_arg_i64, long long: trace_arg_i64, \
+    float: trace_arg_double, double: trace_arg_double, \
+    char *: trace_arg_str, const char *: trace_arg_str, \
+    default: trace_arg_ptr)(x)
+
+// NOTE: These macros count and convert up to 8 arguments of TRACE_ARGS()
+#define TRACE_NARGS(...)        TRACE_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1)
+#define TRACE_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, N, ...)    N
+#define TRACE_ARGV(...)         TRACE_CAT(TRACE_ARGV_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define TRACE_ARGV_1(a)         TRACE_ARG(a)
+#define TRACE_ARGV_2(a, ...)    TRACE_ARG(a), TRACE_ARGV_1(__VA_ARGS__)
+#define TRACE_ARGV_3(a, ...)    TRACE_ARG(a), TRACE_ARGV_2(__VA_ARGS__)
+#define TRACE_ARGV_4(a, ...)    TRACE_ARG(a), TRACE_ARGV_3(__VA_ARGS__)
+#define TRACE_ARGV_5(a, ...)    TRACE_ARG(a), TRACE_ARGV_4(__VA_ARGS__)
+#define TRACE_ARGV_6(a, ...)    TRACE_ARG(a), TRACE_ARGV_5(__VA_ARGS__)
+#define TRACE_ARGV_7(a, ...)    TRACE_ARG(a), TRACE_ARGV_6(__VA_ARGS__)
+#define TRACE_ARGV_8(a, ...)    TRACE_ARG(a), TRACE_ARGV_7(__VA_ARGS__)
+#endif // defined(TRACE_USE_ARGS) && !defined(__cplusplus)
+
 #ifdef TRACE_USE_CONFIG_FILE
 /**
  * @brief      Configures the trace buffer
@@ -107,32 +507,247 @@ extern uint32_t fake_tick(void);
  * @param      isWrap   true - wrap when full, false - stop tracing when full
  */
 #define TRACE_CONFIG(trcName, hdrName, depth, isWrap) \
-    extern trace_line_t gaxTrace##trcName##Line[depth]; \
+    TRACE_CONFIG_EX(trcName, hdrName, depth, isWrap, TRACE_MODE_LINE)
+
+/**
+ * @brief      Configures the trace buffer with a buffer mode
+ *
+ * @param      trcName  Name of Trace object
+ * @param      hdrName  Banner shown in trace dump
+ * @param      depth    Depth of the trace buffer (per thread for TRACE_MODE_SHARD, call sites for TRACE_MODE_AGG)
+ * @param      isWrap   true - wrap when full, false - stop tracing when full
+ * @param      mode     One of TRACE_MODE_xxx
+ */
+#define TRACE_CONFIG_EX(trcName, hdrName, depth, isWrap, mode) \
+    extern trace_line_t gaxTrace##trcName##Line[TRACE_LINES(depth, mode)]; \
     extern trace_t gxTrace##trcName; \
     extern trace_t *gpxTrace##trcName;
 
+/**
+ * @brief      Checks if a call site of the given level and category is traced.
+ *             The build time filter folds to a constant, the run time filter
+ *             is a single branch on the enable mask of the trace buffer.
+ *
+ * @param      trcName   Name of Trace object
+ * @param      level     One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category  Category 0 to TRACE_CATEGORY_MAX - 1
+ */
+#define TRACE_ENABLED(trcName, level, category) \
+    ((level) <= TRACE_LEVEL_MAX && ((TRACE_CATEGORY_MASK >> (category)) & 1) && \
+     (gpxTrace##trcName->ulEnable & TRACE_ENABLE_BITS(level, category)) == TRACE_ENABLE_BITS(level, category))
+
 /**
  * @brief      Traces the executedline in a file
  *
  * @param      trcName  Name of Trace object
  */
-#define TRACE_FILE(trcName)                     trace(gpxTrace##trcName, "--"__FILE__ " @ line", __LINE__)
+#define TRACE_FILE(trcName)                     TRACE(trcName, "--" __FILE__ " @ line", __LINE__)
 
 /**
  * @brief      Traces the executed line in a function
  *
  * @param      trcName  Name of Trace object
  */
-#define TRACE_FUNC(trcName)                     trace(gpxTrace##trcName, (char *)__func__, __LINE__)
+#define TRACE_FUNC(trcName)                     TRACE(trcName, (char *)__func__, __LINE__)
 
 /**
  * @brief      Adds generic message string and value to trace buffer
  *
  * @param      trcName    Name of Trace object
- * @param      pcMessage  Message string
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
  * @param      ulValue    value to trace
  */
-#define TRACE(trcName, pcMessage, ulValue)      trace(gpxTrace##trcName, pcMessage, ulValue)
+#define TRACE(trcName, pcMessage, ulValue) \
+    TRACE_LVL(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT, pcMessage, ulValue)
+
+/**
+ * @brief      Adds generic message string and value to trace buffer if the
+ *             level and category of the call site are enabled
+ *
+ * @param      trcName    Name of Trace object
+ * @param      level      One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category   Category 0 to TRACE_CATEGORY_MAX - 1
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ulValue    value to trace
+ */
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_LVL(trcName, level, category, pcMessage, ulValue) \
+    (TRACE_ENABLED(trcName, level, category) ? trace_id(gpxTrace##trcName, TRACE_MSG_ID(pcMessage), ulValue) : (void)0)
+#else
+#define TRACE_LVL(trcName, level, category, pcMessage, ulValue) \
+    (TRACE_ENABLED(trcName, level, category) ? trace(gpxTrace##trcName, pcMessage, ulValue) : (void)0)
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_ARGS) && !defined(__cplusplus)
+/**
+ * @brief      Adds a message string and 1 to 8 typed arguments to the trace
+ *             buffer as a single record, e.g. TRACE_ARGS(Test, "rx", pxBuf, ullBytes, iStatus)
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ...        Integer, floating point, pointer or string values
+ */
+#define TRACE_ARGS(trcName, pcMessage, ...) \
+    TRACE_ARGS_LVL(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT, pcMessage, __VA_ARGS__)
+
+/**
+ * @brief      Same as TRACE_ARGS() if the level and category of the call site are enabled
+ *
+ * @param      trcName    Name of Trace object
+ * @param      level      One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category   Category 0 to TRACE_CATEGORY_MAX - 1
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ...        Integer, floating point, pointer or string values
+ */
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_ARGS_LVL(trcName, level, category, pcMessage, ...) \
+    (TRACE_ENABLED(trcName, level, category) ? \
+     trace_args_id(gpxTrace##trcName, TRACE_MSG_ID(pcMessage), TRACE_NARGS(__VA_ARGS__), (const trace_arg_t []){ TRACE_ARGV(__VA_ARGS__) }) : (void)0)
+#else
+#define TRACE_ARGS_LVL(trcName, level, category, pcMessage, ...) \
+    (TRACE_ENABLED(trcName, level, category) ? \
+     trace_args(gpxTrace##trcName, pcMessage, TRACE_NARGS(__VA_ARGS__), (const trace_arg_t []){ TRACE_ARGV(__VA_ARGS__) }) : (void)0)
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_ARGS) && !defined(__cplusplus)
+
+#if defined(TRACE_USE_SPANS)
+/**
+ * @brief      Traces the begin of a span, and its end when the enclosing block
+ *             is left, e.g. { TRACE_SCOPE(Test, "rx frame"); ... }
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ */
+#define TRACE_SCOPE(trcName, pcMessage) \
+    TRACE_SCOPE_LVL(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT, pcMessage)
+
+/**
+ * @brief      Same as TRACE_SCOPE() if the level and category of the call site
+ *             are enabled.  The end is traced if the begin was.
+ *
+ * @param      trcName    Name of Trace object
+ * @param      level      One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category   Category 0 to TRACE_CATEGORY_MAX - 1
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ */
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_SCOPE_LVL(trcName, level, category, pcMessage) \
+    trace_scope_t TRACE_CAT(xTraceScope, __LINE__) __attribute__((cleanup(trace_scope_end))) = \
+        trace_scope_begin_id(TRACE_ENABLED(trcName, level, category) ? gpxTrace##trcName : NULL, TRACE_MSG_ID(pcMessage))
+#else
+#define TRACE_SCOPE_LVL(trcName, level, category, pcMessage) \
+    trace_scope_t TRACE_CAT(xTraceScope, __LINE__) __attribute__((cleanup(trace_scope_end))) = \
+        trace_scope_begin(TRACE_ENABLED(trcName, level, category) ? gpxTrace##trcName : NULL, pcMessage)
+#endif // defined(TRACE_USE_MSG_ID)
+
+/**
+ * @brief      Traces the begin and end of a span that does not follow a block,
+ *             e.g. across callbacks.  Both must be traced by the same thread.
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ */
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_BEGIN(trcName, pcMessage) \
+    (TRACE_ENABLED(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT) ? \
+     trace_event_id(gpxTrace##trcName, TRACE_EVENT_BEGIN, TRACE_MSG_ID(pcMessage), 0) : (void)0)
+#define TRACE_END(trcName, pcMessage) \
+    (TRACE_ENABLED(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT) ? \
+     trace_event_id(gpxTrace##trcName, TRACE_EVENT_END, TRACE_MSG_ID(pcMessage), 0) : (void)0)
+#else
+#define TRACE_BEGIN(trcName, pcMessage) \
+    (TRACE_ENABLED(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT) ? \
+     trace_event(gpxTrace##trcName, TRACE_EVENT_BEGIN, pcMessage, 0) : (void)0)
+#define TRACE_END(trcName, pcMessage) \
+    (TRACE_ENABLED(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT) ? \
+     trace_event(gpxTrace##trcName, TRACE_EVENT_END, pcMessage, 0) : (void)0)
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_USE_SAMPLING)
+/**
+ * @brief      Adds 1 in rate calls of the call site to the trace buffer, starting
+ *             with the first.  All calls are counted in the total of the trace buffer.
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ulValue    value to trace
+ * @param      rate       Store 1 in rate calls
+ */
+#define TRACE_SAMPLED(trcName, pcMessage, ulValue, rate) \
+    TRACE_SAMPLED_LVL(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT, pcMessage, ulValue, rate)
+
+/**
+ * @brief      Same as TRACE_SAMPLED() if the level and category of the call site are enabled
+ *
+ * @param      trcName    Name of Trace object
+ * @param      level      One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category   Category 0 to TRACE_CATEGORY_MAX - 1
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ulValue    value to trace
+ * @param      rate       Store 1 in rate calls
+ */
+#define TRACE_SAMPLED_LVL(trcName, level, category, pcMessage, ulValue, rate) ({ \
+    static trace_site_t xTraceSite = { (rate) ? (rate) : 1, 0 }; \
+    (TRACE_ENABLED(trcName, level, category) && trace_site_sample(&xTraceSite)) ? \
+        TRACE_SITE_WRITE(trace_sampled, gpxTrace##trcName, &xTraceSite, pcMessage, ulValue) : (void)0; })
+
+/**
+ * @brief      Adds the calls of the call site to the trace buffer up to rate calls
+ *             per second, with bursts of up to burst calls (token bucket).  All
+ *             calls are counted in the total of the trace buffer.
+ *
+ * @note       Without a time stamp only the first burst calls are stored
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ulValue    value to trace
+ * @param      rate       Calls stored per second
+ * @param      burst      Calls stored back to back
+ */
+#define TRACE_RATELIMITED(trcName, pcMessage, ulValue, rate, burst) \
+    TRACE_RATELIMITED_LVL(trcName, TRACE_LEVEL_DEFAULT, TRACE_CATEGORY_DEFAULT, pcMessage, ulValue, rate, burst)
+
+/**
+ * @brief      Same as TRACE_RATELIMITED() if the level and category of the call site are enabled
+ *
+ * @param      trcName    Name of Trace object
+ * @param      level      One of TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE
+ * @param      category   Category 0 to TRACE_CATEGORY_MAX - 1
+ * @param      pcMessage  Message string (constant with TRACE_USE_MSG_ID)
+ * @param      ulValue    value to trace
+ * @param      rate       Calls stored per second
+ * @param      burst      Calls stored back to back
+ */
+#define TRACE_RATELIMITED_LVL(trcName, level, category, pcMessage, ulValue, rate, burst) ({ \
+    static trace_site_t xTraceSite = { (rate) ? (rate) : 1, (burst) ? (burst) : 1 }; \
+    TRACE_ENABLED(trcName, level, category) ? \
+        TRACE_SITE_WRITE(trace_ratelimited, gpxTrace##trcName, &xTraceSite, pcMessage, ulValue) : (void)0; })
+
+// NOTE: Calls the message string or message ID variant of a call site function
+#if defined(TRACE_USE_MSG_ID)
+#define TRACE_SITE_WRITE(pfn, This, pxSite, pcMessage, ulValue)    pfn##_id(This, pxSite, TRACE_MSG_ID(pcMessage), ulValue)
+#else
+#define TRACE_SITE_WRITE(pfn, This, pxSite, pcMessage, ulValue)    pfn(This, pxSite, pcMessage, ulValue)
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_SAMPLING)
+
+/**
+ * @brief      Sets the level of the trace buffer at run time.  Call sites at or
+ *             below the level are traced.
+ *
+ * @param      trcName  Name of Trace object
+ * @param      level    One of TRACE_LEVEL_xxx
+ */
+#define TRACE_SET_LEVEL(trcName, level)         trace_set_level(gpxTrace##trcName, level)
+
+/**
+ * @brief      Sets the categories of the trace buffer at run time
+ *
+ * @param      trcName     Name of Trace object
+ * @param      categories  Bit per category to trace
+ */
+#define TRACE_SET_CATEGORIES(trcName, categories)   trace_set_categories(gpxTrace##trcName, categories)
 
 /**
  * @brief      Dump the trace buffer to the configured output
@@ -155,37 +770,311 @@ extern uint32_t fake_tick(void);
  * @param[in]  reset  true - reset trace, false - leave as is
  */
 #define TRACE_DUMP_ALL(reset)                   trace_dump_all(reset)
+
+#if defined(TRACE_USE_TRIGGER)
+/**
+ * @brief      Arms the trace buffer to freeze post trace lines after the trigger,
+ *             keeping depth - post trace lines up to and including the trigger.
+ *             A trace of the message, for which the condition holds, triggers.
+ *
+ * @param      trcName    Name of Trace object
+ * @param      pcMessage  Message that triggers, NULL - any message
+ * @param      pfnCond    Condition on the message and value that triggers, NULL - none
+ * @param      post       Number of trace lines to keep after the trigger
+ *
+ * @note       Without a message and condition only TRACE_TRIGGER() triggers
+ */
+#define TRACE_TRIGGER_ARM(trcName, pcMessage, pfnCond, post)    trace_trigger_arm(gpxTrace##trcName, pcMessage, pfnCond, post)
+
+/**
+ * @brief      Triggers an armed trace buffer before its next trace line
+ *
+ * @param      trcName  Name of Trace object
+ */
+#define TRACE_TRIGGER(trcName)                  trace_trigger(gpxTrace##trcName)
+
+/**
+ * @brief      Checks if the trace buffer froze after its trigger
+ *
+ * @param      trcName  Name of Trace object
+ */
+#define TRACE_TRIGGERED(trcName)                trace_triggered(gpxTrace##trcName)
+#endif // defined(TRACE_USE_TRIGGER)
 #else
 #define TRACE_CONFIG(trcName, hdrName, depth, isWrap)
+#define TRACE_CONFIG_EX(trcName, hdrName, depth, isWrap, mode)
 #define TRACE_FILE(trcName)
 #define TRACE_FUNC(trcName)
 #define TRACE(trcName, pcMessage, ulValue)
+#define TRACE_ENABLED(trcName, level, category) (0)
+#define TRACE_LVL(trcName, level, category, pcMessage, ulValue)
+#define TRACE_ARGS(trcName, pcMessage, ...)
+#define TRACE_ARGS_LVL(trcName, level, category, pcMessage, ...)
+#define TRACE_SCOPE(trcName, pcMessage)
+#define TRACE_SCOPE_LVL(trcName, level, category, pcMessage)
+#define TRACE_BEGIN(trcName, pcMessage)
+#define TRACE_END(trcName, pcMessage)
+#define TRACE_SAMPLED(trcName, pcMessage, ulValue, rate)
+#define TRACE_SAMPLED_LVL(trcName, level, category, pcMessage, ulValue, rate)
+#define TRACE_RATELIMITED(trcName, pcMessage, ulValue, rate, burst)
+#define TRACE_RATELIMITED_LVL(trcName, level, category, pcMessage, ulValue, rate, burst)
+#define TRACE_SET_LEVEL(trcName, level)
+#define TRACE_SET_CATEGORIES(trcName, categories)
 #define TRACE_DUMP(trcName, reset)
 #define TRACE_DUMP_ALL(reset)
+#define TRACE_TRIGGER_ARM(trcName, pcMessage, pfnCond, post)
+#define TRACE_TRIGGER(trcName)
+#define TRACE_TRIGGERED(trcName)                (0)
 #endif // defined(TRACE_USE_CONFIG_FILE)
 
 /*********************** Typedefs ****************************/
+// Time stamp as stored in a trace line
+#if defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_COMPACT)
+typedef uint64_t trace_stamp_t;
+#else
+typedef uint32_t trace_stamp_t;
+#endif // defined(TRACE_USE_TICK64) && !defined(TRACE_TICK_COMPACT)
+
+// Message as stored in a trace line
+#if defined(TRACE_USE_MSG_ID)
+typedef uint16_t trace_msg_t;
+#else
+typedef char * trace_msg_t;
+#endif // defined(TRACE_USE_MSG_ID)
+
 // The trace line holds a single trace sample
 typedef struct
 {
 #if defined(TRACE_GET_TICK)
-    uint32_t ulTimeStamp;           // TimeStamp
+    trace_stamp_t xTimeStamp;       // TimeStamp
 #endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+    uint16_t usMsgId;               // ID of Trace Message string (see trace_msg_string)
+#else
     char * pcMessage;               // Pointer to Trace Message string
+#endif // defined(TRACE_USE_MSG_ID)
     uint32_t ulValue;               // Optional value
+#if defined(TRACE_USE_SPANS)
+    uint32_t ulTid;                 // Thread ID of the caller
+    uint8_t  ucEvent;               // One of TRACE_EVENT_xxx
+#endif // defined(TRACE_USE_SPANS)
+#if defined(TRACE_USE_SLOT_SEQ)
+    uint32_t ulSeq;                 // 1 + free running index of the trace, 0 - being written
+#endif // defined(TRACE_USE_SLOT_SEQ)
 } trace_line_t;
 
-typedef struct
+#if defined(TRACE_USE_TRIGGER)
+/**
+ * @brief      Condition of a trace that triggers a trace buffer
+ *
+ * @param      pcMessage  Message of the trace
+ * @param[in]  ulValue    Value of the trace
+ *
+ * @return     true - trigger, false - keep waiting
+ */
+typedef bool (*trace_cond_t)(const char *pcMessage, uint32_t ulValue);
+#endif // defined(TRACE_USE_TRIGGER)
+
+#if defined(TRACE_USE_ATOMIC)
+#define TRACE_ALIGNED           __attribute__((aligned(TRACE_CACHE_LINE)))
+#else
+#define TRACE_ALIGNED
+#endif // defined(TRACE_USE_ATOMIC)
+
+typedef struct trace_s
 {
+#if defined(TRACE_USE_LARGE)
+    uint32_t ulDepth;               // The number of trace lines, a power of two
+    uint8_t  bIsWrap;               // true - wrap when full, false - stop tracing when full
+#else
     uint16_t usDepth : 15;          // The number of trace lines
     uint16_t bIsWrap : 1;           // true - wrap when full, false - stop tracing when full
-    uint16_t usIdx;                 // Index to next trace line to write
-    uint32_t ulCount;               // Total number of trace
+#endif // defined(TRACE_USE_LARGE)
+    uint8_t  ucMode;                // One of TRACE_MODE_xxx
+    uint32_t ulEnable;              // Levels and categories traced by the TRACE* macros (see TRACE_ENABLE_BITS)
+#if defined(TRACE_USE_SHARDS)
+    uint8_t  ucShardKey;            // TRACE_MODE_SHARD: 1 + thread local shard slot, 0 - unassigned
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_ARGS)
+    uint8_t  ucLock;                // TRACE_MODE_ARGS: spin lock with TRACE_USE_ATOMIC
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_TRIGGER)
+    uint8_t  ucTrig;                // TRACE_TRIG_xxx
+#endif // defined(TRACE_USE_TRIGGER)
+#if defined(TRACE_USE_INSTRUMENT)
+    uint8_t  bFunc;                 // true - the messages are function addresses (TRACE_FUNC_BUFFER)
+#endif // defined(TRACE_USE_INSTRUMENT)
+    // NOTE: The free running index is 64-bit, so it never wraps back below the depth nor moves
+    //       the slots of a depth that is not a power of two.  A trace either claims a trace line
+    //       or is counted in ulCount, so the total is ullIdx + ulCount (see trace_total())
+    uint64_t ullIdx;                // Free running index of the next trace line to write
+    uint32_t ulSlot;                // Slot of ullIdx for a single writer (TRACE_LOCK(), a shard), reset at the depth
+    uint32_t ulCount;               // Number of traces without a trace line (e.g. no-wrap buffer full, skipped, records)
     trace_line_t *axLine;           // Pointer to array of trace lines
     char *   name;                  // Name of trace
-} trace_t;
+#if defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+    uint64_t ullTickBase;           // 64-bit tick of the newest trace, extends the 32-bit time stamps
+#endif // defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+#if defined(TRACE_USE_ARGS)
+    uint32_t ulHead;                // TRACE_MODE_ARGS: offset to next record to write [in bytes]
+    uint32_t ulTail;                // TRACE_MODE_ARGS: offset of the oldest record [in bytes]
+    uint32_t ulUsed;                // TRACE_MODE_ARGS: number of bytes used by records
+#endif // defined(TRACE_USE_ARGS)
+#if defined(TRACE_USE_SHARDS)
+    struct trace_s *pxShard;        // TRACE_MODE_SHARD: list of thread shards, Shard: next shard
+    uint32_t ulTid;                 // Shard: thread ID of the owner
+    uint8_t  bShardFree;            // Shard: true - the owner exited, another thread may take it over
+#endif // defined(TRACE_USE_SHARDS)
+#if defined(TRACE_USE_SAMPLING)
+    struct trace_site_s *pxSite;    // List of the call sites of TRACE_SAMPLED() and TRACE_RATELIMITED()
+#endif // defined(TRACE_USE_SAMPLING)
+#if defined(TRACE_USE_TRIGGER)
+    uint32_t ulPost;                // Number of trace lines kept after the trigger
+    uint64_t ullTrig;               // Trace index of the trace line marked by the trigger
+    uint64_t ullStop;               // Trace index the trace buffer freezes at once triggered
+    const char *pcTrigMsg;          // Message that triggers, NULL - any message
+    trace_cond_t pfnTrigCond;       // Condition on the message and value that triggers, NULL - none
+#endif // defined(TRACE_USE_TRIGGER)
+} TRACE_ALIGNED trace_t;
+
+#if defined(TRACE_USE_TICK64)
+/**
+ * @brief      Reads the default 64-bit tick counter: the invariant TSC on x86,
+ *             the virtual counter on ARM64, otherwise CLOCK_MONOTONIC_RAW
+ *
+ * @return     The tick
+ */
+static inline uint64_t trace_tick64(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t ulLo, ulHi;
+    __asm__ __volatile__("rdtsc" : "=a"(ulLo), "=d"(ulHi));
+    return ((uint64_t)ulHi << 32) | ulLo;
+#elif defined(__aarch64__)
+    uint64_t ullTick;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ullTick));
+    return ullTick;
+#else
+    struct timespec xTime;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &xTime);
+    return (uint64_t)xTime.tv_sec * 1000000000ull + xTime.tv_nsec;
+#endif // defined(__x86_64__) || defined(__i386__)
+}
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_SPANS)
+// A span traced by TRACE_SCOPE(), ended when it goes out of scope
+typedef struct
+{
+    trace_t *This;                  // Trace buffer of the span, NULL - not traced
+#if defined(TRACE_USE_MSG_ID)
+    uint16_t usMsgId;               // Message ID
+#else
+    char *   pcMessage;             // Message string
+#endif // defined(TRACE_USE_MSG_ID)
+} trace_scope_t;
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_USE_SAMPLING)
+// State of a call site of TRACE_SAMPLED() or TRACE_RATELIMITED(), in static storage
+typedef struct trace_site_s
+{
+    uint32_t ulRate;                // TRACE_SAMPLED(): 1 in ulRate calls, TRACE_RATELIMITED(): calls per second
+    uint32_t ulBurst;               // TRACE_RATELIMITED(): calls back to back, 0 - TRACE_SAMPLED()
+    uint32_t ulCalls;               // Number of calls
+    uint32_t ulStored;              // Number of calls stored
+    uint32_t ulFolded;              // Number of skipped calls counted in trace_t::ulCount
+    uint64_t ullNext;               // TRACE_RATELIMITED(): time the next call is stored at without a burst
+    trace_t *This;                  // Trace buffer the call site is listed in, NULL - not yet
+    struct trace_site_s *pxNext;    // Next call site of the trace buffer
+#if defined(TRACE_USE_MSG_ID)
+    uint16_t usMsgId;               // Message ID
+#else
+    char *   pcMessage;             // Message string
+#endif // defined(TRACE_USE_MSG_ID)
+} trace_site_t;
+#endif // defined(TRACE_USE_SAMPLING)
+
+#if defined(TRACE_USE_ARGS)
+// A typed argument of TRACE_ARGS()
+typedef struct
+{
+    uint8_t  ucType;                // TRACE_ARG_xxx (see trace_bin.h)
+    union
+    {
+        uint32_t ul;
+        int32_t  l;
+        uint64_t ull;
+        int64_t  ll;
+        const void *pv;
+        double   d;
+        const char *pc;
+    };
+} trace_arg_t;
+
+static inline trace_arg_t trace_arg_u32(uint32_t x)     { trace_arg_t xArg; xArg.ucType = TRACE_ARG_U32; xArg.ul = x; return xArg; }
+static inline trace_arg_t trace_arg_i32(int32_t x)      { trace_arg_t xArg; xArg.ucType = TRACE_ARG_I32; xArg.l = x; return xArg; }
+static inline trace_arg_t trace_arg_u64(uint64_t x)     { trace_arg_t xArg; xArg.ucType = TRACE_ARG_U64; xArg.ull = x; return xArg; }
+static inline trace_arg_t trace_arg_i64(int64_t x)      { trace_arg_t xArg; xArg.ucType = TRACE_ARG_I64; xArg.ll = x; return xArg; }
+static inline trace_arg_t trace_arg_ptr(const void *x)  { trace_arg_t xArg; xArg.ucType = TRACE_ARG_PTR; xArg.pv = x; return xArg; }
+static inline trace_arg_t trace_arg_double(double x)    { trace_arg_t xArg; xArg.ucType = TRACE_ARG_DOUBLE; xArg.d = x; return xArg; }
+static inline trace_arg_t trace_arg_str(const char *x)  { trace_arg_t xArg; xArg.ucType = TRACE_ARG_STR; xArg.pc = x; return xArg; }
+#endif // defined(TRACE_USE_ARGS)
+
+/**
+ * @brief      Receives a block of output data (e.g. from trace_dump_binary)
+ *
+ * @param      pvCtx   Context passed with the sink
+ * @param      pvData  Data to output
+ * @param[in]  xSize   Size of the data [in bytes]
+ */
+typedef void (*trace_sink_t)(void *pvCtx, const void *pvData, size_t xSize);
+
+#if defined(TRACE_USE_DRAIN)
+// Statistics of the drain (see trace_drain_stats)
+typedef struct
+{
+    uint64_t ullLines;              // Number of trace lines written
+    uint64_t ullLost;               // Number of trace lines overwritten before they were drained
+    uint64_t ullBytes;              // Number of bytes written
+    uint32_t ulFiles;               // Number of files started
+} trace_drain_stats_t;
+#endif // defined(TRACE_USE_DRAIN)
+
+#if defined(TRACE_USE_QUERY)
+// Filter of trace_query().  A field left 0 matches all trace lines
+typedef struct
+{
+    trace_t * const *apxTrace;      // Trace buffers to merge, NULL - all the ones of trace_dump_all()
+    uint32_t ulTraces;              // Number of trace buffers in apxTrace
+    const char *pcMatch;            // Substring of the message, NULL - any
+#if defined(TRACE_USE_MSG_ID)
+    bool     bMsgId;                // true - only the message usMsgId
+    uint16_t usMsgId;               // ID of the message (see trace_msg_id)
+#endif // defined(TRACE_USE_MSG_ID)
+    bool     bValue;                // true - only the values from ulValueMin to ulValueMax
+    uint32_t ulValueMin;            // Lowest value
+    uint32_t ulValueMax;            // Highest value
+    bool     bTime;                 // true - only the trace lines from ullTimeFrom to ullTimeTo
+    uint64_t ullTimeFrom;           // Start of the window [in ns with TRACE_USE_TICK64, otherwise in ticks of TRACE_GET_TICK]
+    uint64_t ullTimeTo;             // End of the window, inclusive
+    uint32_t ulTid;                 // Thread ID (TRACE_USE_SPANS, or the owner of a shard), 0 - any
+    uint32_t ulMax;                 // Number of trace lines output, the oldest matches first, 0 - no limit
+} trace_query_t;
+#endif // defined(TRACE_USE_QUERY)
 
 /********************* Extern Variables **********************/
+#if defined(TRACE_USE_MSG_ID)
+// Table of link time messages, indexed by message ID
+extern const char * const __start_trace_msg[] __attribute__((weak));
+extern const char * const __stop_trace_msg[] __attribute__((weak));
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_SPANS)
+// This thread's ID, 0 - not read yet (see trace_tid())
+extern TRACE_THREAD_LOCAL uint32_t gulTraceTid;
+#endif // defined(TRACE_USE_SPANS)
+
 #ifdef TRACE_USE_CONFIG_FILE
 #include TRACE_USE_CONFIG_FILE
 #endif // TRACE_USE_CONFIG_FILE
@@ -197,10 +1086,10 @@ typedef struct
  * @param      This     Pointer to TRACE object
  * @param      name     Name of trace
  * @param      pxLine   Pointer to array of trace line (i.e. trace buffer)
- * @param[in]  usDepth  Depth of the trace buffer
+ * @param[in]  ulDepth  Depth of the trace buffer, rounded down to a power of two with TRACE_USE_LARGE
  * @param[in]  bIsWrap  true - wrap when full, false - stop tracing when full
  */
-void trace_init(trace_t *This, char *name, trace_line_t *pxLine, uint16_t usDepth, bool bIsWrap);
+void trace_init(trace_t *This, char *name, trace_line_t *pxLine, uint32_t ulDepth, bool bIsWrap);
 
 /**
  * @brief      Trace the code by adding to the trace buffer
@@ -211,6 +1100,653 @@ void trace_init(trace_t *This, char *name, trace_line_t *pxLine, uint16_t usDept
  */
 void trace(trace_t *This, char *pcMessage, uint32_t ulValue);
 
+/**
+ * @brief      Copies a consistent snapshot of the most recent trace lines, oldest
+ *             first, without pausing the writers.  With TRACE_USE_SLOT_SEQ the
+ *             trace lines being written or overwritten during the copy are
+ *             discarded, otherwise they are copied as is.
+ *
+ * @param      This    Pointer to the TRACE object (TRACE_MODE_LINE or a shard)
+ * @param      axLine  Receives the trace lines
+ * @param[in]  ulMax   Number of trace lines axLine can hold
+ *
+ * @return     Number of trace lines copied
+ */
+uint32_t trace_snapshot(trace_t *This, trace_line_t *axLine, uint32_t ulMax);
+
+/**
+ * @brief      Sets the level of the trace buffer.  The TRACE* macros trace the
+ *             call sites at or below the level.
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ucLevel  One of TRACE_LEVEL_xxx
+ */
+void trace_set_level(trace_t *This, uint8_t ucLevel);
+
+/**
+ * @brief      Sets the categories of the trace buffer traced by the TRACE* macros
+ *
+ * @param      This          Pointer to the TRACE object
+ * @param[in]  ulCategories  Bit per category 0 to TRACE_CATEGORY_MAX - 1
+ */
+void trace_set_categories(trace_t *This, uint32_t ulCategories);
+
+#if defined(TRACE_USE_TICK64)
+/**
+ * @brief      Measures the rate of TRACE_GET_TICK64() against CLOCK_MONOTONIC_RAW
+ *             over TRACE_TICK_CALIBRATE_MS.  Called at startup, and may be called
+ *             again, e.g. after the counter rate changed.
+ *
+ * @return     The tick rate [in Hz]
+ */
+uint64_t trace_tick_calibrate(void);
+
+/**
+ * @brief      Converts a number of ticks of TRACE_GET_TICK64() to nanoseconds
+ *
+ * @param[in]  ullTicks  Number of ticks
+ *
+ * @return     Time [in ns]
+ */
+uint64_t trace_tick_ns(uint64_t ullTicks);
+#endif // defined(TRACE_USE_TICK64)
+
+#if defined(TRACE_USE_MSG_ID)
+/**
+ * @brief      Trace the code by adding a message ID to the trace buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  usMsgId  Message ID from TRACE_MSG_ID() or trace_msg_id()
+ * @param[in]  ulValue  [OPTIONAL] Value to store
+ */
+void trace_id(trace_t *This, uint16_t usMsgId, uint32_t ulValue);
+
+/**
+ * @brief      Intern a message string at run time.  Used by trace() for
+ *             messages that do not have a link time message ID.
+ *
+ * @param      pcMessage  Null-terminated message string
+ *
+ * @return     Message ID, or TRACE_MSG_NONE if TRACE_MSG_DYN_MAX is exhausted
+ */
+uint16_t trace_msg_id(const char *pcMessage);
+
+/**
+ * @brief      Resolve a message ID back to its message string
+ *
+ * @param[in]  usMsgId  Message ID
+ *
+ * @return     The message string, or NULL if the ID is unknown
+ */
+const char *trace_msg_string(uint16_t usMsgId);
+#endif // defined(TRACE_USE_MSG_ID)
+
+#if defined(TRACE_USE_SPANS)
+/**
+ * @brief      Trace an event of a span, or a point event
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param[in]  ucEvent    One of TRACE_EVENT_xxx
+ * @param      pcMessage  Null-terminated message string
+ * @param[in]  ulValue    [OPTIONAL] Value to store
+ */
+void trace_event(trace_t *This, uint8_t ucEvent, char *pcMessage, uint32_t ulValue);
+
+#if defined(TRACE_USE_MSG_ID)
+/**
+ * @brief      Same as trace_event() with a message ID
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  usMsgId  Message ID from TRACE_MSG_ID() or trace_msg_id()
+ * @param[in]  ulValue  [OPTIONAL] Value to store
+ */
+void trace_event_id(trace_t *This, uint8_t ucEvent, uint16_t usMsgId, uint32_t ulValue);
+
+/**
+ * @brief      Begin the span of TRACE_SCOPE()
+ *
+ * @param      This     Pointer to the TRACE object, NULL - the span is not traced
+ * @param[in]  usMsgId  Message ID
+ *
+ * @return     The span
+ */
+static inline trace_scope_t trace_scope_begin_id(trace_t *This, uint16_t usMsgId)
+{
+    trace_scope_t xScope;
+    xScope.This = This;
+    xScope.usMsgId = usMsgId;
+    if (This)
+    {
+        trace_event_id(This, TRACE_EVENT_BEGIN, usMsgId, 0);
+    }
+    return xScope;
+}
+#else
+/**
+ * @brief      Begin the span of TRACE_SCOPE()
+ *
+ * @param      This       Pointer to the TRACE object, NULL - the span is not traced
+ * @param      pcMessage  Null-terminated message string
+ *
+ * @return     The span
+ */
+static inline trace_scope_t trace_scope_begin(trace_t *This, char *pcMessage)
+{
+    trace_scope_t xScope;
+    xScope.This = This;
+    xScope.pcMessage = pcMessage;
+    if (This)
+    {
+        trace_event(This, TRACE_EVENT_BEGIN, pcMessage, 0);
+    }
+    return xScope;
+}
+#endif // defined(TRACE_USE_MSG_ID)
+
+/**
+ * @brief      End the span of TRACE_SCOPE(), called as it goes out of scope
+ *
+ * @param      pxScope  The span
+ */
+static inline void trace_scope_end(trace_scope_t *pxScope)
+{
+    if (pxScope->This)
+    {
+#if defined(TRACE_USE_MSG_ID)
+        trace_event_id(pxScope->This, TRACE_EVENT_END, pxScope->usMsgId, 0);
+#else
+        trace_event(pxScope->This, TRACE_EVENT_END, pxScope->pcMessage, 0);
+#endif // defined(TRACE_USE_MSG_ID)
+    }
+}
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_USE_TRIGGER)
+/**
+ * @brief      Arms a TRACE_MODE_LINE trace buffer to freeze ulPost trace lines after
+ *             its trigger.  The trigger is re-armed when the trace buffer is reset.
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param      pcMessage  Message that triggers, NULL - any message
+ * @param[in]  pfnCond    Condition on the message and value that triggers, NULL - none.
+ *                        Without a message and condition only trace_trigger() triggers
+ * @param[in]  ulPost     Number of trace lines to keep after the trigger
+ */
+void trace_trigger_arm(trace_t *This, const char *pcMessage, trace_cond_t pfnCond, uint32_t ulPost);
+
+/**
+ * @brief      Disarms the trigger, so the trace buffer records as configured again
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+void trace_trigger_disarm(trace_t *This);
+
+/**
+ * @brief      Triggers an armed trace buffer before its next trace line
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+void trace_trigger(trace_t *This);
+
+/**
+ * @brief      Checks if the trace buffer froze after its trigger
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     true - triggered and frozen, false - still recording
+ */
+bool trace_triggered(trace_t *This);
+
+/**
+ * @brief      Triggers an armed trace buffer if the trace line just stored matches
+ *             its trigger.  Called by trace_line_write()
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ullIdx   Free running index of the trace line
+ * @param[in]  xMsg     Message string or ID of the trace line
+ * @param[in]  ulValue  Value of the trace line
+ */
+void trace_trigger_hit(trace_t *This, uint64_t ullIdx, trace_msg_t xMsg, uint32_t ulValue);
+#endif // defined(TRACE_USE_TRIGGER)
+
+/*
+ * The write path of a TRACE_MODE_LINE buffer, inline so trace.c and the trace
+ * buffers of trace.hpp, which know their depth at compile time, share it.
+ */
+#if defined(TRACE_USE_SPANS)
+/**
+ * @brief      Gets the thread ID of the caller, read once per thread
+ *
+ * @return     The thread ID
+ */
+static inline uint32_t trace_tid(void)
+{
+    uint32_t ulTid = gulTraceTid;
+    if (ulTid == 0)
+    {
+        ulTid = gulTraceTid = TRACE_GET_TID();
+    }
+    return ulTid;
+}
+#endif // defined(TRACE_USE_SPANS)
+
+#if defined(TRACE_GET_TICK)
+/**
+ * @brief      Gets the time stamp of a trace
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     The time stamp
+ */
+static inline trace_stamp_t trace_stamp(trace_t *This)
+{
+#if defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+    uint64_t ullTick = TRACE_GET_TICK64();
+    // NOTE: Concurrent writers may leave a slightly older tick, which is fine to extend from
+    __atomic_store_n(&This->ullTickBase, ullTick, __ATOMIC_RELAXED);
+    return (trace_stamp_t)(ullTick >> TRACE_TICK_SHIFT);
+#else
+    (void)This;
+    return TRACE_GET_TICK();  // Tick [in ms, or of TRACE_GET_TICK64()]
+#endif // defined(TRACE_USE_TICK64) && defined(TRACE_TICK_COMPACT)
+}
+#endif // defined(TRACE_GET_TICK)
+
+/**
+ * @brief      Gets the total number of traces of a trace buffer, stored or only counted
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     The total, wrapping at 2^32
+ */
+static inline uint32_t trace_total(const trace_t *This)
+{
+#if defined(TRACE_USE_ATOMIC)
+    return (uint32_t)(__atomic_load_n(&This->ullIdx, __ATOMIC_RELAXED) + __atomic_load_n(&This->ulCount, __ATOMIC_RELAXED));
+#else
+    return (uint32_t)(This->ullIdx + This->ulCount);
+#endif // defined(TRACE_USE_ATOMIC)
+}
+
+/**
+ * @brief      Claim the next trace line of a trace buffer shared by many callers
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ulDepth  Depth of the trace buffer, a constant lets the compiler fold the slot
+ * @param      pullIdx  Returns the free running index of the trace line
+ *
+ * @return     Trace line to write, or NULL if the trace is only counted
+ */
+static inline trace_line_t *trace_claim(trace_t *This, uint32_t ulDepth, uint64_t *pullIdx)
+{
+#if defined(TRACE_USE_ATOMIC)
+    uint64_t ullIdx;
+    // Step 1: A full no-wrap or frozen buffer only counts the trace, so don't claim a slot
+    ullIdx = __atomic_load_n(&This->ullIdx, __ATOMIC_RELAXED);
+    if ((!This->bIsWrap && ullIdx >= ulDepth) || TRACE_FROZEN(This, ullIdx))
+    {
+        __atomic_fetch_add(&This->ulCount, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    // Step 2: Claim a slot with a single fetch-add, the index also counts the trace
+    ullIdx = __atomic_fetch_add(&This->ullIdx, 1, __ATOMIC_RELAXED);
+    *pullIdx = ullIdx;
+    // Step 3: Map the free running index to a slot.  The no-wrap and frozen cases may
+    //         lose the race for the last slots, in which case the trace is only counted
+    if ((!This->bIsWrap && ullIdx >= ulDepth) || TRACE_FROZEN(This, ullIdx))
+    {
+        return NULL;
+    }
+    return &This->axLine[TRACE_SLOT_OF(ullIdx, ulDepth)];
+#else
+    trace_line_t *pxLine = NULL;
+    // Step 1: Lock the resource
+    TRACE_LOCK();
+    // Step 2: Only store if there is room in the buffer (i.e. no-wrap case) and not
+    //         frozen, otherwise only count the trace
+    if ((This->bIsWrap || This->ullIdx < ulDepth) && !TRACE_FROZEN(This, This->ullIdx))
+    {
+        // Step 3: Take the slot and reset it at the depth, the free running index follows
+        pxLine = &This->axLine[This->ulSlot];
+        if (++This->ulSlot >= ulDepth)
+        {
+            This->ulSlot = 0;
+        }
+        *pullIdx = This->ullIdx++;
+    }
+    else
+    {
+        This->ulCount++;
+    }
+    // Step 4: Unlock the resource
+    TRACE_UNLOCK();
+    return pxLine;
+#endif // defined(TRACE_USE_ATOMIC)
+}
+
+/**
+ * @brief      Store the trace line.  Without TRACE_USE_SLOT_SEQ, assume there is
+ *             enough time to write at slot before wrap
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxLine   Trace line claimed for this trace
+ * @param[in]  ullIdx   Free running index of the trace line
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx, stored with TRACE_USE_SPANS
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value to store
+ */
+static inline void trace_store(trace_t *This, trace_line_t *pxLine, uint64_t ullIdx, uint8_t ucEvent, trace_msg_t xMsg, uint32_t ulValue)
+{
+#if defined(TRACE_USE_SLOT_SEQ)
+    // NOTE: Per slot seqlock, a reader discards the trace line unless the sequence
+    //       number is the same before and after it copies the trace line
+    __atomic_store_n(&pxLine->ulSeq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#else
+    (void)ullIdx;
+#endif // defined(TRACE_USE_SLOT_SEQ)
+#if defined(TRACE_GET_TICK)
+    pxLine->xTimeStamp = trace_stamp(This);
+#else
+    (void)This;
+#endif // defined(TRACE_GET_TICK)
+#if defined(TRACE_USE_MSG_ID)
+    pxLine->usMsgId = xMsg;
+#else
+    pxLine->pcMessage = xMsg;
+#endif // defined(TRACE_USE_MSG_ID)
+    pxLine->ulValue = ulValue;
+#if defined(TRACE_USE_SPANS)
+    pxLine->ulTid = trace_tid();
+    pxLine->ucEvent = ucEvent;
+#else
+    (void)ucEvent;
+#endif // defined(TRACE_USE_SPANS)
+#if defined(TRACE_USE_SLOT_SEQ)
+    __atomic_store_n(&pxLine->ulSeq, TRACE_SEQ(ullIdx), __ATOMIC_RELEASE);
+#endif // defined(TRACE_USE_SLOT_SEQ)
+}
+
+/**
+ * @brief      Add a trace line to a TRACE_MODE_LINE trace buffer
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  ulDepth  Depth of the trace buffer, a constant lets the compiler fold the slot
+ * @param[in]  ucEvent  One of TRACE_EVENT_xxx
+ * @param[in]  xMsg     Message string or ID
+ * @param[in]  ulValue  Value to store
+ */
+static inline void trace_line_write(trace_t *This, uint32_t ulDepth, uint8_t ucEvent, trace_msg_t xMsg, uint32_t ulValue)
+{
+    uint64_t ullIdx;
+    trace_line_t *pxLine = trace_claim(This, ulDepth, &ullIdx);
+    if (pxLine)
+    {
+        trace_store(This, pxLine, ullIdx, ucEvent, xMsg, ulValue);
+#if defined(TRACE_USE_TRIGGER)
+        if (__atomic_load_n(&This->ucTrig, __ATOMIC_RELAXED) == TRACE_TRIG_ARMED)
+        {
+            trace_trigger_hit(This, ullIdx, xMsg, ulValue);
+        }
+#endif // defined(TRACE_USE_TRIGGER)
+    }
+}
+
+#if defined(TRACE_USE_SAMPLING)
+/**
+ * @brief      Counts a call of a TRACE_SAMPLED() call site without a lock
+ *
+ * @param      pxSite  The call site
+ *
+ * @return     true - store the call, false - skip it
+ */
+static inline bool trace_site_sample(trace_site_t *pxSite)
+{
+    return __atomic_fetch_add(&pxSite->ulCalls, 1, __ATOMIC_RELAXED) % pxSite->ulRate == 0;
+}
+
+/**
+ * @brief      Store a call of a TRACE_SAMPLED() call site chosen by trace_site_sample(),
+ *             and count the calls skipped since the last one
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param      pxSite     The call site
+ * @param      pcMessage  Null-terminated message string
+ * @param[in]  ulValue    [OPTIONAL] Value to store
+ */
+void trace_sampled(trace_t *This, trace_site_t *pxSite, char *pcMessage, uint32_t ulValue);
+
+/**
+ * @brief      Store a call of a TRACE_RATELIMITED() call site if within its rate,
+ *             otherwise only count it
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param      pxSite     The call site
+ * @param      pcMessage  Null-terminated message string
+ * @param[in]  ulValue    [OPTIONAL] Value to store
+ */
+void trace_ratelimited(trace_t *This, trace_site_t *pxSite, char *pcMessage, uint32_t ulValue);
+
+#if defined(TRACE_USE_MSG_ID)
+/**
+ * @brief      Same as trace_sampled() with a message ID
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxSite   The call site
+ * @param[in]  usMsgId  Message ID from TRACE_MSG_ID() or trace_msg_id()
+ * @param[in]  ulValue  [OPTIONAL] Value to store
+ */
+void trace_sampled_id(trace_t *This, trace_site_t *pxSite, uint16_t usMsgId, uint32_t ulValue);
+
+/**
+ * @brief      Same as trace_ratelimited() with a message ID
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param      pxSite   The call site
+ * @param[in]  usMsgId  Message ID from TRACE_MSG_ID() or trace_msg_id()
+ * @param[in]  ulValue  [OPTIONAL] Value to store
+ */
+void trace_ratelimited_id(trace_t *This, trace_site_t *pxSite, uint16_t usMsgId, uint32_t ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_SAMPLING)
+
+#if defined(TRACE_USE_ARGS)
+/**
+ * @brief      Trace the code by adding a record of typed arguments to a
+ *             TRACE_MODE_ARGS trace buffer.  The record is reserved in one
+ *             step, so the arguments are stored together.  Other trace
+ *             buffers only store the first argument as the value.
+ *
+ * @param      This       Pointer to the TRACE object
+ * @param      pcMessage  Null-terminated message string
+ * @param[in]  ucArgs     Number of arguments
+ * @param      axArg      The arguments
+ */
+void trace_args(trace_t *This, char *pcMessage, uint8_t ucArgs, const trace_arg_t *axArg);
+
+#if defined(TRACE_USE_MSG_ID)
+/**
+ * @brief      Same as trace_args() with a message ID
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  usMsgId  Message ID from TRACE_MSG_ID() or trace_msg_id()
+ * @param[in]  ucArgs   Number of arguments
+ * @param      axArg    The arguments
+ */
+void trace_args_id(trace_t *This, uint16_t usMsgId, uint8_t ucArgs, const trace_arg_t *axArg);
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // defined(TRACE_USE_ARGS)
+
+#if defined(TRACE_USE_INSTRUMENT)
+/**
+ * @brief      Excludes a function, and the functions it calls, from the trace of
+ *             TRACE_USE_INSTRUMENT.  Each call checks the excluded functions, so
+ *             keep them few; an excluded function already running is still traced
+ *
+ * @param      pvFunc  Address of the function
+ *
+ * @return     true - excluded, false - TRACE_FUNC_EXCLUDE_MAX functions are already excluded
+ */
+bool trace_func_exclude(const void *pvFunc);
+
+/**
+ * @brief      Same as trace_func_exclude() with the symbol of the function, e.g.
+ *             of a static function, looked up once
+ *
+ * @param      pcSymbol  Symbol of the function
+ *
+ * @return     true - excluded, false - unknown symbol or no room
+ */
+bool trace_func_exclude_symbol(const char *pcSymbol);
+
+/**
+ * @brief      Enables or disables the trace of TRACE_USE_INSTRUMENT in the calling
+ *             thread, e.g. to only trace the threads of interest
+ *
+ * @param[in]  bEnable  true - trace the calls of the thread (default), false - don't
+ */
+void trace_func_thread(bool bEnable);
+
+/**
+ * @brief      Resolves a function address to its symbol, with dladdr() or the
+ *             symbol table of the executable, and caches it.  Called by the dumps
+ *             of TRACE_FUNC_BUFFER under TRACE_DUMP_LOCK(), as it is not thread safe
+ *
+ * @param      pvFunc  Address of the function
+ *
+ * @return     The symbol, or the object and offset of the address if unknown
+ */
+const char *trace_func_symbol(const void *pvFunc);
+#endif // defined(TRACE_USE_INSTRUMENT)
+
+#if defined(TRACE_USE_SHM)
+/**
+ * @brief      Gets the name of the shared memory segment of the trace buffers,
+ *             which tools/trace_reader attaches to
+ *
+ * @return     Name of the segment, or of its file with TRACE_USE_PERSIST, NULL if it could not be created
+ */
+const char *trace_shm_name(void);
+#endif // defined(TRACE_USE_SHM)
+
+#if defined(TRACE_USE_PERSIST)
+/**
+ * @brief      Gets the file of the trace buffers of the previous session of the
+ *             program, kept at startup for tools/trace_reader
+ *
+ * @param      pbCrashed  Returns true if the previous session ended without exit(),
+ *                        i.e. it crashed or was killed, NULL - not needed
+ *
+ * @return     Name of the file, NULL if there is no previous session
+ */
+const char *trace_persist_previous(bool *pbCrashed);
+#endif // defined(TRACE_USE_PERSIST)
+
+#if defined(TRACE_USE_DRAIN)
+/**
+ * @brief      Starts the drain thread, which streams the trace lines of the trace
+ *             buffers to the files TRACE_DRAIN_NAME until trace_drain_stop(),
+ *             starting with the trace lines already in the rings.  TRACE_MODE_LINE
+ *             buffers and the shards of TRACE_MODE_SHARD buffers are drained.
+ *             NOTE: A trace buffer that doesn't wrap is only drained until it is full
+ *
+ * @param      pcPath    Path the names of the files start with, e.g. "/var/tmp/app"
+ * @param      apxTrace  Trace buffers to drain, which must outlive the drain, NULL - all trace buffers of
+ *                       TRACE_USE_CONFIG_FILE, and the ones registered as they come and go (TRACE_USE_REGISTRY)
+ * @param[in]  ulTraces  Number of trace buffers in apxTrace
+ *
+ * @return     true - started, false - already running, or the first file could not be created
+ */
+bool trace_drain_start(const char *pcPath, trace_t * const *apxTrace, uint32_t ulTraces);
+
+/**
+ * @brief      Stops the drain thread once it drained the trace lines traced so
+ *             far, and closes the file.  Also called when the process exits
+ */
+void trace_drain_stop(void);
+
+/**
+ * @brief      Gets the overrun counter of a trace buffer
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     Number of trace lines the writers overwrote before the drain read them
+ */
+uint64_t trace_drain_lost(trace_t *This);
+
+/**
+ * @brief      Gets the statistics of the drain since trace_drain_start()
+ *
+ * @param      pxStats  Returns the statistics
+ */
+void trace_drain_stats(trace_drain_stats_t *pxStats);
+#endif // defined(TRACE_USE_DRAIN)
+
+#if defined(TRACE_USE_REGISTRY)
+/**
+ * @brief      Adds a trace buffer set up at run time to the registry, so the
+ *             dumps of all trace buffers and the drain cover it
+ *
+ * @param      This  Pointer to the TRACE object
+ *
+ * @return     true - registered, or already was, false - the registry is full
+ */
+bool trace_register(trace_t *This);
+
+/**
+ * @brief      Removes a trace buffer from the registry.  Waits for the dumps and
+ *             the drain reading the trace buffer, so it may be freed once it
+ *             returns.  The drain misses the trace lines traced since its last
+ *             poll.  Must not be called by a sink of a dump.
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+void trace_unregister(trace_t *This);
+#endif // defined(TRACE_USE_REGISTRY)
+
+#if defined(TRACE_USE_ARENA)
+/**
+ * @brief      Sets up the pool of trace_alloc().  The pool is mapped and touched
+ *             up front, so its memory is committed once.  Otherwise the first
+ *             trace_alloc() sets up a pool of TRACE_ARENA_SIZE on any node.
+ *
+ * @param[in]  xSize  Size of the pool [in bytes]
+ * @param[in]  iNode  NUMA node to place the pool on, -1 - any node
+ *
+ * @return     true - set up, false - already set up, out of memory, or no such node
+ */
+bool trace_arena_init(size_t xSize, int iNode);
+
+/**
+ * @brief      Allocates a trace buffer from the pool, and registers it
+ *
+ * @param      name     Name of trace
+ * @param[in]  ulDepth  Depth of the trace buffer, rounded down to a power of two with TRACE_USE_LARGE
+ * @param[in]  bIsWrap  true - wrap when full, false - stop tracing when full
+ * @param[in]  ucMode   One of TRACE_MODE_xxx, but TRACE_MODE_SHARD, as shards are never freed
+ *
+ * @return     Pointer to the TRACE object, NULL if out of room in the pool or the registry
+ */
+trace_t *trace_alloc(char *name, uint32_t ulDepth, bool bIsWrap, uint8_t ucMode);
+
+/**
+ * @brief      Unregisters a trace buffer of trace_alloc(), and returns it to the pool.
+ *             NOTE: The writers of the trace buffer must be done with it
+ *
+ * @param      This  Pointer to the TRACE object
+ */
+void trace_free(trace_t *This);
+
+/**
+ * @brief      Gets the memory use of the pool
+ *
+ * @param      pxUsed  Returns the number of bytes allocated, including the block headers
+ * @param      pxSize  Returns the size of the pool [in bytes], NULL - not needed
+ */
+void trace_arena_usage(size_t *pxUsed, size_t *pxSize);
+#endif // defined(TRACE_USE_ARENA)
+
 /**
  * @brief      Dump the contents of the trace buffer in order of oldest to
  *             newest.
@@ -224,12 +1760,130 @@ void trace_dump(trace_t *This, bool bReset);
 
 /**
  * @brief      Dump the contents of all trace buffers instantiated with
- *             TRACE_CONFIG() and TRACE_USE_CONFIG_FILE
+ *             TRACE_CONFIG() and TRACE_USE_CONFIG_FILE, and the ones registered
+ *             by trace_register() (TRACE_USE_REGISTRY)
  *
  * @param[in]  bReset  true - reset trace, false - leave as is
  */
 void trace_dump_all(bool bReset);
 
+/**
+ * @brief      Write the trace buffer as a binary record (see trace_bin.h).  The
+ *             raw ring is written in a single block without any formatting,
+ *             which is left to the host side decoder (tools/trace_decode).
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  pfnSink  Receives the binary record
+ * @param      pvCtx    Context passed to pfnSink
+ *
+ * @return     Size of the binary record [in bytes]
+ */
+size_t trace_dump_binary(trace_t *This, trace_sink_t pfnSink, void *pvCtx);
+
+/**
+ * @brief      Write the trace buffer as a binary record to a caller buffer
+ *
+ * @param      This    Pointer to the TRACE object
+ * @param      pvBuf   Buffer to write to
+ * @param[in]  xSize   Size of the buffer [in bytes]
+ *
+ * @return     Size of the binary record [in bytes].  The record is truncated
+ *             if this is greater than xSize
+ */
+size_t trace_dump_binary_buf(trace_t *This, void *pvBuf, size_t xSize);
+
+#if defined(TRACE_USE_FAST_DUMP)
+/**
+ * @brief      Write the trace buffer as the text of trace_dump(), in chunks of
+ *             many trace lines, without TRACE_OUTPUT (e.g. to a UART driver)
+ *
+ * @param      This     Pointer to the TRACE object
+ * @param[in]  pfnSink  Receives the text
+ * @param      pvCtx    Context passed to pfnSink
+ *
+ * @return     Size of the text [in bytes], 0 - not a TRACE_MODE_LINE buffer
+ *
+ * @note       The table of the sampled call sites (TRACE_USE_SAMPLING) is left out
+ */
+size_t trace_dump_text(trace_t *This, trace_sink_t pfnSink, void *pvCtx);
+#endif // defined(TRACE_USE_FAST_DUMP)
+
+/**
+ * @brief      Write the trace buffer as a binary record to a file descriptor
+ *
+ * @note       This feature is only available if TRACE_WRITE is defined
+ *
+ * @param      This  Pointer to the TRACE object
+ * @param[in]  fd    File descriptor to write to
+ *
+ * @return     Size of the binary record [in bytes]
+ */
+size_t trace_dump_binary_fd(trace_t *This, int fd);
+
+/**
+ * @brief      Write all trace buffers instantiated with TRACE_CONFIG() and
+ *             TRACE_USE_CONFIG_FILE, and the ones registered, as consecutive
+ *             binary records
+ *
+ * @param[in]  pfnSink  Receives the binary records
+ * @param      pvCtx    Context passed to pfnSink
+ *
+ * @return     Size of the binary records [in bytes]
+ */
+size_t trace_dump_binary_all(trace_sink_t pfnSink, void *pvCtx);
+
+/**
+ * @brief      Write all trace buffers instantiated with TRACE_CONFIG() and
+ *             TRACE_USE_CONFIG_FILE, and the ones registered, as Chrome trace-event
+ *             JSON, which the Perfetto UI also imports.  Each trace line is an
+ *             event of the thread that traced it: a span with TRACE_USE_SPANS,
+ *             otherwise an instant.
+ *             Without time stamps the events are placed 1 us apart in order.
+ *
+ * @param[in]  pfnSink  Receives the JSON
+ * @param      pvCtx    Context passed to pfnSink
+ *
+ * @return     Size of the JSON [in bytes]
+ */
+size_t trace_export_chrome(trace_sink_t pfnSink, void *pvCtx);
+
+/**
+ * @brief      Same as trace_export_chrome() to a file descriptor
+ *
+ * @note       This feature is only available if TRACE_WRITE is defined
+ *
+ * @param[in]  fd    File descriptor to write to
+ *
+ * @return     Size of the JSON [in bytes]
+ */
+size_t trace_export_chrome_fd(int fd);
+
+#if defined(TRACE_USE_QUERY)
+/**
+ * @brief      Write the trace lines of the selected trace buffers that match the
+ *             filter as text, merged in order of oldest to newest time stamp.
+ *             TRACE_MODE_LINE buffers and the shards of TRACE_MODE_SHARD buffers
+ *             are merged.  Each trace line starts with the name of its trace buffer.
+ *             Without time stamps the trace buffers follow one another.
+ *
+ * @param      pxQuery  The filter
+ * @param[in]  pfnSink  Receives the text
+ * @param      pvCtx    Context passed to pfnSink
+ *
+ * @return     Number of trace lines output
+ */
+uint32_t trace_query(const trace_query_t *pxQuery, trace_sink_t pfnSink, void *pvCtx);
+
+/**
+ * @brief      Same as trace_query() to TRACE_OUTPUT
+ *
+ * @param      pxQuery  The filter
+ *
+ * @return     Number of trace lines output
+ */
+uint32_t trace_query_dump(const trace_query_t *pxQuery);
+#endif // defined(TRACE_USE_QUERY)
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,392 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Header-only C++ front end of the TRACE buffer utility (C++17, messages of
+ * trc::msg<> need C++20).  The trace buffers are the trace_t objects of trace.h,
+ * so C and C++ code trace to, and trace_dump() and trace_dump_all() dump, the same
+ * trace buffers.  The C++ API is in namespace trc, as trace() is the C function.
+ *
+ * Step 1: Configure trace.h as for C.  Link trace.c (compiled as C) to the program
+ *
+ * Step 2: Declare a trace buffer in C++, the depth and wrap mode are template arguments
+ *     trc::buffer<Depth, Wrap = true, Mode = TRACE_MODE_LINE>
+ *     e.g.: static trc::buffer<256> gxRx("Rx Trace");
+ *     NOTE: With TRACE_USE_REGISTRY it is registered while it exists, so trace_dump_all() dumps it too.
+ *           Without it, trace_dump_all() and the other functions over all trace buffers do not
+ *           see it, it is dumped only with gxRx.dump() or by passing gxRx.get()
+ *   or refer to a trace buffer of the config file, which trace_dump_all() dumps
+ *     e.g.: static trc::ref gxTest(gpxTraceTest);
+ *
+ * Step 3: Trace in C++
+ *     e.g.: gxRx.trace("rx frame", usLen);                       Same as TRACE()
+ *     e.g.: gxRx.trace(trc::msg<"rx frame">, usLen);             Message made at compile time (C++20)
+ *     e.g.: gxRx.trace<TRACE_LEVEL_DEBUG, 2>("rx frame", usLen); Same as TRACE_LVL()
+ *     e.g.: gxIo.trace("rx", pvBuf, ullBytes, iStatus);          Same as TRACE_ARGS() (TRACE_USE_ARGS)
+ *     e.g.: auto xSpan = gxRx.scope("rx frame");                 Same as TRACE_SCOPE() (TRACE_USE_SPANS)
+ *
+ * Step 4: Dump with gxRx.dump(true), or pass gxRx.get() to any trace_xxx() function
+ *
+ * NOTE: A TRACE_MODE_LINE trc::buffer<> stores the trace line with trace_line_write() of
+ *       trace.h, inline with its depth as a constant, i.e. masked when it is a power of two.
+ *       trc::ref calls trace() of trace.c.
+ */
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+/********************* System Headers ************************/
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/********************* Local Headers *************************/
+#include "trace.h"
+
+namespace trc
+{
+
+/*********************** Messages ****************************/
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+/**
+ * @brief      A string literal as a template argument
+ */
+template <size_t N>
+struct fixed_string
+{
+    char acText[N];
+    consteval fixed_string(const char (&acLit)[N])
+    {
+        for (size_t idx = 0; idx < N; idx++)
+        {
+            acText[idx] = acLit[idx];
+        }
+    }
+};
+
+/**
+ * @brief      A message made at compile time.  Each message is one constant
+ *             string, and is interned once with TRACE_USE_MSG_ID.
+ */
+template <fixed_string Text>
+struct message
+{
+    static constexpr auto xText = Text;
+
+    static const char *text()
+    {
+        return xText.acText;
+    }
+#if defined(TRACE_USE_MSG_ID)
+    // NOTE: GCC leaves template variables out of the "trace_msg" section, so the
+    //       message gets a run time ID on its first trace
+    static uint16_t id()
+    {
+        static const uint16_t usMsgId = trace_msg_id(xText.acText);
+        return usMsgId;
+    }
+#endif // defined(TRACE_USE_MSG_ID)
+};
+
+// e.g. trc::msg<"rx frame">
+template <fixed_string Text>
+inline constexpr message<Text> msg{};
+#endif // __cpp_nontype_template_args
+
+/*********************** Arguments ***************************/
+#if defined(TRACE_USE_ARGS)
+// Converts a value to a typed argument of trace_args() by its C++ type, as TRACE_ARG() does in C
+template <typename T>
+inline trace_arg_t arg(T x)
+{
+    if constexpr (std::is_same_v<T, bool> || (std::is_integral_v<T> && std::is_unsigned_v<T> && sizeof(T) <= 4))
+    {
+        return trace_arg_u32(x);
+    }
+    else if constexpr (std::is_integral_v<T> && sizeof(T) <= 4)
+    {
+        return trace_arg_i32(x);
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>)
+    {
+        return trace_arg_u64(x);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        return trace_arg_i64(x);
+    }
+    else if constexpr (std::is_enum_v<T>)
+    {
+        return arg(static_cast<std::underlying_type_t<T>>(x));
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        return trace_arg_double(x);
+    }
+    else if constexpr (std::is_same_v<std::decay_t<T>, char *> || std::is_same_v<std::decay_t<T>, const char *>)
+    {
+        return trace_arg_str(x);
+    }
+    else
+    {
+        static_assert(std::is_pointer_v<T>, "trc: argument is not an integer, floating point, pointer or string");
+        return trace_arg_ptr(x);
+    }
+}
+#endif // defined(TRACE_USE_ARGS)
+
+/*********************** Spans *******************************/
+#if defined(TRACE_USE_SPANS)
+/**
+ * @brief      Traces the end of a span when it goes out of scope
+ */
+class scope
+{
+public:
+    explicit scope(trace_scope_t xScope) : m_xScope(xScope) {}
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+    ~scope() { trace_scope_end(&m_xScope); }
+
+private:
+    trace_scope_t m_xScope;
+};
+#endif // defined(TRACE_USE_SPANS)
+
+/*********************** Trace Buffers ***********************/
+/**
+ * @brief      The API of a trace buffer, shared by trc::buffer<> and trc::ref
+ *
+ * @tparam     Derived  Provides get(), and the inline trace path if it has one
+ */
+template <typename Derived>
+class basic
+{
+public:
+    // Pointer to the TRACE object, for trace_xxx() of trace.h
+    trace_t *get() const { return static_cast<const Derived *>(this)->get(); }
+    operator trace_t *() const { return get(); }
+
+    /**
+     * @brief      Checks if a call site of the level and category is traced, as
+     *             TRACE_ENABLED() does
+     */
+    template <uint8_t Level = TRACE_LEVEL_DEFAULT, uint8_t Category = TRACE_CATEGORY_DEFAULT>
+    bool enabled() const
+    {
+        static_assert(Level >= TRACE_LEVEL_ERROR && Level <= TRACE_LEVEL_VERBOSE, "trc: level is not TRACE_LEVEL_ERROR to TRACE_LEVEL_VERBOSE");
+        static_assert(Category < TRACE_CATEGORY_MAX, "trc: category is not 0 to TRACE_CATEGORY_MAX - 1");
+        if constexpr (Level > TRACE_LEVEL_MAX || ((TRACE_CATEGORY_MASK >> Category) & 1) == 0)
+        {
+            return false;
+        }
+        else
+        {
+            return (get()->ulEnable & TRACE_ENABLE_BITS(Level, Category)) == TRACE_ENABLE_BITS(Level, Category);
+        }
+    }
+
+    /**
+     * @brief      Adds a message and value, or a record of 2 to 8 typed
+     *             arguments (TRACE_USE_ARGS), to the trace buffer if the level
+     *             and category of the call site are enabled
+     *
+     * @param      pcMessage  Message string, or trc::msg<"..."> (C++20)
+     * @param      xArgs      An integer of up to 32 bits, or the arguments
+     */
+    template <uint8_t Level = TRACE_LEVEL_DEFAULT, uint8_t Category = TRACE_CATEGORY_DEFAULT, typename Msg, typename... Args>
+    void trace(Msg pcMessage, Args... xArgs) const
+    {
+        static_assert(sizeof...(Args) >= 1 && sizeof...(Args) <= 8, "trc: trace() takes 1 to 8 values");
+        if (enabled<Level, Category>())
+        {
+            if constexpr (sizeof...(Args) == 1)
+            {
+                write(pcMessage, value(xArgs...));
+            }
+            else
+            {
+#if defined(TRACE_USE_ARGS)
+                const trace_arg_t axArg[] = { arg(xArgs)... };
+                write_args(pcMessage, axArg, sizeof...(Args));
+#else
+                static_assert(sizeof...(Args) == 1, "trc: a record of many values needs TRACE_USE_ARGS");
+#endif // defined(TRACE_USE_ARGS)
+            }
+        }
+    }
+
+#if defined(TRACE_USE_SPANS)
+    /**
+     * @brief      Traces the begin of a span, and its end when the returned
+     *             object goes out of scope, e.g. auto xSpan = gxRx.scope("rx frame");
+     */
+    template <uint8_t Level = TRACE_LEVEL_DEFAULT, uint8_t Category = TRACE_CATEGORY_DEFAULT, typename Msg>
+    [[nodiscard]] trc::scope scope(Msg pcMessage) const
+    {
+        trace_t *This = enabled<Level, Category>() ? get() : nullptr;
+#if defined(TRACE_USE_MSG_ID)
+        return trc::scope(trace_scope_begin_id(This, id(pcMessage)));
+#else
+        return trc::scope(trace_scope_begin(This, text(pcMessage)));
+#endif // defined(TRACE_USE_MSG_ID)
+    }
+#endif // defined(TRACE_USE_SPANS)
+
+    void set_level(uint8_t ucLevel) const { trace_set_level(get(), ucLevel); }
+    void set_categories(uint32_t ulCategories) const { trace_set_categories(get(), ulCategories); }
+    void dump(bool bReset = false) const { trace_dump(get(), bReset); }
+
+private:
+    // The value of a trace line: an integer, or enumeration, of up to 32 bits
+    template <typename T>
+    static uint32_t value(T x)
+    {
+        static_assert((std::is_integral_v<T> || std::is_enum_v<T>) && sizeof(T) <= sizeof(uint32_t),
+                      "trc: the value of a trace line is an integer of up to 32 bits");
+        return static_cast<uint32_t>(x);
+    }
+
+    // Message string of a trace
+    static char *text(const char *pcMessage) { return const_cast<char *>(pcMessage); }
+#if defined(TRACE_USE_MSG_ID)
+    static uint16_t id(const char *pcMessage) { return trace_msg_id(pcMessage); }
+#endif // defined(TRACE_USE_MSG_ID)
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+    template <fixed_string Text>
+    static char *text(message<Text>) { return const_cast<char *>(message<Text>::text()); }
+#if defined(TRACE_USE_MSG_ID)
+    template <fixed_string Text>
+    static uint16_t id(message<Text>) { return message<Text>::id(); }
+#endif // defined(TRACE_USE_MSG_ID)
+#endif // __cpp_nontype_template_args
+
+    template <typename Msg>
+    void write(Msg pcMessage, uint32_t ulValue) const
+    {
+#if defined(TRACE_USE_MSG_ID)
+        static_cast<const Derived *>(this)->store(id(pcMessage), ulValue);
+#else
+        static_cast<const Derived *>(this)->store(text(pcMessage), ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+    }
+
+#if defined(TRACE_USE_ARGS)
+    template <typename Msg>
+    void write_args(Msg pcMessage, const trace_arg_t *axArg, uint8_t ucArgs) const
+    {
+#if defined(TRACE_USE_MSG_ID)
+        trace_args_id(get(), id(pcMessage), ucArgs, axArg);
+#else
+        trace_args(get(), text(pcMessage), ucArgs, axArg);
+#endif // defined(TRACE_USE_MSG_ID)
+    }
+#endif // defined(TRACE_USE_ARGS)
+};
+
+/**
+ * @brief      Refers to a trace buffer of C, e.g. trc::ref gxTest(gpxTraceTest)
+ */
+class ref : public basic<ref>
+{
+public:
+    explicit ref(trace_t *This) : m_This(This) {}
+    trace_t *get() const { return m_This; }
+
+private:
+    friend class basic<ref>;
+
+#if defined(TRACE_USE_MSG_ID)
+    void store(uint16_t usMsgId, uint32_t ulValue) const { trace_id(m_This, usMsgId, ulValue); }
+#else
+    void store(char *pcMessage, uint32_t ulValue) const { ::trace(m_This, pcMessage, ulValue); }
+#endif // defined(TRACE_USE_MSG_ID)
+
+    trace_t *m_This;
+};
+
+/**
+ * @brief      A trace buffer with its depth and wrap mode known at compile time
+ *
+ * @tparam     Depth  Depth of the trace buffer (per thread for TRACE_MODE_SHARD, call sites for TRACE_MODE_AGG)
+ * @tparam     Wrap   true - wrap when full, false - stop tracing when full
+ * @tparam     Mode   One of TRACE_MODE_xxx
+ */
+template <uint32_t Depth, bool Wrap = true, uint8_t Mode = TRACE_MODE_LINE>
+class buffer : public basic<buffer<Depth, Wrap, Mode>>
+{
+#if defined(TRACE_USE_LARGE)
+    static_assert(Depth && (Depth & (Depth - 1)) == 0, "trc: the depth of a trace buffer is a power of two with TRACE_USE_LARGE");
+#else
+    static_assert(Depth && Depth < (1u << 15), "trc: the depth of a trace buffer is 1 to 32767 without TRACE_USE_LARGE");
+#endif // defined(TRACE_USE_LARGE)
+
+public:
+    explicit buffer(const char *pcName)
+    {
+        trace_init(&m_xTrace, const_cast<char *>(pcName), m_axLine, Depth, Wrap);
+        m_xTrace.ucMode = Mode;
+#if defined(TRACE_USE_REGISTRY)
+        // NOTE: Listed for trace_dump_all() and the drain while it exists, if the registry has room
+        trace_register(&m_xTrace);
+#endif // defined(TRACE_USE_REGISTRY)
+    }
+#if defined(TRACE_USE_REGISTRY)
+    ~buffer() { trace_unregister(&m_xTrace); }
+#endif // defined(TRACE_USE_REGISTRY)
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    trace_t *get() const { return &m_xTrace; }
+    static constexpr uint32_t depth() { return Depth; }
+
+private:
+    friend class basic<buffer>;
+
+    /**
+     * @brief      Store a trace line.  A TRACE_MODE_LINE buffer takes the write path of
+     *             trace.c, trace_line_write(), inline with its depth as a constant
+     */
+    template <typename Msg>
+    void store(Msg xMsg, uint32_t ulValue) const
+    {
+        if constexpr (Mode == TRACE_MODE_LINE)
+        {
+            trace_line_write(get(), Depth, TRACE_EVENT_INSTANT, xMsg, ulValue);
+        }
+        else
+        {
+#if defined(TRACE_USE_MSG_ID)
+            trace_id(get(), xMsg, ulValue);
+#else
+            ::trace(get(), xMsg, ulValue);
+#endif // defined(TRACE_USE_MSG_ID)
+        }
+    }
+
+    // NOTE: Tracing changes the trace lines, not the trace buffer as an object
+    mutable trace_line_t m_axLine[TRACE_LINES(Depth, Mode)];
+    mutable trace_t m_xTrace;
+};
+
+} // namespace trc
+
+#endif // __TRACE_HPP__
@@ -0,0 +1,286 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015-2017 Howard Chan
+https://github.com/howard-chan/TRACE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Binary trace record format written by trace_dump_binary() and read by the
+ * host side decoder (tools/trace_decode.c).
+ *
+ * Each trace buffer is written as one record:
+ *   trace_bin_hdr_t                      Record header
+ *   uint8_t [ulDepth * usLineSize]       The raw ring of trace_line_t
+ *   String table                         Entries until one with key TRACE_BIN_END_KEY
+ *     uint64_t ullKey                    Value of the message field that refers to the string
+ *     uint16_t usLen                     Length of the string (no null terminator)
+ *     char     [usLen]                   The string
+ *
+ * A TRACE_MODE_ARGS trace buffer (TRACE_BIN_RECORDS) has a ring of ulDepth
+ * bytes instead, holding ulValid bytes of records from offset ulFirst on.  Each
+ * record starts with a header of usLineSize bytes:
+ *   uint16_t usSize                      Size of the record including the header [in bytes]
+ *   uint8_t  ucArgs                      Number of arguments, TRACE_REC_PAD for padding
+ *   uint8_t  ucFlags                     TRACE_REC_xxx
+ *   time stamp and message               As located by xStamp and xMessage
+ * followed by ucArgs arguments, each a TRACE_ARG_xxx type byte and its value:
+ *   TRACE_ARG_U32, TRACE_ARG_I32         4 bytes
+ *   TRACE_ARG_U64, TRACE_ARG_I64         8 bytes
+ *   TRACE_ARG_DOUBLE                     8 bytes
+ *   TRACE_ARG_PTR                        8 bytes with TRACE_BIN_PTR_64, otherwise 4 bytes
+ *   TRACE_ARG_STR                        uint8_t length followed by the characters
+ *
+ * With TRACE_BIN_TICK64 the time stamps are 64-bit ticks, or the lower 32 bits
+ * of (tick >> ucTickShift) which are extended from the oldest to the newest
+ * trace so that the newest is closest to ullTickBase.
+ *
+ * A TRACE_MODE_AGG or TRACE_MODE_AGG_GAP trace buffer (TRACE_BIN_AGG) has a
+ * ring of ulDepth call sites of trace_agg_t instead, where the call sites with
+ * a key of 0 are unused.  The string table keys are the keys of the call sites.
+ * xStamp is only set if the histograms count the time between calls, in units
+ * of ticks, 2^ucTickShift ticks with TRACE_BIN_TICK64, or ms otherwise.
+ *
+ * With TRACE_USE_SPANS each trace line and record also holds the thread ID of
+ * the caller and a TRACE_EVENT_xxx, as located by xTid and xEvent.
+ *
+ * All values are in the byte order of the target (see TRACE_BIN_BIG_ENDIAN).
+ * The trace_line_t layout is described by the record header, so the decoder
+ * does not need to be built with the configuration of the target.
+ *
+ * The shared memory segment of TRACE_USE_SHM, read by tools/trace_reader.c,
+ * holds the live trace buffers of the target instead of a copy:
+ *   trace_shm_hdr_t                      Segment header
+ *   trace_shm_buf_t [usBufs]             Descriptor of each trace buffer
+ *   uint32_t [usMsgLink + usMsgDynMax]   TRACE_BIN_MSG_ID: offset of the string of each message ID
+ *   char     [ulStrSize]                 Null terminated strings of the names and messages
+ *   trace_t and its ring                 At the offsets of the descriptor of each trace buffer
+ * Offsets are from the start of the segment, and an offset of 0 is no string.
+ * The trace_t and trace_line_t are those of the target, so the reader only
+ * reads the fields located by the segment header.  ulMagic is set last, once
+ * the segment is set up.  With TRACE_USE_PERSIST the segment is a file, which
+ * is kept after the process ends.
+ *
+ * The drain of TRACE_USE_DRAIN streams the trace lines to a series of files,
+ * each of which starts with
+ *   trace_drain_hdr_t                    File header
+ * followed by entries, each a TRACE_DRAIN_xxx tag byte and its fields.  A field
+ * is an unsigned LEB128 varint, a signed one is zigzag encoded first:
+ *   TRACE_DRAIN_BUF    id, tid, length, name
+ *                                        Names trace buffer <id> (a shard of thread <tid>)
+ *                                        before its first entry in the file
+ *   TRACE_DRAIN_STR    index, length, string
+ *                                        Message <index>, the indexes restart at 0 once
+ *                                        the file has TRACE_DRAIN_STRS of them
+ *   TRACE_DRAIN_LINE   id, delta, index, value [, tid, event]
+ *                                        Trace line of trace buffer <id>.  <delta> is the
+ *                                        signed difference of the time stamp to the one of
+ *                                        the previous trace line of the trace buffer in the
+ *                                        file, or to ullStampBase.  tid and event follow
+ *                                        with TRACE_BIN_SPANS
+ *   TRACE_DRAIN_LOST   id, count         Trace lines overwritten before they were drained
+ * The time stamps are ucStampSize bytes wide, and their differences wrap at that
+ * width.  With TRACE_BIN_TICK64 they are ticks of ullTickHz, or the lower 32 bits
+ * of (tick >> ucTickShift) with a ucStampSize of 4.
+ */
+#ifndef __TRACE_BIN_H__
+#define __TRACE_BIN_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************* System Headers ************************/
+#include <stdint.h>
+#include <stddef.h>
+
+/*********************** Macros ******************************/
+#define TRACE_BIN_MAGIC         0x42435254  // "TRCB"
+#define TRACE_BIN_VERSION       1
+#define TRACE_SHM_MAGIC         0x53435254  // "TRCS"
+#define TRACE_SHM_VERSION       1
+#define TRACE_DRAIN_MAGIC       0x44435254  // "TRCD"
+#define TRACE_DRAIN_VERSION     1
+
+// States of the session of a shared memory segment
+#define TRACE_SHM_RUNNING       1           // Process running, or ended without exit() if it's gone
+#define TRACE_SHM_EXITED        2           // Process exited
+
+// Record flags
+#define TRACE_BIN_BIG_ENDIAN    0x01        // Target is big endian
+#define TRACE_BIN_MSG_ID        0x02        // Message field is a message ID (TRACE_USE_MSG_ID), not a pointer
+#define TRACE_BIN_RECORDS       0x04        // Ring holds variable length records (TRACE_MODE_ARGS)
+#define TRACE_BIN_PTR_64        0x08        // Pointers are 64-bit
+#define TRACE_BIN_TICK64        0x10        // Time stamps are ticks of ullTickHz (TRACE_USE_TICK64)
+#define TRACE_BIN_AGG           0x20        // Ring holds the call sites of trace_agg_t (TRACE_MODE_AGG)
+#define TRACE_BIN_SPANS         0x40        // Drain: trace lines hold the thread ID and event (TRACE_USE_SPANS)
+
+// Entry tags of a drain file
+#define TRACE_DRAIN_BUF         1           // Name of a trace buffer
+#define TRACE_DRAIN_STR         2           // Message string
+#define TRACE_DRAIN_LINE        3           // Trace line
+#define TRACE_DRAIN_LOST        4           // Number of trace lines lost
+
+// Argument types of a record
+#define TRACE_ARG_U32           1
+#define TRACE_ARG_I32           2
+#define TRACE_ARG_U64           3
+#define TRACE_ARG_I64           4
+#define TRACE_ARG_PTR           5
+#define TRACE_ARG_DOUBLE        6
+#define TRACE_ARG_STR           7
+
+// Event types of a trace line (TRACE_USE_SPANS)
+#define TRACE_EVENT_INSTANT     0           // Point event of TRACE()
+#define TRACE_EVENT_BEGIN       1           // Begin of a span
+#define TRACE_EVENT_END         2           // End of a span
+
+// Record header values
+#define TRACE_REC_PAD           0xFF        // ucArgs of a record that pads the end of the ring
+#define TRACE_REC_DONE          0x01        // ucFlags of a record that is completely written
+
+// Number of log2 buckets of the histogram of a call site: 0, 1, 2-3, 4-7, ... 2^31-2^32-1
+#define TRACE_AGG_BUCKETS       33
+
+// Reserved string table keys
+#define TRACE_BIN_END_KEY       UINT64_MAX          // Terminates the string table
+#define TRACE_BIN_NAME_KEY      (UINT64_MAX - 1)    // Name of the trace
+
+/*********************** Typedefs ****************************/
+// Statistics of a call site of a TRACE_MODE_AGG buffer
+typedef struct
+{
+    uint64_t ullKey;                // Message pointer, or 1 + message ID with TRACE_USE_MSG_ID, 0 - unused
+    uint64_t ullSum;                // Sum of the values
+    uint64_t ullLast;               // TRACE_MODE_AGG_GAP: time stamp of the last call with bit 63 set, 0 - none
+    uint32_t ulCount;               // Number of calls
+    uint32_t ulNotMin;              // Bitwise NOT of the minimum value, so an unused call site has none
+    uint32_t ulMax;                 // Maximum value
+    uint32_t aulHist[TRACE_AGG_BUCKETS];    // Calls per log2 bucket of the value, or of the time since the last call
+} trace_agg_t;
+
+// Location of a field within trace_line_t
+typedef struct
+{
+    uint8_t  ucOffset;              // Offset of the field [in bytes]
+    uint8_t  ucSize;                // Size of the field [in bytes], 0 - not present
+} trace_bin_field_t;
+
+// The record header
+typedef struct
+{
+    uint32_t ulMagic;               // TRACE_BIN_MAGIC
+    uint16_t usVersion;             // TRACE_BIN_VERSION
+    uint16_t usHdrSize;             // sizeof(trace_bin_hdr_t)
+    uint8_t  ucFlags;               // TRACE_BIN_xxx
+    uint8_t  ucMode;                // TRACE_MODE_xxx of the trace buffer
+    uint16_t usLineSize;            // sizeof(trace_line_t)
+    trace_bin_field_t xStamp;       // trace_line_t::xTimeStamp
+    trace_bin_field_t xMessage;     // trace_line_t::pcMessage
+    trace_bin_field_t xValue;       // trace_line_t::ulValue
+    uint16_t bIsWrap;               // true - wrap when full, false - stop tracing when full
+    uint32_t ulDepth;               // The number of trace lines in the ring
+    uint32_t ulFirst;               // Slot of the oldest trace line
+    uint32_t ulValid;               // Number of valid trace lines
+    uint32_t ulCount;               // Total number of trace
+    uint32_t ulTid;                 // Thread ID of the owner of a shard, otherwise 0
+    uint64_t ullName;               // String table key of the name of the trace
+    trace_bin_field_t xSeq;         // trace_line_t::ulSeq, a trace line with a sequence number of 0 is not valid
+    uint8_t  ucTickShift;           // TRACE_BIN_TICK64: a 32-bit time stamp holds the lower bits of (tick >> ucTickShift)
+    uint64_t ullTickHz;             // TRACE_BIN_TICK64: tick rate [in Hz]
+    uint64_t ullTickBase;           // TRACE_BIN_TICK64: tick of the newest trace, extends the 32-bit time stamps
+    trace_bin_field_t xTid;         // trace_line_t::ulTid, thread ID of the caller
+    trace_bin_field_t xEvent;       // trace_line_t::ucEvent, one of TRACE_EVENT_xxx
+    uint32_t ulTrigger;             // 1 + position among the valid trace lines of the trace line marked by
+                                    // the trigger, ulValid + 1 - after the last one, 0 - not triggered
+} trace_bin_hdr_t;
+
+// The shared memory segment header (TRACE_USE_SHM)
+typedef struct
+{
+    uint32_t ulMagic;               // TRACE_SHM_MAGIC, 0 - being set up
+    uint16_t usVersion;             // TRACE_SHM_VERSION
+    uint16_t usHdrSize;             // sizeof(trace_shm_hdr_t)
+    uint64_t ullSize;               // Size of the segment [in bytes]
+    uint32_t ulPid;                 // Process ID of the target
+    uint8_t  ucFlags;               // TRACE_BIN_BIG_ENDIAN, TRACE_BIN_MSG_ID, TRACE_BIN_PTR_64 and TRACE_BIN_TICK64
+    uint8_t  ucTickShift;           // TRACE_BIN_TICK64: a 32-bit time stamp holds the lower bits of (tick >> ucTickShift)
+    uint16_t usBufs;                // Number of trace buffers
+    uint64_t ullTickHz;             // TRACE_BIN_TICK64: tick rate [in Hz], 0 - not calibrated yet
+    uint16_t usLineSize;            // sizeof(trace_line_t)
+    trace_bin_field_t xStamp;       // trace_line_t::xTimeStamp
+    trace_bin_field_t xMessage;     // trace_line_t::pcMessage, or usMsgId with TRACE_BIN_MSG_ID
+    trace_bin_field_t xValue;       // trace_line_t::ulValue
+    trace_bin_field_t xSeq;         // trace_line_t::ulSeq, 1 + free running index of the trace line (skipping 0 at the 32-bit wrap), 0 - being written
+    trace_bin_field_t xTid;         // trace_line_t::ulTid
+    trace_bin_field_t xEvent;       // trace_line_t::ucEvent
+    trace_bin_field_t xIdx;         // trace_t::ullIdx, 64-bit free running index of the next trace line
+    trace_bin_field_t xCount;       // trace_t::ulCount, number of traces not stored, the total is xIdx + xCount
+    trace_bin_field_t xTickBase;    // trace_t::ullTickBase, extends the 32-bit time stamps
+    uint16_t usMsgLink;             // TRACE_BIN_MSG_ID: number of link time message IDs
+    uint16_t usMsgDyn;              // TRACE_BIN_MSG_ID: bit of the message IDs interned at run time
+    uint32_t ulMsgDynMax;           // TRACE_BIN_MSG_ID: number of message IDs interned at run time
+    uint32_t ulMsgTable;            // TRACE_BIN_MSG_ID: offset of the message table
+    uint32_t ulStrings;             // Offset of the strings
+    uint32_t ulStrSize;             // Size of the strings [in bytes]
+    uint32_t ulStrUsed;             // Size of the strings used so far [in bytes]
+    uint8_t  ucState;               // TRACE_SHM_xxx
+    uint32_t ulExe;                 // Offset of the path of the executable
+    uint64_t ullImage;              // Address the executable is loaded at, to relocate its message pointers
+    uint64_t ullStartTime;          // Start of the session [in s since the epoch]
+} trace_shm_hdr_t;
+
+// Descriptor of a trace buffer in the shared memory segment
+typedef struct
+{
+    uint64_t ullTrace;              // Offset of the trace_t
+    uint64_t ullRing;               // Offset of the ring
+    uint32_t ulDepth;               // The number of trace lines in the ring
+    uint32_t ulName;                // Offset of the name of the trace
+    uint8_t  ucMode;                // TRACE_MODE_xxx of the trace buffer
+    uint8_t  bIsWrap;               // true - wrap when full, false - stop tracing when full
+    uint8_t  bLines;                // true - the ring holds trace_line_t, false - other records, which are not read
+    uint8_t  bFunc;                 // true - the messages are function addresses (TRACE_USE_INSTRUMENT)
+} trace_shm_buf_t;
+
+// The header of a drain file (TRACE_USE_DRAIN)
+typedef struct
+{
+    uint32_t ulMagic;               // TRACE_DRAIN_MAGIC
+    uint16_t usVersion;             // TRACE_DRAIN_VERSION
+    uint16_t usHdrSize;             // sizeof(trace_drain_hdr_t)
+    uint8_t  ucFlags;               // TRACE_BIN_BIG_ENDIAN, TRACE_BIN_MSG_ID, TRACE_BIN_TICK64 and TRACE_BIN_SPANS
+    uint8_t  ucTickShift;           // TRACE_BIN_TICK64: a 32-bit time stamp holds the lower bits of (tick >> ucTickShift)
+    uint8_t  ucStampSize;           // Size of the time stamps [in bytes], 0 - none
+    uint8_t  ucRsvd;                // Reserved, 0
+    uint32_t ulFile;                // Number of the file in the stream, from 0
+    uint32_t ulPid;                 // Process ID of the target
+    uint64_t ullTickHz;             // TRACE_BIN_TICK64: tick rate [in Hz]
+    uint64_t ullStampBase;          // Time stamp the file started at, extended to 64 bits
+    uint64_t ullStartTime;          // Time the file started at [in s since the epoch]
+} trace_drain_hdr_t;
+
+// Size of the record header before xSeq was added
+#define TRACE_BIN_HDR_MIN       offsetof(trace_bin_hdr_t, xSeq)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TRACE_BIN_H__